@@ -4,14 +4,37 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES:= dtv.c \
                   dtv_pdu.c \
                   dtv_io.c \
+                  dtv_arbiter.c \
+                  dtv_cache.c \
+                  dtv_cursor.c \
+                  dtv_eit.c \
+                  dtv_epg.c \
+                  dtv_harvest.c \
+                  dtv_prefetch.c \
+                  dtv_pretune.c \
+                  dtv_scan.c \
+                  dtv_search.c \
+                  crc32.c \
+                  dvb_eit.c \
+                  dvb_psi.c \
+                  dvb_si.c \
+                  dvb_text.c \
+                  histogram.c \
+                  trace.c \
+                  ts_demux.c \
                   tv_hal.c \
                   tv_utils.c \
+                  vtuner.c \
+                  iptv.c \
                   io.c \
                   main.c \
                   memptr.c \
                   pdu.c \
                   registry.c \
-                  service.c
+                  service.c \
+                  stats.c \
+                  stats_io.c \
+                  watchdog.c
 LOCAL_C_INCLUDES := system/libfdio/include \
                     system/libpdu/include
 LOCAL_CFLAGS := -DANDROID_VERSION=$(PLATFORM_SDK_VERSION) -Wall
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the CRC-32 of MPEG-2 sections.
+ *
+ * |crc32_mpeg2| computes the CRC with the polynomial 0x04c11db7, an
+ * initial value of 0xffffffff, no reflection and no final XOR, as used
+ * by PSI and SI sections. Running the function over a complete section,
+ * including its CRC_32 field, yields 0 for an intact section.
+ *
+ * The function processes 8 bytes at a time with slicing-by-8 tables,
+ * which are computed on the first call. It is thread-safe.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t
+crc32_mpeg2(const uint8_t* buf, size_t len);
@@ -21,10 +21,15 @@
  * [1] https://source.android.com/devices/halref/tv__input_8h_source.html
  */
 
+#include <assert.h>
+#include <pthread.h>
 #include <string.h>
 #include "dtv.h"
 #include "dtv_io.h"
+#include "log.h"
+#include "stats.h"
 #include "tv_hal.h"
+#include "vtuner.h"
 
 /*
  * This method is used to calculate the number character for a string to show
@@ -34,13 +39,129 @@ static uint8_t
 get_int_length(uint32_t target)
 {
   uint8_t len = 1;
-  while (target > 10) {
+  while (target >= 10) {
     target /= 10;
     len++;
   }
   return len;
 }
 
+static uint32_t
+parse_tuner_id(const char* tuner_id)
+{
+  uint32_t idx;
+  uint32_t device_id;
+  uint32_t length;
+
+  device_id = 0;
+  length = strlen(tuner_id);
+
+  for (idx = 0; idx < length; idx++) {
+    device_id = (device_id*10) + (tuner_id[idx] - '0');
+  }
+
+  return device_id;
+}
+
+/*
+ * Tuner mapping
+ *
+ * A tuner ID names the device with the same ID, unless the devices of two
+ * tuners have been swapped. |g_map| stores the tuners whose device
+ * differs. Swaps are rare, so the list is short.
+ */
+
+#define MAX_MAPPED_TUNERS 16
+
+struct tuner_mapping {
+  uint32_t tuner_id;
+  uint32_t device_id;
+};
+
+static pthread_mutex_t g_map_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct tuner_mapping g_map[MAX_MAPPED_TUNERS];
+static uint32_t g_map_len;
+
+/* Called with |g_map_lock| held. */
+static uint32_t
+map_tuner(uint32_t tuner_id)
+{
+  uint32_t idx;
+
+  for (idx = 0; idx < g_map_len; idx++) {
+    if (g_map[idx].tuner_id == tuner_id) {
+      return g_map[idx].device_id;
+    }
+  }
+  return tuner_id;
+}
+
+/* Called with |g_map_lock| held. */
+static void
+set_mapping(uint32_t tuner_id, uint32_t device_id)
+{
+  uint32_t idx;
+
+  for (idx = 0; idx < g_map_len; idx++) {
+    if (g_map[idx].tuner_id == tuner_id) {
+      break;
+    }
+  }
+  if (tuner_id == device_id) {
+    if (idx < g_map_len) {
+      g_map[idx] = g_map[--g_map_len];
+    }
+    return;
+  }
+  /* a swap adds at most two entries; the mapping is a permutation of the
+   * devices, so it can't outgrow the number of tuners */
+  if (idx == g_map_len) {
+    assert(g_map_len < MAX_MAPPED_TUNERS);
+    ++g_map_len;
+  }
+  g_map[idx].tuner_id = tuner_id;
+  g_map[idx].device_id = device_id;
+}
+
+static uint32_t
+get_device_id(const char* tuner_id)
+{
+  uint32_t device_id;
+
+  pthread_mutex_lock(&g_map_lock);
+  device_id = map_tuner(parse_tuner_id(tuner_id));
+  pthread_mutex_unlock(&g_map_lock);
+
+  return device_id;
+}
+
+void
+dtv_swap_tuners(const char* tuner_id1, const char* tuner_id2)
+{
+  uint32_t id1, id2, device_id1, device_id2;
+
+  id1 = parse_tuner_id(tuner_id1);
+  id2 = parse_tuner_id(tuner_id2);
+
+  pthread_mutex_lock(&g_map_lock);
+  device_id1 = map_tuner(id1);
+  device_id2 = map_tuner(id2);
+  set_mapping(id1, device_id2);
+  set_mapping(id2, device_id1);
+  pthread_mutex_unlock(&g_map_lock);
+}
+
+/*
+ * Returns the virtual tuner with the given ID, or NULL for hardware
+ * tuners. Virtual tuners implement frequency scanning, section reading
+ * and a channel list; see vtuner.h.
+ */
+static struct vtuner*
+get_vtuner(const char* tuner_id)
+{
+  return tv_input_hal_get_vtuner(get_device_id(tuner_id));
+}
+
 uint8_t
 dtv_init(struct dtv_callbacks* dtv_callbacks)
 {
@@ -50,6 +171,10 @@ dtv_init(struct dtv_callbacks* dtv_callbacks)
 uint8_t
 dtv_uninit()
 {
+  pthread_mutex_lock(&g_map_lock);
+  g_map_len = 0;
+  pthread_mutex_unlock(&g_map_lock);
+
   return TV_STATUS_SUCCESS;
 }
 
@@ -60,51 +185,137 @@ dtv_get_tuner_num()
 }
 
 uint8_t
-dtv_get_tuners(const uint32_t tuner_num,
-               struct tv_tuner* tuners)
+dtv_get_tuners(uint32_t* tuner_num, struct tv_tuner* tuners)
 {
-  uint32_t idx;
+  uint32_t idx, num;
   int* tuner_id_list;
+  uint64_t start;
   uint8_t ret;
 
-  tuner_id_list = (int*)malloc(sizeof(int) * tuner_num);
+  if (!*tuner_num) {
+    return TV_STATUS_SUCCESS;
+  }
+
+  tuner_id_list = (int*)malloc(sizeof(int) * *tuner_num);
+  if (!tuner_id_list) {
+    ALOGE_ERRNO("malloc");
+    return TV_STATUS_FAIL;
+  }
 
-  ret = tv_input_hal_get_inputs_by_type(tuner_num, TV_INPUT_TYPE_TUNER,
+  start = stats_now();
+  ret = tv_input_hal_get_inputs_by_type(*tuner_num, TV_INPUT_TYPE_TUNER,
                                         tuner_id_list);
+  stats_hal_call(STATS_HAL_GET_TUNERS, ret, start);
   if (ret != TV_STATUS_SUCCESS) {
-    free(tuner_id_list);
-    return TV_STATUS_FAIL;
+    goto err_tv_input_hal_get_inputs_by_type;
   }
 
-  for (idx = 0; idx < tuner_num; idx++) {
-    uint8_t len = 0;
+  for (idx = 0, num = 0; idx < *tuner_num; idx++) {
+    uint8_t len;
+    if (tuner_id_list[idx] < 0) {
+      continue; /* the HAL pads with -1 if it has fewer tuners */
+    }
     len = get_int_length((uint32_t)tuner_id_list[idx]);
-    tuners[idx].id = (char*)malloc(sizeof(char) * (len + 1));
-    snprintf(tuners[idx].id, len + 1, "%d", tuner_id_list[idx]);
-    tuners[idx].num_types = 0;
+    tuners[num].id = (char*)malloc(sizeof(char) * (len + 1));
+    if (!tuners[num].id) {
+      ALOGE_ERRNO("malloc");
+      goto err_malloc;
+    }
+    snprintf(tuners[num].id, len + 1, "%d", tuner_id_list[idx]);
+    tuners[num].num_types = 0;
+    tuners[num].supported_types = NULL;
+    ++num;
   }
   free(tuner_id_list);
 
+  *tuner_num = num;
+
   return TV_STATUS_SUCCESS;
+err_malloc:
+  while (num) {
+    free(tuners[--num].id);
+  }
+err_tv_input_hal_get_inputs_by_type:
+  free(tuner_id_list);
+  return TV_STATUS_FAIL;
 }
 
 uint8_t
 dtv_set_source(const char* tuner_id, const uint8_t source_type,
                tv_stream_t* tv_stream)
 {
-  uint8_t ret;
-  uint32_t idx;
-  uint32_t device_id;
-  uint32_t length;
+  uint64_t start = stats_now();
+  uint8_t ret = tv_input_hal_get_stream(get_device_id(tuner_id), tv_stream);
 
-  device_id = 0;
-  length = strlen(tuner_id);
+  stats_hal_call(STATS_HAL_SET_SOURCE, ret, start);
 
-  for (idx = 0; idx < length; idx++) {
-    device_id = (device_id*10) + (tuner_id[idx] - '0');
-  }
+  return ret;
+}
 
-  return tv_input_hal_get_stream(device_id, tv_stream);
+uint8_t
+dtv_release_source(const char* tuner_id)
+{
+  uint64_t start = stats_now();
+  uint8_t ret = tv_input_hal_release_source(get_device_id(tuner_id));
+
+  stats_hal_call(STATS_HAL_RELEASE_SOURCE, ret, start);
+
+  return ret;
+}
+
+uint8_t
+dtv_close_source(const char* tuner_id, const int32_t stream_id)
+{
+  uint64_t start = stats_now();
+  uint8_t ret = tv_input_hal_close_source(get_device_id(tuner_id),
+                                          stream_id);
+
+  stats_hal_call(STATS_HAL_RELEASE_SOURCE, ret, start);
+
+  return ret;
+}
+
+int
+dtv_has_stream(const char* tuner_id)
+{
+  return tv_input_hal_has_stream(get_device_id(tuner_id));
+}
+
+uint8_t
+dtv_get_stream_configs(const char* tuner_id, uint32_t* num_configs,
+                       tv_stream_config_t** configs)
+{
+  uint64_t start = stats_now();
+  uint8_t ret = tv_input_hal_get_stream_configs(get_device_id(tuner_id),
+                                                 num_configs, configs);
+
+  stats_hal_call(STATS_HAL_GET_STREAM_CONFIGS, ret, start);
+
+  return ret;
+}
+
+uint8_t
+dtv_open_stream(const char* tuner_id, const int32_t stream_id,
+                tv_stream_t* tv_stream)
+{
+  uint64_t start = stats_now();
+  uint8_t ret = tv_input_hal_open_stream(get_device_id(tuner_id),
+                                          stream_id, tv_stream);
+
+  stats_hal_call(STATS_HAL_OPEN_STREAM, ret, start);
+
+  return ret;
+}
+
+uint8_t
+dtv_close_stream(const char* tuner_id, const int32_t stream_id)
+{
+  uint64_t start = stats_now();
+  uint8_t ret = tv_input_hal_close_stream(get_device_id(tuner_id), stream_id);
+
+  stats_hal_call(STATS_HAL_CLOSE_STREAM, ret, start);
+
+  return ret;
 }
 
 uint8_t
@@ -125,19 +336,157 @@ dtv_cln_scanned_channel_cache()
   return TV_STATUS_NOT_SUPPORTED;
 }
 
+uint8_t
+dtv_supports_frequency_scan(const char* tuner_id, const uint8_t source_type)
+{
+  if (get_vtuner(tuner_id)) {
+    return TV_STATUS_SUCCESS;
+  }
+  return TV_STATUS_NOT_SUPPORTED;
+}
+
+uint8_t
+dtv_tune_frequency(const char* tuner_id,
+                   const uint8_t source_type,
+                   const struct tv_frequency* freq)
+{
+  struct vtuner* vt = get_vtuner(tuner_id);
+  uint64_t start = stats_now();
+  uint8_t status, ret;
+  uint16_t strength;
+
+  if (!vt) {
+    return TV_STATUS_NOT_SUPPORTED;
+  }
+
+  if (vtuner_tune(vt, freq) < 0) {
+    ret = TV_STATUS_FAIL;
+  } else {
+    vtuner_get_status(vt, &status, &strength);
+    ret = (status & TV_FRONTEND_HAS_LOCK) ? TV_STATUS_SUCCESS
+                                          : TV_STATUS_NO_SIGNAL;
+  }
+  stats_hal_call(STATS_HAL_TUNE, ret, start);
+
+  return ret;
+}
+
+uint8_t
+dtv_set_frequency(const char* tuner_id,
+                  const uint8_t source_type,
+                  const struct tv_frequency* freq)
+{
+  struct vtuner* vt = get_vtuner(tuner_id);
+  uint64_t start = stats_now();
+  uint8_t ret;
+
+  if (!vt) {
+    return TV_STATUS_NOT_SUPPORTED;
+  }
+
+  ret = vtuner_tune(vt, freq) < 0 ? TV_STATUS_FAIL : TV_STATUS_SUCCESS;
+  stats_hal_call(STATS_HAL_TUNE, ret, start);
+
+  return ret;
+}
+
+uint8_t
+dtv_get_frontend_status(const char* tuner_id,
+                        const uint8_t source_type,
+                        uint8_t* status,
+                        uint16_t* strength)
+{
+  struct vtuner* vt = get_vtuner(tuner_id);
+  uint64_t start = stats_now();
+
+  if (!vt) {
+    return TV_STATUS_NOT_SUPPORTED;
+  }
+
+  vtuner_get_status(vt, status, strength);
+  stats_hal_call(STATS_HAL_GET_FRONTEND_STATUS, TV_STATUS_SUCCESS, start);
+
+  return TV_STATUS_SUCCESS;
+}
+
+uint8_t
+dtv_get_frequency_channels(const char* tuner_id,
+                           const uint8_t source_type,
+                           uint32_t* ch_num,
+                           struct tv_channel** ch)
+{
+  return TV_STATUS_NOT_SUPPORTED;
+}
+
+uint8_t
+dtv_add_channel(const char* tuner_id,
+                const uint8_t source_type,
+                const struct tv_frequency* freq,
+                const struct tv_channel* ch)
+{
+  struct vtuner* vt = get_vtuner(tuner_id);
+
+  if (vt) {
+    return vtuner_add_channel(vt, freq, ch) < 0 ? TV_STATUS_FAIL
+                                                : TV_STATUS_SUCCESS;
+  }
+  return TV_STATUS_NOT_SUPPORTED;
+}
+
+uint8_t
+dtv_read_section(const char* tuner_id,
+                 const uint8_t source_type,
+                 const uint16_t pid,
+                 const uint8_t table_id,
+                 const uint32_t timeout,
+                 uint8_t* buf,
+                 uint32_t* len)
+{
+  struct vtuner* vt = get_vtuner(tuner_id);
+  uint64_t start = stats_now();
+  uint8_t ret;
+
+  if (!vt) {
+    return TV_STATUS_NOT_SUPPORTED;
+  }
+
+  ret = vtuner_read_section(vt, pid, table_id, timeout, buf, len) < 0
+          ? TV_STATUS_FAIL : TV_STATUS_SUCCESS;
+  stats_hal_call(STATS_HAL_READ_SECTION, ret, start);
+
+  return ret;
+}
+
 uint8_t
 dtv_set_channel(const char* tuner_id,
                 const uint8_t source_type,
                 const char* channel_num,
                 struct tv_channel* ch)
 {
-  return TV_STATUS_NOT_SUPPORTED;
+  struct vtuner* vt = get_vtuner(tuner_id);
+  uint64_t start = stats_now();
+  uint8_t ret;
+
+  if (!vt) {
+    return TV_STATUS_NOT_SUPPORTED;
+  }
+
+  ret = vtuner_set_channel(vt, channel_num, ch) < 0 ? TV_STATUS_INVARG
+                                                    : TV_STATUS_SUCCESS;
+  stats_hal_call(STATS_HAL_SET_CHANNEL, ret, start);
+
+  return ret;
 }
 
 uint32_t
 dtv_get_channel_num(const char* tuner_id,
                     const uint8_t source_type)
 {
+  struct vtuner* vt = get_vtuner(tuner_id);
+
+  if (vt) {
+    return vtuner_get_channel_num(vt);
+  }
   return 0;
 }
 
@@ -147,7 +496,19 @@ dtv_get_channels(const char* tuner_id,
                  const uint32_t ch_num,
                  struct tv_channel* ch)
 {
-  return TV_STATUS_NOT_SUPPORTED;
+  struct vtuner* vt = get_vtuner(tuner_id);
+  uint64_t start = stats_now();
+  uint8_t ret;
+
+  if (!vt) {
+    return TV_STATUS_NOT_SUPPORTED;
+  }
+
+  ret = vtuner_get_channels(vt, ch_num, ch) == ch_num ? TV_STATUS_SUCCESS
+                                                      : TV_STATUS_FAIL;
+  stats_hal_call(STATS_HAL_GET_CHANNELS, ret, start);
+
+  return ret;
 }
 
 uint32_t
@@ -44,17 +44,117 @@ uint8_t dtv_uninit(void);
 
 uint32_t dtv_get_tuner_num();
 
-uint8_t dtv_get_tuners(const uint32_t tuner_num, struct tv_tuner* tuners);
+/*
+ * |dtv_get_tuners| fills in up to |*tuner_num| tuners and stores the
+ * number of tuners it returned in |*tuner_num|. The caller releases the
+ * tuners with |release_tuners|.
+ */
+
+uint8_t dtv_get_tuners(uint32_t* tuner_num, struct tv_tuner* tuners);
 
 uint8_t dtv_set_source(const char* tuner_id, const uint8_t source_type,
                        tv_stream_t* stream);
 
+uint8_t dtv_release_source(const char* tuner_id);
+
+uint8_t dtv_close_source(const char* tuner_id, const int32_t stream_id);
+
+int dtv_has_stream(const char* tuner_id);
+
+/*
+ * Tuner IDs name devices. |dtv_swap_tuners| exchanges the devices of two
+ * tuners, including their tuning state, streams and channel lists. The
+ * pre-tuner uses it to hand over a tuned device to the tuner the user
+ * watches.
+ */
+
+void dtv_swap_tuners(const char* tuner_id1, const char* tuner_id2);
+
+/*
+ * Streams
+ *
+ * A tuner can provide multiple streams at the same time, one per stream
+ * configuration. |dtv_get_stream_configs| returns the configurations in
+ * an array allocated with malloc(3). |dtv_open_stream| opens the stream
+ * of a configuration, or shares the stream if it's open already.
+ * |dtv_close_stream| closes it after the last user.
+ */
+
+uint8_t dtv_get_stream_configs(const char* tuner_id,
+                               uint32_t* num_configs,
+                               tv_stream_config_t** configs);
+
+uint8_t dtv_open_stream(const char* tuner_id, const int32_t stream_id,
+                        tv_stream_t* stream);
+
+uint8_t dtv_close_stream(const char* tuner_id, const int32_t stream_id);
+
 uint8_t dtv_start_scanning(const char* tuner_id, const uint8_t source_type);
 
 uint8_t dtv_stop_scanning(const char* tuner_id, const uint8_t source_type);
 
 uint8_t dtv_cln_scanned_channel_cache();
 
+/*
+ * Frequency scanning
+ *
+ * These functions let tvd run the channel scan itself, for example on
+ * multiple tuners in parallel. |dtv_supports_frequency_scan| tells if a
+ * tuner implements them for a source type. |dtv_tune_frequency| tunes to
+ * a frequency and returns TV_STATUS_NO_SIGNAL if the tuner cannot lock.
+ * After a successful lock, |dtv_get_frequency_channels| returns the
+ * services of the transport stream in an array allocated with malloc(3),
+ * which the caller releases with |release_channels|. |dtv_add_channel|
+ * adds a scanned channel to the tuner's channel list, together with the
+ * frequency of the transport stream that carries it.
+ *
+ * |dtv_read_section| reads the next PSI/SI section with the given PID and
+ * table ID from the tuned transport stream. On input, |len| contains the
+ * size of |buf|; on output, the length of the section. The function fails
+ * if no section arrives within |timeout| milliseconds.
+ *
+ * |dtv_set_frequency| starts tuning to a frequency and returns without
+ * waiting for lock. Afterwards, |dtv_get_frontend_status| returns the
+ * TV_FRONTEND_ flags and the signal strength of the tuner, in the range
+ * of 0 to 65535. Drivers that implement both allow tvd to reject empty
+ * frequencies early, instead of waiting for |dtv_tune_frequency| to time
+ * out.
+ */
+
+uint8_t dtv_supports_frequency_scan(const char* tuner_id,
+                                    const uint8_t source_type);
+
+uint8_t dtv_tune_frequency(const char* tuner_id,
+                           const uint8_t source_type,
+                           const struct tv_frequency* freq);
+
+uint8_t dtv_set_frequency(const char* tuner_id,
+                          const uint8_t source_type,
+                          const struct tv_frequency* freq);
+
+uint8_t dtv_get_frontend_status(const char* tuner_id,
+                                const uint8_t source_type,
+                                uint8_t* status,
+                                uint16_t* strength);
+
+uint8_t dtv_get_frequency_channels(const char* tuner_id,
+                                   const uint8_t source_type,
+                                   uint32_t* ch_num,
+                                   struct tv_channel** ch);
+
+uint8_t dtv_add_channel(const char* tuner_id,
+                        const uint8_t source_type,
+                        const struct tv_frequency* freq,
+                        const struct tv_channel* ch);
+
+uint8_t dtv_read_section(const char* tuner_id,
+                         const uint8_t source_type,
+                         const uint16_t pid,
+                         const uint8_t table_id,
+                         const uint32_t timeout,
+                         uint8_t* buf,
+                         uint32_t* len);
+
 uint8_t dtv_set_channel(const char* tuner_id,
                         const uint8_t source_type,
                         const char* channel_num,
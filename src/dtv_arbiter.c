@@ -0,0 +1,494 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements the tuner arbiter. See the corresponding header
+ * file for documentation.
+ */
+
+#include "dtv_arbiter.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dtv.h"
+#include "log.h"
+#include "memptr.h"
+#include "tv_utils.h"
+
+/*
+ * Claims
+ *
+ * A claim assigns a tuner to a user. While a claim is being preempted,
+ * it already names the new user, but the previous user might still use
+ * the tuner; |preempting| is set until the previous user has stopped.
+ * Users that wait for any tuner are queued in |g_waiter|.
+ *
+ * All state is protected by |g_lock|.
+ */
+
+enum {
+  MAX_CLAIMS = 32,
+  MAX_WAITERS = 8
+};
+
+struct claim {
+  char tuner_id[MAX_TUNER_ID_LEN];
+  struct dtv_tuner_user* user;
+  int preempting;
+};
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+
+static void (*g_reassigned_cb)(const char*, uint8_t, uint8_t);
+
+static struct claim g_claim[MAX_CLAIMS];
+static unsigned long g_num_claims;
+
+static struct dtv_tuner_user* g_waiter[MAX_WAITERS];
+static unsigned long g_num_waiters;
+
+static struct claim*
+find_claim(const char* tuner_id)
+{
+  unsigned long i;
+
+  for (i = 0; i < g_num_claims; ++i) {
+    if (!strcmp(g_claim[i].tuner_id, tuner_id)) {
+      return g_claim + i;
+    }
+  }
+  return NULL;
+}
+
+static struct claim*
+add_claim(const char* tuner_id, struct dtv_tuner_user* user)
+{
+  struct claim* claim;
+
+  if (g_num_claims == ARRAY_LENGTH(g_claim)) {
+    ALOGE("Too many tuner claims");
+    return NULL;
+  }
+
+  claim = g_claim + g_num_claims++;
+  snprintf(claim->tuner_id, sizeof(claim->tuner_id), "%s", tuner_id);
+  claim->user = user;
+  claim->preempting = 0;
+
+  return claim;
+}
+
+static void
+remove_claim(struct claim* claim)
+{
+  *claim = g_claim[--g_num_claims];
+}
+
+static void
+add_waiter(struct dtv_tuner_user* user)
+{
+  unsigned long i;
+
+  for (i = 0; i < g_num_waiters; ++i) {
+    if (g_waiter[i] == user) {
+      return;
+    }
+  }
+  if (g_num_waiters == ARRAY_LENGTH(g_waiter)) {
+    ALOGW("Too many users waiting for tuners");
+    return;
+  }
+  g_waiter[g_num_waiters++] = user;
+}
+
+static void
+remove_waiter(struct dtv_tuner_user* user)
+{
+  unsigned long i;
+
+  for (i = 0; i < g_num_waiters; ++i) {
+    if (g_waiter[i] == user) {
+      g_waiter[i] = g_waiter[--g_num_waiters];
+      return;
+    }
+  }
+}
+
+/* Dequeues all waiting users and resumes them, highest priority first.
+ * Called without the lock held. */
+static void
+resume_waiters(void)
+{
+  struct dtv_tuner_user* waiter[MAX_WAITERS];
+  struct dtv_tuner_user* user;
+  unsigned long num, i, j;
+
+  pthread_mutex_lock(&g_lock);
+  num = g_num_waiters;
+  memcpy(waiter, g_waiter, num * sizeof(*waiter));
+  g_num_waiters = 0;
+  pthread_mutex_unlock(&g_lock);
+
+  for (i = 1; i < num; ++i) {
+    for (j = i; j && waiter[j - 1]->use < waiter[j]->use; --j) {
+      user = waiter[j - 1];
+      waiter[j - 1] = waiter[j];
+      waiter[j] = user;
+    }
+  }
+  for (i = 0; i < num; ++i) {
+    if (waiter[i]->resume) {
+      waiter[i]->resume(waiter[i]);
+    }
+  }
+}
+
+/* Reassigns the tuner of |claim| to |user|. Called with the lock held,
+ * which is released while the previous user stops. */
+static void
+preempt_claim(struct claim* claim, struct dtv_tuner_user* user)
+{
+  struct dtv_tuner_user* holder;
+  char tuner_id[MAX_TUNER_ID_LEN];
+
+  holder = claim->user;
+  assert(holder->preempt);
+
+  claim->user = user;
+  claim->preempting = 1;
+  memcpy(tuner_id, claim->tuner_id, sizeof(tuner_id));
+
+  pthread_mutex_unlock(&g_lock);
+
+  ALOGI("Reassigning tuner %s from use %d to use %d",
+        tuner_id, holder->use, user->use);
+
+  holder->preempt(holder, tuner_id);
+  if (g_reassigned_cb) {
+    g_reassigned_cb(tuner_id, holder->use, user->use);
+  }
+
+  pthread_mutex_lock(&g_lock);
+
+  claim = find_claim(tuner_id);
+  if (claim) {
+    claim->preempting = 0;
+  }
+  pthread_cond_broadcast(&g_cond);
+}
+
+/*
+ * Tuners
+ */
+
+/* Returns the number of tuners and their IDs in an array allocated with
+ * malloc(3), or 0 on errors. Free the array with release_tuners(). */
+static uint32_t
+get_tuners(struct tv_tuner** tuners)
+{
+  uint32_t num;
+
+  *tuners = NULL;
+
+  num = dtv_get_tuner_num();
+  if (!num) {
+    return 0;
+  }
+
+  *tuners = calloc(num, sizeof(**tuners));
+  if (!*tuners) {
+    ALOGE_ERRNO("calloc");
+    return 0;
+  }
+  if (dtv_get_tuners(&num, *tuners) != TV_STATUS_SUCCESS) {
+    free(*tuners);
+    *tuners = NULL;
+    return 0;
+  }
+
+  return num;
+}
+
+static int
+is_tuner(const char* tuner_id)
+{
+  struct tv_tuner* tuners;
+  uint32_t num, i;
+
+  num = get_tuners(&tuners);
+  for (i = 0; i < num; ++i) {
+    if (!strcmp(tuners[i].id, tuner_id)) {
+      break;
+    }
+  }
+  release_tuners(num, tuners);
+
+  return i < num;
+}
+
+/*
+ * Public interface
+ */
+
+int
+init_dtv_arbiter(void (*reassigned_cb)(const char* tuner_id,
+                                       uint8_t old_use,
+                                       uint8_t new_use))
+{
+  g_reassigned_cb = reassigned_cb;
+
+  return 0;
+}
+
+void
+uninit_dtv_arbiter()
+{
+  pthread_mutex_lock(&g_lock);
+  g_num_claims = 0;
+  g_num_waiters = 0;
+  pthread_mutex_unlock(&g_lock);
+
+  g_reassigned_cb = NULL;
+}
+
+uint8_t
+dtv_arbiter_acquire(const char* tuner_id, struct dtv_tuner_user* user)
+{
+  struct claim* claim;
+  int valid;
+  uint8_t ret;
+
+  assert(tuner_id);
+  assert(user);
+
+  if (strlen(tuner_id) >= MAX_TUNER_ID_LEN) {
+    return TV_STATUS_INVARG;
+  }
+
+  valid = 0;
+
+  pthread_mutex_lock(&g_lock);
+
+  for (;;) {
+    claim = find_claim(tuner_id);
+    if (claim && claim->preempting) {
+      pthread_cond_wait(&g_cond, &g_lock);
+      continue;
+    } else if (claim) {
+      break;
+    } else if (valid) {
+      ret = add_claim(tuner_id, user) ? TV_STATUS_SUCCESS : TV_STATUS_FAIL;
+      goto out;
+    }
+
+    /* only claim tuners that exist */
+    pthread_mutex_unlock(&g_lock);
+    valid = is_tuner(tuner_id);
+    pthread_mutex_lock(&g_lock);
+
+    if (!valid) {
+      ALOGE("Unknown tuner %s", tuner_id);
+      ret = TV_STATUS_INVARG;
+      goto out;
+    }
+  }
+
+  if (claim->user == user) {
+    ret = TV_STATUS_SUCCESS;
+  } else if (claim->user->use >= user->use) {
+    ret = TV_STATUS_BUSY;
+  } else {
+    preempt_claim(claim, user);
+    ret = TV_STATUS_SUCCESS;
+  }
+
+out:
+  pthread_mutex_unlock(&g_lock);
+
+  return ret;
+}
+
+uint8_t
+dtv_arbiter_acquire_any(struct dtv_tuner_user* user,
+                        int (*filter)(const char* tuner_id, void* data),
+                        void* data, int wait,
+                        char tuner_id[MAX_TUNER_ID_LEN])
+{
+  struct tv_tuner* tuners;
+  struct claim* claim;
+  struct claim* victim;
+  const char* idle;
+  uint32_t num, i;
+  uint8_t ret;
+
+  assert(user);
+  assert(tuner_id);
+
+  num = get_tuners(&tuners);
+
+  pthread_mutex_lock(&g_lock);
+
+  idle = NULL;
+  victim = NULL;
+
+  for (i = 0; i < num && !idle; ++i) {
+    if (strlen(tuners[i].id) >= MAX_TUNER_ID_LEN) {
+      continue;
+    }
+    claim = find_claim(tuners[i].id);
+    if (claim && (claim->preempting || claim->user->use >= user->use)) {
+      continue;
+    }
+    if (filter && !filter(tuners[i].id, data)) {
+      continue;
+    }
+    if (!claim) {
+      idle = tuners[i].id;
+    } else if (!victim || claim->user->use < victim->user->use) {
+      victim = claim;
+    }
+  }
+
+  if (idle) {
+    snprintf(tuner_id, MAX_TUNER_ID_LEN, "%s", idle);
+    ret = add_claim(idle, user) ? TV_STATUS_SUCCESS : TV_STATUS_FAIL;
+  } else if (victim) {
+    snprintf(tuner_id, MAX_TUNER_ID_LEN, "%s", victim->tuner_id);
+    preempt_claim(victim, user);
+    ret = TV_STATUS_SUCCESS;
+  } else {
+    if (wait) {
+      add_waiter(user);
+    }
+    ret = TV_STATUS_BUSY;
+  }
+
+  pthread_mutex_unlock(&g_lock);
+
+  release_tuners(num, tuners);
+
+  return ret;
+}
+
+void
+dtv_arbiter_release(const char* tuner_id, struct dtv_tuner_user* user)
+{
+  struct claim* claim;
+  int resume;
+
+  assert(tuner_id);
+  assert(user);
+
+  resume = 0;
+
+  pthread_mutex_lock(&g_lock);
+
+  claim = find_claim(tuner_id);
+  if (claim && claim->user == user) {
+    remove_claim(claim);
+    resume = g_num_waiters > 0;
+  }
+
+  pthread_mutex_unlock(&g_lock);
+
+  if (resume) {
+    resume_waiters();
+  }
+}
+
+void
+dtv_arbiter_release_all(struct dtv_tuner_user* user)
+{
+  unsigned long i;
+  int resume;
+
+  assert(user);
+
+  resume = 0;
+
+  pthread_mutex_lock(&g_lock);
+
+  remove_waiter(user);
+
+  for (i = g_num_claims; i--;) {
+    if (g_claim[i].user == user) {
+      remove_claim(g_claim + i);
+      resume = g_num_waiters > 0;
+    }
+  }
+
+  pthread_mutex_unlock(&g_lock);
+
+  if (resume) {
+    resume_waiters();
+  }
+}
+
+void
+dtv_arbiter_cancel(struct dtv_tuner_user* user)
+{
+  assert(user);
+
+  pthread_mutex_lock(&g_lock);
+  remove_waiter(user);
+  pthread_mutex_unlock(&g_lock);
+}
+
+uint8_t
+dtv_arbiter_hand_over(const char* tuner_id, struct dtv_tuner_user* from,
+                      struct dtv_tuner_user* to)
+{
+  struct claim* claim;
+  uint8_t ret;
+
+  assert(tuner_id);
+  assert(from);
+  assert(to);
+
+  pthread_mutex_lock(&g_lock);
+
+  claim = find_claim(tuner_id);
+  if (claim && claim->user == from && !claim->preempting) {
+    claim->user = to;
+    ret = TV_STATUS_SUCCESS;
+  } else {
+    ret = TV_STATUS_BUSY;
+  }
+
+  pthread_mutex_unlock(&g_lock);
+
+  return ret;
+}
+
+uint8_t
+dtv_arbiter_get_use(const char* tuner_id)
+{
+  struct claim* claim;
+  uint8_t use;
+
+  assert(tuner_id);
+
+  pthread_mutex_lock(&g_lock);
+  claim = find_claim(tuner_id);
+  use = claim ? claim->user->use : TUNER_USE_NONE;
+  pthread_mutex_unlock(&g_lock);
+
+  return use;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the interface to the tuner arbiter of the DTV
+ * service.
+ *
+ * All parts of the service that tune acquire their tuners from the
+ * arbiter. Each of them is a |struct dtv_tuner_user| with a use, which
+ * orders the users by priority: live view preempts recording, recording
+ * preempts EPG harvesting, EPG harvesting preempts scanning, and all of
+ * them preempt the pre-tuner. Tuners are identified by their tuner IDs.
+ *
+ * |dtv_arbiter_acquire| acquires a specific tuner. If a user of lower
+ * priority holds the tuner, the arbiter calls the holder's |preempt|
+ * callback, which has to stop using the tuner before it returns. Then
+ * the tuner is reassigned and |init_dtv_arbiter|'s callback reports the
+ * previous and the new use. If the holder has the same or a higher
+ * priority, the function returns TV_STATUS_BUSY. Acquiring a tuner twice
+ * is allowed; a single release frees it.
+ *
+ * |dtv_arbiter_acquire_any| acquires any tuner for which |filter| returns
+ * non-zero. Idle tuners are preferred; otherwise, the user of the lowest
+ * priority below the caller's is preempted. The tuner ID is stored in
+ * |tuner_id|. If there's no tuner and |wait| is set, the user is queued
+ * until any tuner is released, and its |resume| callback is invoked to
+ * retry. This makes low-priority jobs resumable: after a preemption, they
+ * continue as soon as a tuner becomes available again.
+ * |dtv_arbiter_cancel| removes the user from the queue.
+ *
+ * |dtv_arbiter_hand_over| passes a tuner that |from| holds on to |to|,
+ * regardless of their priorities and without callbacks. It returns
+ * TV_STATUS_BUSY if |from| doesn't hold the tuner.
+ *
+ * The arbiter never invokes callbacks while holding its lock, so
+ * callbacks can call into the arbiter, except for |filter|, which runs
+ * with the lock held. |resume| shouldn't block. Users of TUNER_USE_LIVE
+ * are never preempted and don't need callbacks.
+ *
+ * |init_dtv_arbiter| returns 0 on success, or -1 on errors. All other
+ * functions are thread-safe. |dtv_arbiter_acquire| and
+ * |dtv_arbiter_acquire_any| return TV_STATUS_ codes.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+enum {
+  TUNER_USE_NONE = 0x00,
+  TUNER_USE_PRETUNE = 0x01,
+  TUNER_USE_SCAN = 0x02,
+  TUNER_USE_EPG = 0x03,
+  TUNER_USE_RECORDING = 0x04,
+  TUNER_USE_LIVE = 0x05
+};
+
+enum {
+  MAX_TUNER_ID_LEN = 16 /* including '\0' */
+};
+
+struct dtv_tuner_user {
+  uint8_t use;
+  void (*preempt)(struct dtv_tuner_user* user, const char* tuner_id);
+  void (*resume)(struct dtv_tuner_user* user);
+};
+
+int
+init_dtv_arbiter(void (*reassigned_cb)(const char* tuner_id,
+                                       uint8_t old_use,
+                                       uint8_t new_use));
+
+void
+uninit_dtv_arbiter(void);
+
+uint8_t
+dtv_arbiter_acquire(const char* tuner_id, struct dtv_tuner_user* user);
+
+uint8_t
+dtv_arbiter_acquire_any(struct dtv_tuner_user* user,
+                        int (*filter)(const char* tuner_id, void* data),
+                        void* data, int wait,
+                        char tuner_id[MAX_TUNER_ID_LEN]);
+
+void
+dtv_arbiter_release(const char* tuner_id, struct dtv_tuner_user* user);
+
+void
+dtv_arbiter_release_all(struct dtv_tuner_user* user);
+
+void
+dtv_arbiter_cancel(struct dtv_tuner_user* user);
+
+uint8_t
+dtv_arbiter_hand_over(const char* tuner_id, struct dtv_tuner_user* from,
+                      struct dtv_tuner_user* to);
+
+uint8_t
+dtv_arbiter_get_use(const char* tuner_id);
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements the program cache of the DTV service. See the
+ * corresponding header file for documentation.
+ */
+
+#include "dtv_cache.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+#include "log.h"
+#include "memptr.h"
+
+/*
+ * Cache entries
+ *
+ * Each entry lives in two lists: a hash bucket and the LRU list. The
+ * bucket is selected by hashing tuner ID, source type and channel number,
+ * but *not* the time window. All entries of a channel therefore end up
+ * in the same bucket, which makes |dtv_cache_invalidate| touch only a
+ * single bucket instead of the whole cache.
+ *
+ * Key strings and payload are stored in the same allocation as the entry
+ * itself. The size of an entry, as accounted against the cache limit,
+ * includes all of it.
+ */
+
+enum {
+  NUM_BUCKETS = 64 /* must be a power of 2 */
+};
+
+struct cache_entry {
+  LIST_ENTRY(cache_entry) bucket;
+  TAILQ_ENTRY(cache_entry) lru;
+  uint32_t hash;
+  uint32_t size;
+  uint8_t source_type;
+  uint64_t start_time;
+  uint64_t end_time;
+  const char* tuner_id;
+  const char* ch_num;
+  uint16_t len;
+  unsigned char data[0];
+};
+
+LIST_HEAD(cache_entry_list, cache_entry);
+TAILQ_HEAD(cache_entry_tailq, cache_entry);
+
+static struct cache_entry_list g_bucket[NUM_BUCKETS];
+static struct cache_entry_tailq g_lru = TAILQ_HEAD_INITIALIZER(g_lru);
+static struct dtv_cache_stats g_stats;
+
+static uint32_t
+hash_channel(const char* tuner_id, uint8_t source_type, const char* ch_num)
+{
+  /* FNV-1a */
+  uint32_t hash = 2166136261u;
+  const unsigned char* s;
+
+  for (s = (const unsigned char*)tuner_id; *s; ++s) {
+    hash = (hash ^ *s) * 16777619u;
+  }
+  hash = (hash ^ source_type) * 16777619u;
+  for (s = (const unsigned char*)ch_num; *s; ++s) {
+    hash = (hash ^ *s) * 16777619u;
+  }
+
+  return hash;
+}
+
+static int
+entry_is_channel(const struct cache_entry* entry, uint32_t hash,
+                 const char* tuner_id, uint8_t source_type,
+                 const char* ch_num)
+{
+  return (entry->hash == hash) &&
+         (entry->source_type == source_type) &&
+         !strcmp(entry->tuner_id, tuner_id) &&
+         !strcmp(entry->ch_num, ch_num);
+}
+
+static void
+remove_entry(struct cache_entry* entry)
+{
+  assert(entry);
+
+  LIST_REMOVE(entry, bucket);
+  TAILQ_REMOVE(&g_lru, entry, lru);
+
+  g_stats.size -= entry->size;
+  --g_stats.num_entries;
+
+  free(entry);
+}
+
+static void
+evict_entries(uint32_t size)
+{
+  while (!TAILQ_EMPTY(&g_lru) && (g_stats.max_size - g_stats.size) < size) {
+    remove_entry(TAILQ_LAST(&g_lru, cache_entry_tailq));
+    ++g_stats.evictions;
+  }
+}
+
+/*
+ * Public interface
+ */
+
+int
+init_dtv_cache(uint32_t max_size)
+{
+  size_t i;
+
+  for (i = 0; i < ARRAY_LENGTH(g_bucket); ++i) {
+    LIST_INIT(g_bucket + i);
+  }
+  TAILQ_INIT(&g_lru);
+
+  memset(&g_stats, 0, sizeof(g_stats));
+  g_stats.max_size = max_size;
+
+  return 0;
+}
+
+void
+uninit_dtv_cache()
+{
+  ALOGD("program cache: %llu hits, %llu misses, %llu evictions",
+        (unsigned long long)g_stats.hits,
+        (unsigned long long)g_stats.misses,
+        (unsigned long long)g_stats.evictions);
+
+  dtv_cache_flush();
+}
+
+const void*
+dtv_cache_lookup(const char* tuner_id,
+                 uint8_t source_type,
+                 const char* ch_num,
+                 uint64_t start_time,
+                 uint64_t end_time,
+                 uint16_t* len)
+{
+  uint32_t hash;
+  struct cache_entry* entry;
+
+  assert(tuner_id);
+  assert(ch_num);
+  assert(len);
+
+  hash = hash_channel(tuner_id, source_type, ch_num);
+
+  LIST_FOREACH(entry, g_bucket + (hash & (NUM_BUCKETS - 1)), bucket) {
+    if (entry->start_time != start_time ||
+        entry->end_time != end_time ||
+        !entry_is_channel(entry, hash, tuner_id, source_type, ch_num)) {
+      continue;
+    }
+
+    /* move to front of LRU list */
+    TAILQ_REMOVE(&g_lru, entry, lru);
+    TAILQ_INSERT_HEAD(&g_lru, entry, lru);
+
+    ++g_stats.hits;
+    *len = entry->len;
+
+    return entry->data;
+  }
+
+  ++g_stats.misses;
+
+  return NULL;
+}
+
+int
+dtv_cache_insert(const char* tuner_id,
+                 uint8_t source_type,
+                 const char* ch_num,
+                 uint64_t start_time,
+                 uint64_t end_time,
+                 const void* data,
+                 uint16_t len)
+{
+  size_t tuner_id_len, ch_num_len;
+  uint32_t hash, size;
+  struct cache_entry* entry;
+  char* str;
+
+  assert(tuner_id);
+  assert(ch_num);
+  assert(data || !len);
+
+  tuner_id_len = strlen(tuner_id) + 1;
+  ch_num_len = strlen(ch_num) + 1;
+
+  size = sizeof(*entry) + len + tuner_id_len + ch_num_len;
+
+  if (size > g_stats.max_size) {
+    return -1; /* would never fit; don't flush the cache for it */
+  }
+
+  hash = hash_channel(tuner_id, source_type, ch_num);
+
+  /* replace existing entry for the same query */
+  LIST_FOREACH(entry, g_bucket + (hash & (NUM_BUCKETS - 1)), bucket) {
+    if (entry->start_time == start_time &&
+        entry->end_time == end_time &&
+        entry_is_channel(entry, hash, tuner_id, source_type, ch_num)) {
+      remove_entry(entry);
+      break;
+    }
+  }
+
+  evict_entries(size);
+
+  entry = malloc(size);
+  if (!entry) {
+    ALOGE_ERRNO("malloc");
+    return -1;
+  }
+
+  entry->hash = hash;
+  entry->size = size;
+  entry->source_type = source_type;
+  entry->start_time = start_time;
+  entry->end_time = end_time;
+  entry->len = len;
+  memcpy(entry->data, data, len);
+
+  str = (char*)entry->data + len;
+  memcpy(str, tuner_id, tuner_id_len);
+  entry->tuner_id = str;
+
+  str += tuner_id_len;
+  memcpy(str, ch_num, ch_num_len);
+  entry->ch_num = str;
+
+  LIST_INSERT_HEAD(g_bucket + (hash & (NUM_BUCKETS - 1)), entry, bucket);
+  TAILQ_INSERT_HEAD(&g_lru, entry, lru);
+
+  g_stats.size += size;
+  ++g_stats.num_entries;
+
+  return 0;
+}
+
+void
+dtv_cache_invalidate(const char* tuner_id,
+                     uint8_t source_type,
+                     const char* ch_num)
+{
+  uint32_t hash;
+  struct cache_entry* entry;
+  struct cache_entry* next;
+
+  assert(tuner_id);
+  assert(ch_num);
+
+  hash = hash_channel(tuner_id, source_type, ch_num);
+
+  for (entry = LIST_FIRST(g_bucket + (hash & (NUM_BUCKETS - 1)));
+       entry;
+       entry = next) {
+    next = LIST_NEXT(entry, bucket);
+    if (entry_is_channel(entry, hash, tuner_id, source_type, ch_num)) {
+      remove_entry(entry);
+      ++g_stats.invalidations;
+    }
+  }
+}
+
+void
+dtv_cache_flush()
+{
+  while (!TAILQ_EMPTY(&g_lru)) {
+    remove_entry(TAILQ_FIRST(&g_lru));
+  }
+}
+
+void
+dtv_cache_get_stats(struct dtv_cache_stats* stats)
+{
+  assert(stats);
+
+  memcpy(stats, &g_stats, sizeof(*stats));
+}
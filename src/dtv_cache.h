@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the interface to the program cache of the DTV service.
+ *
+ * The cache stores the encoded payload of 'Get programs' responses. Each
+ * entry is keyed by tuner ID, source type, channel number and the requested
+ * time window. Entries are kept in least-recently-used order and the oldest
+ * entries are evicted when the total size of the cached payloads exceeds the
+ * limit given to |init_dtv_cache|.
+ *
+ * |dtv_cache_lookup| returns the cached payload for a query or NULL. The
+ * returned buffer is owned by the cache and only valid until the next call
+ * into the cache. |dtv_cache_insert| copies a payload into the cache and
+ * returns 0 on success, or -1 on errors.
+ *
+ * |dtv_cache_invalidate| removes all entries of a channel, regardless of the
+ * time window. Call it whenever the programs of that channel change, such as
+ * on received EIT data. |dtv_cache_flush| removes all entries.
+ *
+ * The cache is not thread-safe. All functions have to be called on the I/O
+ * thread.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct dtv_cache_stats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t invalidations;
+  uint32_t num_entries;
+  uint32_t size;
+  uint32_t max_size;
+};
+
+int
+init_dtv_cache(uint32_t max_size);
+
+void
+uninit_dtv_cache(void);
+
+const void*
+dtv_cache_lookup(const char* tuner_id,
+                 uint8_t source_type,
+                 const char* ch_num,
+                 uint64_t start_time,
+                 uint64_t end_time,
+                 uint16_t* len);
+
+int
+dtv_cache_insert(const char* tuner_id,
+                 uint8_t source_type,
+                 const char* ch_num,
+                 uint64_t start_time,
+                 uint64_t end_time,
+                 const void* data,
+                 uint16_t len);
+
+void
+dtv_cache_invalidate(const char* tuner_id,
+                     uint8_t source_type,
+                     const char* ch_num);
+
+void
+dtv_cache_flush(void);
+
+void
+dtv_cache_get_stats(struct dtv_cache_stats* stats);
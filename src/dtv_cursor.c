@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements result cursors. See the corresponding header file
+ * for documentation.
+ */
+
+#include "dtv_cursor.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "memptr.h"
+#include "tv_utils.h"
+
+struct cursor {
+  uint64_t token; /* 0 if unused */
+  uint64_t last_use;
+  int type;
+  uint32_t num;
+  void* items;
+};
+
+static struct cursor g_cursor[MAX_CURSORS];
+static uint64_t g_next_token;
+
+static uint64_t
+monotonic_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+release_items(int type, uint32_t num, void* items)
+{
+  switch (type) {
+    case CURSOR_CHANNELS:
+      release_channels(num, items);
+      break;
+    case CURSOR_PROGRAMS:
+      release_programs(num, items);
+      break;
+    default:
+      ALOGE("unknown cursor type %d", type);
+      break;
+  }
+}
+
+static void
+close_cursor(struct cursor* cursor)
+{
+  release_items(cursor->type, cursor->num, cursor->items);
+  memset(cursor, 0, sizeof(*cursor));
+}
+
+static struct cursor*
+find_cursor(uint64_t token)
+{
+  size_t i;
+
+  if (!token) {
+    return NULL;
+  }
+  for (i = 0; i < ARRAY_LENGTH(g_cursor); ++i) {
+    if (g_cursor[i].token == token) {
+      return g_cursor + i;
+    }
+  }
+  return NULL;
+}
+
+static void
+expire_cursors(uint64_t now)
+{
+  size_t i;
+
+  for (i = 0; i < ARRAY_LENGTH(g_cursor); ++i) {
+    if (g_cursor[i].token &&
+        (now - g_cursor[i].last_use) > CURSOR_TIMEOUT) {
+      close_cursor(g_cursor + i);
+    }
+  }
+}
+
+/* Returns an unused cursor, closing the least-recently used one if
+ * necessary. */
+static struct cursor*
+get_free_cursor(void)
+{
+  size_t i;
+  struct cursor* lru;
+
+  lru = g_cursor;
+
+  for (i = 0; i < ARRAY_LENGTH(g_cursor); ++i) {
+    if (!g_cursor[i].token) {
+      return g_cursor + i;
+    }
+    if (g_cursor[i].last_use < lru->last_use) {
+      lru = g_cursor + i;
+    }
+  }
+
+  close_cursor(lru);
+
+  return lru;
+}
+
+/*
+ * Public interface
+ */
+
+int
+init_dtv_cursor()
+{
+  memset(g_cursor, 0, sizeof(g_cursor));
+
+  /* Start with a time-based token, so tokens from a previous instance
+   * of the daemon are unlikely to be valid. */
+  g_next_token = ((uint64_t)time(NULL) << 20) | 1;
+
+  return 0;
+}
+
+void
+uninit_dtv_cursor()
+{
+  size_t i;
+
+  for (i = 0; i < ARRAY_LENGTH(g_cursor); ++i) {
+    if (g_cursor[i].token) {
+      close_cursor(g_cursor + i);
+    }
+  }
+}
+
+uint64_t
+dtv_cursor_open(int type, uint32_t num, void* items)
+{
+  uint64_t now;
+  struct cursor* cursor;
+
+  now = monotonic_ms();
+
+  expire_cursors(now);
+
+  cursor = get_free_cursor();
+
+  cursor->token = g_next_token++;
+  if (!g_next_token) {
+    g_next_token = 1; /* skip invalid token on wrap-around */
+  }
+  cursor->last_use = now;
+  cursor->type = type;
+  cursor->num = num;
+  cursor->items = items;
+
+  return cursor->token;
+}
+
+const void*
+dtv_cursor_items(uint64_t token, int type, uint32_t* num)
+{
+  uint64_t now;
+  struct cursor* cursor;
+
+  assert(num);
+
+  now = monotonic_ms();
+
+  expire_cursors(now);
+
+  cursor = find_cursor(token);
+  if (!cursor) {
+    ALOGW("unknown or expired cursor 0x%llx", (unsigned long long)token);
+    return NULL;
+  }
+  if (cursor->type != type) {
+    ALOGW("cursor 0x%llx has wrong type", (unsigned long long)token);
+    return NULL;
+  }
+
+  cursor->last_use = now;
+  *num = cursor->num;
+
+  return cursor->items;
+}
+
+void
+dtv_cursor_close(uint64_t token)
+{
+  struct cursor* cursor;
+
+  cursor = find_cursor(token);
+  if (!cursor) {
+    return;
+  }
+  close_cursor(cursor);
+}
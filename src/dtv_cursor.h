@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the interface to result cursors of the DTV service.
+ *
+ * A cursor holds a snapshot of a query result, such as a list of channels
+ * or programs, and is identified by a non-zero 64-bit token. Clients page
+ * through the snapshot by sending the token with an offset and a limit.
+ * As the snapshot never changes, pages stay consistent with each other
+ * even if the driver reports updates in the meantime.
+ *
+ * |dtv_cursor_open| takes ownership of an array of items and returns the
+ * new cursor's token. |dtv_cursor_items| returns the items of a cursor,
+ * or NULL if there is no cursor with the given token and type.
+ * |dtv_cursor_close| releases a cursor and its items.
+ *
+ * Cursors that have not been used for |CURSOR_TIMEOUT| milliseconds are
+ * closed automatically. If more than |MAX_CURSORS| cursors are open, the
+ * least-recently used cursor is closed.
+ *
+ * Cursors are not thread-safe. All functions have to be called on the I/O
+ * thread.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+enum {
+  CURSOR_CHANNELS,
+  CURSOR_PROGRAMS
+};
+
+enum {
+  MAX_CURSORS = 8,
+  CURSOR_TIMEOUT = 60 * 1000
+};
+
+int
+init_dtv_cursor(void);
+
+void
+uninit_dtv_cursor(void);
+
+uint64_t
+dtv_cursor_open(int type, uint32_t num, void* items);
+
+const void*
+dtv_cursor_items(uint64_t token, int type, uint32_t* num);
+
+void
+dtv_cursor_close(uint64_t token);
@@ -0,0 +1,597 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements EIT state tracking. See the corresponding header
+ * file for documentation.
+ */
+
+#include "dtv_eit.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+#include "log.h"
+#include "memptr.h"
+#include "tv_utils.h"
+
+/*
+ * Digests
+ *
+ * We identify programs and batches by 64-bit FNV-1a digests. A program's
+ * digest covers all fields that are sent to the client, so any change to
+ * a program results in an 'updated' entry. A batch's digest, the version,
+ * covers the channel and the digests of all programs in the batch.
+ */
+
+static const uint64_t FNV_OFFSET = 14695981039346656037ull;
+
+static uint64_t
+fnv_mem(uint64_t hash, const void* mem, size_t len)
+{
+  const unsigned char* beg = mem;
+  const unsigned char* end = beg + len;
+
+  for (; beg < end; ++beg) {
+    hash = (hash ^ *beg) * 1099511628211ull;
+  }
+  return hash;
+}
+
+static uint64_t
+fnv_str(uint64_t hash, const char* str)
+{
+  if (!str) {
+    str = "";
+  }
+  return fnv_mem(hash, str, strlen(str) + 1);
+}
+
+static uint64_t
+fnv_u64(uint64_t hash, uint64_t value)
+{
+  return fnv_mem(hash, &value, sizeof(value));
+}
+
+static uint64_t
+digest_channel(const struct tv_channel* ch)
+{
+  uint64_t hash = FNV_OFFSET;
+
+  hash = fnv_str(hash, ch->network_id);
+  hash = fnv_str(hash, ch->trans_stream_id);
+  hash = fnv_str(hash, ch->service_id);
+  hash = fnv_u64(hash, ch->type);
+  hash = fnv_str(hash, ch->number);
+  hash = fnv_str(hash, ch->name);
+  hash = fnv_u64(hash, ch->is_emergency);
+  hash = fnv_u64(hash, ch->is_free);
+
+  return hash;
+}
+
+static uint64_t
+digest_program(const struct tv_program* prog)
+{
+  uint64_t hash = FNV_OFFSET;
+  uint32_t idx;
+
+  hash = fnv_str(hash, prog->evt_id);
+  hash = fnv_str(hash, prog->title);
+  hash = fnv_u64(hash, prog->start_time);
+  hash = fnv_u64(hash, prog->duration);
+  hash = fnv_str(hash, prog->descpt);
+  hash = fnv_str(hash, prog->rating);
+  hash = fnv_u64(hash, prog->lang_num);
+  for (idx = 0; idx < prog->lang_num; ++idx) {
+    hash = fnv_str(hash, prog->langs[idx]);
+  }
+  hash = fnv_u64(hash, prog->stl_lang_num);
+  for (idx = 0; idx < prog->stl_lang_num; ++idx) {
+    hash = fnv_str(hash, prog->stl_langs[idx]);
+  }
+
+  return hash;
+}
+
+/*
+ * Channel state
+ *
+ * For each channel, we store the known events sorted by the hash of the
+ * event ID. This allows for merging a sorted batch with the known events
+ * in a single pass. The version of the last applied batch is remembered
+ * to drop repeated batches before doing any work on them. Older versions
+ * don't count, as a later batch might have replaced their events.
+ */
+
+enum {
+  NUM_BUCKETS = 64, /* must be a power of 2 */
+  MAX_EVENTS_PER_CHANNEL = 4096
+};
+
+struct eit_event {
+  uint64_t id_hash;
+  uint64_t digest;
+  uint64_t start_time;
+  uint64_t end_time;
+  char* evt_id;
+};
+
+struct eit_channel {
+  LIST_ENTRY(eit_channel) bucket;
+  uint32_t hash;
+  uint8_t source_type;
+  char* tuner_id;
+  char* ch_num;
+  uint64_t ch_digest;
+  uint64_t version; /* of the last applied batch */
+  uint32_t num_events;
+  struct eit_event* events;
+};
+
+LIST_HEAD(eit_channel_list, eit_channel);
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct eit_channel_list g_bucket[NUM_BUCKETS];
+
+static uint32_t
+hash_channel(const char* tuner_id, uint8_t source_type, const char* ch_num)
+{
+  uint64_t hash = FNV_OFFSET;
+
+  hash = fnv_str(hash, tuner_id);
+  hash = fnv_u64(hash, source_type);
+  hash = fnv_str(hash, ch_num);
+
+  return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static void
+free_channel(struct eit_channel* channel)
+{
+  uint32_t idx;
+
+  for (idx = 0; idx < channel->num_events; ++idx) {
+    free(channel->events[idx].evt_id);
+  }
+  free(channel->events);
+  free(channel->tuner_id);
+  free(channel->ch_num);
+  free(channel);
+}
+
+static struct eit_channel*
+find_channel(const char* tuner_id, uint8_t source_type, const char* ch_num,
+             uint32_t hash)
+{
+  struct eit_channel* channel;
+
+  LIST_FOREACH(channel, g_bucket + (hash & (NUM_BUCKETS - 1)), bucket) {
+    if (channel->hash == hash &&
+        channel->source_type == source_type &&
+        !strcmp(channel->tuner_id, tuner_id) &&
+        !strcmp(channel->ch_num, ch_num)) {
+      return channel;
+    }
+  }
+  return NULL;
+}
+
+static struct eit_channel*
+create_channel(const char* tuner_id, uint8_t source_type, const char* ch_num,
+               uint32_t hash)
+{
+  struct eit_channel* channel;
+
+  channel = calloc(1, sizeof(*channel));
+  if (!channel) {
+    ALOGE_ERRNO("calloc");
+    return NULL;
+  }
+
+  channel->tuner_id = strdup(tuner_id);
+  if (!channel->tuner_id) {
+    ALOGE_ERRNO("strdup");
+    goto err_strdup_tuner_id;
+  }
+
+  channel->ch_num = strdup(ch_num);
+  if (!channel->ch_num) {
+    ALOGE_ERRNO("strdup");
+    goto err_strdup_ch_num;
+  }
+
+  channel->hash = hash;
+  channel->source_type = source_type;
+
+  LIST_INSERT_HEAD(g_bucket + (hash & (NUM_BUCKETS - 1)), channel, bucket);
+
+  return channel;
+
+err_strdup_ch_num:
+  free(channel->tuner_id);
+err_strdup_tuner_id:
+  free(channel);
+  return NULL;
+}
+
+/*
+ * Batch merging
+ */
+
+struct batch_ref {
+  uint64_t id_hash;
+  uint64_t digest;
+  const char* evt_id;
+  uint32_t idx;
+};
+
+static int
+cmp_event_id(uint64_t lhs_hash, const char* lhs_id,
+             uint64_t rhs_hash, const char* rhs_id)
+{
+  if (lhs_hash < rhs_hash) {
+    return -1;
+  } else if (lhs_hash > rhs_hash) {
+    return 1;
+  }
+  return strcmp(lhs_id, rhs_id);
+}
+
+static int
+cmp_batch_ref(const void* lhs, const void* rhs)
+{
+  const struct batch_ref* l = lhs;
+  const struct batch_ref* r = rhs;
+  int res;
+
+  res = cmp_event_id(l->id_hash, l->evt_id, r->id_hash, r->evt_id);
+  if (res) {
+    return res;
+  }
+  /* equal event IDs; sort by index to let the last one win */
+  return (l->idx > r->idx) - (l->idx < r->idx);
+}
+
+static int
+cmp_event_start(const void* lhs, const void* rhs)
+{
+  const struct eit_event* l = lhs;
+  const struct eit_event* r = rhs;
+
+  return (l->start_time > r->start_time) - (l->start_time < r->start_time);
+}
+
+static int
+cmp_event(const void* lhs, const void* rhs)
+{
+  const struct eit_event* l = lhs;
+  const struct eit_event* r = rhs;
+
+  return cmp_event_id(l->id_hash, l->evt_id, r->id_hash, r->evt_id);
+}
+
+static void
+limit_events(struct eit_event* events, uint32_t* num_events)
+{
+  uint32_t num_dropped, idx;
+
+  if (*num_events <= MAX_EVENTS_PER_CHANNEL) {
+    return;
+  }
+
+  /* drop the oldest events and restore order */
+  qsort(events, *num_events, sizeof(*events), cmp_event_start);
+
+  num_dropped = *num_events - MAX_EVENTS_PER_CHANNEL;
+  for (idx = 0; idx < num_dropped; ++idx) {
+    free(events[idx].evt_id);
+  }
+  memmove(events, events + num_dropped,
+          MAX_EVENTS_PER_CHANNEL * sizeof(*events));
+  *num_events = MAX_EVENTS_PER_CHANNEL;
+
+  qsort(events, *num_events, sizeof(*events), cmp_event);
+}
+
+static int
+merge_batch(struct eit_channel* channel,
+            uint32_t prog_num, const struct tv_program* progs,
+            struct batch_ref* ref, uint32_t num_refs,
+            struct dtv_eit_diff* diff)
+{
+  uint64_t span_start, span_end;
+  struct eit_event* events;
+  uint32_t num_events;
+  uint32_t i, j;
+
+  /* the time span covered by this batch */
+  span_start = UINT64_MAX;
+  span_end = 0;
+  for (i = 0; i < prog_num; ++i) {
+    if (progs[i].start_time < span_start) {
+      span_start = progs[i].start_time;
+    }
+    if (progs[i].start_time + progs[i].duration > span_end) {
+      span_end = progs[i].start_time + progs[i].duration;
+    }
+  }
+
+  events = malloc((channel->num_events + num_refs) * sizeof(*events));
+  if (!events && (channel->num_events + num_refs)) {
+    ALOGE_ERRNO("malloc");
+    return -1;
+  }
+  diff->added = malloc(num_refs * sizeof(*diff->added));
+  if (!diff->added && num_refs) {
+    ALOGE_ERRNO("malloc");
+    goto err_malloc_added;
+  }
+  diff->updated = malloc(num_refs * sizeof(*diff->updated));
+  if (!diff->updated && num_refs) {
+    ALOGE_ERRNO("malloc");
+    goto err_malloc_updated;
+  }
+  diff->removed = malloc(channel->num_events * sizeof(*diff->removed));
+  if (!diff->removed && channel->num_events) {
+    ALOGE_ERRNO("malloc");
+    goto err_malloc_removed;
+  }
+
+  num_events = 0;
+  i = 0;
+  j = 0;
+
+  while (i < channel->num_events || j < num_refs) {
+    struct eit_event* old = channel->events + i;
+    int res;
+
+    if (i == channel->num_events) {
+      res = 1;
+    } else if (j == num_refs) {
+      res = -1;
+    } else {
+      res = cmp_event_id(old->id_hash, old->evt_id,
+                         ref[j].id_hash, ref[j].evt_id);
+    }
+
+    if (res < 0) {
+      /* known event, not in batch */
+      if (old->start_time < span_end && old->end_time > span_start) {
+        diff->removed[diff->num_removed++] = old->evt_id; /* moves string */
+      } else {
+        events[num_events++] = *old;
+      }
+      ++i;
+    } else {
+      const struct tv_program* prog = progs + ref[j].idx;
+      struct eit_event* evt = events + num_events++;
+
+      if (res > 0) {
+        /* new event */
+        evt->evt_id = strdup(ref[j].evt_id);
+        if (!evt->evt_id) {
+          ALOGE_ERRNO("strdup");
+          --num_events;
+          goto err_strdup;
+        }
+        evt->id_hash = ref[j].id_hash;
+        diff->added[diff->num_added++] = ref[j].idx;
+      } else {
+        /* known event, in batch */
+        *evt = *old;
+        if (old->digest != ref[j].digest) {
+          diff->updated[diff->num_updated++] = ref[j].idx;
+        }
+        ++i;
+      }
+      evt->digest = ref[j].digest;
+      evt->start_time = prog->start_time;
+      evt->end_time = prog->start_time + prog->duration;
+      ++j;
+    }
+  }
+
+  limit_events(events, &num_events);
+
+  free(channel->events);
+  channel->events = events;
+  channel->num_events = num_events;
+
+  return 0;
+
+err_strdup:
+  /* Old events have been moved; give the state up entirely. */
+  for (; i < channel->num_events; ++i) {
+    free(channel->events[i].evt_id);
+  }
+  free(channel->events);
+  channel->events = events;
+  channel->num_events = num_events;
+  dtv_eit_release_diff(diff);
+  return -1;
+err_malloc_removed:
+  free(diff->updated);
+  diff->updated = NULL;
+err_malloc_updated:
+  free(diff->added);
+  diff->added = NULL;
+err_malloc_added:
+  free(events);
+  return -1;
+}
+
+/*
+ * Public interface
+ */
+
+int
+init_dtv_eit()
+{
+  size_t i;
+
+  for (i = 0; i < ARRAY_LENGTH(g_bucket); ++i) {
+    LIST_INIT(g_bucket + i);
+  }
+
+  return 0;
+}
+
+void
+uninit_dtv_eit()
+{
+  dtv_eit_clear();
+}
+
+int
+dtv_eit_update(const char* tuner_id,
+               uint8_t source_type,
+               const struct tv_channel* ch,
+               uint32_t prog_num,
+               const struct tv_program* progs,
+               struct dtv_eit_diff* diff)
+{
+  uint64_t ch_digest, version;
+  uint32_t hash, i, num_refs;
+  struct batch_ref* ref;
+  struct eit_channel* channel;
+  int res;
+
+  assert(tuner_id);
+  assert(ch);
+  assert(progs || !prog_num);
+  assert(diff);
+
+  memset(diff, 0, sizeof(*diff));
+
+  /* digest batch without holding the lock */
+
+  ref = malloc(prog_num * sizeof(*ref));
+  if (!ref && prog_num) {
+    ALOGE_ERRNO("malloc");
+    return -1;
+  }
+
+  ch_digest = digest_channel(ch);
+  version = fnv_u64(FNV_OFFSET, ch_digest);
+
+  for (i = 0; i < prog_num; ++i) {
+    ref[i].evt_id = progs[i].evt_id ? progs[i].evt_id : "";
+    ref[i].id_hash = fnv_str(FNV_OFFSET, ref[i].evt_id);
+    ref[i].digest = digest_program(progs + i);
+    ref[i].idx = i;
+    version = fnv_u64(version, ref[i].digest);
+  }
+
+  qsort(ref, prog_num, sizeof(*ref), cmp_batch_ref);
+
+  /* remove duplicate event IDs; the last one in the batch wins */
+  num_refs = 0;
+  for (i = 0; i < prog_num; ++i) {
+    if (num_refs &&
+        !cmp_event_id(ref[num_refs - 1].id_hash, ref[num_refs - 1].evt_id,
+                      ref[i].id_hash, ref[i].evt_id)) {
+      --num_refs;
+    }
+    ref[num_refs++] = ref[i];
+  }
+
+  hash = hash_channel(tuner_id, source_type, ch->number);
+
+  pthread_mutex_lock(&g_lock);
+
+  channel = find_channel(tuner_id, source_type, ch->number, hash);
+
+  if (channel && channel->version == version) {
+    res = 0; /* repeated batch; nothing changed */
+    goto out;
+  }
+
+  if (!channel) {
+    channel = create_channel(tuner_id, source_type, ch->number, hash);
+    if (!channel) {
+      res = -1;
+      goto out;
+    }
+    diff->full = 1;
+  } else if (channel->ch_digest != ch_digest) {
+    diff->full = 1;
+  }
+
+  res = merge_batch(channel, prog_num, progs, ref, num_refs, diff);
+  if (res < 0) {
+    LIST_REMOVE(channel, bucket);
+    free_channel(channel);
+    goto out;
+  }
+
+  channel->ch_digest = ch_digest;
+  channel->version = version;
+
+out:
+  pthread_mutex_unlock(&g_lock);
+  free(ref);
+
+  return res;
+}
+
+void
+dtv_eit_release_diff(struct dtv_eit_diff* diff)
+{
+  uint32_t i;
+
+  assert(diff);
+
+  for (i = 0; i < diff->num_removed; ++i) {
+    free(diff->removed[i]);
+  }
+  free(diff->removed);
+  free(diff->updated);
+  free(diff->added);
+
+  memset(diff, 0, sizeof(*diff));
+}
+
+int
+dtv_eit_diff_is_empty(const struct dtv_eit_diff* diff)
+{
+  assert(diff);
+
+  return !diff->full &&
+         !diff->num_added &&
+         !diff->num_updated &&
+         !diff->num_removed;
+}
+
+void
+dtv_eit_clear()
+{
+  size_t i;
+
+  pthread_mutex_lock(&g_lock);
+
+  for (i = 0; i < ARRAY_LENGTH(g_bucket); ++i) {
+    while (!LIST_EMPTY(g_bucket + i)) {
+      struct eit_channel* channel = LIST_FIRST(g_bucket + i);
+      LIST_REMOVE(channel, bucket);
+      free_channel(channel);
+    }
+  }
+
+  pthread_mutex_unlock(&g_lock);
+}
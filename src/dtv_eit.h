@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the interface for tracking EIT state per channel.
+ *
+ * The driver reports EIT data as batches of programs for a channel. The
+ * same batch is often reported over and over again. |dtv_eit_update|
+ * compares a batch against the channel's known events and computes the
+ * difference in |struct dtv_eit_diff|. The batch is identified by a digest
+ * over the channel and all of its programs, which serves as the batch's
+ * version. A batch with the version of the last applied batch results in
+ * an empty diff.
+ *
+ * The diff contains the indices of added and updated programs within the
+ * batch, and the event IDs of removed programs. A known event is removed
+ * if it is missing from a batch that covers the event's time span. The
+ * flag |full| is set for the first batch of a channel and when the
+ * channel's attributes changed. In this case the receiver has no prior
+ * state to apply a diff to and the whole batch should be forwarded.
+ *
+ * |dtv_eit_update| returns 0 on success and -1 on errors. Each successful
+ * call has to be followed by a call to |dtv_eit_release_diff|. On errors,
+ * the channel's state is cleared and the next batch will be reported as
+ * full.
+ *
+ * |dtv_eit_clear| drops all state, which makes the next batch of each
+ * channel a full batch. All functions are thread-safe.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct tv_channel;
+struct tv_program;
+
+struct dtv_eit_diff {
+  int full;
+  uint32_t num_added;
+  uint32_t* added;
+  uint32_t num_updated;
+  uint32_t* updated;
+  uint32_t num_removed;
+  char** removed;
+};
+
+int
+init_dtv_eit(void);
+
+void
+uninit_dtv_eit(void);
+
+int
+dtv_eit_update(const char* tuner_id,
+               uint8_t source_type,
+               const struct tv_channel* ch,
+               uint32_t prog_num,
+               const struct tv_program* progs,
+               struct dtv_eit_diff* diff);
+
+void
+dtv_eit_release_diff(struct dtv_eit_diff* diff);
+
+int
+dtv_eit_diff_is_empty(const struct dtv_eit_diff* diff);
+
+void
+dtv_eit_clear(void);
@@ -0,0 +1,602 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements the EPG store. See the corresponding header file
+ * for documentation.
+ */
+
+#include "dtv_epg.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+#include <time.h>
+
+#include "dtv_search.h"
+#include "log.h"
+#include "memptr.h"
+#include "tv_utils.h"
+
+/*
+ * Channels
+ *
+ * Each channel holds its programs in an array sorted by start time. The
+ * covered window is stored with the monotonic time of its creation, so we
+ * can expire it without being affected by changes to the wall clock.
+ */
+
+enum {
+  NUM_BUCKETS = 64, /* must be a power of 2 */
+  MAX_PROGRAMS_PER_CHANNEL = 4096
+};
+
+struct epg_channel {
+  LIST_ENTRY(epg_channel) bucket;
+  uint32_t hash;
+  uint8_t source_type;
+  char* tuner_id;
+  char* ch_num;
+  uint64_t cover_start;
+  uint64_t cover_end;
+  uint64_t cover_time; /* monotonic; 0 if nothing covered */
+  uint32_t prog_num;
+  struct tv_program* progs;
+};
+
+LIST_HEAD(epg_channel_list, epg_channel);
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct epg_channel_list g_bucket[NUM_BUCKETS];
+
+static uint64_t
+monotonic_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t
+hash_channel(const char* tuner_id, uint8_t source_type, const char* ch_num)
+{
+  /* FNV-1a */
+  uint32_t hash = 2166136261u;
+  const unsigned char* s;
+
+  for (s = (const unsigned char*)tuner_id; *s; ++s) {
+    hash = (hash ^ *s) * 16777619u;
+  }
+  hash = (hash ^ source_type) * 16777619u;
+  for (s = (const unsigned char*)ch_num; *s; ++s) {
+    hash = (hash ^ *s) * 16777619u;
+  }
+
+  return hash;
+}
+
+static struct epg_channel*
+find_channel(const char* tuner_id, uint8_t source_type, const char* ch_num)
+{
+  uint32_t hash;
+  struct epg_channel* channel;
+
+  hash = hash_channel(tuner_id, source_type, ch_num);
+
+  LIST_FOREACH(channel, g_bucket + (hash & (NUM_BUCKETS - 1)), bucket) {
+    if (channel->hash == hash &&
+        channel->source_type == source_type &&
+        !strcmp(channel->tuner_id, tuner_id) &&
+        !strcmp(channel->ch_num, ch_num)) {
+      return channel;
+    }
+  }
+  return NULL;
+}
+
+static struct epg_channel*
+get_channel(const char* tuner_id, uint8_t source_type, const char* ch_num)
+{
+  struct epg_channel* channel;
+
+  channel = find_channel(tuner_id, source_type, ch_num);
+  if (channel) {
+    return channel;
+  }
+
+  channel = calloc(1, sizeof(*channel));
+  if (!channel) {
+    ALOGE_ERRNO("calloc");
+    return NULL;
+  }
+
+  channel->tuner_id = strdup(tuner_id);
+  if (!channel->tuner_id) {
+    ALOGE_ERRNO("strdup");
+    goto err_strdup_tuner_id;
+  }
+
+  channel->ch_num = strdup(ch_num);
+  if (!channel->ch_num) {
+    ALOGE_ERRNO("strdup");
+    goto err_strdup_ch_num;
+  }
+
+  channel->hash = hash_channel(tuner_id, source_type, ch_num);
+  channel->source_type = source_type;
+
+  LIST_INSERT_HEAD(g_bucket + (channel->hash & (NUM_BUCKETS - 1)),
+                   channel, bucket);
+
+  return channel;
+
+err_strdup_ch_num:
+  free(channel->tuner_id);
+err_strdup_tuner_id:
+  free(channel);
+  return NULL;
+}
+
+/* Removes a program from the search index and releases its fields. */
+static void
+drop_program(const struct epg_channel* channel, struct tv_program* prog)
+{
+  dtv_search_remove(channel->tuner_id, channel->source_type,
+                    channel->ch_num, prog);
+  clear_program(prog);
+}
+
+static void
+free_channel(struct epg_channel* channel)
+{
+  release_programs(channel->prog_num, channel->progs);
+  free(channel->tuner_id);
+  free(channel->ch_num);
+  free(channel);
+}
+
+static int
+is_covered(const struct epg_channel* channel,
+           uint64_t start_time, uint64_t end_time)
+{
+  if (!channel->cover_time ||
+      (monotonic_ms() - channel->cover_time) > EPG_COVERAGE_TIMEOUT) {
+    return 0;
+  }
+  return channel->cover_start <= start_time && end_time <= channel->cover_end;
+}
+
+static int
+overlaps(const struct tv_program* prog, uint64_t start_time, uint64_t end_time)
+{
+  return prog->start_time <= end_time &&
+         prog->start_time + prog->duration > start_time;
+}
+
+static int
+cmp_program_start(const void* lhs, const void* rhs)
+{
+  const struct tv_program* l = lhs;
+  const struct tv_program* r = rhs;
+
+  return (l->start_time > r->start_time) - (l->start_time < r->start_time);
+}
+
+/* Replaces the programs within [start_time, end_time) by a batch of
+ * programs. The batch is copied; the channel's state is unchanged on
+ * errors.
+ */
+static int
+replace_programs(struct epg_channel* channel,
+                 uint64_t start_time, uint64_t end_time,
+                 uint32_t prog_num, const struct tv_program* progs)
+{
+  struct tv_program* new_progs;
+  uint32_t new_num, idx;
+
+  new_progs = calloc(channel->prog_num + prog_num + 1, sizeof(*new_progs));
+  if (!new_progs) {
+    ALOGE_ERRNO("calloc");
+    return -1;
+  }
+
+  for (idx = 0; idx < prog_num; ++idx) {
+    if (copy_program(new_progs + idx, progs + idx) < 0) {
+      release_programs(idx, new_progs);
+      return -1;
+    }
+  }
+  new_num = prog_num;
+
+  /* move over the programs outside of the replaced span */
+  for (idx = 0; idx < channel->prog_num; ++idx) {
+    struct tv_program* prog = channel->progs + idx;
+    if (prog->start_time < end_time &&
+        prog->start_time + prog->duration > start_time) {
+      drop_program(channel, prog);
+    } else {
+      new_progs[new_num++] = *prog;
+    }
+  }
+  free(channel->progs);
+
+  /* Programs are added after removing the replaced ones, as an updated
+   * program has the same key in the search index as its old version. A
+   * failed insert only hides the program from searches. */
+  for (idx = 0; idx < prog_num; ++idx) {
+    dtv_search_add(channel->tuner_id, channel->source_type,
+                   channel->ch_num, new_progs + idx);
+  }
+
+  qsort(new_progs, new_num, sizeof(*new_progs), cmp_program_start);
+
+  if (new_num > MAX_PROGRAMS_PER_CHANNEL) {
+    /* drop the oldest programs */
+    uint32_t num_dropped = new_num - MAX_PROGRAMS_PER_CHANNEL;
+    for (idx = 0; idx < num_dropped; ++idx) {
+      drop_program(channel, new_progs + idx);
+    }
+    memmove(new_progs, new_progs + num_dropped,
+            MAX_PROGRAMS_PER_CHANNEL * sizeof(*new_progs));
+    new_num = MAX_PROGRAMS_PER_CHANNEL;
+  }
+
+  channel->progs = new_progs;
+  channel->prog_num = new_num;
+
+  return 0;
+}
+
+/* Copies the channel's programs that overlap the window. */
+static int
+copy_window(const struct epg_channel* channel,
+            uint64_t start_time, uint64_t end_time,
+            uint32_t* prog_num, struct tv_program** progs)
+{
+  uint32_t beg, end, idx, num;
+
+  /* Programs are sorted by start time, so we can stop at the first
+   * program that starts after the window. Before that, long-running
+   * programs might still overlap. */
+  beg = channel->prog_num;
+  end = 0;
+  for (idx = 0;
+       idx < channel->prog_num && channel->progs[idx].start_time <= end_time;
+       ++idx) {
+    if (overlaps(channel->progs + idx, start_time, end_time)) {
+      if (beg > idx) {
+        beg = idx;
+      }
+      end = idx + 1;
+    }
+  }
+
+  *progs = calloc(end > beg ? end - beg : 1, sizeof(**progs));
+  if (!*progs) {
+    ALOGE_ERRNO("calloc");
+    return -1;
+  }
+
+  num = 0;
+  for (idx = beg; idx < end; ++idx) {
+    if (!overlaps(channel->progs + idx, start_time, end_time)) {
+      continue;
+    }
+    if (copy_program(*progs + num, channel->progs + idx) < 0) {
+      release_programs(num, *progs);
+      return -1;
+    }
+    ++num;
+  }
+  *prog_num = num;
+
+  return 0;
+}
+
+/*
+ * Public interface
+ */
+
+int
+init_dtv_epg()
+{
+  size_t i;
+
+  for (i = 0; i < ARRAY_LENGTH(g_bucket); ++i) {
+    LIST_INIT(g_bucket + i);
+  }
+
+  return init_dtv_search();
+}
+
+void
+uninit_dtv_epg()
+{
+  dtv_epg_clear();
+  uninit_dtv_search();
+}
+
+int
+dtv_epg_store(const char* tuner_id,
+              uint8_t source_type,
+              const char* ch_num,
+              uint64_t start_time,
+              uint64_t end_time,
+              uint32_t prog_num,
+              const struct tv_program* progs)
+{
+  struct epg_channel* channel;
+  int res;
+
+  assert(tuner_id);
+  assert(ch_num);
+  assert(progs || !prog_num);
+
+  pthread_mutex_lock(&g_lock);
+
+  channel = get_channel(tuner_id, source_type, ch_num);
+  if (!channel) {
+    res = -1;
+    goto out;
+  }
+
+  /* Programs that overlap the window are part of the query's result, so
+   * the replaced span includes the end time. */
+  res = replace_programs(channel, start_time,
+                         end_time < UINT64_MAX ? end_time + 1 : end_time,
+                         prog_num, progs);
+  if (res < 0) {
+    goto out;
+  }
+
+  if (is_covered(channel, channel->cover_start, channel->cover_end) &&
+      start_time <= channel->cover_end && end_time >= channel->cover_start) {
+    /* extend the existing window */
+    if (start_time < channel->cover_start) {
+      channel->cover_start = start_time;
+    }
+    if (end_time > channel->cover_end) {
+      channel->cover_end = end_time;
+    }
+  } else {
+    channel->cover_start = start_time;
+    channel->cover_end = end_time;
+  }
+  channel->cover_time = monotonic_ms();
+
+out:
+  pthread_mutex_unlock(&g_lock);
+
+  return res;
+}
+
+int
+dtv_epg_merge(const char* tuner_id,
+              uint8_t source_type,
+              const char* ch_num,
+              uint32_t prog_num,
+              const struct tv_program* progs)
+{
+  uint64_t span_start, span_end;
+  uint32_t idx;
+  struct epg_channel* channel;
+  int res;
+
+  assert(tuner_id);
+  assert(ch_num);
+  assert(progs || !prog_num);
+
+  if (!prog_num) {
+    return 0;
+  }
+
+  span_start = UINT64_MAX;
+  span_end = 0;
+  for (idx = 0; idx < prog_num; ++idx) {
+    if (progs[idx].start_time < span_start) {
+      span_start = progs[idx].start_time;
+    }
+    if (progs[idx].start_time + progs[idx].duration > span_end) {
+      span_end = progs[idx].start_time + progs[idx].duration;
+    }
+  }
+
+  pthread_mutex_lock(&g_lock);
+
+  channel = get_channel(tuner_id, source_type, ch_num);
+  if (!channel) {
+    res = -1;
+    goto out;
+  }
+
+  res = replace_programs(channel, span_start, span_end, prog_num, progs);
+
+out:
+  pthread_mutex_unlock(&g_lock);
+
+  return res;
+}
+
+int
+dtv_epg_query(const char* tuner_id,
+              uint8_t source_type,
+              const char* ch_num,
+              uint64_t start_time,
+              uint64_t end_time,
+              uint32_t* prog_num,
+              struct tv_program** progs)
+{
+  struct epg_channel* channel;
+  int res;
+
+  assert(tuner_id);
+  assert(ch_num);
+  assert(prog_num);
+  assert(progs);
+
+  pthread_mutex_lock(&g_lock);
+
+  channel = find_channel(tuner_id, source_type, ch_num);
+  if (!channel || !is_covered(channel, start_time, end_time)) {
+    res = 0;
+  } else {
+    res = copy_window(channel, start_time, end_time, prog_num, progs) < 0 ?
+      -1 : 1;
+  }
+
+  pthread_mutex_unlock(&g_lock);
+
+  return res;
+}
+
+int
+dtv_epg_query_merged(const char* tuner_id,
+                     uint8_t source_type,
+                     const char* ch_num,
+                     uint64_t start_time,
+                     uint64_t end_time,
+                     uint32_t* prog_num,
+                     struct tv_program** progs)
+{
+  static const struct epg_channel empty;
+
+  const struct epg_channel* channel;
+  int res;
+
+  assert(tuner_id);
+  assert(ch_num);
+  assert(prog_num);
+  assert(progs);
+
+  pthread_mutex_lock(&g_lock);
+
+  channel = find_channel(tuner_id, source_type, ch_num);
+  res = copy_window(channel ? channel : &empty, start_time, end_time,
+                    prog_num, progs);
+
+  pthread_mutex_unlock(&g_lock);
+
+  return res;
+}
+
+int
+dtv_epg_lookup(const char* tuner_id,
+               uint8_t source_type,
+               const char* ch_num,
+               const char* evt_id,
+               uint64_t start_time,
+               struct tv_program* prog)
+{
+  struct epg_channel* channel;
+  uint32_t beg, end, mid;
+  int res;
+
+  assert(tuner_id);
+  assert(ch_num);
+  assert(evt_id);
+  assert(prog);
+
+  pthread_mutex_lock(&g_lock);
+
+  channel = find_channel(tuner_id, source_type, ch_num);
+  if (!channel) {
+    res = 0;
+    goto out;
+  }
+
+  /* binary search for the first program at |start_time| */
+  beg = 0;
+  end = channel->prog_num;
+  while (beg < end) {
+    mid = beg + (end - beg) / 2;
+    if (channel->progs[mid].start_time < start_time) {
+      beg = mid + 1;
+    } else {
+      end = mid;
+    }
+  }
+
+  res = 0;
+  for (; beg < channel->prog_num &&
+         channel->progs[beg].start_time == start_time; ++beg) {
+    const struct tv_program* p = channel->progs + beg;
+    if (!strcmp(p->evt_id ? p->evt_id : "", evt_id)) {
+      res = copy_program(prog, p) < 0 ? -1 : 1;
+      break;
+    }
+  }
+
+out:
+  pthread_mutex_unlock(&g_lock);
+
+  return res;
+}
+
+int
+dtv_epg_is_covered(const char* tuner_id,
+                   uint8_t source_type,
+                   const char* ch_num,
+                   uint64_t start_time,
+                   uint64_t end_time)
+{
+  struct epg_channel* channel;
+  int res;
+
+  assert(tuner_id);
+  assert(ch_num);
+
+  pthread_mutex_lock(&g_lock);
+
+  channel = find_channel(tuner_id, source_type, ch_num);
+  res = channel && is_covered(channel, start_time, end_time);
+
+  pthread_mutex_unlock(&g_lock);
+
+  return res;
+}
+
+void
+dtv_epg_clear()
+{
+  size_t i;
+
+  pthread_mutex_lock(&g_lock);
+
+  for (i = 0; i < ARRAY_LENGTH(g_bucket); ++i) {
+    while (!LIST_EMPTY(g_bucket + i)) {
+      struct epg_channel* channel = LIST_FIRST(g_bucket + i);
+      LIST_REMOVE(channel, bucket);
+      free_channel(channel);
+    }
+  }
+
+  dtv_search_clear();
+
+  pthread_mutex_unlock(&g_lock);
+}
+
+uint64_t
+dtv_epg_now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
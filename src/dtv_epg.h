@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the interface to the EPG store of the DTV service.
+ *
+ * The EPG store holds copies of programs per channel. Programs enter the
+ * store in two ways.
+ *
+ *  - |dtv_epg_store| stores the result of a program query for a time
+ *    window. The window becomes the channel's *covered* window, which is
+ *    the time span for which the store can answer queries on its own. The
+ *    covered window expires after |EPG_COVERAGE_TIMEOUT| milliseconds.
+ *
+ *  - |dtv_epg_merge| merges a batch of EIT programs into the store. The
+ *    batch replaces all stored programs within the batch's time span. The
+ *    covered window is not extended by merging.
+ *
+ * |dtv_epg_query| returns copies of a channel's programs that overlap the
+ * given time window. It returns 1 if the window is covered, 0 if it is
+ * not, and -1 on errors. Only on a result of 1 the programs are returned,
+ * and the caller has to free them with |release_programs|.
+ *
+ * |dtv_epg_query_merged| returns the stored programs in the window
+ * regardless of coverage. It's for drivers that can't answer program
+ * queries, where merged EIT programs from the EIT harvester and virtual
+ * tuners are all there is. The caller has to free the programs with
+ * |release_programs|.
+ *
+ * |dtv_epg_lookup| copies a single program, identified by its event ID and
+ * start time, into |prog|. It returns 1 if the program has been found, 0
+ * if not, and -1 on errors. The caller has to free the program's fields
+ * with |clear_program|.
+ *
+ * |dtv_epg_is_covered| tests if a window is covered without copying any
+ * programs. |dtv_epg_clear| removes all programs from the store.
+ *
+ * The store keeps the search index from dtv_search.h up to date with the
+ * programs it holds.
+ *
+ * All times are in milliseconds since the epoch; |dtv_epg_now| returns
+ * the current time in this unit. All functions follow the convention of
+ * returning 0 on success and -1 on errors unless noted otherwise. The
+ * store is thread-safe.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct tv_program;
+
+enum {
+  EPG_COVERAGE_TIMEOUT = 10 * 60 * 1000
+};
+
+int
+init_dtv_epg(void);
+
+void
+uninit_dtv_epg(void);
+
+int
+dtv_epg_store(const char* tuner_id,
+              uint8_t source_type,
+              const char* ch_num,
+              uint64_t start_time,
+              uint64_t end_time,
+              uint32_t prog_num,
+              const struct tv_program* progs);
+
+int
+dtv_epg_merge(const char* tuner_id,
+              uint8_t source_type,
+              const char* ch_num,
+              uint32_t prog_num,
+              const struct tv_program* progs);
+
+int
+dtv_epg_query(const char* tuner_id,
+              uint8_t source_type,
+              const char* ch_num,
+              uint64_t start_time,
+              uint64_t end_time,
+              uint32_t* prog_num,
+              struct tv_program** progs);
+
+int
+dtv_epg_query_merged(const char* tuner_id,
+                     uint8_t source_type,
+                     const char* ch_num,
+                     uint64_t start_time,
+                     uint64_t end_time,
+                     uint32_t* prog_num,
+                     struct tv_program** progs);
+
+int
+dtv_epg_lookup(const char* tuner_id,
+               uint8_t source_type,
+               const char* ch_num,
+               const char* evt_id,
+               uint64_t start_time,
+               struct tv_program* prog);
+
+int
+dtv_epg_is_covered(const char* tuner_id,
+                   uint8_t source_type,
+                   const char* ch_num,
+                   uint64_t start_time,
+                   uint64_t end_time);
+
+void
+dtv_epg_clear(void);
+
+uint64_t
+dtv_epg_now(void);
@@ -0,0 +1,658 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements the EIT harvester. See the corresponding header
+ * file for documentation.
+ */
+
+#include "dtv_harvest.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dtv.h"
+#include "dtv_arbiter.h"
+#include "dtv_scan.h"
+#include "dvb_eit.h"
+#include "dvb_si.h"
+#include "log.h"
+#include "tv_utils.h"
+
+enum {
+  HARVEST_NICE = 10, /* nice value of the worker thread */
+  START_DELAY = 60 * 1000, /* ms; leave the tuners to the client first */
+  IDLE_INTERVAL = 10 * 60 * 1000, /* ms; re-check without transponders */
+  RETRY_INTERVAL = 15 * 60 * 1000, /* ms; after failed harvests */
+  MAX_HARVEST_TIME = 2 * 60 * 1000, /* ms per transponder */
+  STALL_TIMEOUT = 30 * 1000, /* ms; schedules repeat at least every 30 s */
+  READ_TIMEOUT = 500, /* ms; bounds the delay of preemptions */
+  MAX_LINEUPS = 16,
+  NS_PER_MS = 1000000,
+  NS_PER_SEC = 1000000000
+};
+
+enum {
+  HARVEST_DONE,
+  HARVEST_FAILED,
+  HARVEST_PREEMPTED
+};
+
+static uint64_t
+monotonic_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / NS_PER_MS;
+}
+
+/*
+ * Worker state
+ *
+ * |g_tuner| is the tuner that the worker thread harvests on, or empty.
+ * The arbiter preempts the tuner by setting |g_preempted| and waiting
+ * until the worker has left the tuner. While |g_acquiring| is set, the
+ * worker might not have stored a freshly acquired tuner yet. The arbiter
+ * sets |g_resumed| when a tuner has been released.
+ *
+ * All state is protected by |g_lock|.
+ */
+
+static uint32_t g_freshness = DEFAULT_HARVEST_FRESHNESS;
+static uint32_t g_budget = DEFAULT_HARVEST_BUDGET;
+
+static const struct dtv_callbacks* g_callbacks;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond;
+static pthread_t g_thread;
+static int g_running;
+static int g_quit;
+
+static char g_tuner[MAX_TUNER_ID_LEN];
+static int g_preempted;
+static int g_acquiring;
+static int g_resumed;
+
+static void
+preempt_harvest(struct dtv_tuner_user* user, const char* tuner_id);
+
+static void
+resume_harvest(struct dtv_tuner_user* user);
+
+static struct dtv_tuner_user g_user = {
+  .use = TUNER_USE_EPG,
+  .preempt = preempt_harvest,
+  .resume = resume_harvest
+};
+
+static int
+is_preempted(void)
+{
+  return __atomic_load_n(&g_preempted, __ATOMIC_RELAXED);
+}
+
+static void
+preempt_harvest(struct dtv_tuner_user* user, const char* tuner_id)
+{
+  pthread_mutex_lock(&g_lock);
+
+  while (g_acquiring) {
+    pthread_cond_wait(&g_cond, &g_lock);
+  }
+  if (!strcmp(g_tuner, tuner_id)) {
+    __atomic_store_n(&g_preempted, 1, __ATOMIC_RELAXED);
+    while (!strcmp(g_tuner, tuner_id)) {
+      pthread_cond_wait(&g_cond, &g_lock);
+    }
+  }
+
+  pthread_mutex_unlock(&g_lock);
+}
+
+static void
+resume_harvest(struct dtv_tuner_user* user)
+{
+  pthread_mutex_lock(&g_lock);
+  g_resumed = 1;
+  pthread_cond_broadcast(&g_cond);
+  pthread_mutex_unlock(&g_lock);
+}
+
+/* Waits for |ms| milliseconds, or until |flag| is set or the thread
+ * quits. Called with the lock held. */
+static void
+wait_for(uint64_t ms, const int* flag)
+{
+  uint64_t deadline;
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  deadline = (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec + ms * NS_PER_MS;
+
+  ts.tv_sec = deadline / NS_PER_SEC;
+  ts.tv_nsec = deadline % NS_PER_SEC;
+
+  while (!g_quit && !(flag && *flag)) {
+    if (pthread_cond_timedwait(&g_cond, &g_lock, &ts) == ETIMEDOUT) {
+      break;
+    }
+  }
+}
+
+/*
+ * Transponders
+ *
+ * |g_tp| holds the transponders from earlier scans with the time at
+ * which each of them is due for harvesting. It's only used by the worker
+ * thread, which refreshes it before each harvest.
+ */
+
+struct transponder {
+  struct dtv_transponder tp;
+  uint64_t due; /* ms */
+};
+
+static struct transponder* g_tp;
+static unsigned long g_num_tp;
+
+static int
+is_same_transponder(const struct dtv_transponder* lhs,
+                    const struct dtv_transponder* rhs)
+{
+  return lhs->source_type == rhs->source_type &&
+         lhs->freq.frequency == rhs->freq.frequency &&
+         lhs->freq.polarization == rhs->freq.polarization &&
+         lhs->freq.port == rhs->freq.port;
+}
+
+static void
+refresh_transponders(void)
+{
+  struct dtv_transponder* tp;
+  struct transponder* list;
+  unsigned long j;
+  long num, i;
+
+  num = dtv_scan_get_transponders(&tp);
+  if (num <= 0) {
+    return; /* keep harvesting what we know */
+  }
+
+  list = calloc(num, sizeof(*list));
+  if (!list) {
+    ALOGE_ERRNO("calloc");
+    free(tp);
+    return;
+  }
+
+  for (i = 0; i < num; ++i) {
+    list[i].tp = tp[i];
+    for (j = 0; j < g_num_tp; ++j) {
+      if (is_same_transponder(&g_tp[j].tp, tp + i)) {
+        list[i].due = g_tp[j].due;
+        break;
+      }
+    }
+  }
+
+  free(g_tp);
+  g_tp = list;
+  g_num_tp = num;
+
+  free(tp);
+}
+
+/* Returns the index of the transponder that is due first, or -1 if
+ * there's none. Stores the time until it's due in |wait|. */
+static long
+find_due(uint64_t now, uint64_t* wait)
+{
+  unsigned long i;
+  long due;
+
+  due = -1;
+
+  for (i = 0; i < g_num_tp; ++i) {
+    if (due < 0 || g_tp[i].due < g_tp[due].due) {
+      due = i;
+    }
+  }
+
+  if (due < 0) {
+    *wait = IDLE_INTERVAL;
+  } else if (g_tp[due].due > now) {
+    *wait = g_tp[due].due - now;
+  } else {
+    *wait = 0;
+  }
+
+  return due;
+}
+
+/*
+ * Harvesting
+ *
+ * Batches are reported for the channels of all tuners with the same
+ * source type. The assembler knows the channels of all lineups and
+ * reports each batch once; |report_batch| then looks up the channel in
+ * each lineup.
+ */
+
+struct lineup {
+  char* tuner_id;
+  uint32_t num;
+  struct tv_channel* ch;
+};
+
+struct harvest {
+  uint8_t source_type;
+  unsigned long num_lineups;
+  struct lineup lineup[MAX_LINEUPS];
+};
+
+static int
+is_same_id(const char* lhs, const char* rhs)
+{
+  return lhs && rhs && strtoul(lhs, NULL, 0) == strtoul(rhs, NULL, 0);
+}
+
+static int
+is_same_service(const struct tv_channel* lhs, const struct tv_channel* rhs)
+{
+  return is_same_id(lhs->service_id, rhs->service_id) &&
+         is_same_id(lhs->trans_stream_id, rhs->trans_stream_id) &&
+         is_same_id(lhs->network_id, rhs->network_id);
+}
+
+static void
+report_batch(void* data, const struct tv_channel* ch, uint32_t prog_num,
+             const struct tv_program* progs)
+{
+  const struct harvest* harvest = data;
+  unsigned long i;
+  uint32_t j;
+
+  for (i = 0; i < harvest->num_lineups; ++i) {
+    const struct lineup* lineup = harvest->lineup + i;
+
+    for (j = 0; j < lineup->num; ++j) {
+      if (is_same_service(ch, lineup->ch + j)) {
+        g_callbacks->event_nfy_cb(lineup->tuner_id, harvest->source_type,
+                                  lineup->ch + j, prog_num, progs);
+        break;
+      }
+    }
+  }
+}
+
+static void
+release_lineups(struct harvest* harvest)
+{
+  unsigned long i;
+
+  for (i = 0; i < harvest->num_lineups; ++i) {
+    free(harvest->lineup[i].tuner_id);
+    release_channels(harvest->lineup[i].num, harvest->lineup[i].ch);
+  }
+  harvest->num_lineups = 0;
+}
+
+/* Loads the channel lists of all tuners and registers the channels with
+ * the assembler. */
+static void
+load_lineups(struct harvest* harvest, struct dvb_eit* eit)
+{
+  struct tv_tuner* tuners;
+  uint32_t num, i, j;
+
+  num = dtv_get_tuner_num();
+  if (!num) {
+    return;
+  }
+
+  tuners = calloc(num, sizeof(*tuners));
+  if (!tuners) {
+    ALOGE_ERRNO("calloc");
+    return;
+  }
+  if (dtv_get_tuners(&num, tuners) != TV_STATUS_SUCCESS) {
+    free(tuners);
+    return;
+  }
+
+  for (i = 0; i < num && harvest->num_lineups < MAX_LINEUPS; ++i) {
+    struct lineup* lineup = harvest->lineup + harvest->num_lineups;
+
+    lineup->num = dtv_get_channel_num(tuners[i].id, harvest->source_type);
+    if (!lineup->num) {
+      continue;
+    }
+    lineup->ch = calloc(lineup->num, sizeof(*lineup->ch));
+    if (!lineup->ch) {
+      ALOGE_ERRNO("calloc");
+      break;
+    }
+    if (dtv_get_channels(tuners[i].id, harvest->source_type, lineup->num,
+                         lineup->ch) != TV_STATUS_SUCCESS) {
+      release_channels(lineup->num, lineup->ch);
+      continue;
+    }
+    lineup->tuner_id = tuners[i].id;
+    tuners[i].id = NULL; /* moved to lineup */
+    ++harvest->num_lineups;
+
+    for (j = 0; j < lineup->num; ++j) {
+      if (lineup->ch[j].network_id && lineup->ch[j].trans_stream_id &&
+          lineup->ch[j].service_id) {
+        dvb_eit_add_channel(eit, lineup->ch + j);
+      }
+    }
+  }
+
+  release_tuners(num, tuners);
+}
+
+/* Returns the ID of the table to read after |table_id|. The schedule
+ * tables go up to |last_table_id|. */
+static uint8_t
+next_table(uint8_t table_id, uint8_t last_table_id)
+{
+  if (table_id == DVB_TABLE_EIT_PF_ACTUAL) {
+    return DVB_TABLE_EIT_SCHEDULE_ACTUAL;
+  } else if (table_id < last_table_id) {
+    return table_id + 1;
+  }
+  return DVB_TABLE_EIT_PF_ACTUAL;
+}
+
+static int
+harvest_transponder(const char* tuner_id, const struct dtv_transponder* tp)
+{
+  uint8_t buf[DVB_MAX_SECTION_LEN];
+  struct harvest harvest;
+  struct dvb_section sec;
+  struct dvb_eit* eit;
+  uint64_t start, now, last_new;
+  uint8_t table_id, last_table_id;
+  uint32_t len;
+  uint8_t ret;
+  int res, fed;
+
+  ret = dtv_tune_frequency(tuner_id, tp->source_type, &tp->freq);
+  if (is_preempted()) {
+    return HARVEST_PREEMPTED;
+  } else if (ret != TV_STATUS_SUCCESS) {
+    ALOGW("Tuner %s couldn't tune to %u kHz for EIT",
+          tuner_id, tp->freq.frequency);
+    return HARVEST_FAILED;
+  }
+
+  memset(&harvest, 0, sizeof(harvest));
+  harvest.source_type = tp->source_type;
+
+  eit = create_dvb_eit(report_batch, &harvest);
+  if (!eit) {
+    return HARVEST_FAILED;
+  }
+
+  load_lineups(&harvest, eit);
+
+  start = last_new = monotonic_ms();
+  table_id = DVB_TABLE_EIT_PF_ACTUAL;
+  last_table_id = DVB_TABLE_EIT_SCHEDULE_ACTUAL;
+  fed = 0;
+
+  for (;;) {
+    if (is_preempted()) {
+      res = HARVEST_PREEMPTED;
+      break;
+    }
+    now = monotonic_ms();
+    if ((fed && dvb_eit_is_complete(eit)) ||
+        now - last_new >= STALL_TIMEOUT) {
+      res = HARVEST_DONE; /* complete, or as complete as it gets */
+      break;
+    } else if (now - start >= MAX_HARVEST_TIME) {
+      ALOGW("EIT at %u kHz incomplete", tp->freq.frequency);
+      res = HARVEST_FAILED;
+      break;
+    }
+
+    len = sizeof(buf);
+    ret = dtv_read_section(tuner_id, tp->source_type, DVB_PID_EIT, table_id,
+                           READ_TIMEOUT, buf, &len);
+    if (ret == TV_STATUS_NOT_SUPPORTED) {
+      res = HARVEST_FAILED;
+      break;
+    } else if (ret == TV_STATUS_SUCCESS) {
+      /* The schedule's last table ID follows the transport stream ID,
+       * original network ID and segment_last_section_number. */
+      if (!dvb_parse_section_header(buf, len, &sec) && sec.syntax &&
+          sec.payload_len > 5 && sec.payload[5] > last_table_id &&
+          sec.payload[5] < DVB_TABLE_EIT_SCHEDULE_OTHER) {
+        last_table_id = sec.payload[5];
+      }
+      if (dvb_eit_feed(eit, buf, len) > 0) {
+        fed = 1;
+        last_new = monotonic_ms();
+      }
+    }
+    table_id = next_table(table_id, last_table_id);
+  }
+
+  destroy_dvb_eit(eit);
+  release_lineups(&harvest);
+
+  return res;
+}
+
+/*
+ * Worker thread
+ */
+
+static void
+lower_priority(void)
+{
+  /* On Linux, the nice value of a thread ID applies to the thread. */
+  if (setpriority(PRIO_PROCESS, gettid(), HARVEST_NICE) < 0) {
+    ALOGW_ERRNO("setpriority");
+  }
+}
+
+static int
+supports_source(const char* tuner_id, void* data)
+{
+  const uint8_t* source_type = data;
+
+  return dtv_supports_frequency_scan(tuner_id,
+                                     *source_type) == TV_STATUS_SUCCESS;
+}
+
+static void*
+harvest_thread(void* arg)
+{
+  char tuner_id[MAX_TUNER_ID_LEN];
+  struct dtv_transponder tp;
+  uint64_t start, elapsed, wait;
+  long idx;
+  uint8_t ret;
+  int res;
+
+  lower_priority();
+
+  pthread_mutex_lock(&g_lock);
+
+  wait_for(START_DELAY, NULL);
+
+  while (!g_quit) {
+    pthread_mutex_unlock(&g_lock);
+    refresh_transponders();
+    idx = find_due(monotonic_ms(), &wait);
+    pthread_mutex_lock(&g_lock);
+
+    if (idx < 0 || wait) {
+      wait_for(wait, NULL);
+      continue;
+    }
+    tp = g_tp[idx].tp;
+
+    g_acquiring = 1;
+    g_resumed = 0;
+    pthread_mutex_unlock(&g_lock);
+
+    ret = dtv_arbiter_acquire_any(&g_user, supports_source, &tp.source_type,
+                                  1, tuner_id);
+
+    pthread_mutex_lock(&g_lock);
+    if (ret == TV_STATUS_SUCCESS) {
+      memcpy(g_tuner, tuner_id, sizeof(g_tuner));
+    }
+    g_acquiring = 0;
+    pthread_cond_broadcast(&g_cond);
+
+    if (ret != TV_STATUS_SUCCESS) {
+      wait_for(IDLE_INTERVAL, &g_resumed); /* until a tuner is released */
+      continue;
+    }
+
+    pthread_mutex_unlock(&g_lock);
+
+    start = monotonic_ms();
+    res = harvest_transponder(tuner_id, &tp);
+    elapsed = monotonic_ms() - start;
+
+    pthread_mutex_lock(&g_lock);
+    g_tuner[0] = '\0';
+    g_preempted = 0;
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+
+    dtv_arbiter_release(tuner_id, &g_user);
+
+    /* |g_tp| hasn't been refreshed meanwhile. */
+    if (res == HARVEST_DONE) {
+      g_tp[idx].due = monotonic_ms() + g_freshness * 60 * 1000ull;
+    } else if (res == HARVEST_FAILED) {
+      g_tp[idx].due = monotonic_ms() + RETRY_INTERVAL;
+    }
+
+    pthread_mutex_lock(&g_lock);
+
+    if (res != HARVEST_PREEMPTED) {
+      /* rest to keep the tuner within the power budget */
+      wait_for(elapsed * (100 - g_budget) / g_budget, NULL);
+    }
+  }
+
+  pthread_mutex_unlock(&g_lock);
+
+  dtv_arbiter_cancel(&g_user);
+
+  return NULL;
+}
+
+/*
+ * Public interface
+ */
+
+void
+dtv_harvest_configure(uint32_t freshness, uint32_t budget)
+{
+  g_freshness = freshness;
+  g_budget = budget < 100 ? budget : 100;
+}
+
+int
+init_dtv_harvest(const struct dtv_callbacks* callbacks)
+{
+  pthread_condattr_t attr;
+  int err;
+
+  assert(callbacks);
+
+  g_callbacks = callbacks;
+
+  if (!g_budget) {
+    return 0; /* harvesting disabled */
+  }
+
+  err = pthread_condattr_init(&attr);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_condattr_init", err);
+    return -1;
+  }
+  err = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_condattr_setclock", err);
+    goto err_pthread_condattr_setclock;
+  }
+  err = pthread_cond_init(&g_cond, &attr);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_cond_init", err);
+    goto err_pthread_cond_init;
+  }
+  pthread_condattr_destroy(&attr);
+
+  g_quit = 0;
+
+  err = pthread_create(&g_thread, NULL, harvest_thread, NULL);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_create", err);
+    goto err_pthread_create;
+  }
+  g_running = 1;
+
+  return 0;
+
+err_pthread_create:
+  pthread_cond_destroy(&g_cond);
+  return -1;
+err_pthread_cond_init:
+err_pthread_condattr_setclock:
+  pthread_condattr_destroy(&attr);
+  return -1;
+}
+
+void
+uninit_dtv_harvest()
+{
+  if (!g_running) {
+    return;
+  }
+
+  pthread_mutex_lock(&g_lock);
+  g_quit = 1;
+  pthread_cond_broadcast(&g_cond);
+  pthread_mutex_unlock(&g_lock);
+
+  pthread_join(g_thread, NULL);
+  g_running = 0;
+
+  pthread_cond_destroy(&g_cond);
+
+  free(g_tp);
+  g_tp = NULL;
+  g_num_tp = 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the interface to the EIT harvester of the DTV
+ * service.
+ *
+ * Drivers only report EIT data of the transport stream that the user
+ * watches. The harvester fills the guide of all other transport streams
+ * in the background. A worker thread cycles tuners that aren't needed
+ * otherwise through the transponders that locked in earlier scans; see
+ * |dtv_scan_get_transponders|. On each transponder, it reads the EIT
+ * present/following and schedule tables with |dtv_read_section| and
+ * assembles them into batches of programs with the EIT assembler from
+ * dvb_eit.h. Each batch is reported with the |event_nfy_cb| callback for
+ * every tuner that has the channel in its channel list, so the batches
+ * enter the EPG store like EIT data from the driver.
+ *
+ * A transponder is done when all of its services have complete batches,
+ * or when no new sections arrived for a full repetition cycle of the
+ * schedule. It's harvested again after the freshness target. Failed or
+ * incomplete harvests are retried earlier.
+ *
+ * The harvester acquires tuners from the arbiter for EPG harvesting, so
+ * it pauses whenever a tuner is needed for live view or recording; see
+ * dtv_arbiter.h. Pauses take effect after at most one section read. An
+ * interrupted transponder is harvested again first when a tuner becomes
+ * available. The power budget limits the share of time that the
+ * harvester keeps a tuner busy. After each transponder, it rests until
+ * the tuner time matches the budget.
+ *
+ * |dtv_harvest_configure| sets the freshness target in minutes and the
+ * power budget in percent. A budget of 0 disables harvesting. Call it
+ * before |init_dtv_harvest|, which starts the worker thread and returns
+ * 0 on success, or -1 on errors. |uninit_dtv_harvest| stops the worker
+ * thread.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct dtv_callbacks;
+
+enum {
+  DEFAULT_HARVEST_FRESHNESS = 6 * 60, /* min */
+  DEFAULT_HARVEST_BUDGET = 25 /* percent */
+};
+
+void
+dtv_harvest_configure(uint32_t freshness, uint32_t budget);
+
+int
+init_dtv_harvest(const struct dtv_callbacks* callbacks);
+
+void
+uninit_dtv_harvest(void);
@@ -16,12 +16,25 @@
 
 #include <assert.h>
 #include <fdio/task.h>
+#include <time.h>
 #include "service.h"
 #include "log.h"
 #include "pdu.h"
 #include "dtv_io.h"
 #include "dtv.h"
+#include "dtv_arbiter.h"
+#include "dtv_cache.h"
+#include "dtv_cursor.h"
+#include "dtv_eit.h"
+#include "dtv_epg.h"
+#include "dtv_harvest.h"
+#include "dtv_prefetch.h"
+#include "dtv_pretune.h"
+#include "dtv_scan.h"
+#include "dtv_search.h"
+#include "trace.h"
 #include "tv_hal.h"
+#include "watchdog.h"
 #include "dtv_pdu.h"
 #include "memptr.h"
 
@@ -36,29 +49,77 @@ enum {
   OPCODE_SET_CHANNEL = 0x06,
   OPCODE_GET_CHANNEL = 0x07,
   OPCODE_GET_PROGRAM = 0x08,
+  OPCODE_GET_CHANNEL_PAGE = 0x09,
+  OPCODE_GET_PROGRAM_PAGE = 0x0a,
+  OPCODE_SEARCH_PROGRAMS = 0x0b,
+  OPCODE_START_SCAN_WITH_MODE = 0x0c,
+  OPCODE_GET_SCAN_STATS = 0x0d,
+  OPCODE_GET_ZAP_STATS = 0x0e,
+  OPCODE_GET_STREAM_CONFIGS = 0x0f,
+  OPCODE_OPEN_STREAM = 0x10,
+  OPCODE_CLOSE_STREAM = 0x11,
   /* notifications */
   OPCODE_CHANNEL_SCANNED = 0x81,
   OPCODE_SCANNED_COMPLETE = 0x82,
   OPCODE_SCAN_STOPPED = 0x83,
-  OPCODE_EIT_BROADCASTED = 0x84
+  OPCODE_EIT_BROADCASTED = 0x84,
+  OPCODE_EIT_CHANGED = 0x85,
+  OPCODE_SOURCE_CHANGED = 0x86,
+  OPCODE_TUNER_REASSIGNED = 0x87
+};
+
+enum {
+  SOURCE_CHANGED_PRETUNED = 0x00
+};
+
+enum {
+  PROGRAM_CACHE_SIZE = 1024 * 1024, /* bytes of encoded programs */
+  DEFAULT_PAGE_LIMIT = 32, /* items per page if client sets no limit */
+  MAX_PAGE_SIZE = 0xffff /* max payload length of a PDU */
 };
 
 static struct dtv_callbacks dtv_callbacks;
 
+/* Latency in microseconds from receiving a channel-change command until
+ * its response has been queued. Only accessed on the I/O thread. */
+enum {
+  ZAP_SET_SOURCE = 0x00,
+  ZAP_SET_CHANNEL = 0x01,
+  NUM_ZAP_COMMANDS
+};
+
+static struct histogram zap_latency[NUM_ZAP_COMMANDS];
+
 static void (*send_pdu)(struct pdu_wbuf* wbuf);
 
 static enum ioresult
 send_ntf_pdu(void* data)
 {
+  struct pdu_wbuf* wbuf = data;
+
+  trace_flow(TRACE_TASK_RUN, (uintptr_t)data);
+
   /* send notification on I/O thread */
   if (!send_pdu) {
     ALOGE("send_pdu is NULL");
     return IO_OK;
   }
-  send_pdu(data);
+  watchdog_enter(WATCHDOG_NOTIFICATION,
+                 (wbuf->buf.pdu.service << 8) | wbuf->buf.pdu.opcode);
+  send_pdu(wbuf);
+  watchdog_leave();
   return IO_OK;
 }
 
+/* Queues a notification for sending on the I/O thread. */
+static int
+queue_ntf_pdu(struct pdu_wbuf* wbuf)
+{
+  trace_flow(TRACE_TASK_QUEUED, (uintptr_t)wbuf);
+
+  return run_task(send_ntf_pdu, wbuf);
+}
+
 /*
  * Notifications
  */
@@ -94,7 +155,7 @@ channel_scanned_cb(const char* tuner_id,
     goto cleanup;
   }
 
-  if (run_task(send_ntf_pdu, wbuf) < 0) {
+  if (queue_ntf_pdu(wbuf) < 0) {
     goto cleanup;
   }
 
@@ -128,7 +189,75 @@ scanned_complete_cb(const char* tuner_id,
     goto cleanup;
   }
 
-  if (run_task(send_ntf_pdu, wbuf) < 0) {
+  if (queue_ntf_pdu(wbuf) < 0) {
+    goto cleanup;
+  }
+
+  return;
+cleanup:
+  destroy_pdu_wbuf(wbuf);
+}
+
+/*
+ * This function is used to notify that a tuner's source has been replaced,
+ * so the client has to set the source again.
+ */
+static void
+source_changed_cb(const char* tuner_id,
+                  const uint8_t source_type,
+                  const uint8_t reason)
+{
+  struct pdu_wbuf* wbuf;
+
+  wbuf = create_pdu_wbuf(strlen(tuner_id) + 1 + /* Tuner id + '\0'. */
+                         sizeof(uint8_t) +      /* Source type. */
+                         sizeof(uint8_t),       /* Reason. */
+                         0, NULL);
+  if (!wbuf) {
+    return;
+  }
+
+  init_pdu(&wbuf->buf.pdu, SERVICE_DTV, OPCODE_SOURCE_CHANGED);
+  if (append_to_pdu(&wbuf->buf.pdu, "0CC", tuner_id, source_type,
+                    reason) < 0) {
+    goto cleanup;
+  }
+
+  if (queue_ntf_pdu(wbuf) < 0) {
+    goto cleanup;
+  }
+
+  return;
+cleanup:
+  destroy_pdu_wbuf(wbuf);
+}
+
+/*
+ * This function is used to notify that the tuner arbiter has reassigned a
+ * tuner to a use of higher priority.
+ */
+static void
+tuner_reassigned_cb(const char* tuner_id,
+                    const uint8_t old_use,
+                    const uint8_t new_use)
+{
+  struct pdu_wbuf* wbuf;
+
+  wbuf = create_pdu_wbuf(strlen(tuner_id) + 1 + /* Tuner id + '\0'. */
+                         sizeof(uint8_t) +      /* Previous use. */
+                         sizeof(uint8_t),       /* New use. */
+                         0, NULL);
+  if (!wbuf) {
+    return;
+  }
+
+  init_pdu(&wbuf->buf.pdu, SERVICE_DTV, OPCODE_TUNER_REASSIGNED);
+  if (append_to_pdu(&wbuf->buf.pdu, "0CC", tuner_id, old_use,
+                    new_use) < 0) {
+    goto cleanup;
+  }
+
+  if (queue_ntf_pdu(wbuf) < 0) {
     goto cleanup;
   }
 
@@ -162,7 +291,7 @@ scanned_stopped_cb (const char* tuner_id,
     goto cleanup;
   }
 
-  if (run_task(send_ntf_pdu, wbuf) < 0) {
+  if (queue_ntf_pdu(wbuf) < 0) {
     goto cleanup;
   }
 
@@ -225,7 +354,86 @@ eit_broadcasted_cb(const char* tuner_id,
     }
   }
 
-  if (run_task(send_ntf_pdu, wbuf) < 0) {
+  if (queue_ntf_pdu(wbuf) < 0) {
+    goto cleanup;
+  }
+
+  return;
+
+cleanup:
+  destroy_pdu_wbuf(wbuf);
+}
+
+/*
+ * This function is used to notify that the events of a channel changed. Only
+ * the added, updated and removed events are sent.
+ */
+static void
+eit_changed_cb(const char* tuner_id,
+               const uint8_t source_type,
+               const struct tv_channel* ch,
+               const struct tv_program* progs,
+               const struct dtv_eit_diff* diff)
+{
+  struct pdu_wbuf* wbuf;
+  uint32_t pdu_size;
+  uint32_t idx;
+
+  pdu_size = strlen(tuner_id) + 1 +    /* Tuner id + '0'. */
+             sizeof(uint8_t) +         /* Source type. */
+             strlen(ch->number) + 1 +  /* Channel number + '0'. */
+             sizeof(uint32_t) * 3;     /* Number of added/updated/removed. */
+
+  for (idx = 0; idx < diff->num_added; idx++) {
+    pdu_size += calculate_prog_size(&progs[diff->added[idx]]);
+  }
+  for (idx = 0; idx < diff->num_updated; idx++) {
+    pdu_size += calculate_prog_size(&progs[diff->updated[idx]]);
+  }
+  for (idx = 0; idx < diff->num_removed; idx++) {
+    pdu_size += strlen(diff->removed[idx]) + 1;
+  }
+
+  wbuf = create_pdu_wbuf(pdu_size, 0, NULL);
+  if (!wbuf) {
+    return;
+  }
+
+  init_pdu(&wbuf->buf.pdu, SERVICE_DTV, OPCODE_EIT_CHANGED);
+
+  if (append_to_pdu(&wbuf->buf.pdu, "0C0", tuner_id, source_type,
+                                           ch->number) < 0) {
+    goto cleanup;
+  }
+
+  if (append_to_pdu(&wbuf->buf.pdu, "I", diff->num_added) < 0) {
+    goto cleanup;
+  }
+  for (idx = 0; idx < diff->num_added; idx++) {
+    if (append_program(&wbuf->buf.pdu, &progs[diff->added[idx]]) < 0) {
+      goto cleanup;
+    }
+  }
+
+  if (append_to_pdu(&wbuf->buf.pdu, "I", diff->num_updated) < 0) {
+    goto cleanup;
+  }
+  for (idx = 0; idx < diff->num_updated; idx++) {
+    if (append_program(&wbuf->buf.pdu, &progs[diff->updated[idx]]) < 0) {
+      goto cleanup;
+    }
+  }
+
+  if (append_to_pdu(&wbuf->buf.pdu, "I", diff->num_removed) < 0) {
+    goto cleanup;
+  }
+  for (idx = 0; idx < diff->num_removed; idx++) {
+    if (append_to_pdu(&wbuf->buf.pdu, "0", diff->removed[idx]) < 0) {
+      goto cleanup;
+    }
+  }
+
+  if (queue_ntf_pdu(wbuf) < 0) {
     goto cleanup;
   }
 
@@ -242,6 +450,9 @@ channel_update_nfy_cb(uint8_t ch_status,
                       const struct tv_channel* ch)
 {
   if (ch_status == DTV_CHANNEL_ADD) {
+    if (tuner_id) {
+      dtv_prefetch_channels_changed(tuner_id, source_type);
+    }
     channel_scanned_cb(tuner_id, source_type, ch);
   } else {
     ALOGW("Unknown status %d", ch_status);
@@ -262,6 +473,61 @@ scan_status_nfy_cb(uint8_t scan_status,
   }
 }
 
+/*
+ * Received EIT data invalidates the cached programs of the channel. The
+ * program cache lives on the I/O thread, so we send the channel's key
+ * over there and drop the cache entries from within the I/O loop.
+ */
+
+struct channel_key {
+  uint8_t source_type;
+  char* ch_num;
+  char tuner_id[0];
+};
+
+static enum ioresult
+invalidate_programs(void* data)
+{
+  struct channel_key* key = data;
+
+  watchdog_enter(WATCHDOG_TASK, 0);
+  dtv_cache_invalidate(key->tuner_id, key->source_type, key->ch_num);
+  watchdog_leave();
+  free(key);
+
+  return IO_OK;
+}
+
+static void
+invalidate_programs_cb(const char* tuner_id,
+                       const uint8_t source_type,
+                       const struct tv_channel* ch)
+{
+  struct channel_key* key;
+  size_t tuner_id_len;
+
+  if (!tuner_id || !ch || !ch->number) {
+    return;
+  }
+
+  tuner_id_len = strlen(tuner_id) + 1;
+
+  key = malloc(sizeof(*key) + tuner_id_len + strlen(ch->number) + 1);
+  if (!key) {
+    ALOGE_ERRNO("malloc");
+    return;
+  }
+
+  key->source_type = source_type;
+  memcpy(key->tuner_id, tuner_id, tuner_id_len);
+  key->ch_num = key->tuner_id + tuner_id_len;
+  strcpy(key->ch_num, ch->number);
+
+  if (run_task(invalidate_programs, key) < 0) {
+    free(key);
+  }
+}
+
 static void
 event_nfy_cb(const char* tuner_id,
              const uint8_t source_type,
@@ -269,13 +535,51 @@ event_nfy_cb(const char* tuner_id,
              const uint32_t prog_num,
              const struct tv_program* progs)
 {
-  eit_broadcasted_cb(tuner_id, source_type, ch, prog_num, progs);
+  struct dtv_eit_diff diff;
+
+  if (!tuner_id || !ch || !ch->number) {
+    return;
+  }
+
+  if (dtv_eit_update(tuner_id, source_type, ch, prog_num, progs, &diff) < 0) {
+    /* no state to diff against; send everything */
+    dtv_epg_merge(tuner_id, source_type, ch->number, prog_num, progs);
+    invalidate_programs_cb(tuner_id, source_type, ch);
+    eit_broadcasted_cb(tuner_id, source_type, ch, prog_num, progs);
+    return;
+  }
+
+  if (!dtv_eit_diff_is_empty(&diff)) {
+    dtv_epg_merge(tuner_id, source_type, ch->number, prog_num, progs);
+  }
+
+  if (dtv_eit_diff_is_empty(&diff)) {
+    /* repeated EIT data; nothing to do */
+  } else if (diff.full) {
+    invalidate_programs_cb(tuner_id, source_type, ch);
+    eit_broadcasted_cb(tuner_id, source_type, ch, prog_num, progs);
+  } else {
+    invalidate_programs_cb(tuner_id, source_type, ch);
+    eit_changed_cb(tuner_id, source_type, ch, progs, &diff);
+  }
+
+  dtv_eit_release_diff(&diff);
 }
 
 /*
  * Commands/Responses
  */
 
+static uint64_t
+monotonic_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 /*
  * This function pass the input sources which type is TV tuner back.
  */
@@ -288,8 +592,13 @@ get_tuners(const struct pdu* cmd)
 
   tuner_num = dtv_get_tuner_num();
   tuners = (struct tv_tuner*)malloc(sizeof(struct tv_tuner) * tuner_num);
+  if (tuner_num && !tuners) {
+    ALOGE_ERRNO("malloc");
+    return ERROR_NOMEM;
+  }
 
-  if (dtv_get_tuners(tuner_num, tuners) != TV_STATUS_SUCCESS) {
+  if (dtv_get_tuners(&tuner_num, tuners) != TV_STATUS_SUCCESS) {
+    free(tuners);
     return ERROR_FAIL;
   }
 
@@ -306,6 +615,7 @@ get_tuners(const struct pdu* cmd)
 
   wbuf = create_pdu_wbuf(pdu_size, 0, NULL);
   if (!wbuf) {
+    release_tuners(tuner_num, tuners);
     return ERROR_NOMEM;
   }
 
@@ -332,33 +642,46 @@ cleanup:
   return ERROR_NOMEM;
 }
 
+/* The client's live view has the highest priority, so acquiring a tuner
+ * for it preempts any other use, such as pre-tuning or scanning. */
+static struct dtv_tuner_user live_user = {
+  .use = TUNER_USE_LIVE
+};
+
+static int
+acquire_live_tuner(const char* tuner_id)
+{
+  switch (dtv_arbiter_acquire(tuner_id, &live_user)) {
+    case TV_STATUS_SUCCESS:
+      return ERROR_NONE;
+    case TV_STATUS_INVARG:
+      return ERROR_PARM_INVALID;
+    default:
+      return ERROR_FAIL;
+  }
+}
+
+/* Releases the client's tuner, unless a stream still uses it. */
+static void
+release_live_tuner(const char* tuner_id)
+{
+  if (!dtv_has_stream(tuner_id)) {
+    dtv_arbiter_release(tuner_id, &live_user);
+  }
+}
+
 /*
- * This function set the signal source and pass the TV stream back.
+ * This function sends the native handle of a sideband stream. Its file
+ * descriptors are passed as ancillary data.
  */
 static int
-set_source(const struct pdu* cmd)
+send_stream_handle(const struct pdu* cmd, const native_handle_t* native_handle)
 {
   struct pdu_wbuf* wbuf;
-  char* tuner_id;
-  uint8_t source_type;
-  tv_stream_t tv_stream;
-  native_handle_t* native_handle;
   struct ancillary_data* tail_data;
-  uint8_t ret;
   int32_t idx;
   int fd_num;
 
-  if (read_pdu_at(cmd, 0, "0C", &tuner_id, &source_type) < 0) {
-    return ERROR_FAIL;
-  }
-
-  ret = dtv_set_source(tuner_id, source_type, &tv_stream);
-  if (ret != TV_STATUS_SUCCESS) {
-    return ret;
-  }
-
-  native_handle = tv_stream.sideband_stream_source_handle;
-
   if (native_handle->numFds == 0) {
     wbuf = create_pdu_wbuf(sizeof(uint32_t) +                    /* version */
                            sizeof(uint32_t) +                    /* numFds */
@@ -366,7 +689,9 @@ set_source(const struct pdu* cmd)
                            sizeof(int) * native_handle->numInts, /* data */
                            0,
                            NULL);
-
+    if (!wbuf) {
+      return ERROR_NOMEM;
+    }
   } else {
     fd_num = native_handle->numFds;
     wbuf = create_pdu_wbuf(sizeof(uint32_t) +                    /* version */
@@ -378,6 +703,9 @@ set_source(const struct pdu* cmd)
                            (sizeof(unsigned char) *              /* Space for */
                             CMSG_SPACE(sizeof(int) * fd_num)),   /* control   */
                            build_ancillary_data);                /* message.  */
+    if (!wbuf) {
+      return ERROR_NOMEM;
+    }
 
     tail_data = ceil_align(pdu_wbuf_tail(wbuf), ALIGNMENT_PADDING);
     tail_data->fd_num = fd_num;
@@ -386,10 +714,6 @@ set_source(const struct pdu* cmd)
     }
   }
 
-  if (!wbuf) {
-    return ERROR_NOMEM;
-  }
-
   init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
 
   if (append_to_pdu(&wbuf->buf.pdu, "III", native_handle->version
@@ -416,110 +740,349 @@ cleanup:
   return ERROR_NOMEM;
 }
 
+/*
+ * This function set the signal source and pass the TV stream back.
+ */
 static int
-start_scan(const struct pdu* cmd)
+open_source(const struct pdu* cmd)
 {
-  struct pdu_wbuf* wbuf;
   char* tuner_id;
   uint8_t source_type;
+  tv_stream_t tv_stream;
   uint8_t ret;
+  int res, had_stream;
 
   if (read_pdu_at(cmd, 0, "0C", &tuner_id, &source_type) < 0) {
     return ERROR_FAIL;
   }
 
-  ret = dtv_start_scanning(tuner_id, source_type);
+  res = acquire_live_tuner(tuner_id);
+  if (res != ERROR_NONE) {
+    return res;
+  }
+
+  had_stream = dtv_has_stream(tuner_id);
+
+  ret = dtv_set_source(tuner_id, source_type, &tv_stream);
   if (ret != TV_STATUS_SUCCESS) {
+    release_live_tuner(tuner_id);
     return ret;
   }
 
-  wbuf = create_pdu_wbuf(0, 0, NULL);
-  if (!wbuf) {
-    return ERROR_NOMEM;
+  res = send_stream_handle(cmd, tv_stream.sideband_stream_source_handle);
+  if (res != ERROR_NONE) {
+    /* the client never got the source's stream */
+    if (!had_stream) {
+      dtv_release_source(tuner_id);
+    }
+    release_live_tuner(tuner_id);
   }
+  return res;
+}
 
-  init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
-  send_pdu(wbuf);
-
-  return ERROR_NONE;
+static int
+set_source(const struct pdu* cmd)
+{
+  uint64_t start = monotonic_us();
+  int res = open_source(cmd);
+  histogram_add(&zap_latency[ZAP_SET_SOURCE], monotonic_us() - start);
+  return res;
 }
 
 static int
-stop_scan(const struct pdu* cmd)
+get_stream_configs(const struct pdu* cmd)
 {
   struct pdu_wbuf* wbuf;
   char* tuner_id;
-  uint8_t source_type;
+  uint32_t num_configs;
+  tv_stream_config_t* configs;
+  uint32_t idx;
   uint8_t ret;
 
-  if (read_pdu_at(cmd, 0, "0C", &tuner_id, &source_type) < 0) {
+  if (read_pdu_at(cmd, 0, "0", &tuner_id) < 0) {
     return ERROR_FAIL;
   }
 
-  ret = dtv_stop_scanning(tuner_id, source_type);
-  if (ret != TV_STATUS_SUCCESS) {
-    return ret;
+  ret = dtv_get_stream_configs(tuner_id, &num_configs, &configs);
+  if (ret == TV_STATUS_INVARG) {
+    return ERROR_PARM_INVALID;
+  } else if (ret != TV_STATUS_SUCCESS) {
+    return ERROR_FAIL;
   }
 
-  wbuf = create_pdu_wbuf(0, 0, NULL);
+  wbuf = create_pdu_wbuf(sizeof(uint32_t) + /* Number of configs. */
+                         num_configs * (sizeof(uint32_t) + sizeof(uint8_t) +
+                                        2 * sizeof(uint32_t)),
+                         0, NULL);
   if (!wbuf) {
-    return ERROR_NOMEM;
+    goto err_create_pdu_wbuf;
   }
 
   init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
+
+  if (append_to_pdu(&wbuf->buf.pdu, "I", num_configs) < 0) {
+    goto err_append_to_pdu;
+  }
+  for (idx = 0; idx < num_configs; idx++) {
+    if (append_to_pdu(&wbuf->buf.pdu, "ICII", (uint32_t)configs[idx].stream_id,
+                      (uint8_t)configs[idx].type,
+                      configs[idx].max_video_width,
+                      configs[idx].max_video_height) < 0) {
+      goto err_append_to_pdu;
+    }
+  }
+
   send_pdu(wbuf);
+  free(configs);
 
   return ERROR_NONE;
+
+err_append_to_pdu:
+  destroy_pdu_wbuf(wbuf);
+err_create_pdu_wbuf:
+  free(configs);
+  return ERROR_NOMEM;
 }
 
 static int
-clean_cache(const struct pdu* cmd)
+open_stream(const struct pdu* cmd)
 {
-  struct pdu_wbuf* wbuf;
+  char* tuner_id;
+  uint32_t stream_id;
+  tv_stream_t tv_stream;
   uint8_t ret;
+  int res;
 
-  ret = dtv_cln_scanned_channel_cache();
-  if (ret != TV_STATUS_SUCCESS) {
-    return ret;
+  if (read_pdu_at(cmd, 0, "0I", &tuner_id, &stream_id) < 0) {
+    return ERROR_FAIL;
   }
 
-  wbuf = create_pdu_wbuf(0, 0, NULL);
-  if (!wbuf) {
-    return ERROR_NOMEM;
+  res = acquire_live_tuner(tuner_id);
+  if (res != ERROR_NONE) {
+    return res;
   }
 
-  init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
-  send_pdu(wbuf);
+  ret = dtv_open_stream(tuner_id, stream_id, &tv_stream);
+  if (ret != TV_STATUS_SUCCESS) {
+    release_live_tuner(tuner_id);
+    return ret == TV_STATUS_INVARG ? ERROR_PARM_INVALID : ERROR_FAIL;
+  }
 
-  return ERROR_NONE;
+  /* buffer producers require a surface of the client */
+  if (tv_stream.type != TV_STREAM_TYPE_INDEPENDENT_VIDEO_SOURCE) {
+    dtv_close_stream(tuner_id, stream_id);
+    release_live_tuner(tuner_id);
+    return ERROR_UNSUPPORTED;
+  }
+
+  res = send_stream_handle(cmd, tv_stream.sideband_stream_source_handle);
+  if (res != ERROR_NONE) {
+    dtv_close_stream(tuner_id, stream_id);
+    release_live_tuner(tuner_id);
+  }
+  return res;
 }
 
 static int
-set_channel(const struct pdu* cmd)
+close_stream(const struct pdu* cmd)
 {
   struct pdu_wbuf* wbuf;
   char* tuner_id;
-  uint8_t source_type;
-  char* ch_num;
+  uint32_t stream_id;
+  uint8_t ret;
+
+  if (read_pdu_at(cmd, 0, "0I", &tuner_id, &stream_id) < 0) {
+    return ERROR_FAIL;
+  }
+
+  ret = dtv_close_stream(tuner_id, stream_id);
+  if (ret == TV_STATUS_INVARG &&
+      dtv_arbiter_get_use(tuner_id) == TUNER_USE_LIVE) {
+    /* Without 'Open stream', the client closes the stream that it got
+     * from 'Set source'. */
+    ret = dtv_close_source(tuner_id, stream_id);
+  }
+  if (ret == TV_STATUS_INVARG) {
+    return ERROR_PARM_INVALID;
+  } else if (ret != TV_STATUS_SUCCESS) {
+    return ERROR_FAIL;
+  }
+
+  release_live_tuner(tuner_id);
+
+  wbuf = create_pdu_wbuf(0, 0, NULL);
+  if (!wbuf) {
+    return ERROR_NOMEM;
+  }
+
+  init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
+  send_pdu(wbuf);
+
+  return ERROR_NONE;
+}
+
+static int
+send_scan_started(const struct pdu* cmd, const char* tuner_id,
+                  uint8_t source_type, uint8_t mode)
+{
+  struct pdu_wbuf* wbuf;
+  uint8_t ret;
+
+  /* the client hands over its tuner to the scan */
+  ret = dtv_scan_start(tuner_id, source_type, mode, &live_user);
+  if (ret == TV_STATUS_BUSY) {
+    return ERROR_BUSY;
+  } else if (ret != TV_STATUS_SUCCESS) {
+    return ret;
+  }
+
+  /* if the scan didn't take the tuner over, the driver scans on it */
+  dtv_arbiter_release(tuner_id, &live_user);
+
+  wbuf = create_pdu_wbuf(0, 0, NULL);
+  if (!wbuf) {
+    return ERROR_NOMEM;
+  }
+
+  init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
+  send_pdu(wbuf);
+
+  return ERROR_NONE;
+}
+
+static int
+start_scan(const struct pdu* cmd)
+{
+  char* tuner_id;
+  uint8_t source_type;
+
+  if (read_pdu_at(cmd, 0, "0C", &tuner_id, &source_type) < 0) {
+    return ERROR_FAIL;
+  }
+
+  return send_scan_started(cmd, tuner_id, source_type, SCAN_MODE_FULL);
+}
+
+static int
+start_scan_with_mode(const struct pdu* cmd)
+{
+  char* tuner_id;
+  uint8_t source_type;
+  uint8_t mode;
+
+  if (read_pdu_at(cmd, 0, "0CC", &tuner_id, &source_type, &mode) < 0) {
+    return ERROR_FAIL;
+  }
+
+  if (mode != SCAN_MODE_FULL && mode != SCAN_MODE_QUICK &&
+      mode != SCAN_MODE_NETWORK) {
+    return ERROR_PARM_INVALID;
+  }
+
+  return send_scan_started(cmd, tuner_id, source_type, mode);
+}
+
+static int
+stop_scan(const struct pdu* cmd)
+{
+  struct pdu_wbuf* wbuf;
+  char* tuner_id;
+  uint8_t source_type;
+  uint8_t ret;
+
+  if (read_pdu_at(cmd, 0, "0C", &tuner_id, &source_type) < 0) {
+    return ERROR_FAIL;
+  }
+
+  ret = dtv_scan_stop(tuner_id, source_type);
+  if (ret != TV_STATUS_SUCCESS) {
+    return ret;
+  }
+
+  wbuf = create_pdu_wbuf(0, 0, NULL);
+  if (!wbuf) {
+    return ERROR_NOMEM;
+  }
+
+  init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
+  send_pdu(wbuf);
+
+  return ERROR_NONE;
+}
+
+static int
+clean_cache(const struct pdu* cmd)
+{
+  struct pdu_wbuf* wbuf;
+  uint8_t ret;
+
+  ret = dtv_cln_scanned_channel_cache();
+  if (ret != TV_STATUS_SUCCESS) {
+    return ret;
+  }
+
+  dtv_cache_flush();
+  dtv_eit_clear();
+  dtv_epg_clear();
+  dtv_prefetch_clear();
+
+  wbuf = create_pdu_wbuf(0, 0, NULL);
+  if (!wbuf) {
+    return ERROR_NOMEM;
+  }
+
+  init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
+  send_pdu(wbuf);
+
+  return ERROR_NONE;
+}
+
+static int
+change_channel(const struct pdu* cmd)
+{
+  struct pdu_wbuf* wbuf;
+  char* tuner_id;
+  uint8_t source_type;
+  char* ch_num;
   struct tv_channel* ch;
   uint32_t ch_size;
   uint8_t ret;
+  int res, switched;
 
   if (read_pdu_at(cmd, 0, "0C0", &tuner_id, &source_type, &ch_num) < 0) {
     return ERROR_FAIL;
   }
 
-  ch = (struct tv_channel*)malloc(sizeof(struct tv_channel));
+  res = acquire_live_tuner(tuner_id);
+  if (res != ERROR_NONE) {
+    return res;
+  }
 
-  ret = dtv_set_channel(tuner_id, source_type, ch_num, ch);
-  if (ret != TV_STATUS_SUCCESS) {
-    release_channels(1, ch);
-    return ret;
+  ch = calloc(1, sizeof(*ch));
+  if (!ch) {
+    ALOGE_ERRNO("calloc");
+    release_live_tuner(tuner_id);
+    return ERROR_NOMEM;
   }
 
+  switched = dtv_pretune_take(tuner_id, source_type, ch_num, ch);
+  if (!switched) {
+    ret = dtv_set_channel(tuner_id, source_type, ch_num, ch);
+    if (ret != TV_STATUS_SUCCESS) {
+      release_channels(1, ch);
+      release_live_tuner(tuner_id);
+      return ret;
+    }
+  }
+
+  /* warm up the EPG of the channels the user will likely switch to next */
+  dtv_prefetch_channel_set(tuner_id, source_type, ch_num);
+
   ch_size = calculate_ch_size(ch);
   wbuf = create_pdu_wbuf(ch_size, 0, NULL);
   if (!wbuf) {
+    release_channels(1, ch);
+    release_live_tuner(tuner_id);
     return ERROR_NOMEM;
   }
 
@@ -532,14 +1095,28 @@ set_channel(const struct pdu* cmd)
   send_pdu(wbuf);
   release_channels(1, ch);
 
+  if (switched) {
+    source_changed_cb(tuner_id, source_type, SOURCE_CHANGED_PRETUNED);
+  }
+
   return ERROR_NONE;
 
 cleanup:
   release_channels(1, ch);
   destroy_pdu_wbuf(wbuf);
+  release_live_tuner(tuner_id);
   return ERROR_NOMEM;
 }
 
+static int
+set_channel(const struct pdu* cmd)
+{
+  uint64_t start = monotonic_us();
+  int res = change_channel(cmd);
+  histogram_add(&zap_latency[ZAP_SET_CHANNEL], monotonic_us() - start);
+  return res;
+}
+
 static int
 get_channels(const struct pdu* cmd)
 {
@@ -598,6 +1175,87 @@ cleanup:
   return ERROR_NOMEM;
 }
 
+/*
+ * The EPG store covers the window if it has been prefetched or queried
+ * before. Otherwise we ask the driver and store the result. If the driver
+ * doesn't support program queries, we return the EIT programs that have
+ * been merged into the store, such as the harvested ones.
+ */
+static uint8_t
+load_programs(const char* tuner_id,
+              uint8_t source_type,
+              const char* ch_num,
+              uint64_t start_time,
+              uint64_t end_time,
+              uint32_t* prog_num,
+              struct tv_program** prog_list)
+{
+  uint8_t ret;
+
+  if (dtv_epg_query(tuner_id, source_type, ch_num, start_time, end_time,
+                    prog_num, prog_list) > 0) {
+    return TV_STATUS_SUCCESS;
+  }
+
+  *prog_num = dtv_get_prog_num(tuner_id, source_type, ch_num,
+                               start_time, end_time);
+  *prog_list = (struct tv_program*)calloc(*prog_num ? *prog_num : 1,
+                                          sizeof(struct tv_program));
+  if (!*prog_list) {
+    ALOGE_ERRNO("calloc");
+    return TV_STATUS_FAIL;
+  }
+
+  ret = dtv_get_programs(tuner_id, source_type, ch_num,
+                         start_time, end_time, *prog_num, *prog_list);
+  if (ret == TV_STATUS_NOT_SUPPORTED) {
+    free(*prog_list);
+    if (dtv_epg_query_merged(tuner_id, source_type, ch_num, start_time,
+                             end_time, prog_num, prog_list) < 0) {
+      return TV_STATUS_FAIL;
+    }
+    return TV_STATUS_SUCCESS;
+  } else if (ret != TV_STATUS_SUCCESS) {
+    free(*prog_list);
+    return ret;
+  }
+
+  dtv_epg_store(tuner_id, source_type, ch_num, start_time, end_time,
+                *prog_num, *prog_list);
+
+  return TV_STATUS_SUCCESS;
+}
+
+/*
+ * Responses to 'Get programs' are served from the program cache if
+ * possible. On a cache miss, we fetch the programs from the driver, encode
+ * them and store a copy of the encoded payload for later queries.
+ */
+static int
+send_cached_programs(const struct pdu* cmd, const void* data, uint16_t len)
+{
+  struct pdu_wbuf* wbuf;
+
+  wbuf = create_pdu_wbuf(len, 0, NULL);
+  if (!wbuf) {
+    return ERROR_NOMEM;
+  }
+
+  init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
+
+  if (append_to_pdu(&wbuf->buf.pdu, "m", data, (size_t)len) < 0) {
+    goto cleanup;
+  }
+
+  send_pdu(wbuf);
+
+  return ERROR_NONE;
+
+cleanup:
+  destroy_pdu_wbuf(wbuf);
+  return ERROR_NOMEM;
+}
+
 static int
 get_programs(const struct pdu* cmd)
 {
@@ -612,6 +1270,8 @@ get_programs(const struct pdu* cmd)
   uint32_t prog_num;
   uint32_t pdu_size;
   uint32_t prog_idx;
+  const void* cached;
+  uint16_t cached_len;
   uint8_t ret;
 
   if (read_pdu_at(cmd, 0, "0C0LL", &tuner_id, &source_type, &ch_num,
@@ -619,12 +1279,14 @@ get_programs(const struct pdu* cmd)
     return ERROR_FAIL;
   }
 
-  prog_num = dtv_get_prog_num(tuner_id, source_type, ch_num,
-                              start_time, end_time);
-  prog_list = (struct tv_program*)malloc(sizeof(struct tv_program) * prog_num);
+  cached = dtv_cache_lookup(tuner_id, source_type, ch_num,
+                            start_time, end_time, &cached_len);
+  if (cached) {
+    return send_cached_programs(cmd, cached, cached_len);
+  }
 
-  ret = dtv_get_programs(tuner_id, source_type, ch_num, start_time, end_time,
-                         prog_num, prog_list);
+  ret = load_programs(tuner_id, source_type, ch_num, start_time, end_time,
+                      &prog_num, &prog_list);
   if (ret != TV_STATUS_SUCCESS) {
     return ret;
   }
@@ -637,6 +1299,7 @@ get_programs(const struct pdu* cmd)
 
   wbuf = create_pdu_wbuf(pdu_size, 0, NULL);
   if (!wbuf) {
+    release_programs(prog_num, prog_list);
     return ERROR_NOMEM;
   }
 
@@ -652,6 +1315,10 @@ get_programs(const struct pdu* cmd)
     }
   }
 
+  /* A failed insert only costs us the next lookup; ignore errors. */
+  dtv_cache_insert(tuner_id, source_type, ch_num, start_time, end_time,
+                   wbuf->buf.pdu.data, wbuf->buf.pdu.len);
+
   send_pdu(wbuf);
   release_programs(prog_num, prog_list);
 
@@ -663,6 +1330,428 @@ cleanup:
   return ERROR_NOMEM;
 }
 
+/*
+ * Paginated queries
+ *
+ * 'Get channels page' and 'Get programs page' return a range of a query's
+ * result. For the first page, the client sends a token of 0. We run the
+ * query, store the result in a cursor and reply with the cursor's token.
+ * For further pages, the client sends the token and we serve the range
+ * from the cursor's snapshot without asking the driver again. A page ends
+ * at the requested limit, or before the PDU would overflow. The token in
+ * the response is 0 after the last page, at which point we close the
+ * cursor.
+ */
+
+static uint32_t
+calculate_item_size(int type, const void* items, uint32_t idx)
+{
+  if (type == CURSOR_CHANNELS) {
+    return calculate_ch_size((const struct tv_channel*)items + idx);
+  }
+  return calculate_prog_size((const struct tv_program*)items + idx);
+}
+
+static long
+append_item(struct pdu* pdu, int type, const void* items, uint32_t idx)
+{
+  if (type == CURSOR_CHANNELS) {
+    return append_channel(pdu, (const struct tv_channel*)items + idx);
+  }
+  return append_program(pdu, (const struct tv_program*)items + idx);
+}
+
+/* Sends a page of the cursor |token|. A cursor that has been opened for
+ * this command (|is_new|) is closed if the first page fails, as the
+ * client never learns its token. */
+static int
+send_page(const struct pdu* cmd, int type, uint64_t token, int is_new,
+          uint32_t offset, uint32_t limit)
+{
+  struct pdu_wbuf* wbuf;
+  const void* items;
+  uint32_t num;
+  uint32_t count;
+  uint32_t pdu_size;
+  uint32_t idx;
+  uint64_t next_token;
+  int res;
+
+  items = dtv_cursor_items(token, type, &num);
+  if (!items) {
+    return ERROR_PARM_INVALID;
+  }
+
+  if (!limit) {
+    limit = DEFAULT_PAGE_LIMIT;
+  }
+  if (offset > num) {
+    offset = num;
+  }
+
+  pdu_size = sizeof(uint64_t) + /* Token. */
+             sizeof(uint32_t) + /* Total number of items. */
+             sizeof(uint32_t);  /* Number of items in page. */
+
+  for (count = 0; count < limit && offset + count < num; count++) {
+    uint32_t item_size = calculate_item_size(type, items, offset + count);
+    if (pdu_size + item_size > MAX_PAGE_SIZE) {
+      break;
+    }
+    pdu_size += item_size;
+  }
+
+  if (!count && offset < num) {
+    ALOGE("item %u exceeds PDU size", offset);
+    res = ERROR_FAIL;
+    goto err_count;
+  }
+
+  next_token = (offset + count < num) ? token : 0;
+
+  wbuf = create_pdu_wbuf(pdu_size, 0, NULL);
+  if (!wbuf) {
+    res = ERROR_NOMEM;
+    goto err_create_pdu_wbuf;
+  }
+
+  init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
+
+  if (append_to_pdu(&wbuf->buf.pdu, "LII", next_token, num, count) < 0) {
+    goto cleanup;
+  }
+
+  for (idx = offset; idx < offset + count; idx++) {
+    if (append_item(&wbuf->buf.pdu, type, items, idx) < 0) {
+      goto cleanup;
+    }
+  }
+
+  send_pdu(wbuf);
+
+  if (!next_token) {
+    dtv_cursor_close(token);
+  }
+
+  return ERROR_NONE;
+
+cleanup:
+  destroy_pdu_wbuf(wbuf);
+  res = ERROR_NOMEM;
+err_create_pdu_wbuf:
+err_count:
+  if (is_new) {
+    dtv_cursor_close(token);
+  }
+  return res;
+}
+
+static int
+get_channels_page(const struct pdu* cmd)
+{
+  char* tuner_id;
+  uint8_t source_type;
+  uint64_t token;
+  uint32_t offset;
+  uint32_t limit;
+  uint32_t ch_num;
+  struct tv_channel* ch_list;
+  uint8_t ret;
+  int is_new;
+
+  if (read_pdu_at(cmd, 0, "0CLII", &tuner_id, &source_type,
+                                   &token, &offset, &limit) < 0) {
+    return ERROR_FAIL;
+  }
+
+  is_new = !token;
+
+  if (is_new) {
+    ch_num = dtv_get_channel_num(tuner_id, source_type);
+    ch_list = (struct tv_channel*)calloc(ch_num ? ch_num : 1,
+                                         sizeof(struct tv_channel));
+    if (!ch_list) {
+      ALOGE_ERRNO("calloc");
+      return ERROR_NOMEM;
+    }
+
+    ret = dtv_get_channels(tuner_id, source_type, ch_num, ch_list);
+    if (ret != TV_STATUS_SUCCESS) {
+      free(ch_list);
+      return ret;
+    }
+
+    token = dtv_cursor_open(CURSOR_CHANNELS, ch_num, ch_list);
+  }
+
+  return send_page(cmd, CURSOR_CHANNELS, token, is_new, offset, limit);
+}
+
+static int
+get_programs_page(const struct pdu* cmd)
+{
+  char* tuner_id;
+  uint8_t source_type;
+  char* ch_num;
+  uint64_t start_time;
+  uint64_t end_time;
+  uint64_t token;
+  uint32_t offset;
+  uint32_t limit;
+  uint32_t prog_num;
+  struct tv_program* prog_list;
+  uint8_t ret;
+  int is_new;
+
+  if (read_pdu_at(cmd, 0, "0C0LLLII", &tuner_id, &source_type, &ch_num,
+                                      &start_time, &end_time,
+                                      &token, &offset, &limit) < 0) {
+    return ERROR_FAIL;
+  }
+
+  is_new = !token;
+
+  if (is_new) {
+    ret = load_programs(tuner_id, source_type, ch_num, start_time, end_time,
+                        &prog_num, &prog_list);
+    if (ret != TV_STATUS_SUCCESS) {
+      return ret;
+    }
+
+    token = dtv_cursor_open(CURSOR_PROGRAMS, prog_num, prog_list);
+  }
+
+  return send_page(cmd, CURSOR_PROGRAMS, token, is_new, offset, limit);
+}
+
+/*
+ * 'Search programs' runs on the search index of the EPG store and never
+ * queries the driver. The index only returns keys of matching programs;
+ * we look up the programs themselves in the EPG store. Programs that have
+ * been removed from the store in the meantime are skipped.
+ */
+static int
+search_programs(const struct pdu* cmd)
+{
+  struct pdu_wbuf* wbuf;
+  char* tuner_id;
+  uint8_t source_type;
+  char* ch_num;
+  uint64_t start_time;
+  uint64_t end_time;
+  uint8_t mode;
+  char* query;
+  uint32_t limit;
+  struct dtv_search_result* results;
+  struct tv_program* prog_list;
+  uint32_t res_num;
+  uint32_t prog_num;
+  uint32_t pdu_size;
+  uint32_t idx;
+  long num;
+  int res;
+
+  if (read_pdu_at(cmd, 0, "0C0LLC0I", &tuner_id, &source_type, &ch_num,
+                                      &start_time, &end_time, &mode,
+                                      &query, &limit) < 0) {
+    return ERROR_FAIL;
+  }
+
+  if ((mode != SEARCH_SUBSTRING && mode != SEARCH_PREFIX) || !query[0]) {
+    return ERROR_PARM_INVALID;
+  }
+  if (!limit) {
+    limit = DEFAULT_PAGE_LIMIT;
+  }
+
+  num = dtv_search_find(tuner_id, source_type, ch_num, start_time, end_time,
+                        mode, query, limit, &results);
+  if (num < 0) {
+    return ERROR_FAIL;
+  }
+  res_num = num;
+
+  prog_list = calloc(res_num ? res_num : 1, sizeof(*prog_list));
+  if (!prog_list) {
+    ALOGE_ERRNO("calloc");
+    goto err_calloc;
+  }
+
+  pdu_size = sizeof(uint32_t); /* Number of results. */
+  prog_num = 0;
+
+  for (idx = 0; idx < res_num; idx++) {
+    uint32_t res_size;
+    res = dtv_epg_lookup(tuner_id, source_type, results[idx].ch_num,
+                         results[idx].evt_id, results[idx].start_time,
+                         prog_list + prog_num);
+    if (res < 0) {
+      goto err_dtv_epg_lookup;
+    } else if (!res) {
+      continue;
+    }
+    res_size = strlen(results[idx].ch_num) + 1 +
+               calculate_prog_size(prog_list + prog_num);
+    if (pdu_size + res_size > MAX_PAGE_SIZE) {
+      clear_program(prog_list + prog_num);
+      break;
+    }
+    pdu_size += res_size;
+    if (prog_num != idx) {
+      /* keep result and program at the same index */
+      struct dtv_search_result tmp = results[prog_num];
+      results[prog_num] = results[idx];
+      results[idx] = tmp;
+    }
+    prog_num++;
+  }
+
+  wbuf = create_pdu_wbuf(pdu_size, 0, NULL);
+  if (!wbuf) {
+    goto err_create_pdu_wbuf;
+  }
+
+  init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
+
+  if (append_to_pdu(&wbuf->buf.pdu, "I", prog_num) < 0) {
+    goto err_append_to_pdu;
+  }
+
+  for (idx = 0; idx < prog_num; idx++) {
+    if (append_to_pdu(&wbuf->buf.pdu, "0", results[idx].ch_num) < 0) {
+      goto err_append_to_pdu;
+    }
+    if (append_program(&wbuf->buf.pdu, prog_list + idx) < 0) {
+      goto err_append_to_pdu;
+    }
+  }
+
+  send_pdu(wbuf);
+  release_programs(prog_num, prog_list);
+  dtv_search_release_results(res_num, results);
+
+  return ERROR_NONE;
+
+err_append_to_pdu:
+  destroy_pdu_wbuf(wbuf);
+err_create_pdu_wbuf:
+err_dtv_epg_lookup:
+  release_programs(prog_num, prog_list);
+err_calloc:
+  dtv_search_release_results(res_num, results);
+  return ERROR_NOMEM;
+}
+
+static int
+get_scan_stats(const struct pdu* cmd)
+{
+  struct pdu_wbuf* wbuf;
+  uint8_t source_type;
+  uint8_t reset;
+  struct dtv_scan_stats stats[NUM_SCAN_STAGES];
+  uint32_t pdu_size;
+  uint32_t idx;
+
+  if (read_pdu_at(cmd, 0, "CC", &source_type, &reset) < 0) {
+    return ERROR_FAIL;
+  }
+
+  if (dtv_scan_get_stats(source_type, reset, stats) < 0) {
+    return ERROR_PARM_INVALID;
+  }
+
+  pdu_size = sizeof(uint32_t); /* Number of stages. */
+  for (idx = 0; idx < NUM_SCAN_STAGES; idx++) {
+    pdu_size += sizeof(uint8_t) + sizeof(uint32_t) +
+                calculate_histogram_size(&stats[idx].passed) +
+                calculate_histogram_size(&stats[idx].rejected);
+  }
+
+  wbuf = create_pdu_wbuf(pdu_size, 0, NULL);
+  if (!wbuf) {
+    return ERROR_NOMEM;
+  }
+
+  init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
+
+  if (append_to_pdu(&wbuf->buf.pdu, "I", (uint32_t)NUM_SCAN_STAGES) < 0) {
+    goto err_append_to_pdu;
+  }
+
+  for (idx = 0; idx < NUM_SCAN_STAGES; idx++) {
+    if (append_to_pdu(&wbuf->buf.pdu, "CI", (uint8_t)idx,
+                                            stats[idx].timeout) < 0) {
+      goto err_append_to_pdu;
+    }
+    if (append_histogram(&wbuf->buf.pdu, &stats[idx].passed) < 0) {
+      goto err_append_to_pdu;
+    }
+    if (append_histogram(&wbuf->buf.pdu, &stats[idx].rejected) < 0) {
+      goto err_append_to_pdu;
+    }
+  }
+
+  send_pdu(wbuf);
+
+  return ERROR_NONE;
+
+err_append_to_pdu:
+  destroy_pdu_wbuf(wbuf);
+  return ERROR_NOMEM;
+}
+
+static int
+get_zap_stats(const struct pdu* cmd)
+{
+  struct pdu_wbuf* wbuf;
+  uint8_t reset;
+  uint32_t pdu_size;
+  uint32_t idx;
+
+  if (read_pdu_at(cmd, 0, "C", &reset) < 0) {
+    return ERROR_FAIL;
+  }
+
+  pdu_size = sizeof(uint32_t); /* Number of commands. */
+  for (idx = 0; idx < NUM_ZAP_COMMANDS; idx++) {
+    pdu_size += sizeof(uint8_t) + calculate_histogram_size(&zap_latency[idx]);
+  }
+
+  wbuf = create_pdu_wbuf(pdu_size, 0, NULL);
+  if (!wbuf) {
+    return ERROR_NOMEM;
+  }
+
+  init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
+
+  if (append_to_pdu(&wbuf->buf.pdu, "I", (uint32_t)NUM_ZAP_COMMANDS) < 0) {
+    goto err_append_to_pdu;
+  }
+
+  for (idx = 0; idx < NUM_ZAP_COMMANDS; idx++) {
+    if (append_to_pdu(&wbuf->buf.pdu, "C", (uint8_t)idx) < 0) {
+      goto err_append_to_pdu;
+    }
+    if (append_histogram(&wbuf->buf.pdu, &zap_latency[idx]) < 0) {
+      goto err_append_to_pdu;
+    }
+  }
+
+  send_pdu(wbuf);
+
+  if (reset) {
+    for (idx = 0; idx < NUM_ZAP_COMMANDS; idx++) {
+      histogram_clear(&zap_latency[idx]);
+    }
+  }
+
+  return ERROR_NONE;
+
+err_append_to_pdu:
+  destroy_pdu_wbuf(wbuf);
+  return ERROR_NOMEM;
+}
+
 static int
 dtv_handler(const struct pdu* cmd)
 {
@@ -675,6 +1764,15 @@ dtv_handler(const struct pdu* cmd)
     [OPCODE_SET_CHANNEL] = set_channel,
     [OPCODE_GET_CHANNEL] = get_channels,
     [OPCODE_GET_PROGRAM] = get_programs,
+    [OPCODE_GET_CHANNEL_PAGE] = get_channels_page,
+    [OPCODE_GET_PROGRAM_PAGE] = get_programs_page,
+    [OPCODE_SEARCH_PROGRAMS] = search_programs,
+    [OPCODE_START_SCAN_WITH_MODE] = start_scan_with_mode,
+    [OPCODE_GET_SCAN_STATS] = get_scan_stats,
+    [OPCODE_GET_ZAP_STATS] = get_zap_stats,
+    [OPCODE_GET_STREAM_CONFIGS] = get_stream_configs,
+    [OPCODE_OPEN_STREAM] = open_stream,
+    [OPCODE_CLOSE_STREAM] = close_stream,
   };
 
   return handle_pdu_by_opcode(cmd, handler);
@@ -687,11 +1785,43 @@ int
 
   ALOGD("Start init dtv.");
 
+  if (init_dtv_cache(PROGRAM_CACHE_SIZE) < 0) {
+    return NULL;
+  }
+
+  if (init_dtv_eit() < 0) {
+    goto err_init_dtv_eit;
+  }
+
+  if (init_dtv_epg() < 0) {
+    goto err_init_dtv_epg;
+  }
+
+  if (init_dtv_prefetch() < 0) {
+    goto err_init_dtv_prefetch;
+  }
+
+  if (init_dtv_cursor() < 0) {
+    goto err_init_dtv_cursor;
+  }
+
+  if (init_dtv_arbiter(tuner_reassigned_cb) < 0) {
+    goto err_init_dtv_arbiter;
+  }
+
+  if (init_dtv_pretune() < 0) {
+    goto err_init_dtv_pretune;
+  }
+
+  if (init_dtv_scan(&dtv_callbacks) < 0) {
+    goto err_init_dtv_scan;
+  }
+
   /* Init Android TV HAL. */
   ret = tv_input_hal_init();
   if (ret != TV_STATUS_SUCCESS) {
     tv_input_hal_uninit();
-    return NULL;
+    goto err_tv_input_hal_init;
   }
 
   dtv_callbacks.channel_update_nfy_cb = &channel_update_nfy_cb;
@@ -701,12 +1831,39 @@ int
   ret = dtv_init(&dtv_callbacks);
   if (ret != TV_STATUS_SUCCESS) {
     dtv_uninit();
-    return NULL;
+    goto err_dtv_init;
+  }
+
+  /* The harvester uses the driver's tuners, so it starts last. */
+  if (init_dtv_harvest(&dtv_callbacks) < 0) {
+    goto err_init_dtv_harvest;
   }
 
   send_pdu = send_pdu_cb;
 
   return dtv_handler;
+
+err_init_dtv_harvest:
+  dtv_uninit();
+err_dtv_init:
+  tv_input_hal_uninit();
+err_tv_input_hal_init:
+  uninit_dtv_scan();
+err_init_dtv_scan:
+  uninit_dtv_pretune();
+err_init_dtv_pretune:
+  uninit_dtv_arbiter();
+err_init_dtv_arbiter:
+  uninit_dtv_cursor();
+err_init_dtv_cursor:
+  uninit_dtv_prefetch();
+err_init_dtv_prefetch:
+  uninit_dtv_epg();
+err_init_dtv_epg:
+  uninit_dtv_eit();
+err_init_dtv_eit:
+  uninit_dtv_cache();
+  return NULL;
 }
 
 int
@@ -714,6 +1871,13 @@ unregister_dtv(void)
 {
   int32_t ret;
 
+  /* Stop harvesting, scanning and pre-tuning threads before the driver
+   * goes away. */
+  uninit_dtv_harvest();
+  uninit_dtv_scan();
+  uninit_dtv_pretune();
+  uninit_dtv_arbiter();
+
   /* Init Android TV HAL. */
   ret = tv_input_hal_uninit();
   if (ret != TV_STATUS_SUCCESS) {
@@ -726,6 +1890,12 @@ unregister_dtv(void)
     return ERROR_FAIL;
   }
 
+  uninit_dtv_cursor();
+  uninit_dtv_prefetch();
+  uninit_dtv_epg();
+  uninit_dtv_eit();
+  uninit_dtv_cache();
+
   send_pdu = NULL;
 
   return ERROR_NONE;
@@ -16,6 +16,10 @@
 
 #include <pdu/pdubuf.h>
 #include "dtv_pdu.h"
+#include <stdlib.h>
+#include <string.h>
+#include "dvb_text.h"
+#include "log.h"
 #include "memptr.h"
 #include "assert.h"
 
@@ -103,13 +107,31 @@ calculate_prog_size(const struct tv_program* prog)
     size += strlen(prog->langs[idx]) + 1;
   }
   size += sizeof(uint32_t); /* stl_lang_num */
-  for (idx = 0; idx < prog->lang_num; idx++) {
+  for (idx = 0; idx < prog->stl_lang_num; idx++) {
     size += strlen(prog->stl_langs[idx]) + 1;
   }
 
   return size;
 }
 
+uint32_t
+calculate_histogram_size(const struct histogram* hist)
+{
+  uint32_t size = 0;
+
+  if (!hist) {
+    return 0;
+  }
+
+  size += sizeof(uint64_t); /* count */
+  size += sizeof(uint64_t); /* sum */
+  size += sizeof(uint64_t); /* max */
+  size += sizeof(uint32_t); /* number of buckets */
+  size += sizeof(hist->bucket);
+
+  return size;
+}
+
 long
 append_tuner(struct pdu* pdu, const struct tv_tuner* tuner)
 {
@@ -131,12 +153,42 @@ append_tuner(struct pdu* pdu, const struct tv_tuner* tuner)
   return TV_STATUS_SUCCESS;
 }
 
+/* Appends a string that is valid UTF-8. Drivers return arbitrary
+ * bytes, so invalid sequences are replaced by '?'. The length of the
+ * string doesn't change. */
+static long
+append_string(struct pdu* pdu, const char* str)
+{
+  char* copy;
+  long res;
+
+  if (dvb_text_is_utf8(str)) {
+    return append_to_pdu(pdu, "0", str);
+  }
+
+  copy = strdup(str);
+  if (!copy) {
+    ALOGE_ERRNO("strdup");
+    return -1;
+  }
+  dvb_text_repair_utf8(copy);
+  res = append_to_pdu(pdu, "0", copy);
+  free(copy);
+
+  return res;
+}
+
 long
 append_channel(struct pdu* pdu, const struct tv_channel* ch)
 {
-  if (append_to_pdu(pdu, "000C00CC", ch->network_id, ch->trans_stream_id
-                                   , ch->service_id, ch->type, ch->number
-                                   , ch->is_emergency, ch->is_free) < 0) {
+  if (append_to_pdu(pdu, "000C0", ch->network_id, ch->trans_stream_id
+                                , ch->service_id, ch->type, ch->number) < 0) {
+    return -1;
+  }
+  if (append_string(pdu, ch->name) < 0) {
+    return -1;
+  }
+  if (append_to_pdu(pdu, "CC", ch->is_emergency, ch->is_free) < 0) {
     return -1;
   }
 
@@ -148,9 +200,19 @@ append_program(struct pdu* pdu, const struct tv_program* prog)
 {
   uint32_t idx;
 
-  if (append_to_pdu(pdu, "0LL00I", prog->evt_id, prog->start_time
-                                 , prog->duration, prog->descpt
-                                 , prog->rating, prog->lang_num) < 0) {
+  if (append_to_pdu(pdu, "0", prog->evt_id) < 0) {
+    return -1;
+  }
+  if (append_string(pdu, prog->title) < 0) {
+    return -1;
+  }
+  if (append_to_pdu(pdu, "LL", prog->start_time, prog->duration) < 0) {
+    return -1;
+  }
+  if (append_string(pdu, prog->descpt) < 0) {
+    return -1;
+  }
+  if (append_to_pdu(pdu, "0I", prog->rating, prog->lang_num) < 0) {
     return -1;
   }
 
@@ -164,7 +226,7 @@ append_program(struct pdu* pdu, const struct tv_program* prog)
     return -1;
   }
 
-  for (idx = 0; idx < prog->lang_num; idx++) {
+  for (idx = 0; idx < prog->stl_lang_num; idx++) {
     if (append_to_pdu(pdu, "0", prog->stl_langs[idx]) < 0) {
       return -1;
     }
@@ -172,3 +234,22 @@ append_program(struct pdu* pdu, const struct tv_program* prog)
 
   return TV_STATUS_SUCCESS;
 }
+
+long
+append_histogram(struct pdu* pdu, const struct histogram* hist)
+{
+  uint32_t idx;
+
+  if (append_to_pdu(pdu, "LLLI", hist->count, hist->sum, hist->max,
+                                 (uint32_t)HISTOGRAM_BUCKETS) < 0) {
+    return -1;
+  }
+
+  for (idx = 0; idx < HISTOGRAM_BUCKETS; idx++) {
+    if (append_to_pdu(pdu, "I", hist->bucket[idx]) < 0) {
+      return -1;
+    }
+  }
+
+  return TV_STATUS_SUCCESS;
+}
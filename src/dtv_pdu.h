@@ -18,6 +18,7 @@
 
 #include <sys/socket.h>
 #include <pdu/pdubuf.h>
+#include "histogram.h"
 #include "tv_utils.h"
 #include "pdu.h"
 
@@ -41,8 +42,12 @@ uint32_t calculate_ch_size(const struct tv_channel* ch);
 
 uint32_t calculate_prog_size(const struct tv_program* prog);
 
+uint32_t calculate_histogram_size(const struct histogram* hist);
+
 long append_tuner(struct pdu* pdu, const struct tv_tuner* tuner);
 
 long append_channel(struct pdu* pdu, const struct tv_channel* ch);
 
 long append_program(struct pdu* pdu, const struct tv_program* prog);
+
+long append_histogram(struct pdu* pdu, const struct histogram* hist);
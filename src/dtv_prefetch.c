@@ -0,0 +1,536 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements the channel prefetcher. See the corresponding header
+ * file for documentation.
+ */
+
+#include "dtv_prefetch.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+#include "dtv.h"
+#include "dtv_epg.h"
+#include "dtv_pretune.h"
+#include "log.h"
+#include "memptr.h"
+#include "tv_utils.h"
+
+/*
+ * Channel keys
+ *
+ * A channel key identifies a channel by tuner ID, source type and channel
+ * number. Keys are used for the zap history and for prefetch requests. The
+ * strings are stored in the key's allocation.
+ */
+
+struct channel_key {
+  uint8_t source_type;
+  char* ch_num;
+  char tuner_id[0];
+};
+
+static struct channel_key*
+create_channel_key(const char* tuner_id, uint8_t source_type,
+                   const char* ch_num)
+{
+  size_t tuner_id_len;
+  struct channel_key* key;
+
+  tuner_id_len = strlen(tuner_id) + 1;
+
+  key = malloc(sizeof(*key) + tuner_id_len + strlen(ch_num) + 1);
+  if (!key) {
+    ALOGE_ERRNO("malloc");
+    return NULL;
+  }
+
+  key->source_type = source_type;
+  memcpy(key->tuner_id, tuner_id, tuner_id_len);
+  key->ch_num = key->tuner_id + tuner_id_len;
+  strcpy(key->ch_num, ch_num);
+
+  return key;
+}
+
+static int
+is_same_source(const struct channel_key* key,
+               const char* tuner_id, uint8_t source_type)
+{
+  return key->source_type == source_type && !strcmp(key->tuner_id, tuner_id);
+}
+
+/*
+ * Prefetcher state
+ *
+ * |g_history| is a ring buffer of recently set channels. |g_pending| is
+ * the latest prefetch request. A new request replaces a pending one; the
+ * worker only ever works on the most recent zap.
+ *
+ * |g_lineups| caches the channel numbers of each tuner and source type in
+ * the order reported by the driver. A lineup is loaded by the worker
+ * thread and marked stale when channels change.
+ *
+ * All state is protected by |g_lock|.
+ */
+
+enum {
+  HISTORY_LENGTH = 8,
+  MAX_PREDICTIONS = 3
+};
+
+struct lineup {
+  LIST_ENTRY(lineup) entry;
+  int stale;
+  uint32_t ch_num;
+  char** ch_nums;
+  struct channel_key* key; /* ch_num of key unused */
+};
+
+LIST_HEAD(lineup_list, lineup);
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t g_thread;
+static int g_running;
+static int g_quit;
+
+static struct channel_key* g_history[HISTORY_LENGTH];
+static unsigned long g_history_len;
+static struct channel_key* g_pending;
+static struct lineup_list g_lineups = LIST_HEAD_INITIALIZER(g_lineups);
+
+static const struct channel_key*
+history_at(unsigned long age)
+{
+  if (age >= g_history_len || age >= HISTORY_LENGTH) {
+    return NULL;
+  }
+  return g_history[(g_history_len - 1 - age) % HISTORY_LENGTH];
+}
+
+static void
+history_push(struct channel_key* key)
+{
+  unsigned long idx = g_history_len % HISTORY_LENGTH;
+
+  free(g_history[idx]);
+  g_history[idx] = key;
+  ++g_history_len;
+}
+
+static void
+free_lineup(struct lineup* lineup)
+{
+  uint32_t idx;
+
+  for (idx = 0; idx < lineup->ch_num; ++idx) {
+    free(lineup->ch_nums[idx]);
+  }
+  free(lineup->ch_nums);
+  free(lineup->key);
+  free(lineup);
+}
+
+static struct lineup*
+find_lineup(const char* tuner_id, uint8_t source_type)
+{
+  struct lineup* lineup;
+
+  LIST_FOREACH(lineup, &g_lineups, entry) {
+    if (is_same_source(lineup->key, tuner_id, source_type)) {
+      return lineup;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Worker thread
+ */
+
+/* Loads the channel list from the driver. Called without holding the lock
+ * as the driver might block.
+ */
+static struct lineup*
+load_lineup(const char* tuner_id, uint8_t source_type)
+{
+  struct lineup* lineup;
+  struct tv_channel* ch_list;
+  uint32_t ch_num, idx;
+
+  lineup = calloc(1, sizeof(*lineup));
+  if (!lineup) {
+    ALOGE_ERRNO("calloc");
+    return NULL;
+  }
+
+  lineup->key = create_channel_key(tuner_id, source_type, "");
+  if (!lineup->key) {
+    goto err_create_channel_key;
+  }
+
+  ch_num = dtv_get_channel_num(tuner_id, source_type);
+
+  ch_list = calloc(ch_num ? ch_num : 1, sizeof(*ch_list));
+  if (!ch_list) {
+    ALOGE_ERRNO("calloc");
+    goto err_calloc_ch_list;
+  }
+
+  if (dtv_get_channels(tuner_id, source_type, ch_num, ch_list)
+        != TV_STATUS_SUCCESS) {
+    free(ch_list);
+    goto err_dtv_get_channels;
+  }
+
+  lineup->ch_nums = calloc(ch_num ? ch_num : 1, sizeof(*lineup->ch_nums));
+  if (!lineup->ch_nums) {
+    ALOGE_ERRNO("calloc");
+    goto err_calloc_ch_nums;
+  }
+
+  /* steal the channel numbers; release the rest */
+  for (idx = 0; idx < ch_num; ++idx) {
+    lineup->ch_nums[idx] = ch_list[idx].number;
+    ch_list[idx].number = NULL;
+  }
+  lineup->ch_num = ch_num;
+
+  release_channels(ch_num, ch_list);
+
+  return lineup;
+
+err_calloc_ch_nums:
+  release_channels(ch_num, ch_list);
+err_dtv_get_channels:
+err_calloc_ch_list:
+  free(lineup->key);
+err_create_channel_key:
+  free(lineup);
+  return NULL;
+}
+
+static long
+lineup_index(const struct lineup* lineup, const char* ch_num)
+{
+  uint32_t idx;
+
+  for (idx = 0; idx < lineup->ch_num; ++idx) {
+    if (lineup->ch_nums[idx] && !strcmp(lineup->ch_nums[idx], ch_num)) {
+      return idx;
+    }
+  }
+  return -1;
+}
+
+static void
+add_prediction(char** predictions, unsigned long* num, const char* ch_num,
+               const char* current)
+{
+  unsigned long idx;
+
+  if (!ch_num || !strcmp(ch_num, current) || *num >= MAX_PREDICTIONS) {
+    return;
+  }
+  for (idx = 0; idx < *num; ++idx) {
+    if (!strcmp(predictions[idx], ch_num)) {
+      return;
+    }
+  }
+  predictions[*num] = strdup(ch_num);
+  if (predictions[*num]) {
+    ++(*num);
+  }
+}
+
+/* Predicts the next channels for a zap. The channel the user is zapping
+ * towards comes first, then the previously watched channel, then the
+ * neighbor in the other direction. Called with the lock held.
+ */
+static unsigned long
+predict_channels(const struct channel_key* key, const struct lineup* lineup,
+                 char** predictions)
+{
+  const struct channel_key* last;
+  const char* up;
+  const char* down;
+  const char* last_ch_num;
+  long cur, prev;
+  unsigned long num;
+
+  num = 0;
+
+  last = history_at(1);
+  last_ch_num = NULL;
+  if (last && is_same_source(last, key->tuner_id, key->source_type)) {
+    last_ch_num = last->ch_num;
+  }
+
+  cur = lineup_index(lineup, key->ch_num);
+  if (cur < 0 || !lineup->ch_num) {
+    add_prediction(predictions, &num, last_ch_num, key->ch_num);
+    return num;
+  }
+
+  up = lineup->ch_nums[(cur + 1) % lineup->ch_num];
+  down = lineup->ch_nums[(cur + lineup->ch_num - 1) % lineup->ch_num];
+
+  prev = last_ch_num ? lineup_index(lineup, last_ch_num) : -1;
+
+  if (prev >= 0 && (unsigned long)prev == (cur + 1) % lineup->ch_num) {
+    /* zapping down */
+    add_prediction(predictions, &num, down, key->ch_num);
+    add_prediction(predictions, &num, last_ch_num, key->ch_num);
+    add_prediction(predictions, &num, up, key->ch_num);
+  } else {
+    add_prediction(predictions, &num, up, key->ch_num);
+    add_prediction(predictions, &num, last_ch_num, key->ch_num);
+    add_prediction(predictions, &num, down, key->ch_num);
+  }
+
+  return num;
+}
+
+static void
+prefetch_programs(const char* tuner_id, uint8_t source_type,
+                  const char* ch_num)
+{
+  uint64_t start_time, end_time;
+  uint32_t prog_num;
+  struct tv_program* progs;
+
+  start_time = dtv_epg_now();
+  end_time = start_time + PREFETCH_WINDOW;
+
+  if (dtv_epg_is_covered(tuner_id, source_type, ch_num,
+                         start_time, end_time)) {
+    return;
+  }
+
+  prog_num = dtv_get_prog_num(tuner_id, source_type, ch_num,
+                              start_time, end_time);
+
+  progs = calloc(prog_num ? prog_num : 1, sizeof(*progs));
+  if (!progs) {
+    ALOGE_ERRNO("calloc");
+    return;
+  }
+
+  if (dtv_get_programs(tuner_id, source_type, ch_num, start_time, end_time,
+                       prog_num, progs) != TV_STATUS_SUCCESS) {
+    free(progs);
+    return;
+  }
+
+  dtv_epg_store(tuner_id, source_type, ch_num, start_time, end_time,
+                prog_num, progs);
+
+  release_programs(prog_num, progs);
+}
+
+static void
+prefetch(struct channel_key* key)
+{
+  struct lineup* lineup;
+  char* predictions[MAX_PREDICTIONS];
+  unsigned long num, idx;
+
+  pthread_mutex_lock(&g_lock);
+  lineup = find_lineup(key->tuner_id, key->source_type);
+  if (lineup && lineup->stale) {
+    LIST_REMOVE(lineup, entry);
+    free_lineup(lineup);
+    lineup = NULL;
+  }
+  pthread_mutex_unlock(&g_lock);
+
+  if (!lineup) {
+    lineup = load_lineup(key->tuner_id, key->source_type);
+    if (!lineup) {
+      return;
+    }
+    pthread_mutex_lock(&g_lock);
+    LIST_INSERT_HEAD(&g_lineups, lineup, entry);
+    pthread_mutex_unlock(&g_lock);
+  }
+
+  /* The lineup might have been cleared in the meantime; look it up again
+   * while holding the lock. */
+  pthread_mutex_lock(&g_lock);
+  lineup = find_lineup(key->tuner_id, key->source_type);
+  num = lineup ? predict_channels(key, lineup, predictions) : 0;
+  pthread_mutex_unlock(&g_lock);
+
+  if (num) {
+    dtv_pretune_predict(key->tuner_id, key->source_type, predictions[0]);
+  }
+
+  for (idx = 0; idx < num; ++idx) {
+    int superseded;
+
+    pthread_mutex_lock(&g_lock);
+    superseded = g_pending || g_quit;
+    pthread_mutex_unlock(&g_lock);
+
+    if (!superseded) {
+      prefetch_programs(key->tuner_id, key->source_type, predictions[idx]);
+    }
+    free(predictions[idx]);
+  }
+}
+
+static void*
+prefetch_thread(void* arg)
+{
+  struct channel_key* key;
+
+  pthread_mutex_lock(&g_lock);
+
+  while (!g_quit) {
+    if (!g_pending) {
+      pthread_cond_wait(&g_cond, &g_lock);
+      continue;
+    }
+
+    key = g_pending;
+    g_pending = NULL;
+
+    pthread_mutex_unlock(&g_lock);
+    prefetch(key);
+    free(key);
+    pthread_mutex_lock(&g_lock);
+  }
+
+  pthread_mutex_unlock(&g_lock);
+
+  return NULL;
+}
+
+/*
+ * Public interface
+ */
+
+int
+init_dtv_prefetch()
+{
+  int err;
+
+  g_quit = 0;
+
+  err = pthread_create(&g_thread, NULL, prefetch_thread, NULL);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_create", err);
+    return -1;
+  }
+  g_running = 1;
+
+  return 0;
+}
+
+void
+uninit_dtv_prefetch()
+{
+  if (g_running) {
+    pthread_mutex_lock(&g_lock);
+    g_quit = 1;
+    pthread_cond_signal(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+
+    pthread_join(g_thread, NULL);
+    g_running = 0;
+  }
+
+  dtv_prefetch_clear();
+
+  pthread_mutex_lock(&g_lock);
+  free(g_pending);
+  g_pending = NULL;
+  while (g_history_len) {
+    --g_history_len;
+    free(g_history[g_history_len % HISTORY_LENGTH]);
+    g_history[g_history_len % HISTORY_LENGTH] = NULL;
+  }
+  pthread_mutex_unlock(&g_lock);
+}
+
+void
+dtv_prefetch_channel_set(const char* tuner_id,
+                         uint8_t source_type,
+                         const char* ch_num)
+{
+  struct channel_key* key;
+  struct channel_key* pending;
+
+  assert(tuner_id);
+  assert(ch_num);
+
+  key = create_channel_key(tuner_id, source_type, ch_num);
+  if (!key) {
+    return;
+  }
+
+  pending = create_channel_key(tuner_id, source_type, ch_num);
+  if (!pending) {
+    free(key);
+    return;
+  }
+
+  pthread_mutex_lock(&g_lock);
+
+  history_push(key);
+
+  free(g_pending);
+  g_pending = pending;
+  pthread_cond_signal(&g_cond);
+
+  pthread_mutex_unlock(&g_lock);
+}
+
+void
+dtv_prefetch_channels_changed(const char* tuner_id, uint8_t source_type)
+{
+  struct lineup* lineup;
+
+  assert(tuner_id);
+
+  pthread_mutex_lock(&g_lock);
+
+  lineup = find_lineup(tuner_id, source_type);
+  if (lineup) {
+    lineup->stale = 1;
+  }
+
+  pthread_mutex_unlock(&g_lock);
+}
+
+void
+dtv_prefetch_clear()
+{
+  pthread_mutex_lock(&g_lock);
+
+  while (!LIST_EMPTY(&g_lineups)) {
+    struct lineup* lineup = LIST_FIRST(&g_lineups);
+    LIST_REMOVE(lineup, entry);
+    free_lineup(lineup);
+  }
+
+  pthread_mutex_unlock(&g_lock);
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the interface to the channel prefetcher of the DTV
+ * service.
+ *
+ * After each successful 'Set channel', call |dtv_prefetch_channel_set| with
+ * the new channel. The prefetcher records the channel in its zap history
+ * and predicts the channels the user is likely to switch to next. These
+ * are the neighbors of the current channel in the channel list, and the
+ * previously watched channel. On a worker thread, the prefetcher loads the
+ * present and following programs of the predicted channels into the EPG
+ * store, from where subsequent 'Get programs' commands are served. The
+ * most likely channel is also passed to the pre-tuner; see dtv_pretune.h.
+ *
+ * The prefetcher caches the channel list of each tuner and source type.
+ * Call |dtv_prefetch_channels_changed| when channels have been added, or
+ * |dtv_prefetch_clear| when the channel cache has been cleared.
+ *
+ * |init_dtv_prefetch| starts the worker thread and returns 0 on success,
+ * or -1 on errors. |uninit_dtv_prefetch| stops the worker thread. All
+ * other functions are thread-safe and never block on the driver.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+enum {
+  PREFETCH_WINDOW = 3 * 60 * 60 * 1000 /* ms of programs to prefetch */
+};
+
+int
+init_dtv_prefetch(void);
+
+void
+uninit_dtv_prefetch(void);
+
+void
+dtv_prefetch_channel_set(const char* tuner_id,
+                         uint8_t source_type,
+                         const char* ch_num);
+
+void
+dtv_prefetch_channels_changed(const char* tuner_id, uint8_t source_type);
+
+void
+dtv_prefetch_clear(void);
@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements the pre-tuner. See the corresponding header file
+ * for documentation.
+ */
+
+#include "dtv_pretune.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dtv.h"
+#include "dtv_arbiter.h"
+#include "log.h"
+#include "tv_utils.h"
+
+/*
+ * Requests
+ *
+ * A request asks to pre-tune a channel for a tuner. The strings are
+ * stored in the request's allocation.
+ */
+
+struct request {
+  uint8_t source_type;
+  char* ch_num;
+  char tuner_id[0];
+};
+
+static struct request*
+create_request(const char* tuner_id, uint8_t source_type, const char* ch_num)
+{
+  size_t tuner_id_len;
+  struct request* req;
+
+  tuner_id_len = strlen(tuner_id) + 1;
+
+  req = malloc(sizeof(*req) + tuner_id_len + strlen(ch_num) + 1);
+  if (!req) {
+    ALOGE_ERRNO("malloc");
+    return NULL;
+  }
+
+  req->source_type = source_type;
+  memcpy(req->tuner_id, tuner_id, tuner_id_len);
+  req->ch_num = req->tuner_id + tuner_id_len;
+  strcpy(req->ch_num, ch_num);
+
+  return req;
+}
+
+/*
+ * Pre-tuner state
+ *
+ * |g_pending| is the latest request; a new request replaces a pending
+ * one. |g_spare| is the tuner ID of the spare, which pre-tunes for the
+ * tuner |g_live|. Once the spare's source is open, |g_channel| holds the
+ * pre-tuned channel; otherwise its number is NULL. While |g_tuning| is
+ * set, the worker thread uses the spare without holding the lock. The
+ * spare is acquired from the arbiter as |g_user|.
+ *
+ * All state is protected by |g_lock|. The pre-tuner has the lowest
+ * priority, so acquiring a tuner never preempts anyone and it can hold
+ * the lock while it calls into the arbiter.
+ */
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t g_thread;
+static int g_running;
+static int g_quit;
+
+static struct request* g_pending;
+static char* g_spare;
+static char* g_live;
+static uint8_t g_source_type;
+static struct tv_channel g_channel;
+static int g_tuning;
+
+static void
+preempt_spare(struct dtv_tuner_user* user, const char* tuner_id);
+
+static struct dtv_tuner_user g_user = {
+  .use = TUNER_USE_PRETUNE,
+  .preempt = preempt_spare
+};
+
+/* Releases the spare's source and forgets the spare. Called with the lock
+ * held while the worker isn't tuning. */
+static void
+release_spare(void)
+{
+  assert(!g_tuning);
+
+  if (!g_spare) {
+    return;
+  }
+  if (g_channel.number) {
+    dtv_release_source(g_spare);
+  }
+  clear_channel(&g_channel);
+  dtv_arbiter_release(g_spare, &g_user);
+  free(g_spare);
+  g_spare = NULL;
+  free(g_live);
+  g_live = NULL;
+}
+
+/*
+ * Worker thread
+ */
+
+/* Releases the spare when the arbiter assigns it to another user. */
+static void
+preempt_spare(struct dtv_tuner_user* user, const char* tuner_id)
+{
+  pthread_mutex_lock(&g_lock);
+
+  while (g_tuning) {
+    pthread_cond_wait(&g_cond, &g_lock);
+  }
+  if (g_spare && !strcmp(g_spare, tuner_id)) {
+    release_spare();
+  }
+
+  pthread_mutex_unlock(&g_lock);
+}
+
+static void
+pretune(const struct request* req)
+{
+  struct tv_channel ch;
+  tv_stream_t stream;
+  char spare_id[MAX_TUNER_ID_LEN];
+  char* spare;
+  uint8_t res;
+
+  pthread_mutex_lock(&g_lock);
+
+  if (g_spare && (g_source_type != req->source_type ||
+                  strcmp(g_live, req->tuner_id))) {
+    release_spare(); /* the user switched tuners */
+  }
+  if (g_channel.number && !strcmp(g_channel.number, req->ch_num)) {
+    pthread_mutex_unlock(&g_lock);
+    return; /* pre-tuned already */
+  }
+
+  if (!g_spare) {
+    /* live tuners are claimed, so the spare is another tuner */
+    if (dtv_arbiter_acquire_any(&g_user, NULL, NULL, 0,
+                                spare_id) != TV_STATUS_SUCCESS) {
+      pthread_mutex_unlock(&g_lock);
+      return;
+    }
+    g_spare = strdup(spare_id);
+    if (!g_spare) {
+      ALOGE_ERRNO("strdup");
+      dtv_arbiter_release(spare_id, &g_user);
+      pthread_mutex_unlock(&g_lock);
+      return;
+    }
+    g_live = strdup(req->tuner_id);
+    if (!g_live) {
+      ALOGE_ERRNO("strdup");
+      release_spare();
+      pthread_mutex_unlock(&g_lock);
+      return;
+    }
+    g_source_type = req->source_type;
+  }
+
+  clear_channel(&g_channel);
+  g_tuning = 1;
+  spare = g_spare;
+
+  pthread_mutex_unlock(&g_lock);
+
+  res = dtv_set_channel(spare, req->source_type, req->ch_num, &ch);
+  if (res == TV_STATUS_SUCCESS) {
+    res = dtv_set_source(spare, req->source_type, &stream);
+    if (res != TV_STATUS_SUCCESS) {
+      clear_channel(&ch);
+    }
+  }
+
+  pthread_mutex_lock(&g_lock);
+
+  g_tuning = 0;
+  pthread_cond_broadcast(&g_cond);
+
+  if (res == TV_STATUS_SUCCESS) {
+    g_channel = ch;
+  } else {
+    ALOGW("Couldn't pre-tune channel %s on tuner %s", req->ch_num, spare);
+    release_spare();
+  }
+
+  pthread_mutex_unlock(&g_lock);
+}
+
+static void*
+pretune_thread(void* arg)
+{
+  struct request* req;
+
+  pthread_mutex_lock(&g_lock);
+
+  while (!g_quit) {
+    if (!g_pending) {
+      pthread_cond_wait(&g_cond, &g_lock);
+      continue;
+    }
+
+    req = g_pending;
+    g_pending = NULL;
+
+    pthread_mutex_unlock(&g_lock);
+    pretune(req);
+    free(req);
+    pthread_mutex_lock(&g_lock);
+  }
+
+  pthread_mutex_unlock(&g_lock);
+
+  return NULL;
+}
+
+/*
+ * Public interface
+ */
+
+int
+init_dtv_pretune()
+{
+  int err;
+
+  g_quit = 0;
+
+  err = pthread_create(&g_thread, NULL, pretune_thread, NULL);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_create", err);
+    return -1;
+  }
+  g_running = 1;
+
+  return 0;
+}
+
+void
+uninit_dtv_pretune()
+{
+  if (g_running) {
+    pthread_mutex_lock(&g_lock);
+    g_quit = 1;
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+
+    pthread_join(g_thread, NULL);
+    g_running = 0;
+  }
+
+  pthread_mutex_lock(&g_lock);
+  free(g_pending);
+  g_pending = NULL;
+  release_spare();
+  pthread_mutex_unlock(&g_lock);
+}
+
+void
+dtv_pretune_predict(const char* tuner_id, uint8_t source_type,
+                    const char* ch_num)
+{
+  struct request* req;
+
+  assert(tuner_id);
+  assert(ch_num);
+
+  req = create_request(tuner_id, source_type, ch_num);
+  if (!req) {
+    return;
+  }
+
+  pthread_mutex_lock(&g_lock);
+
+  if (g_quit || !g_running) {
+    pthread_mutex_unlock(&g_lock);
+    free(req);
+    return;
+  }
+
+  free(g_pending);
+  g_pending = req;
+  pthread_cond_broadcast(&g_cond);
+
+  pthread_mutex_unlock(&g_lock);
+}
+
+int
+dtv_pretune_take(const char* tuner_id, uint8_t source_type,
+                 const char* ch_num, struct tv_channel* ch)
+{
+  assert(tuner_id);
+  assert(ch_num);
+  assert(ch);
+
+  pthread_mutex_lock(&g_lock);
+
+  /* Don't wait for the worker; the user shouldn't notice the pre-tuner. */
+  if (g_tuning || !g_channel.number || g_source_type != source_type ||
+      strcmp(g_live, tuner_id) || strcmp(g_channel.number, ch_num)) {
+    pthread_mutex_unlock(&g_lock);
+    return 0;
+  }
+
+  /* |tuner_id| now names the pre-tuned device, which keeps its source.
+   * The spare's ID names the previous device, which we make idle. */
+  dtv_swap_tuners(tuner_id, g_spare);
+  dtv_release_source(g_spare);
+
+  *ch = g_channel;
+  memset(&g_channel, 0, sizeof(g_channel));
+  release_spare();
+
+  pthread_mutex_unlock(&g_lock);
+
+  ALOGI("Switched tuner %s to pre-tuned channel %s", tuner_id, ch_num);
+
+  return 1;
+}
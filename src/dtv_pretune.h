@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the interface to the pre-tuner of the DTV service.
+ *
+ * On boxes with multiple tuners, the pre-tuner keeps the channel that the
+ * user will most likely switch to next tuned and streaming on an idle
+ * tuner, the spare. The prefetcher predicts the channel from the channel
+ * list and the zap history, and passes it to |dtv_pretune_predict|. A
+ * worker thread then sets the channel on the spare and opens the spare's
+ * source.
+ *
+ * Call |dtv_pretune_take| before setting a channel. If the spare has the
+ * channel tuned for the given tuner, the pre-tuner swaps the devices of
+ * both tuners with |dtv_swap_tuners| and returns 1 with a copy of the
+ * channel. The tuner's source is then the pre-tuned stream; the client
+ * has to set the source again to receive it. The previous device of the
+ * tuner becomes idle and can serve as the next spare. Otherwise, the
+ * function returns 0 and the caller sets the channel as usual.
+ *
+ * The pre-tuner backs off whenever a tuner is needed elsewhere. It
+ * acquires the spare from the tuner arbiter with the lowest priority, so
+ * any other use preempts it; the spare's source is then released. See
+ * dtv_arbiter.h.
+ *
+ * Pre-tuning assumes that tuners of the same source type have the same
+ * channel lists, for example because each of them has been scanned. Only
+ * tuners that implement |dtv_set_channel| can be pre-tuned.
+ *
+ * |init_dtv_pretune| starts the worker thread and returns 0 on success,
+ * or -1 on errors. |uninit_dtv_pretune| stops the worker thread and
+ * releases the spare. All other functions are thread-safe and never wait
+ * for the driver.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct tv_channel;
+
+int
+init_dtv_pretune(void);
+
+void
+uninit_dtv_pretune(void);
+
+void
+dtv_pretune_predict(const char* tuner_id, uint8_t source_type,
+                    const char* ch_num);
+
+int
+dtv_pretune_take(const char* tuner_id, uint8_t source_type,
+                 const char* ch_num, struct tv_channel* ch);
@@ -0,0 +1,1607 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements the scan coordinator. See the corresponding header
+ * file for documentation.
+ */
+
+#include "dtv_scan.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dtv.h"
+#include "dtv_arbiter.h"
+#include "dvb_psi.h"
+#include "dvb_si.h"
+#include "log.h"
+#include "memptr.h"
+#include "tv_hal.h"
+#include "tv_utils.h"
+
+/*
+ * Frequency plans
+ *
+ * Each band is a raster of equally spaced center frequencies. The plan of
+ * a source type is the concatenation of its bands.
+ */
+
+struct band {
+  uint8_t source_type;
+  uint32_t first;       /* kHz */
+  uint32_t last;        /* kHz */
+  uint32_t step;        /* kHz */
+  uint32_t bandwidth;   /* kHz */
+  uint32_t symbol_rate; /* symbols per second */
+  uint8_t modulation;
+};
+
+static const struct band g_band[] = {
+  /* DVB-T/T2: VHF band III channels 5-12, UHF channels 21-69 */
+  { TVD_DVB_T, 177500, 226500, 7000, 7000, 0, TV_MODULATION_AUTO },
+  { TVD_DVB_T, 474000, 858000, 8000, 8000, 0, TV_MODULATION_AUTO },
+  { TVD_DVB_T2, 177500, 226500, 7000, 7000, 0, TV_MODULATION_AUTO },
+  { TVD_DVB_T2, 474000, 858000, 8000, 8000, 0, TV_MODULATION_AUTO },
+  /* DVB-C/C2: 8 MHz raster across the cable spectrum */
+  { TVD_DVB_C, 113000, 858000, 8000, 8000, 6900000, TV_MODULATION_AUTO },
+  { TVD_DVB_C2, 113000, 858000, 8000, 8000, 0, TV_MODULATION_AUTO },
+  /* ATSC: VHF channels 2-4, 5-6, 7-13, UHF channels 14-36 */
+  { TVD_ATSC, 57000, 69000, 6000, 6000, 0, TV_MODULATION_8VSB },
+  { TVD_ATSC, 79000, 85000, 6000, 6000, 0, TV_MODULATION_8VSB },
+  { TVD_ATSC, 177000, 213000, 6000, 6000, 0, TV_MODULATION_8VSB },
+  { TVD_ATSC, 473000, 611000, 6000, 6000, 0, TV_MODULATION_8VSB },
+  /* ISDB-T: UHF channels 13-62 */
+  { TVD_ISDB_T, 473143, 767143, 6000, 6000, 0, TV_MODULATION_AUTO }
+};
+
+static uint32_t
+count_plan(uint8_t source_type)
+{
+  size_t i;
+  uint32_t num;
+
+  num = 0;
+  for (i = 0; i < ARRAY_LENGTH(g_band); ++i) {
+    if (g_band[i].source_type == source_type) {
+      num += (g_band[i].last - g_band[i].first) / g_band[i].step + 1;
+    }
+  }
+
+  return num;
+}
+
+/*
+ * IPTV groups
+ *
+ * IPTV has no frequency raster. The multicast groups to scan are listed
+ * in |IPTV_GROUPS_FILE|, one group per line in the form 'address:port'.
+ */
+
+#define IPTV_GROUPS_FILE "/data/misc/tvd/iptv_groups"
+
+static uint32_t
+read_groups(struct tv_frequency** group)
+{
+  FILE* file;
+  char addr[16];
+  unsigned int port;
+  uint32_t num, len;
+
+  *group = NULL;
+
+  file = fopen(IPTV_GROUPS_FILE, "r");
+  if (!file) {
+    if (errno != ENOENT) {
+      ALOGW_ERRNO("fopen");
+    }
+    return 0;
+  }
+
+  num = 0;
+  len = 0;
+
+  while (fscanf(file, " %15[0-9.]:%u", addr, &port) == 2) {
+    struct in_addr in;
+    if (inet_pton(AF_INET, addr, &in) != 1 || port > UINT16_MAX) {
+      ALOGW("Invalid IPTV group %s:%u", addr, port);
+      continue;
+    }
+    if (num == len) {
+      uint32_t new_len = len ? len * 2 : 16;
+      void* mem = realloc(*group, new_len * sizeof(**group));
+      if (!mem) {
+        ALOGE_ERRNO("realloc");
+        break; /* scan the groups we have */
+      }
+      *group = mem;
+      len = new_len;
+    }
+    memset(*group + num, 0, sizeof(**group));
+    (*group)[num].frequency = ntohl(in.s_addr);
+    (*group)[num].port = port;
+    ++num;
+  }
+
+  fclose(file);
+
+  return num;
+}
+
+/*
+ * Services
+ *
+ * We remember the services found during a scan, so that services that are
+ * received on multiple frequencies are only reported once.
+ */
+
+enum {
+  NUM_BUCKETS = 64 /* must be a power of 2 */
+};
+
+struct service {
+  LIST_ENTRY(service) bucket;
+  uint32_t hash;
+  char* network_id;
+  char* trans_stream_id;
+  char* service_id;
+};
+
+LIST_HEAD(service_list, service);
+
+static const char*
+str_or_empty(const char* s)
+{
+  return s ? s : "";
+}
+
+static uint32_t
+hash_service(const struct tv_channel* ch)
+{
+  /* FNV-1a */
+  uint32_t hash = 2166136261u;
+  const char* field[3];
+  const unsigned char* s;
+  size_t i;
+
+  field[0] = str_or_empty(ch->network_id);
+  field[1] = str_or_empty(ch->trans_stream_id);
+  field[2] = str_or_empty(ch->service_id);
+
+  for (i = 0; i < ARRAY_LENGTH(field); ++i) {
+    for (s = (const unsigned char*)field[i]; *s; ++s) {
+      hash = (hash ^ *s) * 16777619u;
+    }
+    hash = (hash ^ 0xff) * 16777619u; /* separate fields */
+  }
+
+  return hash;
+}
+
+/*
+ * Scan state
+ *
+ * The coordinator's state is protected by |g_lock|. The worker threads
+ * fetch frequencies from |g_plan| and report new channels in the name of
+ * the requested tuner. Frequencies after the first |g_num_foreground|
+ * ones are scanned in the background with a lower thread priority. The
+ * last worker to finish stores the locked frequencies and reports the
+ * end of the scan. Finished workers are joined before the next scan
+ * starts.
+ *
+ * The workers' tuners are acquired from the arbiter as |g_user|. When
+ * the arbiter preempts a tuner, it sets the worker's |preempted| flag and
+ * waits until the worker has cleared it. The worker then puts back its
+ * current frequency and moves to another tuner. The last running worker
+ * waits for a tuner if there's none, until |resume_scan| sets
+ * |g_resumed|. While |g_acquiring| is set, the arbiter might preempt a
+ * tuner before its worker is known, so |preempt_worker| waits for it.
+ */
+
+enum {
+  BACKGROUND_NICE = 10, /* nice value of background scanning */
+  MAX_NIT_ATTEMPTS = 2, /* transponders to try for reading the NIT */
+  MAX_NIT_READS = 64, /* sections to read before giving up */
+  MAX_NIT_TRANSPORTS = 256,
+  NIT_TIMEOUT = 12 * 1000, /* ms; NIT repeats at least every 10 s */
+  READ_TIMEOUT = 500, /* ms; bounds the delay of preemptions */
+  SAME_FREQUENCY_RANGE = 1000 /* kHz */
+};
+
+struct worker {
+  pthread_t thread;
+  char tuner_id[MAX_TUNER_ID_LEN]; /* empty after leaving the tuner */
+  int preempted;
+};
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+static const struct dtv_callbacks* g_callbacks;
+
+static int g_active;
+static int g_stop;
+static char* g_tuner_id;
+static uint8_t g_source_type;
+
+static struct tv_frequency* g_plan;
+static uint32_t g_plan_len;
+static uint32_t g_num_foreground;
+static uint32_t g_next_freq;
+
+static struct tv_frequency* g_locked;
+static uint32_t g_num_locked;
+
+static uint8_t g_mode;
+static int g_nit_found;
+static unsigned long g_nit_attempts;
+
+static struct worker g_worker[MAX_SCAN_TUNERS];
+static unsigned long g_num_workers;
+static unsigned long g_num_running;
+static unsigned long g_acquiring;
+static int g_resumed;
+
+static void
+preempt_worker(struct dtv_tuner_user* user, const char* tuner_id);
+
+static void
+resume_scan(struct dtv_tuner_user* user);
+
+static struct dtv_tuner_user g_user = {
+  .use = TUNER_USE_SCAN,
+  .preempt = preempt_worker,
+  .resume = resume_scan
+};
+
+static struct service_list g_service[NUM_BUCKETS];
+
+static void
+clear_services(void)
+{
+  size_t i;
+
+  for (i = 0; i < ARRAY_LENGTH(g_service); ++i) {
+    while (!LIST_EMPTY(g_service + i)) {
+      struct service* service = LIST_FIRST(g_service + i);
+      LIST_REMOVE(service, bucket);
+      free(service->network_id);
+      free(service->trans_stream_id);
+      free(service->service_id);
+      free(service);
+    }
+  }
+}
+
+/* Returns 1 if the channel's service has not been seen before, 0 if it
+ * has, or -1 on errors. */
+static int
+add_service(const struct tv_channel* ch)
+{
+  uint32_t hash;
+  struct service_list* bucket;
+  struct service* service;
+
+  hash = hash_service(ch);
+  bucket = g_service + (hash & (NUM_BUCKETS - 1));
+
+  LIST_FOREACH(service, bucket, bucket) {
+    if (service->hash == hash &&
+        !strcmp(service->network_id, str_or_empty(ch->network_id)) &&
+        !strcmp(service->trans_stream_id, str_or_empty(ch->trans_stream_id)) &&
+        !strcmp(service->service_id, str_or_empty(ch->service_id))) {
+      return 0;
+    }
+  }
+
+  service = calloc(1, sizeof(*service));
+  if (!service) {
+    ALOGE_ERRNO("calloc");
+    return -1;
+  }
+
+  service->hash = hash;
+  service->network_id = strdup(str_or_empty(ch->network_id));
+  service->trans_stream_id = strdup(str_or_empty(ch->trans_stream_id));
+  service->service_id = strdup(str_or_empty(ch->service_id));
+
+  if (!service->network_id || !service->trans_stream_id ||
+      !service->service_id) {
+    ALOGE_ERRNO("strdup");
+    free(service->network_id);
+    free(service->trans_stream_id);
+    free(service->service_id);
+    free(service);
+    return -1;
+  }
+
+  LIST_INSERT_HEAD(bucket, service, bucket);
+
+  return 1;
+}
+
+/*
+ * Known frequencies
+ *
+ * Frequencies that achieved lock in earlier scans are stored in
+ * |SCAN_STATE_FILE|, one line per frequency with the source type and
+ * the tuning parameters. The last field, the UDP port of IPTV groups, is
+ * optional. A quick rescan tunes to them before sweeping
+ * the rest of the plan. After a scan that covered the whole plan, the
+ * known frequencies of the source type are replaced by the ones that
+ * locked. After a stopped scan, new locks are only added.
+ */
+
+#define SCAN_STATE_FILE "/data/misc/tvd/scan_frequencies"
+
+struct known_freq {
+  uint8_t source_type;
+  struct tv_frequency freq;
+};
+
+static struct known_freq* g_known;
+static uint32_t g_known_num;
+static uint32_t g_known_len;
+
+static long
+find_known(uint8_t source_type, const struct tv_frequency* freq)
+{
+  uint32_t i;
+
+  /* Transponders can share a frequency on different polarizations or
+   * IPTV ports. */
+  for (i = 0; i < g_known_num; ++i) {
+    if (g_known[i].source_type == source_type &&
+        g_known[i].freq.frequency == freq->frequency &&
+        g_known[i].freq.polarization == freq->polarization &&
+        g_known[i].freq.port == freq->port) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int
+add_known(uint8_t source_type, const struct tv_frequency* freq)
+{
+  long i;
+
+  i = find_known(source_type, freq);
+  if (i >= 0) {
+    g_known[i].freq = *freq;
+    return 0;
+  }
+
+  if (g_known_num == g_known_len) {
+    uint32_t len = g_known_len ? g_known_len * 2 : 32;
+    void* known = realloc(g_known, len * sizeof(*g_known));
+    if (!known) {
+      ALOGE_ERRNO("realloc");
+      return -1;
+    }
+    g_known = known;
+    g_known_len = len;
+  }
+
+  g_known[g_known_num].source_type = source_type;
+  g_known[g_known_num].freq = *freq;
+  ++g_known_num;
+
+  return 0;
+}
+
+static void
+remove_known(uint8_t source_type)
+{
+  uint32_t i, num;
+
+  num = 0;
+  for (i = 0; i < g_known_num; ++i) {
+    if (g_known[i].source_type != source_type) {
+      g_known[num++] = g_known[i];
+    }
+  }
+  g_known_num = num;
+}
+
+static void
+load_known(void)
+{
+  FILE* file;
+  char line[128];
+  unsigned int source_type, frequency, bandwidth, symbol_rate, modulation,
+               polarization, port;
+
+  file = fopen(SCAN_STATE_FILE, "r");
+  if (!file) {
+    if (errno != ENOENT) {
+      ALOGW_ERRNO("fopen");
+    }
+    return;
+  }
+
+  while (fgets(line, sizeof(line), file)) {
+    port = 0;
+    if (sscanf(line, "%u %u %u %u %u %u %u", &source_type, &frequency,
+               &bandwidth, &symbol_rate, &modulation, &polarization,
+               &port) < 6) {
+      break;
+    }
+    struct tv_frequency freq = {
+      .frequency = frequency,
+      .bandwidth = bandwidth,
+      .symbol_rate = symbol_rate,
+      .modulation = modulation,
+      .polarization = polarization,
+      .port = port
+    };
+    if (add_known(source_type, &freq) < 0) {
+      break;
+    }
+  }
+
+  fclose(file);
+}
+
+static void
+save_known(void)
+{
+  FILE* file;
+  uint32_t i;
+  int err;
+
+  /* Write to a temporary file and rename it, so a crash never leaves
+   * us with a partial file. */
+  file = fopen(SCAN_STATE_FILE ".tmp", "w");
+  if (!file) {
+    ALOGW_ERRNO("fopen");
+    return;
+  }
+
+  for (i = 0; i < g_known_num; ++i) {
+    fprintf(file, "%u %u %u %u %u %u %u\n",
+            (unsigned int)g_known[i].source_type,
+            (unsigned int)g_known[i].freq.frequency,
+            (unsigned int)g_known[i].freq.bandwidth,
+            (unsigned int)g_known[i].freq.symbol_rate,
+            (unsigned int)g_known[i].freq.modulation,
+            (unsigned int)g_known[i].freq.polarization,
+            (unsigned int)g_known[i].freq.port);
+  }
+
+  err = ferror(file);
+  if (fclose(file) || err) {
+    ALOGW("Couldn't write %s", SCAN_STATE_FILE ".tmp");
+    unlink(SCAN_STATE_FILE ".tmp");
+    return;
+  }
+
+  if (rename(SCAN_STATE_FILE ".tmp", SCAN_STATE_FILE) < 0) {
+    ALOGW_ERRNO("rename");
+  }
+}
+
+/* Builds the plan of frequencies to scan. In quick and network mode, the
+ * known frequencies of the source type come first. In quick mode,
+ * |num_foreground| is set to their number; otherwise all frequencies are
+ * foreground. Source types without frequency plan can still be scanned
+ * in network mode, if a frequency is known. The plan of IPTV consists of
+ * the configured multicast groups. */
+static uint32_t
+build_plan(uint8_t source_type, uint8_t mode,
+           struct tv_frequency** plan, uint32_t* num_foreground)
+{
+  size_t i;
+  uint32_t num, num_known, num_groups, freq;
+  struct tv_frequency* f;
+  struct tv_frequency* group;
+
+  num_groups = 0;
+  group = NULL;
+  if (source_type == TVD_IPTV) {
+    num_groups = read_groups(&group);
+  }
+
+  num = count_plan(source_type) + num_groups;
+
+  num_known = 0;
+  if (mode != SCAN_MODE_FULL) {
+    for (i = 0; i < g_known_num; ++i) {
+      num_known += g_known[i].source_type == source_type;
+    }
+  }
+
+  if (!(num + num_known)) {
+    *plan = NULL;
+    return 0;
+  }
+
+  *plan = calloc(num + num_known, sizeof(**plan));
+  if (!*plan) {
+    ALOGE_ERRNO("calloc");
+    free(group);
+    return 0;
+  }
+
+  f = *plan;
+
+  if (mode != SCAN_MODE_FULL) {
+    for (i = 0; i < g_known_num; ++i) {
+      if (g_known[i].source_type == source_type) {
+        *f++ = g_known[i].freq;
+      }
+    }
+  }
+
+  for (i = 0; i < ARRAY_LENGTH(g_band); ++i) {
+    if (g_band[i].source_type != source_type) {
+      continue;
+    }
+    for (freq = g_band[i].first; freq <= g_band[i].last;
+         freq += g_band[i].step) {
+      f->frequency = freq;
+      f->bandwidth = g_band[i].bandwidth;
+      f->symbol_rate = g_band[i].symbol_rate;
+      f->modulation = g_band[i].modulation;
+      if (mode != SCAN_MODE_FULL && find_known(source_type, f) >= 0) {
+        continue; /* already in foreground part */
+      }
+      ++f;
+    }
+  }
+
+  for (i = 0; i < num_groups; ++i) {
+    if (mode != SCAN_MODE_FULL &&
+        find_known(source_type, group + i) >= 0) {
+      continue;
+    }
+    *f++ = group[i];
+  }
+  free(group);
+
+  num = f - *plan;
+  *num_foreground = (mode == SCAN_MODE_QUICK) ? num_known : num;
+
+  return num;
+}
+
+/* Adds new services to the requested tuner's channel list. |freq| is
+ * the frequency of the worker that found them, which can differ from
+ * the requested tuner's. */
+static void
+merge_channels(const struct tv_frequency* freq, uint32_t ch_num,
+               const struct tv_channel* ch)
+{
+  uint32_t idx;
+
+  pthread_mutex_lock(&g_lock);
+
+  for (idx = 0; idx < ch_num; ++idx) {
+    if (add_service(ch + idx) <= 0) {
+      continue;
+    }
+    if (dtv_add_channel(g_tuner_id, g_source_type, freq,
+                        ch + idx) != TV_STATUS_SUCCESS) {
+      ALOGW("Couldn't add channel %s to tuner %s",
+            str_or_empty(ch[idx].number), g_tuner_id);
+      continue;
+    }
+    g_callbacks->channel_update_nfy_cb(DTV_CHANNEL_ADD, g_tuner_id,
+                                       g_source_type, ch + idx);
+  }
+
+  pthread_mutex_unlock(&g_lock);
+}
+
+/*
+ * Dwell times
+ *
+ * Most frequencies of a blind scan carry nothing, so we want to leave
+ * them as soon as possible. A frequency first has to show a signal, then
+ * the demodulator has to lock, and finally a PAT has to arrive. Each
+ * stage has its own timeout per source type. The stages' timings are
+ * collected in |g_stats| to tune the timeouts. The statistics have their
+ * own lock, so that reading them doesn't block the workers.
+ */
+
+enum {
+  MAX_SOURCE_TYPES = 32,
+  POLL_INTERVAL = 10, /* ms */
+  MAX_PSI_READS = 256,
+  PSI_TIMEOUT = 2500 /* ms; the SDT repeats at least every 2 s */
+};
+
+struct dwell {
+  uint8_t source_type;
+  uint32_t timeout[NUM_SCAN_STAGES]; /* ms */
+};
+
+static const struct dwell g_dwell[] = {
+  /* signal, lock, PSI; the PAT repeats at least every 500 ms */
+  { TVD_DVB_T, { 100, 1000, 600 } },
+  { TVD_DVB_T2, { 150, 2000, 600 } }, /* L1 signalling takes longer */
+  { TVD_DVB_C, { 100, 600, 600 } },
+  { TVD_DVB_C2, { 150, 1500, 600 } },
+  { TVD_DVB_S, { 100, 1000, 600 } },
+  { TVD_DVB_S2, { 100, 1500, 600 } },
+  { TVD_ATSC, { 100, 1000, 600 } },
+  { TVD_ISDB_T, { 150, 1500, 600 } },
+  { TVD_IPTV, { 100, 1000, 600 } } /* lock waits for the IGMP join */
+};
+
+static const struct dwell g_default_dwell = {
+  0, { 200, 2000, 1000 }
+};
+
+static pthread_mutex_t g_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dtv_scan_stats g_stats[MAX_SOURCE_TYPES][NUM_SCAN_STAGES];
+
+static const struct dwell*
+find_dwell(uint8_t source_type)
+{
+  size_t i;
+
+  for (i = 0; i < ARRAY_LENGTH(g_dwell); ++i) {
+    if (g_dwell[i].source_type == source_type) {
+      return g_dwell + i;
+    }
+  }
+  return &g_default_dwell;
+}
+
+static uint64_t
+monotonic_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+record_stage(uint8_t source_type, int stage, int passed, uint64_t time)
+{
+  struct dtv_scan_stats* stats;
+
+  if (source_type >= MAX_SOURCE_TYPES) {
+    return;
+  }
+  stats = &g_stats[source_type][stage];
+
+  pthread_mutex_lock(&g_stats_lock);
+  histogram_add(passed ? &stats->passed : &stats->rejected, time);
+  pthread_mutex_unlock(&g_stats_lock);
+}
+
+static int
+is_preempted(const struct worker* worker)
+{
+  return __atomic_load_n(&worker->preempted, __ATOMIC_RELAXED);
+}
+
+/* Reads a section like |dtv_read_section|, but in reads of at most
+ * |READ_TIMEOUT| ms, so that a preemption doesn't wait for the whole
+ * |timeout|. Returns TV_STATUS_BUSY if the worker has been preempted. */
+static uint8_t
+read_section(const struct worker* worker, uint8_t source_type,
+             uint16_t pid, uint8_t table_id, uint32_t timeout,
+             uint8_t* buf, uint32_t* len)
+{
+  uint64_t start, elapsed;
+  uint32_t size;
+  uint8_t ret;
+
+  start = monotonic_ms();
+  size = *len;
+
+  for (;;) {
+    if (is_preempted(worker)) {
+      return TV_STATUS_BUSY;
+    }
+    elapsed = monotonic_ms() - start;
+    if (elapsed >= timeout) {
+      return TV_STATUS_FAIL;
+    }
+    *len = size;
+    ret = dtv_read_section(worker->tuner_id, source_type, pid, table_id,
+                           timeout - elapsed < READ_TIMEOUT ?
+                             timeout - elapsed : READ_TIMEOUT,
+                           buf, len);
+    if (ret != TV_STATUS_FAIL) {
+      return ret;
+    }
+  }
+}
+
+/* Polls the frontend until it reports one of |flags|. Returns 1 if it
+ * did, 0 on timeout or preemption, or -1 if the driver doesn't report its
+ * status. */
+static int
+wait_for_frontend(const struct worker* worker, uint8_t source_type,
+                  uint8_t flags, uint64_t start, uint32_t timeout)
+{
+  static const struct timespec interval = {
+    .tv_sec = 0,
+    .tv_nsec = POLL_INTERVAL * 1000000
+  };
+
+  for (;;) {
+    uint8_t status;
+    uint16_t strength;
+
+    if (dtv_get_frontend_status(worker->tuner_id, source_type, &status,
+                                &strength) != TV_STATUS_SUCCESS) {
+      return -1;
+    }
+    if (status & flags) {
+      return 1;
+    }
+    if (monotonic_ms() - start >= timeout || is_preempted(worker)) {
+      return 0;
+    }
+    nanosleep(&interval, NULL);
+  }
+}
+
+/* Returns 1 if the frequency passed all stages, 0 if it has been rejected,
+ * or -1 if the driver doesn't support staged tuning. */
+static int
+tune_staged(const struct worker* worker, uint8_t source_type,
+            const struct tv_frequency* freq)
+{
+  static const uint8_t stage_flags[] = {
+    [SCAN_STAGE_SIGNAL] = TV_FRONTEND_HAS_SIGNAL | TV_FRONTEND_HAS_LOCK,
+    [SCAN_STAGE_SYNC] = TV_FRONTEND_HAS_LOCK
+  };
+  const struct dwell* dwell;
+  uint8_t buf[DVB_MAX_SECTION_LEN];
+  uint32_t len;
+  uint64_t start;
+  uint8_t ret;
+  int stage, res;
+
+  if (dtv_set_frequency(worker->tuner_id, source_type,
+                        freq) != TV_STATUS_SUCCESS) {
+    return -1;
+  }
+
+  dwell = find_dwell(source_type);
+
+  for (stage = SCAN_STAGE_SIGNAL; stage < SCAN_STAGE_PSI; ++stage) {
+    start = monotonic_ms();
+    res = wait_for_frontend(worker, source_type, stage_flags[stage],
+                            start, dwell->timeout[stage]);
+    if (res < 0) {
+      return -1;
+    } else if (is_preempted(worker)) {
+      return 0;
+    }
+    record_stage(source_type, stage, res, monotonic_ms() - start);
+    if (!res) {
+      return 0;
+    }
+  }
+
+  /* Locked; a PAT proves that there's a transport stream. */
+  len = sizeof(buf);
+  start = monotonic_ms();
+  ret = dtv_read_section(worker->tuner_id, source_type, DVB_PID_PAT,
+                         DVB_TABLE_PAT, dwell->timeout[SCAN_STAGE_PSI],
+                         buf, &len);
+  if (ret == TV_STATUS_NOT_SUPPORTED) {
+    return 1;
+  }
+  res = ret == TV_STATUS_SUCCESS;
+  record_stage(source_type, SCAN_STAGE_PSI, res, monotonic_ms() - start);
+
+  return res;
+}
+
+int
+dtv_scan_get_stats(uint8_t source_type, int reset,
+                   struct dtv_scan_stats stats[NUM_SCAN_STAGES])
+{
+  const struct dwell* dwell;
+  int i;
+
+  if (source_type >= MAX_SOURCE_TYPES) {
+    ALOGE("invalid source type %u", source_type);
+    return -1;
+  }
+
+  dwell = find_dwell(source_type);
+
+  pthread_mutex_lock(&g_stats_lock);
+  for (i = 0; i < NUM_SCAN_STAGES; ++i) {
+    stats[i] = g_stats[source_type][i];
+    stats[i].timeout = dwell->timeout[i];
+    if (reset) {
+      histogram_clear(&g_stats[source_type][i].passed);
+      histogram_clear(&g_stats[source_type][i].rejected);
+    }
+  }
+  pthread_mutex_unlock(&g_stats_lock);
+
+  return 0;
+}
+
+/* Builds the channels of the tuned transport stream from its PSI/SI
+ * tables, for drivers that don't return them. The PAT is required; the
+ * channels of missing PMTs or SDT have less information. */
+static uint8_t
+read_psi_channels(const struct worker* worker, uint8_t source_type,
+                  uint32_t* ch_num, struct tv_channel** ch)
+{
+  uint8_t buf[DVB_MAX_SECTION_LEN];
+  struct dvb_psi* psi;
+  uint16_t pid;
+  uint8_t table_id;
+  unsigned long i;
+  uint8_t ret;
+
+  psi = create_dvb_psi();
+  if (!psi) {
+    return TV_STATUS_FAIL;
+  }
+
+  ret = TV_STATUS_SUCCESS;
+
+  for (i = 0; i < MAX_PSI_READS &&
+              dvb_psi_next_missing(psi, &pid, &table_id); ++i) {
+    uint32_t len = sizeof(buf);
+
+    ret = read_section(worker, source_type, pid, table_id, PSI_TIMEOUT,
+                       buf, &len);
+    if (ret != TV_STATUS_SUCCESS) {
+      break;
+    }
+    dvb_psi_feed(psi, buf, len);
+  }
+
+  if (dvb_psi_next_missing(psi, &pid, &table_id) &&
+      table_id == DVB_TABLE_PAT) {
+    ret = ret == TV_STATUS_SUCCESS ? TV_STATUS_FAIL : ret;
+    goto err_pat;
+  }
+
+  if (dvb_psi_get_channels(psi, ch_num, ch) < 0) {
+    ret = TV_STATUS_FAIL;
+    goto err_dvb_psi_get_channels;
+  }
+
+  destroy_dvb_psi(psi);
+
+  return TV_STATUS_SUCCESS;
+
+err_dvb_psi_get_channels:
+err_pat:
+  destroy_dvb_psi(psi);
+  return ret;
+}
+
+/* Returns 1 if the tuner locked to the frequency, 0 otherwise, or -1 if
+ * the worker has been preempted before it could tell. */
+static int
+scan_frequency(const struct worker* worker, uint8_t source_type,
+               const struct tv_frequency* freq)
+{
+  const char* tuner_id = worker->tuner_id;
+  uint32_t ch_num;
+  struct tv_channel* ch;
+  uint8_t ret;
+  int res;
+
+  res = tune_staged(worker, source_type, freq);
+  if (is_preempted(worker)) {
+    return -1;
+  } else if (!res) {
+    return 0;
+  } else if (res < 0) {
+    ret = dtv_tune_frequency(tuner_id, source_type, freq);
+    if (ret == TV_STATUS_NO_SIGNAL) {
+      return 0;
+    } else if (ret != TV_STATUS_SUCCESS) {
+      ALOGW("Tuner %s couldn't tune to %u kHz", tuner_id, freq->frequency);
+      return 0;
+    }
+  }
+
+  ch_num = 0;
+  ch = NULL;
+
+  ret = dtv_get_frequency_channels(tuner_id, source_type, &ch_num, &ch);
+  if (ret == TV_STATUS_NOT_SUPPORTED) {
+    ret = read_psi_channels(worker, source_type, &ch_num, &ch);
+  }
+  if (ret == TV_STATUS_BUSY) {
+    return -1; /* preempted; scan the frequency again later */
+  } else if (ret != TV_STATUS_SUCCESS) {
+    ALOGW("Tuner %s couldn't read channels at %u kHz",
+          tuner_id, freq->frequency);
+    return 1;
+  }
+
+  merge_channels(freq, ch_num, ch);
+  release_channels(ch_num, ch);
+
+  return 1;
+}
+
+/*
+ * Network scan
+ *
+ * In network mode, the workers sweep the plan until one of them locks.
+ * This worker reads the NIT from the transport stream and replaces the
+ * rest of the plan by the advertised transport streams. If there's no
+ * complete NIT on the first |MAX_NIT_ATTEMPTS| transponders, the blind
+ * sweep simply continues.
+ */
+
+static uint8_t
+delivery_tag(uint8_t source_type)
+{
+  switch (source_type) {
+    case TVD_DVB_T:
+    case TVD_DVB_T2:
+      return DVB_DESC_TERRESTRIAL_DELIVERY;
+    case TVD_DVB_C:
+    case TVD_DVB_C2:
+      return DVB_DESC_CABLE_DELIVERY;
+    case TVD_DVB_S:
+    case TVD_DVB_S2:
+      return DVB_DESC_SATELLITE_DELIVERY;
+    default:
+      break;
+  }
+  return 0;
+}
+
+/* Reads all sections of the current NIT. Returns the number of delivery
+ * entries, or -1 if no complete NIT has been received. */
+static long
+read_nit(const struct worker* worker, uint8_t source_type,
+         struct dvb_delivery* delivery, size_t max)
+{
+  uint8_t buf[DVB_MAX_SECTION_LEN];
+  uint8_t seen[256 / 8];
+  struct dvb_section sec;
+  unsigned long i;
+  unsigned int num_seen;
+  int version;
+  size_t num;
+  long res;
+
+  version = -1;
+  num_seen = 0;
+  num = 0;
+
+  for (i = 0; i < MAX_NIT_READS; ++i) {
+    uint32_t len = sizeof(buf);
+
+    if (read_section(worker, source_type, DVB_PID_NIT,
+                     DVB_TABLE_NIT_ACTUAL, NIT_TIMEOUT,
+                     buf, &len) != TV_STATUS_SUCCESS) {
+      break;
+    }
+    if (dvb_parse_section(buf, len, &sec) < 0 ||
+        sec.table_id != DVB_TABLE_NIT_ACTUAL || !sec.current) {
+      continue;
+    }
+    if (sec.version != version) {
+      /* (re-)start with new version */
+      version = sec.version;
+      memset(seen, 0, sizeof(seen));
+      num_seen = 0;
+      num = 0;
+    }
+    if (seen[sec.number / 8] & (1 << (sec.number % 8))) {
+      continue;
+    }
+    res = dvb_parse_nit(&sec, delivery + num, max - num);
+    if (res < 0) {
+      continue;
+    }
+    seen[sec.number / 8] |= 1 << (sec.number % 8);
+    num += res;
+
+    if (++num_seen == sec.last_number + 1u) {
+      return num;
+    }
+  }
+
+  if (!is_preempted(worker)) {
+    ALOGW("No complete NIT on tuner %s", worker->tuner_id);
+  }
+  return -1;
+}
+
+static int
+is_near_frequency(const struct tv_frequency* lhs,
+                  const struct tv_frequency* rhs)
+{
+  uint32_t diff = lhs->frequency > rhs->frequency ?
+                  lhs->frequency - rhs->frequency :
+                  rhs->frequency - lhs->frequency;
+
+  return diff < SAME_FREQUENCY_RANGE &&
+         lhs->polarization == rhs->polarization;
+}
+
+/* Replaces the unscanned part of the plan by the transport streams of the
+ * NIT. Has to be called with |g_lock| held. */
+static void
+apply_nit(uint8_t source_type, const struct dvb_delivery* delivery,
+          size_t num)
+{
+  uint8_t tag;
+  struct tv_frequency* plan;
+  void* locked;
+  uint32_t len, i, j;
+
+  tag = delivery_tag(source_type);
+
+  plan = calloc(g_next_freq + num, sizeof(*plan));
+  if (!plan) {
+    ALOGE_ERRNO("calloc");
+    return;
+  }
+
+  /* keep the frequencies that have been handed out already */
+  memcpy(plan, g_plan, g_next_freq * sizeof(*plan));
+  len = g_next_freq;
+
+  for (i = 0; i < num; ++i) {
+    if (delivery[i].tag != tag || !delivery[i].freq.frequency) {
+      continue;
+    }
+    for (j = 0; j < len; ++j) {
+      if (is_near_frequency(plan + j, &delivery[i].freq)) {
+        break;
+      }
+    }
+    if (j == len) {
+      plan[len++] = delivery[i].freq;
+    }
+  }
+
+  if (len == g_next_freq) {
+    ALOGW("NIT contains no new transport streams");
+    free(plan);
+    return;
+  }
+
+  locked = realloc(g_locked, len * sizeof(*g_locked));
+  if (!locked) {
+    ALOGE_ERRNO("realloc");
+    free(plan);
+    return;
+  }
+  g_locked = locked;
+
+  ALOGI("NIT lists %u more transport streams", len - g_next_freq);
+
+  free(g_plan);
+  g_plan = plan;
+  g_plan_len = len;
+  g_num_foreground = len;
+  g_nit_found = 1;
+}
+
+static void
+scan_network(const struct worker* worker, uint8_t source_type)
+{
+  struct dvb_delivery* delivery;
+  long num;
+
+  delivery = calloc(MAX_NIT_TRANSPORTS, sizeof(*delivery));
+  if (!delivery) {
+    ALOGE_ERRNO("calloc");
+    return;
+  }
+
+  num = read_nit(worker, source_type, delivery, MAX_NIT_TRANSPORTS);
+
+  pthread_mutex_lock(&g_lock);
+  if (num > 0 && !g_nit_found) {
+    apply_nit(source_type, delivery, num);
+  } else if (num < 0 && is_preempted(worker)) {
+    --g_nit_attempts; /* try again on the next transponder */
+  }
+  pthread_mutex_unlock(&g_lock);
+
+  free(delivery);
+}
+
+static void
+lower_priority(void)
+{
+  /* On Linux, the nice value of a thread ID applies to the thread. */
+  if (setpriority(PRIO_PROCESS, gettid(), BACKGROUND_NICE) < 0) {
+    ALOGW_ERRNO("setpriority");
+  }
+}
+
+/* Remembers the locked frequencies of the finished scan. */
+static void
+update_known(uint8_t source_type, int complete)
+{
+  uint32_t i;
+
+  if (complete) {
+    remove_known(source_type);
+  }
+  for (i = 0; i < g_num_locked; ++i) {
+    if (add_known(source_type, g_locked + i) < 0) {
+      break;
+    }
+  }
+  save_known();
+}
+
+/*
+ * Tuner arbitration
+ */
+
+static int
+supports_scan(const char* tuner_id, void* data)
+{
+  const uint8_t* source_type = data;
+
+  return dtv_supports_frequency_scan(tuner_id,
+                                     *source_type) == TV_STATUS_SUCCESS;
+}
+
+/* Takes a tuner away from its worker. */
+static void
+preempt_worker(struct dtv_tuner_user* user, const char* tuner_id)
+{
+  unsigned long i;
+
+  pthread_mutex_lock(&g_lock);
+
+  while (g_acquiring) {
+    pthread_cond_wait(&g_cond, &g_lock);
+  }
+
+  for (i = 0; i < g_num_workers; ++i) {
+    struct worker* worker = g_worker + i;
+
+    if (strcmp(worker->tuner_id, tuner_id)) {
+      continue;
+    }
+    __atomic_store_n(&worker->preempted, 1, __ATOMIC_RELAXED);
+    while (worker->preempted) {
+      pthread_cond_wait(&g_cond, &g_lock);
+    }
+  }
+
+  pthread_mutex_unlock(&g_lock);
+}
+
+static void
+resume_scan(struct dtv_tuner_user* user)
+{
+  pthread_mutex_lock(&g_lock);
+  g_resumed = 1;
+  pthread_cond_broadcast(&g_cond);
+  pthread_mutex_unlock(&g_lock);
+}
+
+/* Moves a preempted worker to another tuner. If there's none, the worker
+ * finishes, unless it's the last running worker; then it waits for a
+ * tuner to be released, so the scan resumes. Called with the lock held.
+ * Returns 1 on success, or 0 if the worker should finish. */
+static int
+switch_tuner(struct worker* worker, uint8_t source_type)
+{
+  char tuner_id[MAX_TUNER_ID_LEN];
+  uint8_t ret;
+  int wait;
+
+  /* the tuner belongs to somebody else now */
+  worker->tuner_id[0] = '\0';
+  worker->preempted = 0;
+  pthread_cond_broadcast(&g_cond);
+
+  while (!g_stop) {
+    wait = g_num_running == 1;
+    g_resumed = 0;
+    ++g_acquiring;
+    pthread_mutex_unlock(&g_lock);
+
+    ret = dtv_arbiter_acquire_any(&g_user, supports_scan, &source_type,
+                                  wait, tuner_id);
+
+    pthread_mutex_lock(&g_lock);
+    if (ret == TV_STATUS_SUCCESS) {
+      snprintf(worker->tuner_id, sizeof(worker->tuner_id), "%s", tuner_id);
+    }
+    --g_acquiring;
+    pthread_cond_broadcast(&g_cond);
+
+    if (ret == TV_STATUS_SUCCESS) {
+      ALOGI("Scan continues on tuner %s", tuner_id);
+      return 1;
+    } else if (!wait) {
+      if (g_num_running > 1) {
+        return 0; /* the other workers finish the plan */
+      }
+      continue;
+    }
+
+    ALOGI("Scan suspended until a tuner is released");
+    while (!g_resumed && !g_stop) {
+      pthread_cond_wait(&g_cond, &g_lock);
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Workers
+ */
+
+static void*
+scan_thread(void* arg)
+{
+  struct worker* worker = arg;
+  struct tv_frequency freq;
+  char tuner_id[MAX_TUNER_ID_LEN];
+  uint8_t source_type;
+  uint8_t status;
+  int background, lower, locked, want_nit, last;
+
+  background = 0;
+
+  pthread_mutex_lock(&g_lock);
+
+  source_type = g_source_type;
+
+  while (!g_stop && g_next_freq < g_plan_len) {
+    if (worker->preempted) {
+      if (!switch_tuner(worker, source_type)) {
+        break;
+      }
+      continue;
+    }
+    lower = !background && g_next_freq >= g_num_foreground;
+    freq = g_plan[g_next_freq++];
+    pthread_mutex_unlock(&g_lock);
+    if (lower) {
+      lower_priority();
+      background = 1;
+    }
+    locked = scan_frequency(worker, source_type, &freq);
+    pthread_mutex_lock(&g_lock);
+    if (locked < 0) {
+      /* The plan's frequencies before |g_next_freq| have been taken,
+       * so the slot is free. */
+      g_plan[--g_next_freq] = freq;
+      continue;
+    } else if (!locked) {
+      continue;
+    }
+    /* |g_locked| has room for the whole plan. */
+    g_locked[g_num_locked++] = freq;
+
+    want_nit = g_mode == SCAN_MODE_NETWORK && !g_nit_found &&
+               g_nit_attempts < MAX_NIT_ATTEMPTS;
+    if (want_nit) {
+      ++g_nit_attempts;
+      pthread_mutex_unlock(&g_lock);
+      scan_network(worker, source_type);
+      pthread_mutex_lock(&g_lock);
+    }
+  }
+
+  memcpy(tuner_id, worker->tuner_id, sizeof(tuner_id));
+  worker->tuner_id[0] = '\0';
+  worker->preempted = 0;
+  pthread_cond_broadcast(&g_cond);
+
+  last = !--g_num_running;
+  status = g_stop ? DTV_SCAN_STOPPED : DTV_SCAN_COMPLETE;
+  if (last) {
+    update_known(source_type, !g_stop);
+    g_active = 0;
+  }
+
+  pthread_mutex_unlock(&g_lock);
+
+  if (tuner_id[0]) {
+    dtv_arbiter_release(tuner_id, &g_user);
+  }
+
+  if (last) {
+    dtv_arbiter_cancel(&g_user);
+    /* The next scan joins this thread before touching |g_tuner_id|. */
+    g_callbacks->scan_status_nfy_cb(status, g_tuner_id, source_type);
+  }
+
+  return NULL;
+}
+
+static void
+join_workers(void)
+{
+  unsigned long i;
+
+  for (i = 0; i < g_num_workers; ++i) {
+    pthread_join(g_worker[i].thread, NULL);
+  }
+  g_num_workers = 0;
+
+  free(g_plan);
+  g_plan = NULL;
+  g_plan_len = 0;
+
+  free(g_locked);
+  g_locked = NULL;
+  g_num_locked = 0;
+
+  free(g_tuner_id);
+  g_tuner_id = NULL;
+
+  clear_services();
+}
+
+static int
+add_worker(const char* tuner_id)
+{
+  struct worker* worker;
+  int err;
+
+  assert(g_num_workers < ARRAY_LENGTH(g_worker));
+
+  worker = g_worker + g_num_workers;
+  snprintf(worker->tuner_id, sizeof(worker->tuner_id), "%s", tuner_id);
+  worker->preempted = 0;
+
+  err = pthread_create(&worker->thread, NULL, scan_thread, worker);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_create", err);
+    return -1;
+  }
+  ++g_num_workers;
+  ++g_num_running;
+
+  return 0;
+}
+
+/* Acquires the requested tuner, or takes it over from |holder|, and all
+ * other tuners that support frequency scanning for the source type, as
+ * far as the arbiter assigns them to the scan, and starts a worker on
+ * each. Returns a TV_STATUS_ code. */
+static uint8_t
+start_workers(const char* tuner_id, uint8_t source_type,
+              struct dtv_tuner_user* holder)
+{
+  char id[MAX_SCAN_TUNERS][MAX_TUNER_ID_LEN];
+  unsigned long num, i;
+  int handed_over;
+
+  pthread_mutex_lock(&g_lock);
+  ++g_acquiring;
+  pthread_mutex_unlock(&g_lock);
+
+  num = 0;
+
+  handed_over = holder &&
+                dtv_arbiter_hand_over(tuner_id, holder, &g_user) ==
+                  TV_STATUS_SUCCESS;
+  if (handed_over ||
+      dtv_arbiter_acquire(tuner_id, &g_user) == TV_STATUS_SUCCESS) {
+    snprintf(id[num++], MAX_TUNER_ID_LEN, "%s", tuner_id);
+  } else {
+    ALOGW("Tuner %s is busy, scanning on other tuners", tuner_id);
+  }
+  while (num < ARRAY_LENGTH(id) &&
+         dtv_arbiter_acquire_any(&g_user, supports_scan, &source_type, 0,
+                                 id[num]) == TV_STATUS_SUCCESS) {
+    ++num;
+  }
+
+  /* Workers wait for the lock until all of them have been started, so
+   * none of them can report the end of the scan too early. */
+  pthread_mutex_lock(&g_lock);
+  for (i = 0; i < num; ++i) {
+    if (add_worker(id[i]) < 0) {
+      break; /* continue with fewer tuners */
+    }
+  }
+  g_active = g_num_workers > 0;
+  --g_acquiring;
+  pthread_cond_broadcast(&g_cond);
+  pthread_mutex_unlock(&g_lock);
+
+  for (; i < num; ++i) {
+    if (!i && handed_over) {
+      dtv_arbiter_hand_over(id[i], &g_user, holder); /* give it back */
+    } else {
+      dtv_arbiter_release(id[i], &g_user);
+    }
+  }
+
+  if (!num) {
+    return TV_STATUS_BUSY;
+  }
+  return g_active ? TV_STATUS_SUCCESS : TV_STATUS_FAIL;
+}
+
+/*
+ * Public interface
+ */
+
+int
+init_dtv_scan(const struct dtv_callbacks* callbacks)
+{
+  size_t i;
+
+  assert(callbacks);
+
+  g_callbacks = callbacks;
+
+  for (i = 0; i < ARRAY_LENGTH(g_service); ++i) {
+    LIST_INIT(g_service + i);
+  }
+
+  load_known();
+
+  return 0;
+}
+
+void
+uninit_dtv_scan()
+{
+  pthread_mutex_lock(&g_lock);
+  g_stop = 1;
+  pthread_cond_broadcast(&g_cond);
+  pthread_mutex_unlock(&g_lock);
+
+  join_workers();
+
+  free(g_known);
+  g_known = NULL;
+  g_known_num = 0;
+  g_known_len = 0;
+}
+
+uint8_t
+dtv_scan_start(const char* tuner_id, uint8_t source_type, uint8_t mode,
+               struct dtv_tuner_user* holder)
+{
+  uint8_t ret;
+
+  assert(tuner_id);
+
+  pthread_mutex_lock(&g_lock);
+  if (g_active) {
+    ALOGE("Scan is already running on tuner %s", g_tuner_id);
+    pthread_mutex_unlock(&g_lock);
+    return TV_STATUS_BUSY;
+  }
+  pthread_mutex_unlock(&g_lock);
+
+  join_workers();
+
+  if (dtv_supports_frequency_scan(tuner_id, source_type) !=
+      TV_STATUS_SUCCESS) {
+    return dtv_start_scanning(tuner_id, source_type);
+  }
+
+  g_plan_len = build_plan(source_type, mode, &g_plan, &g_num_foreground);
+  if (!g_plan_len) {
+    ALOGW("No frequency plan for source type %d", source_type);
+    return dtv_start_scanning(tuner_id, source_type);
+  }
+
+  g_locked = calloc(g_plan_len, sizeof(*g_locked));
+  if (!g_locked) {
+    ALOGE_ERRNO("calloc");
+    ret = TV_STATUS_FAIL;
+    goto err_calloc;
+  }
+
+  g_tuner_id = strdup(tuner_id);
+  if (!g_tuner_id) {
+    ALOGE_ERRNO("strdup");
+    ret = TV_STATUS_FAIL;
+    goto err_strdup;
+  }
+  g_source_type = source_type;
+  g_mode = mode;
+  g_next_freq = 0;
+  g_nit_found = 0;
+  g_nit_attempts = 0;
+  g_stop = 0;
+
+  ret = start_workers(tuner_id, source_type, holder);
+  if (ret != TV_STATUS_SUCCESS) {
+    goto err_start_workers;
+  }
+
+  ALOGI("Scanning %u frequencies (%u known) on %lu tuners",
+        g_plan_len, g_num_foreground < g_plan_len ? g_num_foreground : 0,
+        g_num_workers);
+
+  return TV_STATUS_SUCCESS;
+
+err_start_workers:
+err_strdup:
+err_calloc:
+  join_workers(); /* no workers are running; frees the plan */
+  return ret;
+}
+
+uint8_t
+dtv_scan_stop(const char* tuner_id, uint8_t source_type)
+{
+  assert(tuner_id);
+
+  pthread_mutex_lock(&g_lock);
+
+  if (!g_active || g_source_type != source_type ||
+      strcmp(g_tuner_id, tuner_id)) {
+    pthread_mutex_unlock(&g_lock);
+    return dtv_stop_scanning(tuner_id, source_type);
+  }
+
+  g_stop = 1;
+  pthread_cond_broadcast(&g_cond); /* wake up suspended workers */
+
+  pthread_mutex_unlock(&g_lock);
+
+  return TV_STATUS_SUCCESS;
+}
+
+long
+dtv_scan_get_transponders(struct dtv_transponder** tp)
+{
+  uint32_t i;
+  long num;
+
+  assert(tp);
+
+  *tp = NULL;
+
+  pthread_mutex_lock(&g_lock);
+
+  num = g_known_num;
+  if (num) {
+    *tp = calloc(num, sizeof(**tp));
+    if (!*tp) {
+      ALOGE_ERRNO("calloc");
+      num = -1;
+    }
+  }
+  for (i = 0; (long)i < num; ++i) {
+    (*tp)[i].source_type = g_known[i].source_type;
+    (*tp)[i].freq = g_known[i].freq;
+  }
+
+  pthread_mutex_unlock(&g_lock);
+
+  return num;
+}
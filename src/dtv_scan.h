@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the interface to the scan coordinator of the DTV
+ * service.
+ *
+ * |dtv_scan_start| scans the channels of a source type. If the driver
+ * implements frequency scanning for the requested tuner, the coordinator
+ * sweeps the source type's frequency plan itself. The frequencies are
+ * distributed among the requested tuner and all other tuners that support
+ * the source type and that the tuner arbiter assigns to the scan, each of
+ * which runs on its own thread. Tuners fetch the next frequency from a
+ * shared queue, so faster tuners take over more of the plan.
+ *
+ * Scanning has a low priority. If a tuner is needed for anything else
+ * than pre-tuning, the arbiter preempts the scan on this tuner; see
+ * dtv_arbiter.h. The tuner's current frequency goes back to the queue and
+ * the tuner's thread moves on to another tuner. If there's none left, the
+ * scan is suspended until a tuner is released. If no tuner at all is
+ * available, |dtv_scan_start| returns TV_STATUS_BUSY. If |holder| is
+ * not NULL and holds the requested tuner, the scan takes the tuner over
+ * from it; if the scan doesn't start, |holder| keeps the tuner.
+ *
+ * Channels found by any tuner are merged into the channel list of the
+ * requested tuner. Services that are received on multiple frequencies
+ * are reported once, identified by their original network ID, transport
+ * stream ID and service ID. Each new channel is reported with the
+ * |channel_update_nfy_cb| callback. After all tuners are done, a single
+ * |scan_status_nfy_cb| callback reports DTV_SCAN_COMPLETE, or
+ * DTV_SCAN_STOPPED if the scan has been stopped.
+ *
+ * With |SCAN_MODE_QUICK|, the coordinator first tunes to the frequencies
+ * that achieved lock in earlier scans, which are stored persistently.
+ * Channels on these frequencies are reported right away. Afterwards, the
+ * remaining frequencies of the plan are swept in the background with a
+ * lower thread priority. |SCAN_MODE_FULL| sweeps the plan in order.
+ *
+ * With |SCAN_MODE_NETWORK|, the coordinator tunes until the first lock,
+ * starting with the known frequencies. It then reads the Network
+ * Information Table from the transport stream and only scans the
+ * transport streams listed there. Without NIT, it continues with a blind
+ * sweep of the plan.
+ *
+ * Each frequency passes up to three stages, each of which can reject it
+ * early: the tuner has to detect a signal, lock to it, and then receive
+ * a PAT. Each stage has a timeout that depends on the source type. If
+ * the driver doesn't report its frontend status, the coordinator waits
+ * for |dtv_tune_frequency| instead. |dtv_scan_get_stats| returns the
+ * stages' timeouts and histograms of the time in milliseconds that
+ * passing and rejected frequencies spent in each stage. The statistics
+ * accumulate over all scans of a source type until they are reset.
+ *
+ * If the driver doesn't return the channels of a frequency, the
+ * coordinator reads the PSI/SI tables of the transport stream with
+ * |dtv_read_section| and builds the channels itself.
+ *
+ * If frequency scanning is not supported, |dtv_scan_start| and
+ * |dtv_scan_stop| forward to the driver's |dtv_start_scanning| and
+ * |dtv_stop_scanning|. The driver reports the end of such scans directly,
+ * so they bypass the tuner arbiter.
+ *
+ * Only one scan runs at a time; while a scan is active, |dtv_scan_start|
+ * returns TV_STATUS_BUSY. Both functions return a TV_STATUS_ code and
+ * are called on the I/O thread.
+ *
+ * |dtv_scan_get_transponders| returns the frequencies that locked in
+ * earlier scans in an array allocated with malloc(3). It returns the
+ * number of transponders, or -1 on errors, and is thread-safe.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "dtv_arbiter.h"
+#include "histogram.h"
+#include "tv_utils.h"
+
+struct dtv_callbacks;
+
+enum {
+  SCAN_MODE_FULL = 0x00,
+  SCAN_MODE_QUICK = 0x01,
+  SCAN_MODE_NETWORK = 0x02
+};
+
+enum {
+  MAX_SCAN_TUNERS = 8
+};
+
+enum {
+  SCAN_STAGE_SIGNAL = 0x00,
+  SCAN_STAGE_SYNC = 0x01,
+  SCAN_STAGE_PSI = 0x02,
+  NUM_SCAN_STAGES
+};
+
+struct dtv_transponder {
+  uint8_t source_type;
+  struct tv_frequency freq;
+};
+
+struct dtv_scan_stats {
+  uint32_t timeout; /* ms */
+  struct histogram passed;
+  struct histogram rejected;
+};
+
+int
+init_dtv_scan(const struct dtv_callbacks* callbacks);
+
+void
+uninit_dtv_scan(void);
+
+uint8_t
+dtv_scan_start(const char* tuner_id, uint8_t source_type, uint8_t mode,
+               struct dtv_tuner_user* holder);
+
+uint8_t
+dtv_scan_stop(const char* tuner_id, uint8_t source_type);
+
+int
+dtv_scan_get_stats(uint8_t source_type, int reset,
+                   struct dtv_scan_stats stats[NUM_SCAN_STAGES]);
+
+long
+dtv_scan_get_transponders(struct dtv_transponder** tp);
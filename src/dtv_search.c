@@ -0,0 +1,809 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements the program search index. See the corresponding
+ * header file for documentation.
+ */
+
+#include "dtv_search.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "memptr.h"
+#include "tv_utils.h"
+
+enum {
+  NUM_KEY_BUCKETS = 1 << 16, /* must be a power of 2 */
+  MIN_TRIGRAM_SLOTS = 1 << 12, /* must be a power of 2 */
+  MAX_TEXT_LEN = 4096,
+  MIN_STALE_POSTINGS = 1 << 16
+};
+
+static const uint32_t NO_DOC = UINT32_MAX;
+
+/*
+ * Documents
+ *
+ * Each indexed program is stored as a document with its key, its time
+ * span and its case-folded text. Documents live in a single array and
+ * unused slots form a free list. We also keep a hash table from program
+ * keys to documents, so the EPG store can remove programs by key.
+ *
+ * The generation of a slot is incremented whenever its document is
+ * removed. Postings carry the generation of the document they refer to,
+ * which lets us remove documents without touching the posting lists.
+ */
+
+struct doc {
+  uint32_t gen;
+  uint32_t next; /* next document in bucket, or in free list */
+  uint32_t hash;
+  uint32_t num_postings; /* 0 if unused */
+  uint8_t source_type;
+  char* tuner_id;
+  char* ch_num;
+  char* evt_id;
+  uint64_t start_time;
+  uint64_t end_time;
+  char* text;
+};
+
+/*
+ * Trigrams
+ *
+ * The trigram table is an open-addressing hash table with linear probing.
+ * Each slot holds the posting list of a trigram, which is encoded as the
+ * 24-bit value of its three bytes. The text never contains zero bytes, so
+ * a key of 0 marks an empty slot. Slots are never removed; posting lists
+ * shrink during compaction.
+ */
+
+struct posting {
+  uint32_t doc;
+  uint32_t gen;
+};
+
+struct trigram {
+  uint32_t key;
+  uint32_t num;
+  uint32_t len;
+  struct posting* posting;
+};
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct doc* g_doc;
+static uint32_t g_doc_len;
+static uint32_t g_free_doc;
+static uint32_t* g_key_bucket;
+
+static struct trigram* g_trigram;
+static uint32_t g_trigram_len;
+static uint32_t g_trigram_num;
+
+static uint64_t g_live_postings;
+static uint64_t g_stale_postings;
+
+static uint32_t
+hash_key(const char* tuner_id, uint8_t source_type, const char* ch_num,
+         const char* evt_id, uint64_t start_time)
+{
+  /* FNV-1a */
+  uint32_t hash = 2166136261u;
+  const unsigned char* s;
+  size_t i;
+
+  for (s = (const unsigned char*)tuner_id; *s; ++s) {
+    hash = (hash ^ *s) * 16777619u;
+  }
+  hash = (hash ^ source_type) * 16777619u;
+  for (s = (const unsigned char*)ch_num; *s; ++s) {
+    hash = (hash ^ *s) * 16777619u;
+  }
+  hash = (hash ^ 0xff) * 16777619u; /* separate channel from event ID */
+  for (s = (const unsigned char*)evt_id; *s; ++s) {
+    hash = (hash ^ *s) * 16777619u;
+  }
+  for (i = 0; i < sizeof(start_time); ++i) {
+    hash = (hash ^ ((start_time >> (i * 8)) & 0xff)) * 16777619u;
+  }
+
+  return hash;
+}
+
+static uint32_t
+hash_trigram(uint32_t key)
+{
+  return key * 2654435761u;
+}
+
+static unsigned char
+fold(unsigned char c)
+{
+  /* Only ASCII is folded; multi-byte UTF-8 sequences pass unchanged. */
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static int
+is_word_char(unsigned char c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+static uint32_t
+trigram_key(const char* s)
+{
+  return ((uint32_t)(unsigned char)s[0] << 16) |
+         ((uint32_t)(unsigned char)s[1] << 8) |
+         (uint32_t)(unsigned char)s[2];
+}
+
+/* Returns a case-folded copy of the program's title and description. */
+static char*
+fold_text(const struct tv_program* prog)
+{
+  const char* part[2];
+  size_t i, len;
+  char* text;
+
+  part[0] = prog->title ? prog->title : "";
+  part[1] = prog->descpt ? prog->descpt : "";
+
+  text = malloc(MAX_TEXT_LEN + 1);
+  if (!text) {
+    ALOGE_ERRNO("malloc");
+    return NULL;
+  }
+
+  len = 0;
+  for (i = 0; i < ARRAY_LENGTH(part); ++i) {
+    const unsigned char* s;
+    if (i && len < MAX_TEXT_LEN) {
+      text[len++] = '\n'; /* no word continues across the separator */
+    }
+    for (s = (const unsigned char*)part[i]; *s && len < MAX_TEXT_LEN; ++s) {
+      text[len++] = fold(*s);
+    }
+  }
+  text[len] = '\0';
+
+  return text;
+}
+
+static struct trigram*
+find_trigram(uint32_t key)
+{
+  uint32_t i;
+
+  if (!g_trigram_len) {
+    return NULL;
+  }
+
+  for (i = hash_trigram(key) & (g_trigram_len - 1);
+       g_trigram[i].key;
+       i = (i + 1) & (g_trigram_len - 1)) {
+    if (g_trigram[i].key == key) {
+      return g_trigram + i;
+    }
+  }
+  return NULL;
+}
+
+static int
+grow_trigrams(void)
+{
+  struct trigram* trigram;
+  uint32_t len, i, j;
+
+  len = g_trigram_len ? g_trigram_len * 2 : MIN_TRIGRAM_SLOTS;
+
+  trigram = calloc(len, sizeof(*trigram));
+  if (!trigram) {
+    ALOGE_ERRNO("calloc");
+    return -1;
+  }
+
+  for (i = 0; i < g_trigram_len; ++i) {
+    if (!g_trigram[i].key) {
+      continue;
+    }
+    for (j = hash_trigram(g_trigram[i].key) & (len - 1);
+         trigram[j].key;
+         j = (j + 1) & (len - 1)) {
+    }
+    trigram[j] = g_trigram[i];
+  }
+
+  free(g_trigram);
+  g_trigram = trigram;
+  g_trigram_len = len;
+
+  return 0;
+}
+
+static struct trigram*
+get_trigram(uint32_t key)
+{
+  struct trigram* trigram;
+  uint32_t i;
+
+  trigram = find_trigram(key);
+  if (trigram) {
+    return trigram;
+  }
+
+  /* keep the load factor below 1/2 */
+  if ((g_trigram_num + 1) * 2 > g_trigram_len) {
+    if (grow_trigrams() < 0) {
+      return NULL;
+    }
+  }
+
+  for (i = hash_trigram(key) & (g_trigram_len - 1);
+       g_trigram[i].key;
+       i = (i + 1) & (g_trigram_len - 1)) {
+  }
+  g_trigram[i].key = key;
+  ++g_trigram_num;
+
+  return g_trigram + i;
+}
+
+static int
+append_posting(struct trigram* trigram, uint32_t doc, uint32_t gen)
+{
+  if (trigram->num) {
+    const struct posting* last = trigram->posting + trigram->num - 1;
+    if (last->doc == doc && last->gen == gen) {
+      return 0; /* trigram occurs repeatedly in document */
+    }
+  }
+
+  if (trigram->num == trigram->len) {
+    uint32_t len = trigram->len ? trigram->len * 2 : 4;
+    void* posting = realloc(trigram->posting, len * sizeof(*trigram->posting));
+    if (!posting) {
+      ALOGE_ERRNO("realloc");
+      return -1;
+    }
+    trigram->posting = posting;
+    trigram->len = len;
+  }
+
+  trigram->posting[trigram->num].doc = doc;
+  trigram->posting[trigram->num].gen = gen;
+  ++trigram->num;
+
+  return 1;
+}
+
+static int
+is_live(const struct posting* posting)
+{
+  const struct doc* doc = g_doc + posting->doc;
+
+  return doc->num_postings && doc->gen == posting->gen;
+}
+
+/* Removes postings of removed documents from all posting lists. */
+static void
+compact_postings(void)
+{
+  uint32_t i, j, num;
+
+  for (i = 0; i < g_trigram_len; ++i) {
+    struct trigram* trigram = g_trigram + i;
+    num = 0;
+    for (j = 0; j < trigram->num; ++j) {
+      if (is_live(trigram->posting + j)) {
+        trigram->posting[num++] = trigram->posting[j];
+      }
+    }
+    trigram->num = num;
+    if (!num) {
+      free(trigram->posting);
+      trigram->posting = NULL;
+      trigram->len = 0;
+    }
+  }
+
+  g_stale_postings = 0;
+}
+
+static uint32_t
+find_doc(const char* tuner_id, uint8_t source_type, const char* ch_num,
+         const char* evt_id, uint64_t start_time)
+{
+  uint32_t hash, i;
+
+  hash = hash_key(tuner_id, source_type, ch_num, evt_id, start_time);
+
+  for (i = g_key_bucket[hash & (NUM_KEY_BUCKETS - 1)];
+       i != NO_DOC;
+       i = g_doc[i].next) {
+    const struct doc* doc = g_doc + i;
+    if (doc->hash == hash &&
+        doc->source_type == source_type &&
+        doc->start_time == start_time &&
+        !strcmp(doc->evt_id, evt_id) &&
+        !strcmp(doc->ch_num, ch_num) &&
+        !strcmp(doc->tuner_id, tuner_id)) {
+      return i;
+    }
+  }
+  return NO_DOC;
+}
+
+static uint32_t
+alloc_doc(void)
+{
+  uint32_t i;
+
+  if (g_free_doc == NO_DOC) {
+    uint32_t len = g_doc_len ? g_doc_len * 2 : 1024;
+    struct doc* doc = realloc(g_doc, len * sizeof(*doc));
+    if (!doc) {
+      ALOGE_ERRNO("realloc");
+      return NO_DOC;
+    }
+    memset(doc + g_doc_len, 0, (len - g_doc_len) * sizeof(*doc));
+    for (i = len; i > g_doc_len; --i) {
+      doc[i - 1].next = g_free_doc;
+      g_free_doc = i - 1;
+    }
+    g_doc = doc;
+    g_doc_len = len;
+  }
+
+  i = g_free_doc;
+  g_free_doc = g_doc[i].next;
+
+  return i;
+}
+
+static void
+free_doc(uint32_t i)
+{
+  struct doc* doc = g_doc + i;
+
+  free(doc->tuner_id);
+  free(doc->ch_num);
+  free(doc->evt_id);
+  free(doc->text);
+
+  doc->tuner_id = NULL;
+  doc->ch_num = NULL;
+  doc->evt_id = NULL;
+  doc->text = NULL;
+  doc->num_postings = 0;
+  ++doc->gen;
+
+  doc->next = g_free_doc;
+  g_free_doc = i;
+}
+
+static void
+unlink_doc(uint32_t i)
+{
+  uint32_t* link;
+
+  for (link = g_key_bucket + (g_doc[i].hash & (NUM_KEY_BUCKETS - 1));
+       *link != i;
+       link = &g_doc[*link].next) {
+    assert(*link != NO_DOC);
+  }
+  *link = g_doc[i].next;
+}
+
+static void
+remove_doc(uint32_t i)
+{
+  g_live_postings -= g_doc[i].num_postings;
+  g_stale_postings += g_doc[i].num_postings;
+
+  unlink_doc(i);
+  free_doc(i);
+
+  if (g_stale_postings > MIN_STALE_POSTINGS &&
+      g_stale_postings > g_live_postings) {
+    compact_postings();
+  }
+}
+
+/* Returns non-zero if the query occurs in the text. In prefix mode, the
+ * query has to start at a word boundary. */
+static int
+match_text(const char* text, const char* query, uint8_t mode)
+{
+  const char* pos;
+
+  for (pos = strstr(text, query); pos; pos = strstr(pos + 1, query)) {
+    if (mode != SEARCH_PREFIX ||
+        pos == text ||
+        !is_word_char((unsigned char)pos[-1])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int
+match_doc(const struct doc* doc, const char* tuner_id, uint8_t source_type,
+          const char* ch_num, uint64_t start_time, uint64_t end_time,
+          const char* query, uint8_t mode)
+{
+  return doc->num_postings &&
+         doc->source_type == source_type &&
+         doc->start_time <= end_time &&
+         doc->end_time > start_time &&
+         (!ch_num[0] || !strcmp(doc->ch_num, ch_num)) &&
+         !strcmp(doc->tuner_id, tuner_id) &&
+         match_text(doc->text, query, mode);
+}
+
+static int
+cmp_doc_start(const void* lhs, const void* rhs)
+{
+  const struct doc* l = g_doc + *(const uint32_t*)lhs;
+  const struct doc* r = g_doc + *(const uint32_t*)rhs;
+
+  if (l->start_time != r->start_time) {
+    return (l->start_time > r->start_time) - (l->start_time < r->start_time);
+  }
+  return strcmp(l->ch_num, r->ch_num);
+}
+
+/*
+ * Public interface
+ */
+
+int
+init_dtv_search()
+{
+  uint32_t i;
+
+  g_key_bucket = malloc(NUM_KEY_BUCKETS * sizeof(*g_key_bucket));
+  if (!g_key_bucket) {
+    ALOGE_ERRNO("malloc");
+    return -1;
+  }
+  for (i = 0; i < NUM_KEY_BUCKETS; ++i) {
+    g_key_bucket[i] = NO_DOC;
+  }
+
+  g_doc = NULL;
+  g_doc_len = 0;
+  g_free_doc = NO_DOC;
+
+  g_trigram = NULL;
+  g_trigram_len = 0;
+  g_trigram_num = 0;
+
+  g_live_postings = 0;
+  g_stale_postings = 0;
+
+  return 0;
+}
+
+void
+uninit_dtv_search()
+{
+  dtv_search_clear();
+
+  free(g_doc);
+  g_doc = NULL;
+  g_doc_len = 0;
+  g_free_doc = NO_DOC;
+
+  free(g_trigram);
+  g_trigram = NULL;
+  g_trigram_len = 0;
+  g_trigram_num = 0;
+
+  free(g_key_bucket);
+  g_key_bucket = NULL;
+}
+
+int
+dtv_search_add(const char* tuner_id,
+               uint8_t source_type,
+               const char* ch_num,
+               const struct tv_program* prog)
+{
+  uint32_t i, gen, num_postings;
+  struct doc* doc;
+  const char* evt_id;
+  const char* s;
+  int res;
+
+  assert(tuner_id);
+  assert(ch_num);
+  assert(prog);
+
+  evt_id = prog->evt_id ? prog->evt_id : "";
+
+  pthread_mutex_lock(&g_lock);
+
+  i = find_doc(tuner_id, source_type, ch_num, evt_id, prog->start_time);
+  if (i != NO_DOC) {
+    remove_doc(i); /* re-index the updated program */
+  }
+
+  i = alloc_doc();
+  if (i == NO_DOC) {
+    goto err_alloc_doc;
+  }
+  doc = g_doc + i;
+  gen = doc->gen;
+
+  doc->tuner_id = strdup(tuner_id);
+  doc->ch_num = strdup(ch_num);
+  doc->evt_id = strdup(evt_id);
+  if (!doc->tuner_id || !doc->ch_num || !doc->evt_id) {
+    ALOGE_ERRNO("strdup");
+    goto err_strdup;
+  }
+
+  doc->text = fold_text(prog);
+  if (!doc->text) {
+    goto err_fold_text;
+  }
+
+  doc->source_type = source_type;
+  doc->start_time = prog->start_time;
+  doc->end_time = prog->start_time + prog->duration;
+
+  num_postings = 0;
+  for (s = doc->text; s[0] && s[1] && s[2]; ++s) {
+    struct trigram* trigram = get_trigram(trigram_key(s));
+    if (!trigram) {
+      goto err_get_trigram;
+    }
+    res = append_posting(trigram, i, gen);
+    if (res < 0) {
+      goto err_get_trigram;
+    }
+    num_postings += res;
+  }
+
+  /* Even documents without trigrams count as used. */
+  doc->num_postings = num_postings ? num_postings : 1;
+  doc->hash = hash_key(tuner_id, source_type, ch_num, evt_id,
+                       prog->start_time);
+  doc->next = g_key_bucket[doc->hash & (NUM_KEY_BUCKETS - 1)];
+  g_key_bucket[doc->hash & (NUM_KEY_BUCKETS - 1)] = i;
+
+  g_live_postings += num_postings;
+
+  pthread_mutex_unlock(&g_lock);
+
+  return 0;
+
+err_get_trigram:
+  /* Postings that have been added become stale with the generation. */
+  g_stale_postings += num_postings;
+err_fold_text:
+err_strdup:
+  free_doc(i);
+err_alloc_doc:
+  pthread_mutex_unlock(&g_lock);
+  return -1;
+}
+
+int
+dtv_search_remove(const char* tuner_id,
+                  uint8_t source_type,
+                  const char* ch_num,
+                  const struct tv_program* prog)
+{
+  uint32_t i;
+
+  assert(tuner_id);
+  assert(ch_num);
+  assert(prog);
+
+  pthread_mutex_lock(&g_lock);
+
+  i = find_doc(tuner_id, source_type, ch_num,
+               prog->evt_id ? prog->evt_id : "", prog->start_time);
+  if (i != NO_DOC) {
+    remove_doc(i);
+  }
+
+  pthread_mutex_unlock(&g_lock);
+
+  return 0;
+}
+
+long
+dtv_search_find(const char* tuner_id,
+                uint8_t source_type,
+                const char* ch_num,
+                uint64_t start_time,
+                uint64_t end_time,
+                uint8_t mode,
+                const char* query,
+                uint32_t max_results,
+                struct dtv_search_result** results)
+{
+  char* folded;
+  size_t i, len;
+  uint32_t* match;
+  uint32_t num_matches, len_matches, num;
+  const struct trigram* rarest;
+  long res;
+
+  assert(tuner_id);
+  assert(ch_num);
+  assert(query);
+  assert(results);
+
+  len = strlen(query);
+  if (!len) {
+    ALOGE("empty search query");
+    return -1;
+  }
+
+  folded = strdup(query);
+  if (!folded) {
+    ALOGE_ERRNO("strdup");
+    return -1;
+  }
+  for (i = 0; i < len; ++i) {
+    folded[i] = fold((unsigned char)folded[i]);
+  }
+
+  match = NULL;
+  num_matches = 0;
+  len_matches = 0;
+
+  pthread_mutex_lock(&g_lock);
+
+  /* Every match contains all of the query's trigrams, so the posting list
+   * of the rarest trigram is a superset of the result. Queries without
+   * trigrams are answered by scanning all documents. */
+  rarest = NULL;
+  for (i = 0; i + 3 <= len; ++i) {
+    const struct trigram* trigram = find_trigram(trigram_key(folded + i));
+    if (!trigram || !trigram->num) {
+      goto done; /* no document contains the trigram */
+    }
+    if (!rarest || trigram->num < rarest->num) {
+      rarest = trigram;
+    }
+  }
+
+  num = rarest ? rarest->num : g_doc_len;
+
+  for (i = 0; i < num; ++i) {
+    uint32_t d;
+    if (rarest) {
+      if (!is_live(rarest->posting + i)) {
+        continue;
+      }
+      d = rarest->posting[i].doc;
+    } else {
+      d = i;
+    }
+    if (!match_doc(g_doc + d, tuner_id, source_type, ch_num,
+                   start_time, end_time, folded, mode)) {
+      continue;
+    }
+    if (num_matches == len_matches && num_matches / 2 >= max_results) {
+      /* only the earliest matches are returned; drop the others */
+      qsort(match, num_matches, sizeof(*match), cmp_doc_start);
+      num_matches = max_results;
+    }
+    if (num_matches == len_matches) {
+      uint32_t new_len = len_matches ? len_matches * 2 : 64;
+      void* p = realloc(match, new_len * sizeof(*match));
+      if (!p) {
+        ALOGE_ERRNO("realloc");
+        goto err_realloc;
+      }
+      match = p;
+      len_matches = new_len;
+    }
+    match[num_matches++] = d;
+  }
+
+  qsort(match, num_matches, sizeof(*match), cmp_doc_start);
+
+done:
+  if (num_matches > max_results) {
+    num_matches = max_results;
+  }
+
+  *results = calloc(num_matches ? num_matches : 1, sizeof(**results));
+  if (!*results) {
+    ALOGE_ERRNO("calloc");
+    goto err_calloc;
+  }
+
+  for (i = 0; i < num_matches; ++i) {
+    const struct doc* doc = g_doc + match[i];
+    struct dtv_search_result* result = *results + i;
+    result->ch_num = strdup(doc->ch_num);
+    result->evt_id = strdup(doc->evt_id);
+    result->start_time = doc->start_time;
+    if (!result->ch_num || !result->evt_id) {
+      ALOGE_ERRNO("strdup");
+      dtv_search_release_results(i + 1, *results);
+      goto err_strdup;
+    }
+  }
+  res = num_matches;
+
+  pthread_mutex_unlock(&g_lock);
+  free(match);
+  free(folded);
+
+  return res;
+
+err_strdup:
+err_calloc:
+err_realloc:
+  pthread_mutex_unlock(&g_lock);
+  free(match);
+  free(folded);
+  return -1;
+}
+
+void
+dtv_search_release_results(uint32_t num, struct dtv_search_result* results)
+{
+  uint32_t i;
+
+  for (i = 0; i < num; ++i) {
+    free(results[i].ch_num);
+    free(results[i].evt_id);
+  }
+  free(results);
+}
+
+void
+dtv_search_clear()
+{
+  uint32_t i;
+
+  pthread_mutex_lock(&g_lock);
+
+  for (i = 0; i < g_doc_len; ++i) {
+    if (g_doc[i].num_postings) {
+      free_doc(i);
+    }
+  }
+  for (i = 0; i < g_trigram_len; ++i) {
+    free(g_trigram[i].posting);
+  }
+  memset(g_trigram, 0, g_trigram_len * sizeof(*g_trigram));
+  g_trigram_num = 0;
+
+  if (g_key_bucket) {
+    for (i = 0; i < NUM_KEY_BUCKETS; ++i) {
+      g_key_bucket[i] = NO_DOC;
+    }
+  }
+
+  g_live_postings = 0;
+  g_stale_postings = 0;
+
+  pthread_mutex_unlock(&g_lock);
+}
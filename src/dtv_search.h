@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the interface to the program search index of the DTV
+ * service.
+ *
+ * The index maps trigrams of each program's title and description to the
+ * program. It is maintained by the EPG store, which calls |dtv_search_add|
+ * and |dtv_search_remove| whenever a program enters or leaves the store.
+ * Programs are identified by channel, event ID and start time.
+ *
+ * |dtv_search_find| returns the programs that match a query string, sorted
+ * by start time. With |SEARCH_SUBSTRING|, the query can appear anywhere in
+ * the title or description; with |SEARCH_PREFIX|, it has to appear at the
+ * beginning of a word. Matching ignores ASCII case. The results can be
+ * restricted to a channel and to programs that overlap a time window. An
+ * empty channel number matches all channels of the tuner and source type.
+ * At most |max_results| matches are returned. Each result contains the
+ * channel number, event ID and start time of the program, which can be
+ * used for looking up the full program in the EPG store. The caller has to
+ * free the results with |dtv_search_release_results|.
+ *
+ * All functions return 0 on success and -1 on errors; |dtv_search_find|
+ * returns the number of results. The index is thread-safe.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct tv_program;
+
+enum {
+  SEARCH_SUBSTRING = 0x00,
+  SEARCH_PREFIX = 0x01
+};
+
+struct dtv_search_result {
+  char* ch_num;
+  char* evt_id;
+  uint64_t start_time;
+};
+
+int
+init_dtv_search(void);
+
+void
+uninit_dtv_search(void);
+
+int
+dtv_search_add(const char* tuner_id,
+               uint8_t source_type,
+               const char* ch_num,
+               const struct tv_program* prog);
+
+int
+dtv_search_remove(const char* tuner_id,
+                  uint8_t source_type,
+                  const char* ch_num,
+                  const struct tv_program* prog);
+
+long
+dtv_search_find(const char* tuner_id,
+                uint8_t source_type,
+                const char* ch_num,
+                uint64_t start_time,
+                uint64_t end_time,
+                uint8_t mode,
+                const char* query,
+                uint32_t max_results,
+                struct dtv_search_result** results);
+
+void
+dtv_search_release_results(uint32_t num,
+                           struct dtv_search_result* results);
+
+void
+dtv_search_clear(void);
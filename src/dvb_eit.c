@@ -0,0 +1,794 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements the EIT assembler. See the corresponding header
+ * file for documentation.
+ */
+
+#include "dvb_eit.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+#include "dvb_si.h"
+#include "dvb_text.h"
+#include "log.h"
+#include "memptr.h"
+#include "tv_utils.h"
+
+enum {
+  NUM_BUCKETS = 256, /* must be a power of 2 */
+  TABLE_PF = 0,
+  NUM_TABLES = 17, /* present/following and 16 schedule tables */
+  MAX_SECTION_EVENTS = 256,
+  MAX_LANGS = 16,
+  COMPLETE_PF = 0x01,
+  COMPLETE_SCHEDULE = 0x02
+};
+
+struct eit_section {
+  uint32_t num;
+  struct tv_program* progs;
+};
+
+struct eit_table {
+  int version; /* -1 if nothing has been received */
+  uint8_t last_number;
+  uint8_t seen[256 / 8];
+  uint8_t seg_known[32 / 8];
+  uint8_t seg_last[32];
+  struct eit_section* section; /* 256 entries */
+};
+
+struct eit_service {
+  LIST_ENTRY(eit_service) bucket;
+  uint16_t original_network_id;
+  uint16_t transport_stream_id;
+  uint16_t service_id;
+  uint8_t num_schedule_tables; /* 0 if unknown */
+  uint8_t complete;
+  struct eit_table table[NUM_TABLES];
+};
+
+LIST_HEAD(eit_service_list, eit_service);
+
+struct dvb_eit {
+  dvb_eit_cb cb;
+  void* data;
+
+  struct tv_channel* channel;
+  size_t num_channels;
+  size_t max_channels;
+
+  struct eit_service_list service[NUM_BUCKETS];
+};
+
+/*
+ * Sub-tables
+ */
+
+static int
+table_index(uint8_t table_id)
+{
+  if (table_id < DVB_TABLE_EIT_SCHEDULE_ACTUAL) {
+    return TABLE_PF;
+  }
+  return (table_id & 0x0f) + 1;
+}
+
+static void
+reset_table(struct eit_table* table)
+{
+  unsigned long i;
+
+  if (table->section) {
+    for (i = 0; i < 256; ++i) {
+      release_programs(table->section[i].num, table->section[i].progs);
+    }
+    free(table->section);
+  }
+  memset(table, 0, sizeof(*table));
+  table->version = -1;
+}
+
+static int
+is_seen(const struct eit_table* table, const struct dvb_section* sec)
+{
+  return table->version == sec->version &&
+         table->seen[sec->number / 8] & (1 << (sec->number % 8));
+}
+
+/* Returns 1 if all sections of all segments have been received. Each
+ * segment of 8 sections ends at its own last section number. */
+static int
+is_table_complete(const struct eit_table* table)
+{
+  unsigned int seg, number;
+
+  if (table->version < 0) {
+    return 0;
+  }
+  for (seg = 0; seg <= table->last_number / 8u; ++seg) {
+    if (!(table->seg_known[seg / 8] & (1 << (seg % 8)))) {
+      return 0;
+    }
+    for (number = seg * 8; number <= table->seg_last[seg]; ++number) {
+      if (!(table->seen[number / 8] & (1 << (number % 8)))) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+/*
+ * Services
+ */
+
+static uint32_t
+hash_service(uint16_t original_network_id, uint16_t transport_stream_id,
+             uint16_t service_id)
+{
+  /* FNV-1a */
+  uint32_t hash = 2166136261u;
+  uint16_t id[3];
+  size_t i;
+
+  id[0] = original_network_id;
+  id[1] = transport_stream_id;
+  id[2] = service_id;
+
+  for (i = 0; i < ARRAY_LENGTH(id); ++i) {
+    hash = (hash ^ (id[i] & 0xff)) * 16777619u;
+    hash = (hash ^ (id[i] >> 8)) * 16777619u;
+  }
+
+  return hash;
+}
+
+static struct eit_service_list*
+service_bucket(struct dvb_eit* eit, uint16_t original_network_id,
+               uint16_t transport_stream_id, uint16_t service_id)
+{
+  uint32_t hash = hash_service(original_network_id, transport_stream_id,
+                               service_id);
+  return eit->service + (hash & (NUM_BUCKETS - 1));
+}
+
+static struct eit_service*
+find_service(struct dvb_eit* eit, uint16_t original_network_id,
+             uint16_t transport_stream_id, uint16_t service_id)
+{
+  struct eit_service* service;
+
+  LIST_FOREACH(service, service_bucket(eit, original_network_id,
+                                       transport_stream_id, service_id),
+               bucket) {
+    if (service->original_network_id == original_network_id &&
+        service->transport_stream_id == transport_stream_id &&
+        service->service_id == service_id) {
+      return service;
+    }
+  }
+  return NULL;
+}
+
+static struct eit_service*
+create_service(struct dvb_eit* eit, uint16_t original_network_id,
+               uint16_t transport_stream_id, uint16_t service_id)
+{
+  struct eit_service* service;
+  size_t i;
+
+  service = calloc(1, sizeof(*service));
+  if (!service) {
+    ALOGE_ERRNO("calloc");
+    return NULL;
+  }
+  service->original_network_id = original_network_id;
+  service->transport_stream_id = transport_stream_id;
+  service->service_id = service_id;
+  for (i = 0; i < ARRAY_LENGTH(service->table); ++i) {
+    service->table[i].version = -1;
+  }
+
+  LIST_INSERT_HEAD(service_bucket(eit, original_network_id,
+                                  transport_stream_id, service_id),
+                   service, bucket);
+  return service;
+}
+
+static void
+destroy_service(struct eit_service* service)
+{
+  size_t i;
+
+  LIST_REMOVE(service, bucket);
+
+  for (i = 0; i < ARRAY_LENGTH(service->table); ++i) {
+    reset_table(service->table + i);
+  }
+  free(service);
+}
+
+/*
+ * Channels
+ */
+
+static int
+is_channel(const struct tv_channel* ch, uint16_t original_network_id,
+           uint16_t transport_stream_id, uint16_t service_id)
+{
+  return ch->network_id && ch->trans_stream_id && ch->service_id &&
+         strtoul(ch->network_id, NULL, 0) == original_network_id &&
+         strtoul(ch->trans_stream_id, NULL, 0) == transport_stream_id &&
+         strtoul(ch->service_id, NULL, 0) == service_id;
+}
+
+static struct tv_channel*
+find_channel(const struct dvb_eit* eit, uint16_t original_network_id,
+             uint16_t transport_stream_id, uint16_t service_id)
+{
+  size_t i;
+
+  for (i = 0; i < eit->num_channels; ++i) {
+    if (is_channel(eit->channel + i, original_network_id,
+                   transport_stream_id, service_id)) {
+      return eit->channel + i;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Events
+ */
+
+static int
+add_lang(char** lang, uint32_t* num, const uint8_t* code)
+{
+  char str[4];
+  uint32_t i;
+
+  if (*num == MAX_LANGS) {
+    return 0;
+  }
+  dvb_text_decode(str, sizeof(str), code, 3);
+  for (i = 0; i < *num; ++i) {
+    if (!strcmp(lang[i], str)) {
+      return 0;
+    }
+  }
+  lang[*num] = strdup(str);
+  if (!lang[*num]) {
+    ALOGE_ERRNO("strdup");
+    return -1;
+  }
+  ++*num;
+
+  return 0;
+}
+
+static char**
+copy_langs(char** lang, uint32_t num)
+{
+  char** langs;
+
+  langs = malloc((num ? num : 1) * sizeof(*langs));
+  if (!langs) {
+    ALOGE_ERRNO("malloc");
+    return NULL;
+  }
+  memcpy(langs, lang, num * sizeof(*langs));
+
+  return langs;
+}
+
+static int
+decode_event(const struct dvb_event* evt, struct tv_program* prog)
+{
+  char title[DVB_TEXT_MAX_LEN(255)];
+  char descpt[DVB_TEXT_MAX_LEN(DVB_MAX_SECTION_LEN)];
+  char rating[32];
+  char evt_id[8];
+  char* lang[MAX_LANGS];
+  char* stl_lang[MAX_LANGS];
+  uint32_t lang_num, stl_lang_num, i;
+  size_t descpt_len;
+  const uint8_t* p;
+  const uint8_t* end;
+
+  title[0] = '\0';
+  descpt[0] = '\0';
+  descpt_len = 0;
+  rating[0] = '\0';
+  lang_num = 0;
+  stl_lang_num = 0;
+
+  p = evt->desc;
+  end = p + evt->desc_len;
+
+  while (end - p >= 2 && end - p >= 2 + p[1]) {
+    const uint8_t* d = p + 2;
+    uint8_t len = p[1];
+
+    switch (p[0]) {
+      case DVB_DESC_SHORT_EVENT:
+        /* language, event name, text */
+        if (len >= 5 && 4 + d[3] < len && 5 + d[3] + d[4 + d[3]] <= len &&
+            !title[0]) {
+          dvb_text_decode(title, sizeof(title), d + 4, d[3]);
+          descpt_len = dvb_text_decode(descpt, sizeof(descpt),
+                                       d + 5 + d[3], d[4 + d[3]]);
+        }
+        break;
+      case DVB_DESC_EXTENDED_EVENT:
+        /* number, language, items, text */
+        if (len >= 6 && 5 + d[4] < len && 6 + d[4] + d[5 + d[4]] <= len) {
+          if (descpt_len && !(d[0] >> 4) && descpt_len + 1 < sizeof(descpt)) {
+            descpt[descpt_len++] = '\n'; /* first extended descriptor */
+          }
+          descpt_len += dvb_text_decode(descpt + descpt_len,
+                                        sizeof(descpt) - descpt_len,
+                                        d + 6 + d[4], d[5 + d[4]]);
+        }
+        break;
+      case DVB_DESC_COMPONENT:
+        /* stream content, component type, tag, language */
+        if (len >= 6) {
+          uint8_t content = d[0] & 0x0f;
+          int res = 0;
+          if (content == 0x02 || content == 0x04 || content == 0x06) {
+            res = add_lang(lang, &lang_num, d + 3);
+          } else if (content == 0x03 && d[1] >= 0x10 && d[1] <= 0x25) {
+            res = add_lang(stl_lang, &stl_lang_num, d + 3);
+          }
+          if (res < 0) {
+            goto err_add_lang;
+          }
+        }
+        break;
+      case DVB_DESC_PARENTAL_RATING:
+        /* country, rating; use the first entry */
+        if (len >= 4 && d[3] >= 0x01 && d[3] <= 0x0f && !rating[0]) {
+          snprintf(rating, sizeof(rating), "com.android.tv/DVB/DVB_%u",
+                   d[3] + 3);
+        }
+        break;
+      default:
+        break;
+    }
+    p += 2 + len;
+  }
+
+  snprintf(evt_id, sizeof(evt_id), "%u", evt->event_id);
+
+  memset(prog, 0, sizeof(*prog));
+
+  /* |prog| takes over the languages */
+  prog->langs = copy_langs(lang, lang_num);
+  if (!prog->langs) {
+    goto err_copy_langs;
+  }
+  prog->lang_num = lang_num;
+  lang_num = 0;
+
+  prog->stl_langs = copy_langs(stl_lang, stl_lang_num);
+  if (!prog->stl_langs) {
+    goto err_copy_stl_langs;
+  }
+  prog->stl_lang_num = stl_lang_num;
+  stl_lang_num = 0;
+
+  prog->evt_id = strdup(evt_id);
+  prog->title = strdup(title);
+  prog->start_time = evt->start_time;
+  prog->duration = (uint64_t)evt->duration * 1000;
+  prog->descpt = strdup(descpt);
+  prog->rating = strdup(rating);
+
+  if (!prog->evt_id || !prog->title || !prog->descpt || !prog->rating) {
+    ALOGE_ERRNO("strdup");
+    goto err_strdup;
+  }
+
+  return 0;
+
+err_strdup:
+err_copy_stl_langs:
+  clear_program(prog);
+err_copy_langs:
+err_add_lang:
+  for (i = 0; i < lang_num; ++i) {
+    free(lang[i]);
+  }
+  for (i = 0; i < stl_lang_num; ++i) {
+    free(stl_lang[i]);
+  }
+  return -1;
+}
+
+/* Decodes the events of a section. Events without start time are
+ * skipped. */
+static int
+decode_section(const struct dvb_section* sec, struct dvb_eit_header* hdr,
+               struct eit_section* section)
+{
+  struct dvb_event event[MAX_SECTION_EVENTS];
+  struct tv_program* progs;
+  uint32_t num;
+  long res, i;
+
+  res = dvb_parse_eit(sec, hdr, event, ARRAY_LENGTH(event));
+  if (res < 0) {
+    return -1;
+  }
+
+  progs = calloc(res ? res : 1, sizeof(*progs));
+  if (!progs) {
+    ALOGE_ERRNO("calloc");
+    return -1;
+  }
+
+  num = 0;
+  for (i = 0; i < res; ++i) {
+    if (!event[i].start_time) {
+      continue;
+    }
+    if (decode_event(event + i, progs + num) < 0) {
+      goto err_decode_event;
+    }
+    ++num;
+  }
+
+  section->num = num;
+  section->progs = progs;
+
+  return 0;
+
+err_decode_event:
+  release_programs(num, progs);
+  return -1;
+}
+
+/*
+ * Batches
+ */
+
+static int
+cmp_start_time(const void* lhs, const void* rhs)
+{
+  const struct tv_program* l = lhs;
+  const struct tv_program* r = rhs;
+
+  return (l->start_time > r->start_time) - (l->start_time < r->start_time);
+}
+
+/* Reports the events of the sub-tables from |first| to |last|. */
+static int
+report_batch(struct dvb_eit* eit, const struct eit_service* service,
+             unsigned int first, unsigned int last)
+{
+  char network_id[8], trans_stream_id[8], service_id[8];
+  struct tv_channel tmp_ch;
+  const struct tv_channel* ch;
+  struct tv_program* progs;
+  uint32_t num;
+  unsigned int i, j;
+
+  num = 0;
+  for (i = first; i <= last; ++i) {
+    for (j = 0; j <= service->table[i].last_number; ++j) {
+      num += service->table[i].section[j].num;
+    }
+  }
+  if (!num) {
+    return 0;
+  }
+
+  /* shallow copies; the sections keep the programs */
+  progs = malloc(num * sizeof(*progs));
+  if (!progs) {
+    ALOGE_ERRNO("malloc");
+    return -1;
+  }
+
+  num = 0;
+  for (i = first; i <= last; ++i) {
+    for (j = 0; j <= service->table[i].last_number; ++j) {
+      const struct eit_section* section = service->table[i].section + j;
+      if (!section->num) {
+        continue;
+      }
+      memcpy(progs + num, section->progs, section->num * sizeof(*progs));
+      num += section->num;
+    }
+  }
+  qsort(progs, num, sizeof(*progs), cmp_start_time);
+
+  ch = find_channel(eit, service->original_network_id,
+                    service->transport_stream_id, service->service_id);
+  if (!ch) {
+    snprintf(network_id, sizeof(network_id), "%u",
+             service->original_network_id);
+    snprintf(trans_stream_id, sizeof(trans_stream_id), "%u",
+             service->transport_stream_id);
+    snprintf(service_id, sizeof(service_id), "%u", service->service_id);
+
+    memset(&tmp_ch, 0, sizeof(tmp_ch));
+    tmp_ch.network_id = network_id;
+    tmp_ch.trans_stream_id = trans_stream_id;
+    tmp_ch.service_id = service_id;
+    tmp_ch.number = service_id;
+    tmp_ch.name = "";
+    ch = &tmp_ch;
+  }
+
+  eit->cb(eit->data, ch, num, progs);
+
+  free(progs);
+
+  return 0;
+}
+
+static int
+is_schedule_complete(const struct eit_service* service)
+{
+  unsigned int i;
+
+  if (!service->num_schedule_tables) {
+    return 0;
+  }
+  for (i = 1; i <= service->num_schedule_tables; ++i) {
+    if (!is_table_complete(service->table + i)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Public interfaces
+ */
+
+struct dvb_eit*
+create_dvb_eit(dvb_eit_cb cb, void* data)
+{
+  struct dvb_eit* eit;
+  size_t i;
+
+  assert(cb);
+
+  eit = calloc(1, sizeof(*eit));
+  if (!eit) {
+    ALOGE_ERRNO("calloc");
+    return NULL;
+  }
+  eit->cb = cb;
+  eit->data = data;
+
+  for (i = 0; i < ARRAY_LENGTH(eit->service); ++i) {
+    LIST_INIT(eit->service + i);
+  }
+
+  return eit;
+}
+
+void
+destroy_dvb_eit(struct dvb_eit* eit)
+{
+  size_t i;
+
+  if (!eit) {
+    return;
+  }
+
+  for (i = 0; i < ARRAY_LENGTH(eit->service); ++i) {
+    while (!LIST_EMPTY(eit->service + i)) {
+      destroy_service(LIST_FIRST(eit->service + i));
+    }
+  }
+  for (i = 0; i < eit->num_channels; ++i) {
+    clear_channel(eit->channel + i);
+  }
+  free(eit->channel);
+  free(eit);
+}
+
+int
+dvb_eit_add_channel(struct dvb_eit* eit, const struct tv_channel* ch)
+{
+  struct tv_channel copy;
+  struct tv_channel* old;
+
+  assert(eit);
+  assert(ch);
+
+  if (!ch->network_id || !ch->trans_stream_id || !ch->service_id) {
+    ALOGE("channel without IDs");
+    return -1;
+  }
+
+  if (copy_channel(&copy, ch) < 0) {
+    return -1;
+  }
+
+  old = find_channel(eit, strtoul(ch->network_id, NULL, 0),
+                     strtoul(ch->trans_stream_id, NULL, 0),
+                     strtoul(ch->service_id, NULL, 0));
+  if (old) {
+    clear_channel(old);
+    *old = copy;
+    return 0;
+  }
+
+  if (eit->num_channels == eit->max_channels) {
+    size_t max = eit->max_channels ? eit->max_channels * 2 : 16;
+    void* channel = realloc(eit->channel, max * sizeof(*eit->channel));
+    if (!channel) {
+      ALOGE_ERRNO("realloc");
+      goto err_realloc;
+    }
+    eit->channel = channel;
+    eit->max_channels = max;
+  }
+  eit->channel[eit->num_channels++] = copy;
+
+  return 0;
+
+err_realloc:
+  clear_channel(&copy);
+  return -1;
+}
+
+int
+dvb_eit_feed(struct dvb_eit* eit, const uint8_t* buf, size_t len)
+{
+  struct dvb_section sec;
+  struct dvb_eit_header hdr;
+  struct eit_section section;
+  struct eit_service* service;
+  struct eit_table* table;
+  uint16_t original_network_id, transport_stream_id;
+  unsigned int idx, seg, seg_end;
+
+  assert(eit);
+  assert(buf);
+
+  if (dvb_parse_section_header(buf, len, &sec) < 0) {
+    return -1;
+  }
+  if (!sec.syntax || !sec.current ||
+      sec.table_id < DVB_TABLE_EIT_PF_ACTUAL ||
+      sec.table_id > DVB_TABLE_EIT_LAST) {
+    return 0;
+  }
+  if (sec.payload_len < 6) {
+    ALOGW("malformed EIT section");
+    return -1;
+  }
+
+  /* fast path for repeated sections */
+  transport_stream_id = (sec.payload[0] << 8) | sec.payload[1];
+  original_network_id = (sec.payload[2] << 8) | sec.payload[3];
+  idx = table_index(sec.table_id);
+
+  service = find_service(eit, original_network_id, transport_stream_id,
+                         sec.table_id_ext);
+  if (service && is_seen(service->table + idx, &sec)) {
+    return 0;
+  }
+
+  if (dvb_parse_section(buf, len, &sec) < 0) {
+    return -1;
+  }
+  if (decode_section(&sec, &hdr, &section) < 0) {
+    return -1;
+  }
+
+  if (!service) {
+    service = create_service(eit, original_network_id, transport_stream_id,
+                             sec.table_id_ext);
+    if (!service) {
+      goto err_create_service;
+    }
+  }
+
+  table = service->table + idx;
+
+  if (table->version != sec.version ||
+      table->last_number != sec.last_number) {
+    reset_table(table);
+    table->version = sec.version;
+    table->last_number = sec.last_number;
+    service->complete &= idx == TABLE_PF ? ~COMPLETE_PF : ~COMPLETE_SCHEDULE;
+  }
+
+  if (!table->section) {
+    table->section = calloc(256, sizeof(*table->section));
+    if (!table->section) {
+      ALOGE_ERRNO("calloc");
+      goto err_calloc;
+    }
+  }
+
+  table->section[sec.number] = section;
+  table->seen[sec.number / 8] |= 1 << (sec.number % 8);
+
+  /* Each segment of 8 sections has its own last section number. */
+  seg = sec.number / 8;
+  seg_end = seg * 8 + 7 < table->last_number ? seg * 8 + 7
+                                             : table->last_number;
+  if (hdr.segment_last_section_number < sec.number) {
+    table->seg_last[seg] = sec.number;
+  } else if (hdr.segment_last_section_number > seg_end) {
+    table->seg_last[seg] = seg_end;
+  } else {
+    table->seg_last[seg] = hdr.segment_last_section_number;
+  }
+  table->seg_known[seg / 8] |= 1 << (seg % 8);
+
+  if (idx != TABLE_PF && hdr.last_table_id >= sec.table_id &&
+      (hdr.last_table_id & 0xf0) == (sec.table_id & 0xf0)) {
+    service->num_schedule_tables = (hdr.last_table_id & 0x0f) + 1;
+  }
+
+  if (idx == TABLE_PF) {
+    if (is_table_complete(table)) {
+      service->complete |= COMPLETE_PF;
+      report_batch(eit, service, TABLE_PF, TABLE_PF);
+    }
+  } else if (is_schedule_complete(service)) {
+    service->complete |= COMPLETE_SCHEDULE;
+    report_batch(eit, service, 1, service->num_schedule_tables);
+  }
+
+  return 1;
+
+err_calloc:
+err_create_service:
+  release_programs(section.num, section.progs);
+  return -1;
+}
+
+int
+dvb_eit_is_complete(const struct dvb_eit* eit)
+{
+  const struct eit_service* service;
+  int found;
+  size_t i;
+
+  assert(eit);
+
+  found = 0;
+
+  for (i = 0; i < ARRAY_LENGTH(eit->service); ++i) {
+    LIST_FOREACH(service, eit->service + i, bucket) {
+      if (!(service->complete & COMPLETE_PF)) {
+        return 0;
+      }
+      if (service->num_schedule_tables &&
+          !(service->complete & COMPLETE_SCHEDULE)) {
+        return 0;
+      }
+      found = 1;
+    }
+  }
+  return found;
+}
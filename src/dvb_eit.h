@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the EIT assembler. It turns EIT sections into
+ * batches of programs per service.
+ *
+ * |create_dvb_eit| returns an assembler that reports complete batches to
+ * |cb|, and |destroy_dvb_eit| releases it. Sections of any transport
+ * stream are passed to |dvb_eit_feed|, which returns 1 if the section has
+ * been added, 0 if it has been skipped, or -1 on errors.
+ *
+ * EIT sub-tables are keyed by table ID, original network ID, transport
+ * stream ID and service ID. For each sub-table, the assembler tracks the
+ * version and a bitmap of received section numbers. Repeated sections
+ * are dropped after parsing the section header, before checking the CRC
+ * or decoding any events. Once the schedule is complete, feeding sections
+ * costs little more than a hash lookup per section.
+ *
+ * Each service has two batches. The present/following batch is reported
+ * when both of its sections have been received. The schedule batch is
+ * reported when all sections of all schedule tables up to the signalled
+ * last table ID have been received, taking segments into account. A new
+ * version of a sub-table replaces its events, and the batch is reported
+ * again once it's complete. Batches are sorted by start time.
+ *
+ * Batches are reported for the channel that has been registered with
+ * |dvb_eit_add_channel| for the service's network, transport stream and
+ * service IDs. Without registered channel, the assembler reports a
+ * channel with the service ID as number.
+ *
+ * |dvb_eit_is_complete| returns 1 if all services that have been seen
+ * so far have complete batches.
+ *
+ * Assemblers don't lock; each one is used by a single thread. All
+ * functions return 0 on success and -1 on errors unless noted otherwise.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct dvb_eit;
+struct tv_channel;
+struct tv_program;
+
+typedef void (*dvb_eit_cb)(void* data, const struct tv_channel* ch,
+                           uint32_t prog_num, const struct tv_program* progs);
+
+struct dvb_eit*
+create_dvb_eit(dvb_eit_cb cb, void* data);
+
+void
+destroy_dvb_eit(struct dvb_eit* eit);
+
+int
+dvb_eit_add_channel(struct dvb_eit* eit, const struct tv_channel* ch);
+
+int
+dvb_eit_feed(struct dvb_eit* eit, const uint8_t* buf, size_t len);
+
+int
+dvb_eit_is_complete(const struct dvb_eit* eit);
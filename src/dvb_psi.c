@@ -0,0 +1,617 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements the table tracker of a transport stream. See the
+ * corresponding header file for documentation.
+ */
+
+#include "dvb_psi.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dvb_si.h"
+#include "dvb_text.h"
+#include "log.h"
+#include "memptr.h"
+
+enum {
+  /* PSI sections are at most 1024 bytes long, which limits the number of
+   * entries per section. */
+  MAX_SECTION_ENTRIES = 256,
+  RUNNING_STATUS_NOT_RUNNING = 0x01
+};
+
+struct table {
+  int version; /* -1 if nothing has been received */
+  uint16_t table_id_ext;
+  uint8_t last_number;
+  unsigned int num_seen;
+  uint8_t seen[256 / 8];
+};
+
+struct program {
+  uint16_t number;
+  uint16_t pmt_pid;
+  uint8_t has_video;
+  uint8_t has_audio;
+  uint8_t has_ca;
+  struct table pmt;
+};
+
+struct service {
+  uint16_t service_id;
+  uint8_t running_status;
+  uint8_t free_ca_mode;
+  uint8_t service_type;
+  char* name;
+};
+
+struct dvb_psi {
+  uint16_t original_network_id;
+
+  struct table pat;
+  struct program* program;
+  size_t num_programs;
+  size_t max_programs;
+
+  struct table sdt;
+  struct service* service;
+  size_t num_services;
+  size_t max_services;
+
+  struct table nit;
+  struct dvb_lcn* lcn;
+  size_t num_lcns;
+  size_t max_lcns;
+};
+
+/*
+ * Tables
+ */
+
+static void
+reset_table(struct table* table)
+{
+  table->version = -1;
+  table->table_id_ext = 0;
+  table->last_number = 0;
+  table->num_seen = 0;
+  memset(table->seen, 0, sizeof(table->seen));
+}
+
+static int
+is_seen(const struct table* table, const struct dvb_section* sec)
+{
+  return table->version == sec->version &&
+         table->table_id_ext == sec->table_id_ext &&
+         table->seen[sec->number / 8] & (1 << (sec->number % 8));
+}
+
+static int
+is_new_version(const struct table* table, const struct dvb_section* sec)
+{
+  return table->version != sec->version ||
+         table->table_id_ext != sec->table_id_ext ||
+         table->last_number != sec->last_number;
+}
+
+static void
+start_version(struct table* table, const struct dvb_section* sec)
+{
+  reset_table(table);
+  table->version = sec->version;
+  table->table_id_ext = sec->table_id_ext;
+  table->last_number = sec->last_number;
+}
+
+static void
+mark_seen(struct table* table, const struct dvb_section* sec)
+{
+  table->seen[sec->number / 8] |= 1 << (sec->number % 8);
+  ++table->num_seen;
+}
+
+static int
+is_complete(const struct table* table)
+{
+  return table->version >= 0 && table->num_seen == table->last_number + 1u;
+}
+
+static int
+grow(void** array, size_t* max, size_t size, size_t need)
+{
+  size_t new_max;
+  void* new_array;
+
+  if (need <= *max) {
+    return 0;
+  }
+  new_max = *max ? *max : 16;
+  while (new_max < need) {
+    new_max *= 2;
+  }
+  new_array = realloc(*array, new_max * size);
+  if (!new_array) {
+    ALOGE_ERRNO("realloc");
+    return -1;
+  }
+  *array = new_array;
+  *max = new_max;
+
+  return 0;
+}
+
+/*
+ * PAT and PMTs
+ */
+
+static struct program*
+find_program(const struct dvb_psi* psi, uint16_t number)
+{
+  size_t i;
+
+  for (i = 0; i < psi->num_programs; ++i) {
+    if (psi->program[i].number == number) {
+      return psi->program + i;
+    }
+  }
+  return NULL;
+}
+
+static int
+merge_pat(struct dvb_psi* psi, const struct dvb_section* sec)
+{
+  struct dvb_pat_entry entry[MAX_SECTION_ENTRIES];
+  long num, i;
+
+  num = dvb_parse_pat(sec, entry, ARRAY_LENGTH(entry));
+  if (num < 0) {
+    return -1;
+  }
+
+  for (i = 0; i < num; ++i) {
+    struct program* prog;
+
+    if (!entry[i].program_number ||
+        find_program(psi, entry[i].program_number)) {
+      continue; /* network PID or duplicate */
+    }
+    if (grow((void**)&psi->program, &psi->max_programs,
+             sizeof(*psi->program), psi->num_programs + 1) < 0) {
+      return -1;
+    }
+    prog = psi->program + psi->num_programs++;
+    memset(prog, 0, sizeof(*prog));
+    prog->number = entry[i].program_number;
+    prog->pmt_pid = entry[i].pid;
+    reset_table(&prog->pmt);
+  }
+
+  return 0;
+}
+
+static int
+is_video(uint8_t stream_type)
+{
+  switch (stream_type) {
+    case 0x01: /* MPEG-1 */
+    case 0x02: /* MPEG-2 */
+    case 0x10: /* MPEG-4 part 2 */
+    case 0x1b: /* H.264 */
+    case 0x24: /* HEVC */
+    case 0x42: /* AVS */
+      return 1;
+    default:
+      break;
+  }
+  return 0;
+}
+
+static int
+is_audio(uint8_t stream_type)
+{
+  switch (stream_type) {
+    case 0x03: /* MPEG-1 */
+    case 0x04: /* MPEG-2 */
+    case 0x0f: /* AAC ADTS */
+    case 0x11: /* AAC LATM */
+    case 0x81: /* AC-3 in ATSC */
+    case 0x87: /* E-AC-3 in ATSC */
+      return 1;
+    default:
+      break;
+  }
+  return 0;
+}
+
+static int
+merge_pmt(struct program* prog, const struct dvb_section* sec)
+{
+  struct dvb_pmt pmt;
+  struct dvb_pmt_stream stream[MAX_SECTION_ENTRIES];
+  long num, i;
+
+  num = dvb_parse_pmt(sec, &pmt, stream, ARRAY_LENGTH(stream));
+  if (num < 0) {
+    return -1;
+  }
+
+  for (i = 0; i < num; ++i) {
+    prog->has_video |= is_video(stream[i].stream_type);
+    prog->has_audio |= is_audio(stream[i].stream_type);
+  }
+  prog->has_ca |= pmt.has_ca;
+
+  return 0;
+}
+
+/*
+ * SDT
+ */
+
+static struct service*
+find_service(const struct dvb_psi* psi, uint16_t service_id)
+{
+  size_t i;
+
+  for (i = 0; i < psi->num_services; ++i) {
+    if (psi->service[i].service_id == service_id) {
+      return psi->service + i;
+    }
+  }
+  return NULL;
+}
+
+static void
+clear_services(struct dvb_psi* psi)
+{
+  size_t i;
+
+  for (i = 0; i < psi->num_services; ++i) {
+    free(psi->service[i].name);
+  }
+  psi->num_services = 0;
+}
+
+static int
+merge_sdt(struct dvb_psi* psi, const struct dvb_section* sec)
+{
+  struct dvb_service service[MAX_SECTION_ENTRIES];
+  long num, i;
+
+  num = dvb_parse_sdt(sec, &psi->original_network_id, service,
+                      ARRAY_LENGTH(service));
+  if (num < 0) {
+    return -1;
+  }
+
+  for (i = 0; i < num; ++i) {
+    struct service* s;
+
+    if (find_service(psi, service[i].service_id)) {
+      continue;
+    }
+    if (grow((void**)&psi->service, &psi->max_services,
+             sizeof(*psi->service), psi->num_services + 1) < 0) {
+      return -1;
+    }
+    s = psi->service + psi->num_services;
+    s->service_id = service[i].service_id;
+    s->running_status = service[i].running_status;
+    s->free_ca_mode = service[i].free_ca_mode;
+    s->service_type = service[i].service_type;
+    s->name = dvb_text_dup(service[i].name, service[i].name_len);
+    if (!s->name) {
+      return -1;
+    }
+    ++psi->num_services;
+  }
+
+  return 0;
+}
+
+/*
+ * NIT
+ */
+
+static const struct dvb_lcn*
+find_lcn(const struct dvb_psi* psi, uint16_t transport_stream_id,
+         uint16_t service_id)
+{
+  size_t i;
+
+  for (i = 0; i < psi->num_lcns; ++i) {
+    const struct dvb_lcn* lcn = psi->lcn + i;
+    if (lcn->transport_stream_id == transport_stream_id &&
+        lcn->original_network_id == psi->original_network_id &&
+        lcn->service_id == service_id) {
+      return lcn;
+    }
+  }
+  return NULL;
+}
+
+static int
+merge_nit(struct dvb_psi* psi, const struct dvb_section* sec)
+{
+  struct dvb_lcn lcn[MAX_SECTION_ENTRIES];
+  long num;
+
+  num = dvb_parse_lcn(sec, lcn, ARRAY_LENGTH(lcn));
+  if (num < 0) {
+    return -1;
+  }
+  if (grow((void**)&psi->lcn, &psi->max_lcns, sizeof(*psi->lcn),
+           psi->num_lcns + num) < 0) {
+    return -1;
+  }
+  memcpy(psi->lcn + psi->num_lcns, lcn, num * sizeof(*lcn));
+  psi->num_lcns += num;
+
+  return 0;
+}
+
+/*
+ * Public interfaces
+ */
+
+struct dvb_psi*
+create_dvb_psi(void)
+{
+  struct dvb_psi* psi;
+
+  psi = calloc(1, sizeof(*psi));
+  if (!psi) {
+    ALOGE_ERRNO("calloc");
+    return NULL;
+  }
+  reset_table(&psi->pat);
+  reset_table(&psi->sdt);
+  reset_table(&psi->nit);
+
+  return psi;
+}
+
+void
+destroy_dvb_psi(struct dvb_psi* psi)
+{
+  if (!psi) {
+    return;
+  }
+  clear_services(psi);
+  free(psi->service);
+  free(psi->program);
+  free(psi->lcn);
+  free(psi);
+}
+
+int
+dvb_psi_feed(struct dvb_psi* psi, const uint8_t* buf, size_t len)
+{
+  struct dvb_section sec;
+  struct table* table;
+  struct program* prog;
+  int res;
+
+  assert(psi);
+  assert(buf);
+
+  if (dvb_parse_section_header(buf, len, &sec) < 0) {
+    return -1;
+  }
+  if (!sec.syntax || !sec.current) {
+    return 0;
+  }
+
+  prog = NULL;
+
+  switch (sec.table_id) {
+    case DVB_TABLE_PAT:
+      table = &psi->pat;
+      break;
+    case DVB_TABLE_PMT:
+      prog = find_program(psi, sec.table_id_ext);
+      if (!prog) {
+        return 0; /* not (yet) in PAT */
+      }
+      table = &prog->pmt;
+      break;
+    case DVB_TABLE_SDT_ACTUAL:
+      table = &psi->sdt;
+      break;
+    case DVB_TABLE_NIT_ACTUAL:
+      table = &psi->nit;
+      break;
+    default:
+      return 0;
+  }
+
+  if (is_seen(table, &sec)) {
+    return 0; /* fast path for repeated sections */
+  }
+
+  if (dvb_parse_section(buf, len, &sec) < 0) {
+    return -1;
+  }
+
+  if (is_new_version(table, &sec)) {
+    switch (sec.table_id) {
+      case DVB_TABLE_PAT:
+        psi->num_programs = 0;
+        break;
+      case DVB_TABLE_PMT:
+        prog->has_video = 0;
+        prog->has_audio = 0;
+        prog->has_ca = 0;
+        break;
+      case DVB_TABLE_SDT_ACTUAL:
+        clear_services(psi);
+        break;
+      case DVB_TABLE_NIT_ACTUAL:
+        psi->num_lcns = 0;
+        break;
+    }
+    start_version(table, &sec);
+  }
+
+  switch (sec.table_id) {
+    case DVB_TABLE_PAT:
+      res = merge_pat(psi, &sec);
+      break;
+    case DVB_TABLE_PMT:
+      res = merge_pmt(prog, &sec);
+      break;
+    case DVB_TABLE_SDT_ACTUAL:
+      res = merge_sdt(psi, &sec);
+      break;
+    default:
+      res = merge_nit(psi, &sec);
+      break;
+  }
+  if (res < 0) {
+    return -1;
+  }
+
+  mark_seen(table, &sec);
+
+  return 1;
+}
+
+int
+dvb_psi_next_missing(const struct dvb_psi* psi, uint16_t* pid,
+                     uint8_t* table_id)
+{
+  size_t i;
+
+  assert(psi);
+  assert(pid);
+  assert(table_id);
+
+  if (!is_complete(&psi->pat)) {
+    *pid = DVB_PID_PAT;
+    *table_id = DVB_TABLE_PAT;
+    return 1;
+  }
+  for (i = 0; i < psi->num_programs; ++i) {
+    if (!is_complete(&psi->program[i].pmt)) {
+      *pid = psi->program[i].pmt_pid;
+      *table_id = DVB_TABLE_PMT;
+      return 1;
+    }
+  }
+  if (!is_complete(&psi->sdt)) {
+    *pid = DVB_PID_SDT;
+    *table_id = DVB_TABLE_SDT_ACTUAL;
+    return 1;
+  }
+  return 0;
+}
+
+static char*
+format_id(uint32_t id)
+{
+  char buf[16];
+  char* str;
+
+  snprintf(buf, sizeof(buf), "%u", id);
+
+  str = strdup(buf);
+  if (!str) {
+    ALOGE_ERRNO("strdup");
+  }
+  return str;
+}
+
+static char
+channel_type(const struct program* prog, const struct service* service)
+{
+  if (service && service->service_type) {
+    return service->service_type;
+  } else if (prog->has_video) {
+    return DVB_SERVICE_TYPE_TV;
+  } else if (prog->has_audio) {
+    return DVB_SERVICE_TYPE_RADIO;
+  }
+  return 0;
+}
+
+int
+dvb_psi_get_channels(const struct dvb_psi* psi, uint32_t* ch_num,
+                     struct tv_channel** ch)
+{
+  struct tv_channel* channel;
+  uint32_t num;
+  size_t i;
+
+  assert(psi);
+  assert(ch_num);
+  assert(ch);
+
+  channel = calloc(psi->num_programs ? psi->num_programs : 1,
+                   sizeof(*channel));
+  if (!channel) {
+    ALOGE_ERRNO("calloc");
+    return -1;
+  }
+
+  num = 0;
+
+  for (i = 0; i < psi->num_programs; ++i) {
+    const struct program* prog = psi->program + i;
+    const struct service* service;
+    const struct dvb_lcn* lcn;
+    struct tv_channel* c;
+
+    service = find_service(psi, prog->number);
+    lcn = find_lcn(psi, psi->pat.table_id_ext, prog->number);
+
+    if (service && service->running_status == RUNNING_STATUS_NOT_RUNNING) {
+      continue;
+    }
+    if (lcn && !lcn->visible) {
+      continue;
+    }
+
+    c = channel + num++;
+    c->network_id = service ? format_id(psi->original_network_id)
+                            : strdup("");
+    c->trans_stream_id = format_id(psi->pat.table_id_ext);
+    c->service_id = format_id(prog->number);
+    c->type = channel_type(prog, service);
+    c->number = format_id(lcn ? lcn->number : prog->number);
+    c->name = strdup(service ? service->name : "");
+    c->is_emergency = 0;
+    c->is_free = service ? !service->free_ca_mode : !prog->has_ca;
+
+    if (!c->network_id || !c->trans_stream_id || !c->service_id ||
+        !c->number || !c->name) {
+      ALOGE("Couldn't allocate channel");
+      goto err_alloc;
+    }
+  }
+
+  *ch_num = num;
+  *ch = channel;
+
+  return 0;
+
+err_alloc:
+  release_channels(num, channel);
+  return -1;
+}
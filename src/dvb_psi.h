@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the table tracker of a transport stream. It builds
+ * channels from PSI/SI sections, independent of the driver.
+ *
+ * |create_dvb_psi| returns a tracker for a single transport stream, and
+ * |destroy_dvb_psi| releases it. Sections are passed to |dvb_psi_feed| in
+ * any order, from any tuner or transport stream source. The tracker uses
+ * the PAT, PMTs and SDT actual to list the transport stream's services,
+ * and the logical channel numbers from NIT actual if available.
+ *
+ * For each table, the tracker remembers the version and the received
+ * section numbers. Repeated sections are skipped after parsing the
+ * section header, without checking the CRC. A new version replaces the
+ * table's content. |dvb_psi_feed| returns 1 if the section changed the
+ * tracker's state, 0 if the section has been skipped, or -1 on errors.
+ *
+ * |dvb_psi_next_missing| returns 1 and the PID and table ID of a table
+ * that is still incomplete, or 0 if the PAT, all announced PMTs and the
+ * SDT are complete. The NIT is never reported as missing, as it's rarely
+ * needed and repeats slowly.
+ *
+ * |dvb_psi_get_channels| returns the services of the transport stream as
+ * channels, in an array allocated with malloc(3) that the caller releases
+ * with |release_channels|. Channel numbers default to the service ID. The
+ * function returns 0 on success, or -1 on errors.
+ *
+ * Trackers don't lock; each one is used by a single thread.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "tv_utils.h"
+
+struct dvb_psi;
+
+struct dvb_psi*
+create_dvb_psi(void);
+
+void
+destroy_dvb_psi(struct dvb_psi* psi);
+
+int
+dvb_psi_feed(struct dvb_psi* psi, const uint8_t* buf, size_t len);
+
+int
+dvb_psi_next_missing(const struct dvb_psi* psi, uint16_t* pid,
+                     uint8_t* table_id);
+
+int
+dvb_psi_get_channels(const struct dvb_psi* psi, uint32_t* ch_num,
+                     struct tv_channel** ch);
@@ -0,0 +1,665 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements parsers for PSI and SI sections. See the
+ * corresponding header file for documentation.
+ */
+
+#include "dvb_si.h"
+
+#include <assert.h>
+
+#include "crc32.h"
+#include "log.h"
+#include "memptr.h"
+
+enum {
+  SHORT_HEADER_LEN = 3,
+  LONG_HEADER_LEN = 8,
+  CRC_LEN = 4
+};
+
+static uint16_t
+get_u16(const uint8_t* p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+static uint32_t
+get_u32(const uint8_t* p)
+{
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* Returns the 12-bit length field that follows 4 reserved bits. */
+static uint16_t
+get_len12(const uint8_t* p)
+{
+  return get_u16(p) & 0x0fff;
+}
+
+/* Decodes |digits| BCD digits, starting with the most significant nibble
+ * of |value|. */
+static uint32_t
+bcd(uint32_t value, unsigned int digits)
+{
+  uint32_t res = 0;
+
+  value <<= (8 - digits) * 4;
+
+  while (digits--) {
+    res = res * 10 + (value >> 28);
+    value <<= 4;
+  }
+  return res;
+}
+
+int
+dvb_parse_section_header(const uint8_t* buf, size_t len,
+                         struct dvb_section* sec)
+{
+  assert(buf);
+  assert(sec);
+
+  if (len < SHORT_HEADER_LEN) {
+    ALOGW("section too short");
+    return -1;
+  }
+
+  sec->table_id = buf[0];
+  sec->syntax = buf[1] >> 7;
+  sec->length = SHORT_HEADER_LEN + get_len12(buf + 1);
+
+  if (sec->length > len) {
+    ALOGW("section of table 0x%02x is truncated", sec->table_id);
+    return -1;
+  }
+
+  if (!sec->syntax) {
+    sec->table_id_ext = 0;
+    sec->version = 0;
+    sec->current = 1;
+    sec->number = 0;
+    sec->last_number = 0;
+    sec->payload = buf + SHORT_HEADER_LEN;
+    sec->payload_len = sec->length - SHORT_HEADER_LEN;
+    return 0;
+  }
+
+  if (sec->length < LONG_HEADER_LEN + CRC_LEN) {
+    ALOGW("section of table 0x%02x too short", sec->table_id);
+    return -1;
+  }
+
+  sec->table_id_ext = get_u16(buf + 3);
+  sec->version = (buf[5] >> 1) & 0x1f;
+  sec->current = buf[5] & 0x01;
+  sec->number = buf[6];
+  sec->last_number = buf[7];
+  sec->payload = buf + LONG_HEADER_LEN;
+  sec->payload_len = sec->length - LONG_HEADER_LEN - CRC_LEN;
+
+  if (sec->number > sec->last_number) {
+    ALOGW("invalid section number in table 0x%02x", sec->table_id);
+    return -1;
+  }
+
+  return 0;
+}
+
+int
+dvb_parse_section(const uint8_t* buf, size_t len, struct dvb_section* sec)
+{
+  if (dvb_parse_section_header(buf, len, sec) < 0) {
+    return -1;
+  }
+
+  if (sec->syntax && crc32_mpeg2(buf, sec->length)) {
+    ALOGW("CRC error in section of table 0x%02x", sec->table_id);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Returns 1 if the descriptor loop from |p| to |end| contains a
+ * descriptor with |tag|, 0 if not, or -1 if the loop is malformed. */
+static int
+has_descriptor(const uint8_t* p, const uint8_t* end, uint8_t tag)
+{
+  int found = 0;
+
+  while (p < end) {
+    if (end - p < 2 || end - p < 2 + p[1]) {
+      return -1;
+    }
+    found |= p[0] == tag;
+    p += 2 + p[1];
+  }
+  return found;
+}
+
+/*
+ * Program-specific information
+ */
+
+long
+dvb_parse_pat(const struct dvb_section* sec,
+              struct dvb_pat_entry* entry, size_t max)
+{
+  const uint8_t* p;
+  const uint8_t* end;
+  size_t num;
+
+  assert(sec);
+  assert(entry || !max);
+
+  if (sec->table_id != DVB_TABLE_PAT || sec->payload_len % 4) {
+    ALOGW("malformed PAT section");
+    return -1;
+  }
+
+  p = sec->payload;
+  end = p + sec->payload_len;
+
+  for (num = 0; p < end && num < max; p += 4, ++num) {
+    entry[num].program_number = get_u16(p);
+    entry[num].pid = get_u16(p + 2) & 0x1fff;
+  }
+
+  return num;
+}
+
+long
+dvb_parse_pmt(const struct dvb_section* sec, struct dvb_pmt* pmt,
+              struct dvb_pmt_stream* stream, size_t max)
+{
+  const uint8_t* p;
+  const uint8_t* end;
+  size_t num;
+  int res;
+
+  assert(sec);
+  assert(pmt);
+  assert(stream || !max);
+
+  if (sec->table_id != DVB_TABLE_PMT) {
+    ALOGW("table 0x%02x is not a PMT", sec->table_id);
+    return -1;
+  }
+
+  p = sec->payload;
+  end = p + sec->payload_len;
+
+  if (end - p < 4 || end - p < 4 + get_len12(p + 2)) {
+    goto err_malformed;
+  }
+  pmt->pcr_pid = get_u16(p) & 0x1fff;
+  res = has_descriptor(p + 4, p + 4 + get_len12(p + 2), DVB_DESC_CA);
+  if (res < 0) {
+    goto err_malformed;
+  }
+  pmt->has_ca = res;
+  p += 4 + get_len12(p + 2);
+
+  num = 0;
+
+  while (p < end) {
+    if (end - p < 5 || end - p < 5 + get_len12(p + 3)) {
+      goto err_malformed;
+    }
+    res = has_descriptor(p + 5, p + 5 + get_len12(p + 3), DVB_DESC_CA);
+    if (res < 0) {
+      goto err_malformed;
+    }
+    pmt->has_ca |= res;
+    if (num < max) {
+      stream[num].stream_type = p[0];
+      stream[num].pid = get_u16(p + 1) & 0x1fff;
+      ++num;
+    }
+    p += 5 + get_len12(p + 3);
+  }
+
+  return num;
+
+err_malformed:
+  ALOGW("malformed PMT section");
+  return -1;
+}
+
+/*
+ * Service information
+ */
+
+static void
+parse_service_descriptor(const uint8_t* desc, uint8_t len,
+                         struct dvb_service* service)
+{
+  /* service type, provider name and service name, each name with a
+   * leading length octet */
+  if (len < 3 || 2 + desc[1] >= len ||
+      3 + desc[1] + desc[2 + desc[1]] > len) {
+    return; /* ignore malformed descriptor */
+  }
+
+  service->service_type = desc[0];
+  service->provider_len = desc[1];
+  service->provider = desc + 2;
+  desc += 2 + service->provider_len;
+  service->name_len = desc[0];
+  service->name = desc + 1;
+}
+
+long
+dvb_parse_sdt(const struct dvb_section* sec, uint16_t* original_network_id,
+              struct dvb_service* service, size_t max)
+{
+  const uint8_t* p;
+  const uint8_t* end;
+  size_t num;
+
+  assert(sec);
+  assert(original_network_id);
+  assert(service || !max);
+
+  if (sec->table_id != DVB_TABLE_SDT_ACTUAL &&
+      sec->table_id != DVB_TABLE_SDT_ACTUAL + 4) {
+    ALOGW("table 0x%02x is not a SDT", sec->table_id);
+    return -1;
+  }
+
+  p = sec->payload;
+  end = p + sec->payload_len;
+
+  if (end - p < 3) {
+    goto err_malformed;
+  }
+  *original_network_id = get_u16(p);
+  p += 3;
+
+  num = 0;
+
+  while (p < end) {
+    const uint8_t* desc_end;
+    struct dvb_service* s;
+
+    if (end - p < 5 || end - p < 5 + get_len12(p + 3)) {
+      goto err_malformed;
+    }
+    desc_end = p + 5 + get_len12(p + 3);
+
+    if (num == max) {
+      p = desc_end;
+      continue;
+    }
+
+    s = service + num++;
+    s->service_id = get_u16(p);
+    s->running_status = p[3] >> 5;
+    s->free_ca_mode = (p[3] >> 4) & 0x01;
+    s->service_type = 0;
+    s->provider_len = 0;
+    s->provider = NULL;
+    s->name_len = 0;
+    s->name = NULL;
+    p += 5;
+
+    while (p < desc_end) {
+      if (desc_end - p < 2 || desc_end - p < 2 + p[1]) {
+        goto err_malformed;
+      }
+      if (p[0] == DVB_DESC_SERVICE) {
+        parse_service_descriptor(p + 2, p[1], s);
+      }
+      p += 2 + p[1];
+    }
+  }
+
+  return num;
+
+err_malformed:
+  ALOGW("malformed SDT section");
+  return -1;
+}
+
+/*
+ * Delivery system descriptors
+ */
+
+static int
+parse_satellite_delivery(const uint8_t* desc, uint8_t len,
+                         struct tv_frequency* freq)
+{
+  static const uint8_t modulation[4] = {
+    TV_MODULATION_AUTO, TV_MODULATION_QPSK,
+    TV_MODULATION_8PSK, TV_MODULATION_QAM16
+  };
+  static const uint8_t polarization[4] = {
+    TV_POLARIZATION_HORIZONTAL, TV_POLARIZATION_VERTICAL,
+    TV_POLARIZATION_LEFT, TV_POLARIZATION_RIGHT
+  };
+
+  if (len < 11) {
+    return -1;
+  }
+
+  /* frequency in units of 10 kHz, symbol rate in units of 100 symbols/s */
+  freq->frequency = bcd(get_u32(desc), 8) * 10;
+  freq->bandwidth = 0;
+  freq->polarization = polarization[(desc[6] >> 5) & 0x03];
+  freq->modulation = modulation[desc[6] & 0x03];
+  freq->symbol_rate = bcd(get_u32(desc + 7) >> 4, 7) * 100;
+
+  return 0;
+}
+
+static int
+parse_cable_delivery(const uint8_t* desc, uint8_t len,
+                     struct tv_frequency* freq)
+{
+  static const uint8_t modulation[6] = {
+    TV_MODULATION_AUTO, TV_MODULATION_QAM16, TV_MODULATION_QAM32,
+    TV_MODULATION_QAM64, TV_MODULATION_QAM128, TV_MODULATION_QAM256
+  };
+
+  if (len < 11) {
+    return -1;
+  }
+
+  /* frequency in units of 100 Hz, symbol rate in units of 100 symbols/s */
+  freq->frequency = bcd(get_u32(desc), 8) / 10;
+  freq->bandwidth = 8000;
+  freq->polarization = TV_POLARIZATION_NONE;
+  freq->modulation = desc[6] < ARRAY_LENGTH(modulation) ?
+                     modulation[desc[6]] : TV_MODULATION_AUTO;
+  freq->symbol_rate = bcd(get_u32(desc + 7) >> 4, 7) * 100;
+
+  return 0;
+}
+
+static int
+parse_terrestrial_delivery(const uint8_t* desc, uint8_t len,
+                           struct tv_frequency* freq)
+{
+  static const uint32_t bandwidth[8] = {
+    8000, 7000, 6000, 5000, 0, 0, 0, 0
+  };
+  static const uint8_t modulation[4] = {
+    TV_MODULATION_QPSK, TV_MODULATION_QAM16,
+    TV_MODULATION_QAM64, TV_MODULATION_AUTO
+  };
+
+  if (len < 11) {
+    return -1;
+  }
+
+  /* frequency in units of 10 Hz */
+  freq->frequency = get_u32(desc) / 100;
+  freq->bandwidth = bandwidth[desc[4] >> 5];
+  freq->polarization = TV_POLARIZATION_NONE;
+  freq->modulation = modulation[desc[5] >> 6];
+  freq->symbol_rate = 0;
+
+  return 0;
+}
+
+long
+dvb_parse_nit(const struct dvb_section* sec,
+              struct dvb_delivery* delivery, size_t max)
+{
+  const uint8_t* p;
+  const uint8_t* end;
+  size_t num;
+
+  assert(sec);
+  assert(delivery || !max);
+
+  if (sec->table_id != DVB_TABLE_NIT_ACTUAL &&
+      sec->table_id != DVB_TABLE_NIT_ACTUAL + 1) {
+    ALOGW("table 0x%02x is not a NIT", sec->table_id);
+    return -1;
+  }
+
+  p = sec->payload;
+  end = p + sec->payload_len;
+
+  /* skip network descriptors */
+  if (end - p < 2 || end - p < 2 + get_len12(p)) {
+    goto err_malformed;
+  }
+  p += 2 + get_len12(p);
+
+  /* transport stream loop */
+  if (end - p < 2 || end - p < 2 + get_len12(p)) {
+    goto err_malformed;
+  }
+  end = p + 2 + get_len12(p);
+  p += 2;
+
+  num = 0;
+
+  while (p < end) {
+    uint16_t tsid, onid;
+    const uint8_t* desc_end;
+
+    if (end - p < 6 || end - p < 6 + get_len12(p + 4)) {
+      goto err_malformed;
+    }
+    tsid = get_u16(p);
+    onid = get_u16(p + 2);
+    desc_end = p + 6 + get_len12(p + 4);
+    p += 6;
+
+    while (p < desc_end) {
+      uint8_t tag, len;
+      int res;
+
+      if (desc_end - p < 2 || desc_end - p < 2 + p[1]) {
+        goto err_malformed;
+      }
+      tag = p[0];
+      len = p[1];
+      p += 2;
+
+      if (num < max) {
+        switch (tag) {
+          case DVB_DESC_SATELLITE_DELIVERY:
+            res = parse_satellite_delivery(p, len, &delivery[num].freq);
+            break;
+          case DVB_DESC_CABLE_DELIVERY:
+            res = parse_cable_delivery(p, len, &delivery[num].freq);
+            break;
+          case DVB_DESC_TERRESTRIAL_DELIVERY:
+            res = parse_terrestrial_delivery(p, len, &delivery[num].freq);
+            break;
+          default:
+            res = -1; /* not a delivery system descriptor */
+            break;
+        }
+        if (!res) {
+          delivery[num].tag = tag;
+          delivery[num].transport_stream_id = tsid;
+          delivery[num].original_network_id = onid;
+          ++num;
+        }
+      }
+      p += len;
+    }
+  }
+
+  return num;
+
+err_malformed:
+  ALOGW("malformed NIT section");
+  return -1;
+}
+
+long
+dvb_parse_lcn(const struct dvb_section* sec, struct dvb_lcn* lcn,
+              size_t max)
+{
+  const uint8_t* p;
+  const uint8_t* end;
+  size_t num;
+
+  assert(sec);
+  assert(lcn || !max);
+
+  if (sec->table_id != DVB_TABLE_NIT_ACTUAL &&
+      sec->table_id != DVB_TABLE_NIT_ACTUAL + 1) {
+    ALOGW("table 0x%02x is not a NIT", sec->table_id);
+    return -1;
+  }
+
+  p = sec->payload;
+  end = p + sec->payload_len;
+
+  /* skip network descriptors */
+  if (end - p < 2 || end - p < 2 + get_len12(p)) {
+    goto err_malformed;
+  }
+  p += 2 + get_len12(p);
+
+  /* transport stream loop */
+  if (end - p < 2 || end - p < 2 + get_len12(p)) {
+    goto err_malformed;
+  }
+  end = p + 2 + get_len12(p);
+  p += 2;
+
+  num = 0;
+
+  while (p < end) {
+    uint16_t tsid, onid;
+    const uint8_t* desc_end;
+
+    if (end - p < 6 || end - p < 6 + get_len12(p + 4)) {
+      goto err_malformed;
+    }
+    tsid = get_u16(p);
+    onid = get_u16(p + 2);
+    desc_end = p + 6 + get_len12(p + 4);
+    p += 6;
+
+    while (p < desc_end) {
+      const uint8_t* q;
+
+      if (desc_end - p < 2 || desc_end - p < 2 + p[1]) {
+        goto err_malformed;
+      }
+      if (p[0] == DVB_DESC_LOGICAL_CHANNEL) {
+        /* 4 octets per service */
+        for (q = p + 2; q + 4 <= p + 2 + p[1] && num < max; q += 4) {
+          lcn[num].transport_stream_id = tsid;
+          lcn[num].original_network_id = onid;
+          lcn[num].service_id = get_u16(q);
+          lcn[num].visible = q[2] >> 7;
+          lcn[num].number = get_u16(q + 2) & 0x03ff;
+          ++num;
+        }
+      }
+      p += 2 + p[1];
+    }
+  }
+
+  return num;
+
+err_malformed:
+  ALOGW("malformed NIT section");
+  return -1;
+}
+
+/*
+ * Event information
+ */
+
+enum {
+  MJD_UNIX_EPOCH = 40587, /* 1970-01-01 */
+  SECONDS_PER_DAY = 24 * 60 * 60
+};
+
+/* Converts 6 BCD digits of hours, minutes and seconds to seconds. */
+static uint32_t
+bcd_time(const uint8_t* p)
+{
+  return bcd(p[0], 2) * 3600 + bcd(p[1], 2) * 60 + bcd(p[2], 2);
+}
+
+long
+dvb_parse_eit(const struct dvb_section* sec, struct dvb_eit_header* hdr,
+              struct dvb_event* event, size_t max)
+{
+  const uint8_t* p;
+  const uint8_t* end;
+  size_t num;
+
+  assert(sec);
+  assert(hdr);
+  assert(event || !max);
+
+  if (sec->table_id < DVB_TABLE_EIT_PF_ACTUAL ||
+      sec->table_id > DVB_TABLE_EIT_LAST) {
+    ALOGW("table 0x%02x is not an EIT", sec->table_id);
+    return -1;
+  }
+
+  p = sec->payload;
+  end = p + sec->payload_len;
+
+  if (end - p < 6) {
+    goto err_malformed;
+  }
+  hdr->transport_stream_id = get_u16(p);
+  hdr->original_network_id = get_u16(p + 2);
+  hdr->segment_last_section_number = p[4];
+  hdr->last_table_id = p[5];
+  p += 6;
+
+  num = 0;
+
+  while (p < end) {
+    uint16_t mjd;
+
+    if (end - p < 12 || end - p < 12 + get_len12(p + 10)) {
+      goto err_malformed;
+    }
+    if (num < max) {
+      mjd = get_u16(p + 2);
+      event[num].event_id = get_u16(p);
+      if (mjd == 0xffff || mjd < MJD_UNIX_EPOCH) {
+        event[num].start_time = 0; /* undefined */
+      } else {
+        event[num].start_time =
+          ((uint64_t)(mjd - MJD_UNIX_EPOCH) * SECONDS_PER_DAY +
+           bcd_time(p + 4)) * 1000;
+      }
+      event[num].duration = bcd_time(p + 7);
+      event[num].running_status = p[10] >> 5;
+      event[num].free_ca_mode = (p[10] >> 4) & 0x01;
+      event[num].desc_len = get_len12(p + 10);
+      event[num].desc = p + 12;
+      ++num;
+    }
+    p += 12 + get_len12(p + 10);
+  }
+
+  return num;
+
+err_malformed:
+  ALOGW("malformed EIT section");
+  return -1;
+}
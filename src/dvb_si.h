@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains parsers for MPEG-2 PSI and DVB SI sections, as
+ * specified in ISO/IEC 13818-1 and ETSI EN 300 468.
+ *
+ * |dvb_parse_section| validates a section and parses its header. For
+ * sections with the long syntax, it checks the section's CRC. The
+ * section's payload is the data between the header and the CRC.
+ * |dvb_parse_section_header| only parses the header without checking the
+ * CRC. It's meant for cheaply skipping sections that have been received
+ * before; the section has to be validated before parsing its payload.
+ *
+ * |dvb_parse_pat|, |dvb_parse_pmt| and |dvb_parse_sdt| return the entries
+ * of a Program Association Table, the elementary streams of a Program Map
+ * Table, and the services of a Service Description Table section. The
+ * service and provider names of the SDT point into the section and are
+ * not decoded; they use the character tables of EN 300 468, Annex A.
+ *
+ * |dvb_parse_lcn| returns the logical channel numbers of a NIT section,
+ * as signalled by the EACEM/NorDig logical channel descriptor.
+ *
+ * |dvb_parse_eit| returns the header fields and events of an Event
+ * Information Table section. Start times are converted to milliseconds
+ * since the epoch, durations to seconds. Each event's descriptor loop
+ * points into the section.
+ *
+ * |dvb_parse_nit| extracts the delivery system descriptors of a Network
+ * Information Table section. For each transport stream of the network,
+ * it returns the tuning parameters of the satellite, cable or
+ * terrestrial delivery system descriptors. At most |max| entries are
+ * stored in |delivery|; the function returns the number of entries, or
+ * -1 if the section is malformed. The other table parsers work the same
+ * way.
+ *
+ * The parsers don't allocate memory and are thread-safe. All functions
+ * return 0 on success and -1 on errors unless noted otherwise.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "tv_utils.h"
+
+enum {
+  DVB_MAX_SECTION_LEN = 4096
+};
+
+enum {
+  DVB_PID_PAT = 0x0000,
+  DVB_PID_NIT = 0x0010,
+  DVB_PID_SDT = 0x0011,
+  DVB_PID_EIT = 0x0012
+};
+
+enum {
+  DVB_TABLE_PAT = 0x00,
+  DVB_TABLE_PMT = 0x02,
+  DVB_TABLE_NIT_ACTUAL = 0x40,
+  DVB_TABLE_SDT_ACTUAL = 0x42,
+  DVB_TABLE_EIT_PF_ACTUAL = 0x4e,
+  DVB_TABLE_EIT_PF_OTHER = 0x4f,
+  DVB_TABLE_EIT_SCHEDULE_ACTUAL = 0x50, /* to 0x5f */
+  DVB_TABLE_EIT_SCHEDULE_OTHER = 0x60, /* to 0x6f */
+  DVB_TABLE_EIT_LAST = 0x6f
+};
+
+enum {
+  DVB_DESC_CA = 0x09,
+  DVB_DESC_SATELLITE_DELIVERY = 0x43,
+  DVB_DESC_CABLE_DELIVERY = 0x44,
+  DVB_DESC_SERVICE = 0x48,
+  DVB_DESC_SHORT_EVENT = 0x4d,
+  DVB_DESC_EXTENDED_EVENT = 0x4e,
+  DVB_DESC_COMPONENT = 0x50,
+  DVB_DESC_PARENTAL_RATING = 0x55,
+  DVB_DESC_TERRESTRIAL_DELIVERY = 0x5a,
+  DVB_DESC_LOGICAL_CHANNEL = 0x83
+};
+
+enum {
+  DVB_SERVICE_TYPE_TV = 0x01,
+  DVB_SERVICE_TYPE_RADIO = 0x02
+};
+
+struct dvb_section {
+  uint8_t table_id;
+  uint8_t syntax; /* section_syntax_indicator */
+  uint16_t length; /* length of whole section */
+  /* The fields below are only valid for the long syntax. */
+  uint16_t table_id_ext;
+  uint8_t version;
+  uint8_t current;
+  uint8_t number;
+  uint8_t last_number;
+  const uint8_t* payload;
+  size_t payload_len;
+};
+
+struct dvb_delivery {
+  uint8_t tag; /* DVB_DESC_*_DELIVERY */
+  uint16_t transport_stream_id;
+  uint16_t original_network_id;
+  struct tv_frequency freq;
+};
+
+struct dvb_pat_entry {
+  uint16_t program_number; /* 0 for the network PID */
+  uint16_t pid;
+};
+
+struct dvb_pmt_stream {
+  uint8_t stream_type;
+  uint16_t pid;
+};
+
+struct dvb_pmt {
+  uint16_t pcr_pid;
+  uint8_t has_ca; /* CA descriptor in program or stream loop */
+};
+
+struct dvb_service {
+  uint16_t service_id;
+  uint8_t running_status;
+  uint8_t free_ca_mode;
+  uint8_t service_type; /* 0 if there's no service descriptor */
+  uint8_t provider_len;
+  uint8_t name_len;
+  const uint8_t* provider; /* points into section */
+  const uint8_t* name; /* points into section */
+};
+
+struct dvb_lcn {
+  uint16_t transport_stream_id;
+  uint16_t original_network_id;
+  uint16_t service_id;
+  uint16_t number;
+  uint8_t visible;
+};
+
+struct dvb_eit_header {
+  uint16_t transport_stream_id;
+  uint16_t original_network_id;
+  uint8_t segment_last_section_number;
+  uint8_t last_table_id;
+};
+
+struct dvb_event {
+  uint16_t event_id;
+  uint64_t start_time; /* ms since the epoch, 0 if undefined */
+  uint32_t duration; /* s */
+  uint8_t running_status;
+  uint8_t free_ca_mode;
+  uint16_t desc_len;
+  const uint8_t* desc; /* points into section */
+};
+
+int
+dvb_parse_section_header(const uint8_t* buf, size_t len,
+                         struct dvb_section* sec);
+
+int
+dvb_parse_section(const uint8_t* buf, size_t len, struct dvb_section* sec);
+
+long
+dvb_parse_pat(const struct dvb_section* sec,
+              struct dvb_pat_entry* entry, size_t max);
+
+long
+dvb_parse_pmt(const struct dvb_section* sec, struct dvb_pmt* pmt,
+              struct dvb_pmt_stream* stream, size_t max);
+
+long
+dvb_parse_sdt(const struct dvb_section* sec, uint16_t* original_network_id,
+              struct dvb_service* service, size_t max);
+
+long
+dvb_parse_lcn(const struct dvb_section* sec, struct dvb_lcn* lcn,
+              size_t max);
+
+long
+dvb_parse_eit(const struct dvb_section* sec, struct dvb_eit_header* hdr,
+              struct dvb_event* event, size_t max);
+
+long
+dvb_parse_nit(const struct dvb_section* sec,
+              struct dvb_delivery* delivery, size_t max);
@@ -0,0 +1,810 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements the decoder for text in SI tables. See the
+ * corresponding header file for documentation.
+ */
+
+#include "dvb_text.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "memptr.h"
+
+enum {
+  REPLACEMENT_CHARACTER = 0xfffd,
+  CONTROL_CR_LF = 0x8a, /* in 0x80 to 0x9f */
+  PRIVATE_CONTROL_BASE = 0xe000 /* control codes in UCS-2 and UTF-8 */
+};
+
+enum {
+  TABLE_ISO6937,
+  TABLE_ISO8859,
+  TABLE_UCS2,
+  TABLE_UTF8,
+  TABLE_UNSUPPORTED
+};
+
+/* The upper half (0xa0 to 0xff) of ISO/IEC 6937, with the euro sign at
+ * 0xa4 as in EN 300 468. The non-spacing diacritical marks at 0xc1 to
+ * 0xcf are handled separately. */
+static const uint16_t g_iso6937[96] = {
+  0x00a0, 0x00a1, 0x00a2, 0x00a3, 0x20ac, 0x00a5, 0x0023, 0x00a7,
+  0x00a4, 0x2018, 0x201c, 0x00ab, 0x2190, 0x2191, 0x2192, 0x2193,
+  0x00b0, 0x00b1, 0x00b2, 0x00b3, 0x00d7, 0x00b5, 0x00b6, 0x00b7,
+  0x00f7, 0x2019, 0x201d, 0x00bb, 0x00bc, 0x00bd, 0x00be, 0x00bf,
+  0xfffd, 0x0300, 0x0301, 0x0302, 0x0303, 0x0304, 0x0306, 0x0307,
+  0x0308, 0xfffd, 0x030a, 0x0327, 0xfffd, 0x030b, 0x0328, 0x030c,
+  0x2015, 0x00b9, 0x00ae, 0x00a9, 0x2122, 0x266a, 0x00ac, 0x00a6,
+  0xfffd, 0xfffd, 0xfffd, 0xfffd, 0x215b, 0x215c, 0x215d, 0x215e,
+  0x2126, 0x00c6, 0x0110, 0x00aa, 0x0126, 0xfffd, 0x0132, 0x013f,
+  0x0141, 0x00d8, 0x0152, 0x00ba, 0x00de, 0x0166, 0x014a, 0x0149,
+  0x0138, 0x00e6, 0x0111, 0x00f0, 0x0127, 0x0131, 0x0133, 0x0140,
+  0x0142, 0x00f8, 0x0153, 0x00df, 0x00fe, 0x0167, 0x014b, 0x00ad
+};
+
+struct diacritic {
+  uint8_t mark;
+  uint8_t letter;
+  uint16_t code_point;
+};
+
+/* Precomposed letters for the non-spacing diacritical marks 0xc1 to 0xcf
+ * of ISO/IEC 6937, sorted by mark and letter. */
+static const struct diacritic g_iso6937_letter[] = {
+  { 0xc1, 'A', 0x00c0 }, { 0xc1, 'E', 0x00c8 }, { 0xc1, 'I', 0x00cc },
+  { 0xc1, 'N', 0x01f8 }, { 0xc1, 'O', 0x00d2 }, { 0xc1, 'U', 0x00d9 },
+  { 0xc1, 'W', 0x1e80 }, { 0xc1, 'Y', 0x1ef2 }, { 0xc1, 'a', 0x00e0 },
+  { 0xc1, 'e', 0x00e8 }, { 0xc1, 'i', 0x00ec }, { 0xc1, 'n', 0x01f9 },
+  { 0xc1, 'o', 0x00f2 }, { 0xc1, 'u', 0x00f9 }, { 0xc1, 'w', 0x1e81 },
+  { 0xc1, 'y', 0x1ef3 }, { 0xc2, 'A', 0x00c1 }, { 0xc2, 'C', 0x0106 },
+  { 0xc2, 'E', 0x00c9 }, { 0xc2, 'G', 0x01f4 }, { 0xc2, 'I', 0x00cd },
+  { 0xc2, 'K', 0x1e30 }, { 0xc2, 'L', 0x0139 }, { 0xc2, 'N', 0x0143 },
+  { 0xc2, 'O', 0x00d3 }, { 0xc2, 'R', 0x0154 }, { 0xc2, 'S', 0x015a },
+  { 0xc2, 'U', 0x00da }, { 0xc2, 'W', 0x1e82 }, { 0xc2, 'Y', 0x00dd },
+  { 0xc2, 'Z', 0x0179 }, { 0xc2, 'a', 0x00e1 }, { 0xc2, 'c', 0x0107 },
+  { 0xc2, 'e', 0x00e9 }, { 0xc2, 'g', 0x01f5 }, { 0xc2, 'i', 0x00ed },
+  { 0xc2, 'k', 0x1e31 }, { 0xc2, 'l', 0x013a }, { 0xc2, 'n', 0x0144 },
+  { 0xc2, 'o', 0x00f3 }, { 0xc2, 'r', 0x0155 }, { 0xc2, 's', 0x015b },
+  { 0xc2, 'u', 0x00fa }, { 0xc2, 'w', 0x1e83 }, { 0xc2, 'y', 0x00fd },
+  { 0xc2, 'z', 0x017a }, { 0xc3, 'A', 0x00c2 }, { 0xc3, 'C', 0x0108 },
+  { 0xc3, 'E', 0x00ca }, { 0xc3, 'G', 0x011c }, { 0xc3, 'H', 0x0124 },
+  { 0xc3, 'I', 0x00ce }, { 0xc3, 'J', 0x0134 }, { 0xc3, 'O', 0x00d4 },
+  { 0xc3, 'S', 0x015c }, { 0xc3, 'U', 0x00db }, { 0xc3, 'W', 0x0174 },
+  { 0xc3, 'Y', 0x0176 }, { 0xc3, 'Z', 0x1e90 }, { 0xc3, 'a', 0x00e2 },
+  { 0xc3, 'c', 0x0109 }, { 0xc3, 'e', 0x00ea }, { 0xc3, 'g', 0x011d },
+  { 0xc3, 'i', 0x00ee }, { 0xc3, 'j', 0x0135 }, { 0xc3, 'o', 0x00f4 },
+  { 0xc3, 's', 0x015d }, { 0xc3, 'u', 0x00fb }, { 0xc3, 'w', 0x0175 },
+  { 0xc3, 'y', 0x0177 }, { 0xc3, 'z', 0x1e91 }, { 0xc4, 'A', 0x00c3 },
+  { 0xc4, 'E', 0x1ebc }, { 0xc4, 'I', 0x0128 }, { 0xc4, 'N', 0x00d1 },
+  { 0xc4, 'O', 0x00d5 }, { 0xc4, 'U', 0x0168 }, { 0xc4, 'Y', 0x1ef8 },
+  { 0xc4, 'a', 0x00e3 }, { 0xc4, 'e', 0x1ebd }, { 0xc4, 'i', 0x0129 },
+  { 0xc4, 'n', 0x00f1 }, { 0xc4, 'o', 0x00f5 }, { 0xc4, 'u', 0x0169 },
+  { 0xc4, 'y', 0x1ef9 }, { 0xc5, 'A', 0x0100 }, { 0xc5, 'E', 0x0112 },
+  { 0xc5, 'G', 0x1e20 }, { 0xc5, 'I', 0x012a }, { 0xc5, 'O', 0x014c },
+  { 0xc5, 'U', 0x016a }, { 0xc5, 'Y', 0x0232 }, { 0xc5, 'a', 0x0101 },
+  { 0xc5, 'e', 0x0113 }, { 0xc5, 'g', 0x1e21 }, { 0xc5, 'i', 0x012b },
+  { 0xc5, 'o', 0x014d }, { 0xc5, 'u', 0x016b }, { 0xc5, 'y', 0x0233 },
+  { 0xc6, 'A', 0x0102 }, { 0xc6, 'E', 0x0114 }, { 0xc6, 'G', 0x011e },
+  { 0xc6, 'I', 0x012c }, { 0xc6, 'O', 0x014e }, { 0xc6, 'U', 0x016c },
+  { 0xc6, 'a', 0x0103 }, { 0xc6, 'e', 0x0115 }, { 0xc6, 'g', 0x011f },
+  { 0xc6, 'i', 0x012d }, { 0xc6, 'o', 0x014f }, { 0xc6, 'u', 0x016d },
+  { 0xc7, 'A', 0x0226 }, { 0xc7, 'C', 0x010a }, { 0xc7, 'E', 0x0116 },
+  { 0xc7, 'G', 0x0120 }, { 0xc7, 'H', 0x1e22 }, { 0xc7, 'I', 0x0130 },
+  { 0xc7, 'N', 0x1e44 }, { 0xc7, 'O', 0x022e }, { 0xc7, 'R', 0x1e58 },
+  { 0xc7, 'S', 0x1e60 }, { 0xc7, 'T', 0x1e6a }, { 0xc7, 'W', 0x1e86 },
+  { 0xc7, 'Y', 0x1e8e }, { 0xc7, 'Z', 0x017b }, { 0xc7, 'a', 0x0227 },
+  { 0xc7, 'c', 0x010b }, { 0xc7, 'e', 0x0117 }, { 0xc7, 'g', 0x0121 },
+  { 0xc7, 'n', 0x1e45 }, { 0xc7, 'o', 0x022f }, { 0xc7, 'r', 0x1e59 },
+  { 0xc7, 's', 0x1e61 }, { 0xc7, 't', 0x1e6b }, { 0xc7, 'w', 0x1e87 },
+  { 0xc7, 'y', 0x1e8f }, { 0xc7, 'z', 0x017c }, { 0xc8, 'A', 0x00c4 },
+  { 0xc8, 'E', 0x00cb }, { 0xc8, 'H', 0x1e26 }, { 0xc8, 'I', 0x00cf },
+  { 0xc8, 'O', 0x00d6 }, { 0xc8, 'U', 0x00dc }, { 0xc8, 'W', 0x1e84 },
+  { 0xc8, 'Y', 0x0178 }, { 0xc8, 'a', 0x00e4 }, { 0xc8, 'e', 0x00eb },
+  { 0xc8, 'i', 0x00ef }, { 0xc8, 'o', 0x00f6 }, { 0xc8, 't', 0x1e97 },
+  { 0xc8, 'u', 0x00fc }, { 0xc8, 'w', 0x1e85 }, { 0xc8, 'y', 0x00ff },
+  { 0xca, 'A', 0x00c5 }, { 0xca, 'U', 0x016e }, { 0xca, 'a', 0x00e5 },
+  { 0xca, 'u', 0x016f }, { 0xca, 'w', 0x1e98 }, { 0xca, 'y', 0x1e99 },
+  { 0xcb, 'C', 0x00c7 }, { 0xcb, 'E', 0x0228 }, { 0xcb, 'G', 0x0122 },
+  { 0xcb, 'H', 0x1e28 }, { 0xcb, 'K', 0x0136 }, { 0xcb, 'L', 0x013b },
+  { 0xcb, 'N', 0x0145 }, { 0xcb, 'R', 0x0156 }, { 0xcb, 'S', 0x015e },
+  { 0xcb, 'T', 0x0162 }, { 0xcb, 'c', 0x00e7 }, { 0xcb, 'e', 0x0229 },
+  { 0xcb, 'g', 0x0123 }, { 0xcb, 'k', 0x0137 }, { 0xcb, 'l', 0x013c },
+  { 0xcb, 'n', 0x0146 }, { 0xcb, 'r', 0x0157 }, { 0xcb, 's', 0x015f },
+  { 0xcb, 't', 0x0163 }, { 0xcd, 'O', 0x0150 }, { 0xcd, 'U', 0x0170 },
+  { 0xcd, 'o', 0x0151 }, { 0xcd, 'u', 0x0171 }, { 0xce, 'A', 0x0104 },
+  { 0xce, 'E', 0x0118 }, { 0xce, 'I', 0x012e }, { 0xce, 'O', 0x01ea },
+  { 0xce, 'U', 0x0172 }, { 0xce, 'a', 0x0105 }, { 0xce, 'e', 0x0119 },
+  { 0xce, 'i', 0x012f }, { 0xce, 'o', 0x01eb }, { 0xce, 'u', 0x0173 },
+  { 0xcf, 'A', 0x01cd }, { 0xcf, 'C', 0x010c }, { 0xcf, 'E', 0x011a },
+  { 0xcf, 'G', 0x01e6 }, { 0xcf, 'H', 0x021e }, { 0xcf, 'I', 0x01cf },
+  { 0xcf, 'K', 0x01e8 }, { 0xcf, 'L', 0x013d }, { 0xcf, 'N', 0x0147 },
+  { 0xcf, 'O', 0x01d1 }, { 0xcf, 'R', 0x0158 }, { 0xcf, 'S', 0x0160 },
+  { 0xcf, 'T', 0x0164 }, { 0xcf, 'U', 0x01d3 }, { 0xcf, 'Z', 0x017d },
+  { 0xcf, 'a', 0x01ce }, { 0xcf, 'c', 0x010d }, { 0xcf, 'e', 0x011b },
+  { 0xcf, 'g', 0x01e7 }, { 0xcf, 'i', 0x01d0 }, { 0xcf, 'j', 0x01f0 },
+  { 0xcf, 'k', 0x01e9 }, { 0xcf, 'l', 0x013e }, { 0xcf, 'n', 0x0148 },
+  { 0xcf, 'o', 0x01d2 }, { 0xcf, 'r', 0x0159 }, { 0xcf, 's', 0x0161 },
+  { 0xcf, 't', 0x0165 }, { 0xcf, 'u', 0x01d4 }, { 0xcf, 'z', 0x017e }
+};
+
+/* Upper halves (0xa0 to 0xff) of ISO/IEC 8859 parts 2 to 16. Part 12
+ * doesn't exist; part 1 equals the first code points of Unicode. */
+static const uint16_t g_iso8859[17][96] = {
+  [2] = {
+    0x00a0, 0x0104, 0x02d8, 0x0141, 0x00a4, 0x013d, 0x015a, 0x00a7,
+    0x00a8, 0x0160, 0x015e, 0x0164, 0x0179, 0x00ad, 0x017d, 0x017b,
+    0x00b0, 0x0105, 0x02db, 0x0142, 0x00b4, 0x013e, 0x015b, 0x02c7,
+    0x00b8, 0x0161, 0x015f, 0x0165, 0x017a, 0x02dd, 0x017e, 0x017c,
+    0x0154, 0x00c1, 0x00c2, 0x0102, 0x00c4, 0x0139, 0x0106, 0x00c7,
+    0x010c, 0x00c9, 0x0118, 0x00cb, 0x011a, 0x00cd, 0x00ce, 0x010e,
+    0x0110, 0x0143, 0x0147, 0x00d3, 0x00d4, 0x0150, 0x00d6, 0x00d7,
+    0x0158, 0x016e, 0x00da, 0x0170, 0x00dc, 0x00dd, 0x0162, 0x00df,
+    0x0155, 0x00e1, 0x00e2, 0x0103, 0x00e4, 0x013a, 0x0107, 0x00e7,
+    0x010d, 0x00e9, 0x0119, 0x00eb, 0x011b, 0x00ed, 0x00ee, 0x010f,
+    0x0111, 0x0144, 0x0148, 0x00f3, 0x00f4, 0x0151, 0x00f6, 0x00f7,
+    0x0159, 0x016f, 0x00fa, 0x0171, 0x00fc, 0x00fd, 0x0163, 0x02d9
+  },
+  [3] = {
+    0x00a0, 0x0126, 0x02d8, 0x00a3, 0x00a4, 0xfffd, 0x0124, 0x00a7,
+    0x00a8, 0x0130, 0x015e, 0x011e, 0x0134, 0x00ad, 0xfffd, 0x017b,
+    0x00b0, 0x0127, 0x00b2, 0x00b3, 0x00b4, 0x00b5, 0x0125, 0x00b7,
+    0x00b8, 0x0131, 0x015f, 0x011f, 0x0135, 0x00bd, 0xfffd, 0x017c,
+    0x00c0, 0x00c1, 0x00c2, 0xfffd, 0x00c4, 0x010a, 0x0108, 0x00c7,
+    0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+    0xfffd, 0x00d1, 0x00d2, 0x00d3, 0x00d4, 0x0120, 0x00d6, 0x00d7,
+    0x011c, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x016c, 0x015c, 0x00df,
+    0x00e0, 0x00e1, 0x00e2, 0xfffd, 0x00e4, 0x010b, 0x0109, 0x00e7,
+    0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+    0xfffd, 0x00f1, 0x00f2, 0x00f3, 0x00f4, 0x0121, 0x00f6, 0x00f7,
+    0x011d, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x016d, 0x015d, 0x02d9
+  },
+  [4] = {
+    0x00a0, 0x0104, 0x0138, 0x0156, 0x00a4, 0x0128, 0x013b, 0x00a7,
+    0x00a8, 0x0160, 0x0112, 0x0122, 0x0166, 0x00ad, 0x017d, 0x00af,
+    0x00b0, 0x0105, 0x02db, 0x0157, 0x00b4, 0x0129, 0x013c, 0x02c7,
+    0x00b8, 0x0161, 0x0113, 0x0123, 0x0167, 0x014a, 0x017e, 0x014b,
+    0x0100, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x012e,
+    0x010c, 0x00c9, 0x0118, 0x00cb, 0x0116, 0x00cd, 0x00ce, 0x012a,
+    0x0110, 0x0145, 0x014c, 0x0136, 0x00d4, 0x00d5, 0x00d6, 0x00d7,
+    0x00d8, 0x0172, 0x00da, 0x00db, 0x00dc, 0x0168, 0x016a, 0x00df,
+    0x0101, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x012f,
+    0x010d, 0x00e9, 0x0119, 0x00eb, 0x0117, 0x00ed, 0x00ee, 0x012b,
+    0x0111, 0x0146, 0x014d, 0x0137, 0x00f4, 0x00f5, 0x00f6, 0x00f7,
+    0x00f8, 0x0173, 0x00fa, 0x00fb, 0x00fc, 0x0169, 0x016b, 0x02d9
+  },
+  [5] = {
+    0x00a0, 0x0401, 0x0402, 0x0403, 0x0404, 0x0405, 0x0406, 0x0407,
+    0x0408, 0x0409, 0x040a, 0x040b, 0x040c, 0x00ad, 0x040e, 0x040f,
+    0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+    0x0418, 0x0419, 0x041a, 0x041b, 0x041c, 0x041d, 0x041e, 0x041f,
+    0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+    0x0428, 0x0429, 0x042a, 0x042b, 0x042c, 0x042d, 0x042e, 0x042f,
+    0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+    0x0438, 0x0439, 0x043a, 0x043b, 0x043c, 0x043d, 0x043e, 0x043f,
+    0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+    0x0448, 0x0449, 0x044a, 0x044b, 0x044c, 0x044d, 0x044e, 0x044f,
+    0x2116, 0x0451, 0x0452, 0x0453, 0x0454, 0x0455, 0x0456, 0x0457,
+    0x0458, 0x0459, 0x045a, 0x045b, 0x045c, 0x00a7, 0x045e, 0x045f
+  },
+  [6] = {
+    0x00a0, 0xfffd, 0xfffd, 0xfffd, 0x00a4, 0xfffd, 0xfffd, 0xfffd,
+    0xfffd, 0xfffd, 0xfffd, 0xfffd, 0x060c, 0x00ad, 0xfffd, 0xfffd,
+    0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd,
+    0xfffd, 0xfffd, 0xfffd, 0x061b, 0xfffd, 0xfffd, 0xfffd, 0x061f,
+    0xfffd, 0x0621, 0x0622, 0x0623, 0x0624, 0x0625, 0x0626, 0x0627,
+    0x0628, 0x0629, 0x062a, 0x062b, 0x062c, 0x062d, 0x062e, 0x062f,
+    0x0630, 0x0631, 0x0632, 0x0633, 0x0634, 0x0635, 0x0636, 0x0637,
+    0x0638, 0x0639, 0x063a, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd,
+    0x0640, 0x0641, 0x0642, 0x0643, 0x0644, 0x0645, 0x0646, 0x0647,
+    0x0648, 0x0649, 0x064a, 0x064b, 0x064c, 0x064d, 0x064e, 0x064f,
+    0x0650, 0x0651, 0x0652, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd,
+    0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd
+  },
+  [7] = {
+    0x00a0, 0x2018, 0x2019, 0x00a3, 0x20ac, 0x20af, 0x00a6, 0x00a7,
+    0x00a8, 0x00a9, 0x037a, 0x00ab, 0x00ac, 0x00ad, 0xfffd, 0x2015,
+    0x00b0, 0x00b1, 0x00b2, 0x00b3, 0x0384, 0x0385, 0x0386, 0x00b7,
+    0x0388, 0x0389, 0x038a, 0x00bb, 0x038c, 0x00bd, 0x038e, 0x038f,
+    0x0390, 0x0391, 0x0392, 0x0393, 0x0394, 0x0395, 0x0396, 0x0397,
+    0x0398, 0x0399, 0x039a, 0x039b, 0x039c, 0x039d, 0x039e, 0x039f,
+    0x03a0, 0x03a1, 0xfffd, 0x03a3, 0x03a4, 0x03a5, 0x03a6, 0x03a7,
+    0x03a8, 0x03a9, 0x03aa, 0x03ab, 0x03ac, 0x03ad, 0x03ae, 0x03af,
+    0x03b0, 0x03b1, 0x03b2, 0x03b3, 0x03b4, 0x03b5, 0x03b6, 0x03b7,
+    0x03b8, 0x03b9, 0x03ba, 0x03bb, 0x03bc, 0x03bd, 0x03be, 0x03bf,
+    0x03c0, 0x03c1, 0x03c2, 0x03c3, 0x03c4, 0x03c5, 0x03c6, 0x03c7,
+    0x03c8, 0x03c9, 0x03ca, 0x03cb, 0x03cc, 0x03cd, 0x03ce, 0xfffd
+  },
+  [8] = {
+    0x00a0, 0xfffd, 0x00a2, 0x00a3, 0x00a4, 0x00a5, 0x00a6, 0x00a7,
+    0x00a8, 0x00a9, 0x00d7, 0x00ab, 0x00ac, 0x00ad, 0x00ae, 0x00af,
+    0x00b0, 0x00b1, 0x00b2, 0x00b3, 0x00b4, 0x00b5, 0x00b6, 0x00b7,
+    0x00b8, 0x00b9, 0x00f7, 0x00bb, 0x00bc, 0x00bd, 0x00be, 0xfffd,
+    0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd,
+    0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd,
+    0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd,
+    0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0x2017,
+    0x05d0, 0x05d1, 0x05d2, 0x05d3, 0x05d4, 0x05d5, 0x05d6, 0x05d7,
+    0x05d8, 0x05d9, 0x05da, 0x05db, 0x05dc, 0x05dd, 0x05de, 0x05df,
+    0x05e0, 0x05e1, 0x05e2, 0x05e3, 0x05e4, 0x05e5, 0x05e6, 0x05e7,
+    0x05e8, 0x05e9, 0x05ea, 0xfffd, 0xfffd, 0x200e, 0x200f, 0xfffd
+  },
+  [9] = {
+    0x00a0, 0x00a1, 0x00a2, 0x00a3, 0x00a4, 0x00a5, 0x00a6, 0x00a7,
+    0x00a8, 0x00a9, 0x00aa, 0x00ab, 0x00ac, 0x00ad, 0x00ae, 0x00af,
+    0x00b0, 0x00b1, 0x00b2, 0x00b3, 0x00b4, 0x00b5, 0x00b6, 0x00b7,
+    0x00b8, 0x00b9, 0x00ba, 0x00bb, 0x00bc, 0x00bd, 0x00be, 0x00bf,
+    0x00c0, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x00c7,
+    0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+    0x011e, 0x00d1, 0x00d2, 0x00d3, 0x00d4, 0x00d5, 0x00d6, 0x00d7,
+    0x00d8, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x0130, 0x015e, 0x00df,
+    0x00e0, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x00e7,
+    0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+    0x011f, 0x00f1, 0x00f2, 0x00f3, 0x00f4, 0x00f5, 0x00f6, 0x00f7,
+    0x00f8, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x0131, 0x015f, 0x00ff
+  },
+  [10] = {
+    0x00a0, 0x0104, 0x0112, 0x0122, 0x012a, 0x0128, 0x0136, 0x00a7,
+    0x013b, 0x0110, 0x0160, 0x0166, 0x017d, 0x00ad, 0x016a, 0x014a,
+    0x00b0, 0x0105, 0x0113, 0x0123, 0x012b, 0x0129, 0x0137, 0x00b7,
+    0x013c, 0x0111, 0x0161, 0x0167, 0x017e, 0x2015, 0x016b, 0x014b,
+    0x0100, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x012e,
+    0x010c, 0x00c9, 0x0118, 0x00cb, 0x0116, 0x00cd, 0x00ce, 0x00cf,
+    0x00d0, 0x0145, 0x014c, 0x00d3, 0x00d4, 0x00d5, 0x00d6, 0x0168,
+    0x00d8, 0x0172, 0x00da, 0x00db, 0x00dc, 0x00dd, 0x00de, 0x00df,
+    0x0101, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x012f,
+    0x010d, 0x00e9, 0x0119, 0x00eb, 0x0117, 0x00ed, 0x00ee, 0x00ef,
+    0x00f0, 0x0146, 0x014d, 0x00f3, 0x00f4, 0x00f5, 0x00f6, 0x0169,
+    0x00f8, 0x0173, 0x00fa, 0x00fb, 0x00fc, 0x00fd, 0x00fe, 0x0138
+  },
+  [11] = {
+    0x00a0, 0x0e01, 0x0e02, 0x0e03, 0x0e04, 0x0e05, 0x0e06, 0x0e07,
+    0x0e08, 0x0e09, 0x0e0a, 0x0e0b, 0x0e0c, 0x0e0d, 0x0e0e, 0x0e0f,
+    0x0e10, 0x0e11, 0x0e12, 0x0e13, 0x0e14, 0x0e15, 0x0e16, 0x0e17,
+    0x0e18, 0x0e19, 0x0e1a, 0x0e1b, 0x0e1c, 0x0e1d, 0x0e1e, 0x0e1f,
+    0x0e20, 0x0e21, 0x0e22, 0x0e23, 0x0e24, 0x0e25, 0x0e26, 0x0e27,
+    0x0e28, 0x0e29, 0x0e2a, 0x0e2b, 0x0e2c, 0x0e2d, 0x0e2e, 0x0e2f,
+    0x0e30, 0x0e31, 0x0e32, 0x0e33, 0x0e34, 0x0e35, 0x0e36, 0x0e37,
+    0x0e38, 0x0e39, 0x0e3a, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0x0e3f,
+    0x0e40, 0x0e41, 0x0e42, 0x0e43, 0x0e44, 0x0e45, 0x0e46, 0x0e47,
+    0x0e48, 0x0e49, 0x0e4a, 0x0e4b, 0x0e4c, 0x0e4d, 0x0e4e, 0x0e4f,
+    0x0e50, 0x0e51, 0x0e52, 0x0e53, 0x0e54, 0x0e55, 0x0e56, 0x0e57,
+    0x0e58, 0x0e59, 0x0e5a, 0x0e5b, 0xfffd, 0xfffd, 0xfffd, 0xfffd
+  },
+  [13] = {
+    0x00a0, 0x201d, 0x00a2, 0x00a3, 0x00a4, 0x201e, 0x00a6, 0x00a7,
+    0x00d8, 0x00a9, 0x0156, 0x00ab, 0x00ac, 0x00ad, 0x00ae, 0x00c6,
+    0x00b0, 0x00b1, 0x00b2, 0x00b3, 0x201c, 0x00b5, 0x00b6, 0x00b7,
+    0x00f8, 0x00b9, 0x0157, 0x00bb, 0x00bc, 0x00bd, 0x00be, 0x00e6,
+    0x0104, 0x012e, 0x0100, 0x0106, 0x00c4, 0x00c5, 0x0118, 0x0112,
+    0x010c, 0x00c9, 0x0179, 0x0116, 0x0122, 0x0136, 0x012a, 0x013b,
+    0x0160, 0x0143, 0x0145, 0x00d3, 0x014c, 0x00d5, 0x00d6, 0x00d7,
+    0x0172, 0x0141, 0x015a, 0x016a, 0x00dc, 0x017b, 0x017d, 0x00df,
+    0x0105, 0x012f, 0x0101, 0x0107, 0x00e4, 0x00e5, 0x0119, 0x0113,
+    0x010d, 0x00e9, 0x017a, 0x0117, 0x0123, 0x0137, 0x012b, 0x013c,
+    0x0161, 0x0144, 0x0146, 0x00f3, 0x014d, 0x00f5, 0x00f6, 0x00f7,
+    0x0173, 0x0142, 0x015b, 0x016b, 0x00fc, 0x017c, 0x017e, 0x2019
+  },
+  [14] = {
+    0x00a0, 0x1e02, 0x1e03, 0x00a3, 0x010a, 0x010b, 0x1e0a, 0x00a7,
+    0x1e80, 0x00a9, 0x1e82, 0x1e0b, 0x1ef2, 0x00ad, 0x00ae, 0x0178,
+    0x1e1e, 0x1e1f, 0x0120, 0x0121, 0x1e40, 0x1e41, 0x00b6, 0x1e56,
+    0x1e81, 0x1e57, 0x1e83, 0x1e60, 0x1ef3, 0x1e84, 0x1e85, 0x1e61,
+    0x00c0, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x00c7,
+    0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+    0x0174, 0x00d1, 0x00d2, 0x00d3, 0x00d4, 0x00d5, 0x00d6, 0x1e6a,
+    0x00d8, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x00dd, 0x0176, 0x00df,
+    0x00e0, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x00e7,
+    0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+    0x0175, 0x00f1, 0x00f2, 0x00f3, 0x00f4, 0x00f5, 0x00f6, 0x1e6b,
+    0x00f8, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x00fd, 0x0177, 0x00ff
+  },
+  [15] = {
+    0x00a0, 0x00a1, 0x00a2, 0x00a3, 0x20ac, 0x00a5, 0x0160, 0x00a7,
+    0x0161, 0x00a9, 0x00aa, 0x00ab, 0x00ac, 0x00ad, 0x00ae, 0x00af,
+    0x00b0, 0x00b1, 0x00b2, 0x00b3, 0x017d, 0x00b5, 0x00b6, 0x00b7,
+    0x017e, 0x00b9, 0x00ba, 0x00bb, 0x0152, 0x0153, 0x0178, 0x00bf,
+    0x00c0, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x00c7,
+    0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+    0x00d0, 0x00d1, 0x00d2, 0x00d3, 0x00d4, 0x00d5, 0x00d6, 0x00d7,
+    0x00d8, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x00dd, 0x00de, 0x00df,
+    0x00e0, 0x00e1, 0x00e2, 0x00e3, 0x00e4, 0x00e5, 0x00e6, 0x00e7,
+    0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+    0x00f0, 0x00f1, 0x00f2, 0x00f3, 0x00f4, 0x00f5, 0x00f6, 0x00f7,
+    0x00f8, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x00fd, 0x00fe, 0x00ff
+  },
+  [16] = {
+    0x00a0, 0x0104, 0x0105, 0x0141, 0x20ac, 0x201e, 0x0160, 0x00a7,
+    0x0161, 0x00a9, 0x0218, 0x00ab, 0x0179, 0x00ad, 0x017a, 0x017b,
+    0x00b0, 0x00b1, 0x010c, 0x0142, 0x017d, 0x201d, 0x00b6, 0x00b7,
+    0x017e, 0x010d, 0x0219, 0x00bb, 0x0152, 0x0153, 0x0178, 0x017c,
+    0x00c0, 0x00c1, 0x00c2, 0x0102, 0x00c4, 0x0106, 0x00c6, 0x00c7,
+    0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+    0x0110, 0x0143, 0x00d2, 0x00d3, 0x00d4, 0x0150, 0x00d6, 0x015a,
+    0x0170, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x0118, 0x021a, 0x00df,
+    0x00e0, 0x00e1, 0x00e2, 0x0103, 0x00e4, 0x0107, 0x00e6, 0x00e7,
+    0x00e8, 0x00e9, 0x00ea, 0x00eb, 0x00ec, 0x00ed, 0x00ee, 0x00ef,
+    0x0111, 0x0144, 0x00f2, 0x00f3, 0x00f4, 0x0151, 0x00f6, 0x015b,
+    0x0171, 0x00f9, 0x00fa, 0x00fb, 0x00fc, 0x0119, 0x021b, 0x00ff
+  }
+};
+
+/*
+ * Output
+ */
+
+struct output {
+  char* p;
+  char* end; /* leaves room for the terminating null byte */
+};
+
+static int
+put_code_point(struct output* out, uint32_t cp)
+{
+  char* p = out->p;
+
+  if (cp < 0x80) {
+    if (out->end - p < 1) {
+      return -1;
+    }
+    *p++ = cp;
+  } else if (cp < 0x800) {
+    if (out->end - p < 2) {
+      return -1;
+    }
+    *p++ = 0xc0 | (cp >> 6);
+    *p++ = 0x80 | (cp & 0x3f);
+  } else if (cp < 0x10000) {
+    if (out->end - p < 3) {
+      return -1;
+    }
+    *p++ = 0xe0 | (cp >> 12);
+    *p++ = 0x80 | ((cp >> 6) & 0x3f);
+    *p++ = 0x80 | (cp & 0x3f);
+  } else {
+    if (out->end - p < 4) {
+      return -1;
+    }
+    *p++ = 0xf0 | (cp >> 18);
+    *p++ = 0x80 | ((cp >> 12) & 0x3f);
+    *p++ = 0x80 | ((cp >> 6) & 0x3f);
+    *p++ = 0x80 | (cp & 0x3f);
+  }
+  out->p = p;
+
+  return 0;
+}
+
+/* Handles the control codes 0x80 to 0x9f. */
+static int
+put_control(struct output* out, uint8_t code)
+{
+  if (code == CONTROL_CR_LF) {
+    return put_code_point(out, '\n');
+  }
+  return 0; /* drop emphasis and reserved codes */
+}
+
+/* Copies the leading run of printable ASCII characters. Returns the
+ * number of copied bytes. */
+static size_t
+copy_ascii(struct output* out, const uint8_t* src, size_t len)
+{
+  static const uint64_t HIGH_BITS = 0x8080808080808080ull;
+  static const uint64_t SPACES = 0x2020202020202020ull;
+  static const uint64_t ONES = 0x0101010101010101ull;
+  size_t max, n;
+
+  max = out->end - out->p;
+  if (max > len) {
+    max = len;
+  }
+
+  /* A byte of |v - SPACES| has its high bit set if the byte in |v| is
+   * below 0x20, or if there's a borrow from such a byte. A byte of
+   * |v + ONES| has it set if the byte in |v| is DEL, 0x7f. Bytes of
+   * 0x80 and above have it set in |v|; only their carries can spill
+   * into |v + ONES|. */
+  for (n = 0; n + 8 <= max; n += 8) {
+    uint64_t v;
+    memcpy(&v, src + n, sizeof(v));
+    if ((v | (v - SPACES) | (v + ONES)) & HIGH_BITS) {
+      break;
+    }
+  }
+  for (; n < max && src[n] >= 0x20 && src[n] < 0x7f; ++n) { }
+
+  memcpy(out->p, src, n);
+  out->p += n;
+
+  return n;
+}
+
+/*
+ * Character tables
+ */
+
+static const struct diacritic*
+find_letter(uint8_t mark, uint8_t letter)
+{
+  size_t lo = 0;
+  size_t hi = ARRAY_LENGTH(g_iso6937_letter);
+
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    const struct diacritic* d = g_iso6937_letter + mid;
+    int cmp = (d->mark - mark) ? (d->mark - mark) : (d->letter - letter);
+    if (!cmp) {
+      return d;
+    } else if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return NULL;
+}
+
+static int
+is_mark(uint8_t c)
+{
+  return c >= 0xc1 && c <= 0xcf;
+}
+
+static void
+decode_iso6937(struct output* out, const uint8_t* src, size_t len)
+{
+  size_t i = 0;
+
+  while (i < len) {
+    uint8_t c;
+    int res;
+
+    i += copy_ascii(out, src + i, len - i);
+    if (i == len) {
+      break;
+    }
+
+    c = src[i++];
+    if (c < 0x20 || c == 0x7f) {
+      continue; /* drop C0 controls */
+    } else if (c < 0x80) {
+      res = put_code_point(out, c); /* no room for whole run */
+    } else if (c < 0xa0) {
+      res = put_control(out, c);
+    } else if (is_mark(c) && i < len) {
+      const struct diacritic* d = find_letter(c, src[i]);
+      if (d) {
+        res = put_code_point(out, d->code_point);
+        ++i;
+      } else if (src[i] >= 0x20 && src[i] < 0x7f) {
+        /* letter followed by combining mark */
+        res = put_code_point(out, src[i]);
+        if (!res) {
+          res = put_code_point(out, g_iso6937[c - 0xa0]);
+        }
+        ++i;
+      } else {
+        res = put_code_point(out, REPLACEMENT_CHARACTER);
+      }
+    } else {
+      res = put_code_point(out, g_iso6937[c - 0xa0]);
+    }
+    if (res < 0) {
+      break;
+    }
+  }
+}
+
+static void
+decode_iso8859(struct output* out, const uint8_t* src, size_t len,
+               unsigned int part)
+{
+  const uint16_t* upper = part > 1 ? g_iso8859[part] : NULL;
+  size_t i = 0;
+
+  while (i < len) {
+    uint8_t c;
+    int res;
+
+    i += copy_ascii(out, src + i, len - i);
+    if (i == len) {
+      break;
+    }
+
+    c = src[i++];
+    if (c < 0x20 || c == 0x7f) {
+      continue;
+    } else if (c < 0x80) {
+      res = put_code_point(out, c);
+    } else if (c < 0xa0) {
+      res = put_control(out, c);
+    } else {
+      res = put_code_point(out, upper ? upper[c - 0xa0] : c);
+    }
+    if (res < 0) {
+      break;
+    }
+  }
+}
+
+/* Returns a private-use control code as its single-byte equivalent, or 0
+ * for other code points. */
+static uint8_t
+private_control(uint32_t cp)
+{
+  if (cp >= PRIVATE_CONTROL_BASE + 0x80 && cp < PRIVATE_CONTROL_BASE + 0xa0) {
+    return cp - PRIVATE_CONTROL_BASE;
+  }
+  return 0;
+}
+
+static void
+decode_ucs2(struct output* out, const uint8_t* src, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i + 1 < len; i += 2) {
+    uint32_t cp = (src[i] << 8) | src[i + 1];
+    int res;
+
+    if (cp < 0x20 || (cp >= 0x7f && cp < 0xa0)) {
+      continue;
+    } else if (private_control(cp)) {
+      res = put_control(out, private_control(cp));
+    } else if (cp >= 0xd800 && cp < 0xe000) {
+      res = put_code_point(out, REPLACEMENT_CHARACTER); /* surrogate */
+    } else {
+      res = put_code_point(out, cp);
+    }
+    if (res < 0) {
+      break;
+    }
+  }
+}
+
+/* Decodes a UTF-8 sequence. Returns its length, or 0 if it's invalid. */
+static size_t
+decode_utf8_sequence(const uint8_t* s, size_t len, uint32_t* cp)
+{
+  size_t n, i;
+  uint32_t min;
+
+  if (s[0] < 0x80) {
+    *cp = s[0];
+    return 1;
+  } else if ((s[0] & 0xe0) == 0xc0) {
+    n = 2;
+    min = 0x80;
+    *cp = s[0] & 0x1f;
+  } else if ((s[0] & 0xf0) == 0xe0) {
+    n = 3;
+    min = 0x800;
+    *cp = s[0] & 0x0f;
+  } else if ((s[0] & 0xf8) == 0xf0) {
+    n = 4;
+    min = 0x10000;
+    *cp = s[0] & 0x07;
+  } else {
+    return 0;
+  }
+
+  if (len < n) {
+    return 0;
+  }
+  for (i = 1; i < n; ++i) {
+    if ((s[i] & 0xc0) != 0x80) {
+      return 0;
+    }
+    *cp = (*cp << 6) | (s[i] & 0x3f);
+  }
+  if (*cp < min || *cp > 0x10ffff || (*cp >= 0xd800 && *cp < 0xe000)) {
+    return 0; /* overlong, out of range or surrogate */
+  }
+  return n;
+}
+
+static void
+decode_utf8(struct output* out, const uint8_t* src, size_t len)
+{
+  size_t i = 0;
+
+  while (i < len) {
+    uint32_t cp;
+    size_t n;
+    int res;
+
+    i += copy_ascii(out, src + i, len - i);
+    if (i == len) {
+      break;
+    }
+
+    n = decode_utf8_sequence(src + i, len - i, &cp);
+    if (!n) {
+      cp = REPLACEMENT_CHARACTER;
+      n = 1;
+    }
+    i += n;
+
+    if (cp < 0x20 || (cp >= 0x7f && cp < 0xa0)) {
+      continue;
+    } else if (private_control(cp)) {
+      res = put_control(out, private_control(cp));
+    } else {
+      res = put_code_point(out, cp);
+    }
+    if (res < 0) {
+      break;
+    }
+  }
+}
+
+/* Returns the character table selected by the first bytes of |src|, and
+ * the length of the selection. */
+static int
+select_table(const uint8_t* src, size_t len, size_t* skip,
+             unsigned int* part)
+{
+  *skip = 0;
+  *part = 0;
+
+  if (!len || src[0] >= 0x20) {
+    return TABLE_ISO6937;
+  }
+
+  *skip = 1;
+
+  switch (src[0]) {
+    case 0x01 ... 0x07:
+    case 0x09 ... 0x0b:
+      *part = src[0] + 4; /* ISO/IEC 8859-5 to 8859-15 */
+      return TABLE_ISO8859;
+    case 0x10:
+      if (len < 3 || src[1] || !src[2] || src[2] > 16 || src[2] == 12) {
+        return TABLE_UNSUPPORTED;
+      }
+      *skip = 3;
+      *part = src[2];
+      return TABLE_ISO8859;
+    case 0x11:
+      return TABLE_UCS2;
+    case 0x15:
+      return TABLE_UTF8;
+    case 0x1f:
+      *skip = 2; /* encoding_type_id, e.g. Huffman */
+      return TABLE_UNSUPPORTED;
+    default:
+      return TABLE_UNSUPPORTED; /* Korean and Chinese tables */
+  }
+}
+
+/*
+ * Public interfaces
+ */
+
+size_t
+dvb_text_decode(char* dst, size_t cap, const uint8_t* src, size_t len)
+{
+  struct output out;
+  unsigned int part;
+  size_t skip;
+  int table;
+
+  assert(dst);
+  assert(cap);
+  assert(src || !len);
+
+  out.p = dst;
+  out.end = dst + cap - 1;
+
+  table = select_table(src, len, &skip, &part);
+  if (skip > len) {
+    skip = len;
+  }
+  src += skip;
+  len -= skip;
+
+  switch (table) {
+    case TABLE_ISO6937:
+      decode_iso6937(&out, src, len);
+      break;
+    case TABLE_ISO8859:
+      decode_iso8859(&out, src, len, part);
+      break;
+    case TABLE_UCS2:
+      decode_ucs2(&out, src, len);
+      break;
+    case TABLE_UTF8:
+      decode_utf8(&out, src, len);
+      break;
+    default:
+      break;
+  }
+  *out.p = '\0';
+
+  return out.p - dst;
+}
+
+char*
+dvb_text_dup(const uint8_t* src, size_t len)
+{
+  char* str;
+
+  str = malloc(DVB_TEXT_MAX_LEN(len));
+  if (!str) {
+    ALOGE_ERRNO("malloc");
+    return NULL;
+  }
+  dvb_text_decode(str, DVB_TEXT_MAX_LEN(len), src, len);
+
+  return str;
+}
+
+int
+dvb_text_is_utf8(const char* str)
+{
+  const uint8_t* s = (const uint8_t*)str;
+  size_t len;
+
+  assert(str);
+
+  len = strlen(str);
+
+  while (len) {
+    uint32_t cp;
+    size_t n;
+
+    if (*s < 0x80) {
+      ++s;
+      --len;
+      continue;
+    }
+    n = decode_utf8_sequence(s, len, &cp);
+    if (!n) {
+      return 0;
+    }
+    s += n;
+    len -= n;
+  }
+  return 1;
+}
+
+void
+dvb_text_repair_utf8(char* str)
+{
+  uint8_t* s = (uint8_t*)str;
+  size_t len;
+
+  assert(str);
+
+  len = strlen(str);
+
+  while (len) {
+    uint32_t cp;
+    size_t n;
+
+    n = decode_utf8_sequence(s, len, &cp);
+    if (!n) {
+      *s = '?';
+      n = 1;
+    }
+    s += n;
+    len -= n;
+  }
+}
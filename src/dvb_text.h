@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the decoder for text in SI tables, as specified in
+ * ETSI EN 300 468, Annex A.
+ *
+ * |dvb_text_decode| converts a DVB string to UTF-8. The first bytes of
+ * the string select the character table. Without selection, the string
+ * uses ISO/IEC 6937, where diacritical marks precede their letters. The
+ * decoder supports ISO/IEC 8859 parts 1 to 16, ISO/IEC 10646 in UCS-2
+ * and UTF-8. Strings in other tables, such as Huffman-compressed text,
+ * are decoded to an empty string. Undefined characters and invalid UTF-8
+ * sequences become U+FFFD. Emphasis control codes are dropped, and the
+ * CR/LF control code becomes a line feed.
+ *
+ * Runs of printable ASCII characters are copied 8 bytes at a time. Other
+ * characters are translated with lookup tables.
+ *
+ * The output is null-terminated and cut off at a character boundary if
+ * it doesn't fit into |cap| bytes. The function returns the length of the
+ * output, excluding the terminating null byte. The UTF-8 output of a
+ * string takes at most |DVB_TEXT_MAX_LEN| bytes. |dvb_text_dup| returns
+ * the output in a buffer allocated with malloc(3), or NULL on errors.
+ *
+ * |dvb_text_is_utf8| tells if a string is valid UTF-8, and
+ * |dvb_text_repair_utf8| replaces each byte of invalid sequences with
+ * '?', so that the string keeps its length.
+ *
+ * All functions are thread-safe.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Each input byte results in at most 3 output bytes. */
+#define DVB_TEXT_MAX_LEN(_len) (3 * (_len) + 1)
+
+size_t
+dvb_text_decode(char* dst, size_t cap, const uint8_t* src, size_t len);
+
+char*
+dvb_text_dup(const uint8_t* src, size_t len);
+
+int
+dvb_text_is_utf8(const char* str);
+
+void
+dvb_text_repair_utf8(char* str);
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements histograms with logarithmic buckets. See the
+ * corresponding header file for documentation.
+ */
+
+#include "histogram.h"
+
+#include <assert.h>
+#include <string.h>
+
+static unsigned int
+bucket_of(uint64_t value)
+{
+  unsigned int bucket;
+
+  if (!value) {
+    return 0;
+  }
+  bucket = 64 - __builtin_clzll(value);
+
+  return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+void
+histogram_clear(struct histogram* hist)
+{
+  assert(hist);
+
+  memset(hist, 0, sizeof(*hist));
+}
+
+void
+histogram_add(struct histogram* hist, uint64_t value)
+{
+  assert(hist);
+
+  ++hist->bucket[bucket_of(value)];
+  ++hist->count;
+  hist->sum += value;
+  if (value > hist->max) {
+    hist->max = value;
+  }
+}
+
+void
+histogram_add_atomic(struct histogram* hist, uint64_t value)
+{
+  uint64_t max;
+
+  assert(hist);
+
+  __atomic_fetch_add(hist->bucket + bucket_of(value), 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&hist->sum, value, __ATOMIC_RELAXED);
+
+  max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+  while (value > max &&
+         !__atomic_compare_exchange_n(&hist->max, &max, value, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    /* |max| has been reloaded; try again */
+  }
+}
+
+void
+histogram_load_atomic(const struct histogram* hist, struct histogram* copy)
+{
+  unsigned int i;
+
+  assert(hist);
+  assert(copy);
+
+  copy->count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+  copy->sum = __atomic_load_n(&hist->sum, __ATOMIC_RELAXED);
+  copy->max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+  for (i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+    copy->bucket[i] = __atomic_load_n(hist->bucket + i, __ATOMIC_RELAXED);
+  }
+}
+
+void
+histogram_clear_atomic(struct histogram* hist)
+{
+  unsigned int i;
+
+  assert(hist);
+
+  for (i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+    __atomic_store_n(hist->bucket + i, 0, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&hist->count, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&hist->sum, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&hist->max, 0, __ATOMIC_RELAXED);
+}
+
+uint64_t
+histogram_percentile(const struct histogram* hist, unsigned int percent)
+{
+  uint64_t rank, seen;
+  unsigned int i;
+
+  assert(hist);
+  assert(percent <= 100);
+
+  if (!hist->count) {
+    return 0;
+  }
+
+  rank = (hist->count * percent + 99) / 100;
+  if (!rank) {
+    rank = 1;
+  }
+
+  seen = 0;
+  for (i = 0; i < HISTOGRAM_BUCKETS - 1; ++i) {
+    seen += hist->bucket[i];
+    if (seen >= rank) {
+      uint64_t upper = i ? (1ull << i) - 1 : 0;
+      return upper < hist->max ? upper : hist->max;
+    }
+  }
+  return hist->max;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains histograms with logarithmic buckets, for example
+ * for timings.
+ *
+ * |histogram_add| counts a value in the bucket of its binary magnitude.
+ * Bucket 0 counts the value 0, bucket n counts values in [2^(n-1), 2^n).
+ * The last bucket also counts all larger values. Besides the buckets, a
+ * histogram tracks the number of values, their sum and their maximum.
+ *
+ * |histogram_percentile| returns the upper bound of the bucket that
+ * contains the given percentile, or the maximum for the last bucket.
+ *
+ * Histograms don't lock. Callers serialize access themselves. For
+ * histograms that are updated from multiple threads, the |_atomic|
+ * variants update, copy and clear each field with relaxed atomic
+ * operations. A copy taken while other threads add values might not be
+ * consistent across fields, but each field is.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+enum {
+  HISTOGRAM_BUCKETS = 32
+};
+
+struct histogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint32_t bucket[HISTOGRAM_BUCKETS];
+};
+
+void
+histogram_clear(struct histogram* hist);
+
+void
+histogram_add(struct histogram* hist, uint64_t value);
+
+void
+histogram_add_atomic(struct histogram* hist, uint64_t value);
+
+void
+histogram_load_atomic(const struct histogram* hist, struct histogram* copy);
+
+void
+histogram_clear_atomic(struct histogram* hist);
+
+uint64_t
+histogram_percentile(const struct histogram* hist, unsigned int percent);
@@ -36,7 +36,10 @@
 #include "pdu.h"
 #include "registry.h"
 #include "service.h"
+#include "stats.h"
+#include "trace.h"
 #include "wakelock.h"
+#include "watchdog.h"
 
 enum {
   OPCODE_ERROR = 0
@@ -83,8 +86,18 @@ enum {
  * Instances of |struct io_state| should always be initialized with a
  * call to |IO_STATE_INITIALIZER| or |INIT_IO_STATE|. The former sets
  *  the file-descriptor field |fd| to '-1', which means 'invalid'.
+ *
+ * For the statistics, |sendq_time| holds the times at which the queued
+ * PDUs have been appended to the send queue. It's a ring buffer indexed
+ * by the number of appended and removed PDUs, which follows the order of
+ * the queue. If the queue is longer than the ring, the times of the
+ * excess PDUs are not tracked.
  */
 
+enum {
+  SENDQ_TIMES = 64
+};
+
 STAILQ_HEAD(pdu_wbuf_stailq, pdu_wbuf);
 
 struct io_state {
@@ -93,6 +106,9 @@ struct io_state {
   struct fd_events* epoll_funcs;
   struct pdu_rbuf* rbuf;
   struct pdu_wbuf_stailq sendq;
+  unsigned long sendq_head; /* number of removed PDUs */
+  unsigned long sendq_tail; /* number of appended PDUs */
+  uint64_t sendq_time[SENDQ_TIMES]; /* us, 0 if not tracked */
 };
 
 #define IO_STATE_INITIALIZER(_io_state) \
@@ -112,6 +128,9 @@ struct io_state {
     __io_state->epoll_funcs = (_epoll_funcs); \
     __io_state->rbuf = (_rbuf); \
     STAILQ_INIT(&__io_state->sendq); \
+    __io_state->sendq_head = 0; \
+    __io_state->sendq_tail = 0; \
+    memset(__io_state->sendq_time, 0, sizeof(__io_state->sendq_time)); \
   } while (0)
 
 static void
@@ -218,6 +237,33 @@ err_recvmsg:
   return -1;
 }
 
+static void
+io_state_sendq_appended(struct io_state* io_state)
+{
+  unsigned long len = io_state->sendq_tail - io_state->sendq_head;
+
+  if (len < SENDQ_TIMES) {
+    io_state->sendq_time[io_state->sendq_tail % SENDQ_TIMES] = stats_now();
+  }
+  ++io_state->sendq_tail;
+
+  stats_sendq_len(len + 1);
+}
+
+static void
+io_state_sendq_removed(struct io_state* io_state)
+{
+  uint64_t* time = io_state->sendq_time + io_state->sendq_head % SENDQ_TIMES;
+
+  if (*time) {
+    stats_sendq(*time);
+    *time = 0;
+  }
+  ++io_state->sendq_head;
+
+  stats_sendq_len(io_state->sendq_tail - io_state->sendq_head);
+}
+
 static void
 io_state_send_pending_wbufs(struct io_state* io_state)
 {
@@ -227,12 +273,17 @@ io_state_send_pending_wbufs(struct io_state* io_state)
     /* send next pending PDU */
 
     struct pdu_wbuf* wbuf = STAILQ_FIRST(&io_state->sendq);
+    uint64_t start = trace_is_enabled() ? trace_now() : 0;
 
     if (!send_pdu_wbuf(wbuf, io_state->fd, 0)) {
       return; /* the operation would block; wait for EPOLLOUT */
     }
 
+    trace_span(TRACE_SEND,
+               (wbuf->buf.pdu.service << 8) | wbuf->buf.pdu.opcode, start);
+
     STAILQ_REMOVE_HEAD(&io_state->sendq, stailq);
+    io_state_sendq_removed(io_state);
     destroy_pdu_wbuf(wbuf);
   }
 }
@@ -271,7 +322,10 @@ io_state_send(struct io_state* io_state, struct pdu_wbuf* wbuf)
 
   /* append wbuf to send queue and flush the queue */
 
+  stats_sent(wbuf->buf.pdu.service, wbuf->buf.pdu.opcode);
+
   STAILQ_INSERT_TAIL(&io_state->sendq, wbuf, stailq);
+  io_state_sendq_appended(io_state);
   io_state_send_pending_wbufs(io_state);
 
   if (!STAILQ_EMPTY(&io_state->sendq) &&
@@ -328,11 +382,16 @@ send_error_reply(uint8_t service, uint8_t error, struct io_state* io_state)
 static int
 handle_pdu(const struct pdu* cmd, struct io_state* io_state)
 {
+  uint64_t start;
   int status;
 
   assert(cmd);
 
+  watchdog_enter(WATCHDOG_COMMAND, (cmd->service << 8) | cmd->opcode);
+  start = stats_now();
   status = handle_pdu_by_service(cmd, g_service_handler);
+  stats_dispatch(cmd->service, cmd->opcode, status, start);
+  watchdog_leave();
 
   if (status) {
     goto err_handle_pdu_by_service;
@@ -408,13 +467,18 @@ static enum ioresult
 fd_io_out(int fd ATTRIBS(UNUSED), void* data)
 {
   struct io_state* io_state;
+  int res;
 
   assert(data);
 
   io_state = data;
   assert(io_state->fd == fd);
 
-  if (io_state_out(io_state) < 0) {
+  watchdog_enter(WATCHDOG_SEND, 0);
+  res = io_state_out(io_state);
+  watchdog_leave();
+
+  if (res < 0) {
     return IO_ABORT;
   }
 
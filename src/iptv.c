@@ -0,0 +1,642 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements the receiver for transport streams over UDP/RTP
+ * multicast. See the corresponding header file for documentation.
+ */
+
+#include "iptv.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "ts_demux.h"
+#include "tv_utils.h"
+
+enum {
+  SLOT_SIZE = 2048, /* fits a datagram of an Ethernet MTU */
+  SLOT_MASK = IPTV_RING_SLOTS - 1,
+  RECV_BATCH = 64, /* datagrams per recvmmsg */
+  RECV_TIMEOUT = 100, /* ms; interval for checking the stop flag */
+  LOCK_TIMEOUT = 1000, /* ms */
+  SOCKET_BUFFER = 8 * 1024 * 1024 /* absorbs bursts while the ring is full */
+};
+
+enum {
+  RTP_VERSION = 2,
+  RTP_HEADER_LEN = 12
+};
+
+static const uint64_t NS_PER_SEC = 1000000000ull;
+static const uint64_t NS_PER_MS = 1000000ull;
+
+struct slot {
+  uint16_t off; /* of the first TS packet */
+  uint16_t len; /* of the TS packets */
+};
+
+struct iptv_receiver {
+  pthread_mutex_t lock;
+  pthread_cond_t data_cond; /* signals new datagrams */
+  pthread_cond_t space_cond; /* signals released slots and new sockets */
+  pthread_t thread;
+  int stop;
+
+  struct in_addr ifaddr;
+  int fd; /* -1 if no group is joined */
+  int busy_fd; /* socket that the thread is receiving from */
+  int closing_fd; /* closed after the thread returns from receiving */
+  uint64_t join_time; /* ns */
+  uint64_t last_time; /* ns of last datagram with TS packets */
+  int32_t rtp_seq; /* highest received, or -1 if unknown */
+
+  uint8_t* buf;
+  struct slot slot[IPTV_RING_SLOTS];
+  uint64_t head;
+  uint64_t join_pos; /* first datagram of the current group */
+  LIST_HEAD(, iptv_reader) readers;
+
+  struct iptv_stats stats;
+};
+
+static uint64_t
+monotonic_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+/* Waits on a condition variable that uses CLOCK_MONOTONIC. Returns
+ * ETIMEDOUT after |deadline|. */
+static int
+wait_until(pthread_cond_t* cond, pthread_mutex_t* lock, uint64_t deadline)
+{
+  struct timespec ts = {
+    .tv_sec = deadline / NS_PER_SEC,
+    .tv_nsec = deadline % NS_PER_SEC
+  };
+
+  return pthread_cond_timedwait(cond, lock, &ts);
+}
+
+/*
+ * Sockets
+ */
+
+static int
+open_socket(const struct in_addr* ifaddr, uint32_t group, uint16_t port)
+{
+  static const int ONE = 1;
+  static const int BUFFER_SIZE = SOCKET_BUFFER;
+  static const struct timeval TIMEOUT = {
+    .tv_sec = 0,
+    .tv_usec = RECV_TIMEOUT * 1000
+  };
+
+  struct sockaddr_in addr;
+  int fd;
+
+  fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    ALOGE_ERRNO("socket");
+    return -1;
+  }
+
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &ONE, sizeof(ONE)) < 0) {
+    ALOGE_ERRNO("setsockopt(SO_REUSEADDR)");
+    goto err_setsockopt;
+  }
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &TIMEOUT,
+                 sizeof(TIMEOUT)) < 0) {
+    ALOGE_ERRNO("setsockopt(SO_RCVTIMEO)");
+    goto err_setsockopt;
+  }
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &BUFFER_SIZE,
+                 sizeof(BUFFER_SIZE)) < 0) {
+    ALOGW_ERRNO("setsockopt(SO_RCVBUF)"); /* continue with default */
+  }
+
+  /* Binding to the group filters datagrams of other groups on the same
+   * port. Unicast addresses allow for testing without multicast. */
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(group);
+  addr.sin_port = htons(port);
+
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    ALOGE_ERRNO("bind");
+    goto err_bind;
+  }
+
+  if (IN_MULTICAST(group)) {
+    struct ip_mreq mreq = {
+      .imr_multiaddr = addr.sin_addr,
+      .imr_interface = *ifaddr
+    };
+    if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+                   sizeof(mreq)) < 0) {
+      ALOGE_ERRNO("setsockopt(IP_ADD_MEMBERSHIP)");
+      goto err_add_membership;
+    }
+  }
+
+  return fd;
+
+err_add_membership:
+err_bind:
+err_setsockopt:
+  close(fd);
+  return -1;
+}
+
+/* Replaces the receiver's socket. Closing a socket leaves its group. If
+ * the thread is receiving from the old socket, we wake it up and let it
+ * close the socket, so that the file descriptor cannot be reused while
+ * the thread is still using it. */
+static void
+replace_socket(struct iptv_receiver* recv, int fd)
+{
+  if (recv->fd == recv->busy_fd && recv->fd >= 0) {
+    shutdown(recv->fd, SHUT_RDWR);
+    recv->closing_fd = recv->fd;
+  } else if (recv->fd >= 0) {
+    close(recv->fd);
+  }
+  recv->fd = fd;
+}
+
+/*
+ * Ring
+ */
+
+static uint8_t*
+slot_data(const struct iptv_receiver* recv, uint64_t pos)
+{
+  return recv->buf + (pos & SLOT_MASK) * SLOT_SIZE;
+}
+
+/* Returns the position of the slowest reader. Readers that haven't
+ * skipped to the current group yet might still use their slots. */
+static uint64_t
+min_pos(const struct iptv_receiver* recv)
+{
+  const struct iptv_reader* reader;
+  uint64_t pos = recv->head;
+
+  LIST_FOREACH(reader, &recv->readers, entry) {
+    if (reader->pos < pos) {
+      pos = reader->pos;
+    }
+  }
+  return pos;
+}
+
+/* Finds the TS packets in a datagram and stores their location in the
+ * datagram's slot. Returns 1 if the datagram contains TS packets, or 0
+ * otherwise. */
+static int
+parse_datagram(struct iptv_receiver* recv, uint64_t pos, size_t len)
+{
+  const uint8_t* p = slot_data(recv, pos);
+  struct slot* slot = recv->slot + (pos & SLOT_MASK);
+  size_t off = 0;
+
+  slot->off = 0;
+  slot->len = 0;
+
+  if (len > SLOT_SIZE) {
+    len = SLOT_SIZE; /* truncated */
+  }
+
+  if (len && p[0] != TS_SYNC_BYTE) {
+    uint16_t seq, diff;
+
+    /* RTP header, CSRCs, extension, padding */
+    if (len < RTP_HEADER_LEN || (p[0] >> 6) != RTP_VERSION) {
+      goto invalid;
+    }
+    off = RTP_HEADER_LEN + 4 * (p[0] & 0x0f);
+    if ((p[0] & 0x10) && off + 4 <= len) {
+      off += 4 + 4 * ((p[off + 2] << 8) | p[off + 3]);
+    }
+    if ((p[0] & 0x20) && off < len && p[len - 1] <= len - off) {
+      len -= p[len - 1];
+    }
+
+    /* Duplicates and datagrams that arrive after a later one don't
+     * count, and they don't move the sequence number backwards. */
+    seq = (p[2] << 8) | p[3];
+    diff = seq - recv->rtp_seq;
+    if (recv->rtp_seq < 0) {
+      recv->rtp_seq = seq;
+    } else if (diff && diff < 0x8000) {
+      recv->stats.lost += diff - 1;
+      recv->rtp_seq = seq;
+    }
+  }
+
+  if (off >= len || p[off] != TS_SYNC_BYTE) {
+    goto invalid;
+  }
+
+  slot->off = off;
+  slot->len = (len - off) - (len - off) % TS_PACKET_SIZE;
+  recv->stats.bytes += slot->len;
+
+  return 1;
+
+invalid:
+  ++recv->stats.invalid;
+  return 0;
+}
+
+static void*
+receive_thread(void* arg)
+{
+  struct iptv_receiver* recv = arg;
+  struct mmsghdr msg[RECV_BATCH];
+  struct iovec iov[RECV_BATCH];
+
+  pthread_mutex_lock(&recv->lock);
+
+  while (!recv->stop) {
+    uint64_t head = recv->head;
+    uint32_t num = IPTV_RING_SLOTS - (head - min_pos(recv));
+    int fd = recv->fd;
+    int res, err, valid, i;
+
+    if (fd < 0 || !num) {
+      if (fd >= 0) {
+        ++recv->stats.ring_full;
+      }
+      wait_until(&recv->space_cond, &recv->lock,
+                 monotonic_ns() + RECV_TIMEOUT * NS_PER_MS);
+      continue;
+    }
+    if (num > RECV_BATCH) {
+      num = RECV_BATCH;
+    }
+    recv->busy_fd = fd;
+
+    pthread_mutex_unlock(&recv->lock);
+
+    /* The slots behind |head| are free, so we receive into them
+     * without holding the lock. */
+    memset(msg, 0, num * sizeof(*msg));
+    for (i = 0; i < (int)num; ++i) {
+      iov[i].iov_base = slot_data(recv, head + i);
+      iov[i].iov_len = SLOT_SIZE;
+      msg[i].msg_hdr.msg_iov = iov + i;
+      msg[i].msg_hdr.msg_iovlen = 1;
+    }
+    res = recvmmsg(fd, msg, num, MSG_WAITFORONE, NULL);
+    err = errno;
+
+    pthread_mutex_lock(&recv->lock);
+
+    recv->busy_fd = -1;
+    if (recv->closing_fd >= 0) {
+      close(recv->closing_fd);
+      recv->closing_fd = -1;
+    }
+
+    if (res < 0) {
+      if (err != EAGAIN && err != EWOULDBLOCK && err != EINTR) {
+        ALOGE_ERRNO_NUM("recvmmsg", err);
+        wait_until(&recv->space_cond, &recv->lock,
+                   monotonic_ns() + RECV_TIMEOUT * NS_PER_MS);
+      }
+      continue;
+    } else if (fd != recv->fd) {
+      continue; /* datagrams of the previous group */
+    }
+
+    for (valid = 0, i = 0; i < res; ++i) {
+      valid |= parse_datagram(recv, head + i, msg[i].msg_len);
+    }
+    if (valid) {
+      recv->last_time = monotonic_ns();
+    }
+    if (res > 0) {
+      recv->head = head + res;
+      recv->stats.datagrams += res;
+      pthread_cond_broadcast(&recv->data_cond);
+    }
+  }
+
+  pthread_mutex_unlock(&recv->lock);
+
+  return NULL;
+}
+
+/*
+ * Public interfaces
+ */
+
+static int
+init_cond(pthread_cond_t* cond)
+{
+  pthread_condattr_t attr;
+  int err;
+
+  err = pthread_condattr_init(&attr);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_condattr_init", err);
+    return -1;
+  }
+  err = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_condattr_setclock", err);
+    goto err_pthread_condattr_setclock;
+  }
+  err = pthread_cond_init(cond, &attr);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_cond_init", err);
+    goto err_pthread_cond_init;
+  }
+  pthread_condattr_destroy(&attr);
+
+  return 0;
+
+err_pthread_cond_init:
+err_pthread_condattr_setclock:
+  pthread_condattr_destroy(&attr);
+  return -1;
+}
+
+struct iptv_receiver*
+create_iptv_receiver(const char* ifaddr)
+{
+  struct iptv_receiver* recv;
+  int err;
+
+  recv = calloc(1, sizeof(*recv));
+  if (!recv) {
+    ALOGE_ERRNO("calloc");
+    return NULL;
+  }
+
+  if (!ifaddr) {
+    recv->ifaddr.s_addr = htonl(INADDR_ANY);
+  } else if (inet_pton(AF_INET, ifaddr, &recv->ifaddr) != 1) {
+    ALOGE("Invalid interface address %s", ifaddr);
+    goto err_inet_pton;
+  }
+
+  recv->buf = malloc(IPTV_RING_SLOTS * SLOT_SIZE);
+  if (!recv->buf) {
+    ALOGE_ERRNO("malloc");
+    goto err_malloc;
+  }
+
+  recv->fd = -1;
+  recv->busy_fd = -1;
+  recv->closing_fd = -1;
+  recv->rtp_seq = -1;
+  LIST_INIT(&recv->readers);
+
+  err = pthread_mutex_init(&recv->lock, NULL);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_mutex_init", err);
+    goto err_pthread_mutex_init;
+  }
+  if (init_cond(&recv->data_cond) < 0) {
+    goto err_init_cond_data;
+  }
+  if (init_cond(&recv->space_cond) < 0) {
+    goto err_init_cond_space;
+  }
+
+  err = pthread_create(&recv->thread, NULL, receive_thread, recv);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_create", err);
+    goto err_pthread_create;
+  }
+
+  return recv;
+
+err_pthread_create:
+  pthread_cond_destroy(&recv->space_cond);
+err_init_cond_space:
+  pthread_cond_destroy(&recv->data_cond);
+err_init_cond_data:
+  pthread_mutex_destroy(&recv->lock);
+err_pthread_mutex_init:
+  free(recv->buf);
+err_malloc:
+err_inet_pton:
+  free(recv);
+  return NULL;
+}
+
+void
+destroy_iptv_receiver(struct iptv_receiver* recv)
+{
+  assert(recv);
+  assert(LIST_EMPTY(&recv->readers));
+
+  pthread_mutex_lock(&recv->lock);
+  recv->stop = 1;
+  replace_socket(recv, -1);
+  pthread_cond_broadcast(&recv->space_cond);
+  pthread_mutex_unlock(&recv->lock);
+
+  pthread_join(recv->thread, NULL);
+
+  if (recv->closing_fd >= 0) {
+    close(recv->closing_fd);
+  }
+  pthread_cond_destroy(&recv->space_cond);
+  pthread_cond_destroy(&recv->data_cond);
+  pthread_mutex_destroy(&recv->lock);
+  free(recv->buf);
+  free(recv);
+}
+
+int
+iptv_receiver_join(struct iptv_receiver* recv, uint32_t group,
+                   uint16_t port)
+{
+  int fd;
+
+  assert(recv);
+
+  fd = open_socket(&recv->ifaddr, group, port);
+
+  pthread_mutex_lock(&recv->lock);
+
+  replace_socket(recv, fd);
+  recv->join_time = monotonic_ns();
+  recv->last_time = 0;
+  recv->join_pos = recv->head;
+  recv->rtp_seq = -1;
+  pthread_cond_broadcast(&recv->space_cond);
+
+  pthread_mutex_unlock(&recv->lock);
+
+  return fd < 0 ? -1 : 0;
+}
+
+void
+iptv_receiver_leave(struct iptv_receiver* recv)
+{
+  assert(recv);
+
+  pthread_mutex_lock(&recv->lock);
+  replace_socket(recv, -1);
+  recv->join_pos = recv->head;
+  pthread_mutex_unlock(&recv->lock);
+}
+
+void
+iptv_receiver_get_status(struct iptv_receiver* recv, uint8_t* status,
+                         uint16_t* strength)
+{
+  uint64_t now;
+
+  assert(recv);
+  assert(status);
+  assert(strength);
+
+  now = monotonic_ns();
+
+  pthread_mutex_lock(&recv->lock);
+
+  *status = 0;
+  *strength = 0;
+
+  if (recv->fd >= 0) {
+    *status = TV_FRONTEND_HAS_SIGNAL | TV_FRONTEND_HAS_CARRIER;
+    if (recv->last_time > recv->join_time &&
+        now - recv->last_time < LOCK_TIMEOUT * NS_PER_MS) {
+      *status |= TV_FRONTEND_HAS_SYNC | TV_FRONTEND_HAS_LOCK;
+      *strength = UINT16_MAX;
+    }
+  }
+
+  pthread_mutex_unlock(&recv->lock);
+}
+
+void
+iptv_receiver_get_stats(struct iptv_receiver* recv,
+                        struct iptv_stats* stats)
+{
+  assert(recv);
+  assert(stats);
+
+  pthread_mutex_lock(&recv->lock);
+  *stats = recv->stats;
+  pthread_mutex_unlock(&recv->lock);
+}
+
+void
+iptv_receiver_add_reader(struct iptv_receiver* recv,
+                         struct iptv_reader* reader)
+{
+  assert(recv);
+  assert(reader);
+
+  pthread_mutex_lock(&recv->lock);
+  reader->pos = recv->head;
+  LIST_INSERT_HEAD(&recv->readers, reader, entry);
+  pthread_mutex_unlock(&recv->lock);
+}
+
+void
+iptv_receiver_remove_reader(struct iptv_receiver* recv,
+                            struct iptv_reader* reader)
+{
+  assert(recv);
+  assert(reader);
+
+  pthread_mutex_lock(&recv->lock);
+  LIST_REMOVE(reader, entry);
+  pthread_cond_broadcast(&recv->space_cond);
+  pthread_mutex_unlock(&recv->lock);
+}
+
+uint32_t
+iptv_receiver_wait(struct iptv_receiver* recv, struct iptv_reader* reader,
+                   uint64_t deadline)
+{
+  uint32_t num;
+
+  assert(recv);
+  assert(reader);
+
+  pthread_mutex_lock(&recv->lock);
+
+  for (;;) {
+    if (reader->pos < recv->join_pos) {
+      reader->pos = recv->join_pos; /* skip previous group */
+    }
+    if (recv->head > reader->pos ||
+        wait_until(&recv->data_cond, &recv->lock, deadline) == ETIMEDOUT) {
+      break;
+    }
+  }
+  if (reader->pos < recv->join_pos) {
+    reader->pos = recv->join_pos;
+  }
+  num = recv->head - reader->pos;
+
+  pthread_mutex_unlock(&recv->lock);
+
+  return num;
+}
+
+const uint8_t*
+iptv_receiver_get(struct iptv_receiver* recv,
+                  const struct iptv_reader* reader, uint32_t i,
+                  size_t* len)
+{
+  const struct slot* slot;
+
+  assert(recv);
+  assert(reader);
+  assert(len);
+
+  /* The slot stays unchanged until the reader releases it. */
+  slot = recv->slot + ((reader->pos + i) & SLOT_MASK);
+  *len = slot->len;
+
+  return slot_data(recv, reader->pos + i) + slot->off;
+}
+
+void
+iptv_receiver_release(struct iptv_receiver* recv,
+                      struct iptv_reader* reader, uint32_t num)
+{
+  assert(recv);
+  assert(reader);
+
+  pthread_mutex_lock(&recv->lock);
+  reader->pos += num;
+  pthread_cond_signal(&recv->space_cond);
+  pthread_mutex_unlock(&recv->lock);
+}
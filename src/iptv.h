@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the receiver for transport streams over UDP/RTP
+ * multicast, as used by IPTV tuners.
+ *
+ * |create_iptv_receiver| returns a receiver that joins multicast groups
+ * on the network interface with the IPv4 address |ifaddr|, or on the
+ * default interface if |ifaddr| is NULL. |iptv_receiver_join| leaves the
+ * current group and joins |group| on |port|, both in host byte order.
+ * |iptv_receiver_leave| only leaves the current group.
+ *
+ * A thread receives datagrams with recvmmsg(2) directly into a ring of
+ * packet slots. Datagrams carry either plain transport stream packets or
+ * RTP with an MPEG-2 TS payload. RTP headers are detected and skipped,
+ * and the gaps in their sequence numbers are counted as lost datagrams.
+ *
+ * Readers consume the ring without copying. |iptv_receiver_add_reader|
+ * registers a reader at the ring's current end. |iptv_receiver_wait|
+ * returns the number of datagrams that are available to the reader, or
+ * 0 if none arrives until |deadline|, in nanoseconds of CLOCK_MONOTONIC.
+ * |iptv_receiver_get| returns the TS packets of the i-th available
+ * datagram. The data stays valid until the reader releases it with
+ * |iptv_receiver_release|. |iptv_receiver_remove_reader| unregisters the
+ * reader.
+ *
+ * The ring holds |IPTV_RING_SLOTS| datagrams. The thread doesn't overwrite
+ * slots before all readers released them. If the ring is full, datagrams
+ * queue up in the socket's receive buffer and are dropped by the kernel
+ * when it overflows. Readers that release data quickly keep the ring
+ * empty. After joining a group, readers skip the remaining datagrams of
+ * the previous group.
+ *
+ * |iptv_receiver_get_status| returns TV_FRONTEND_ flags: the receiver has
+ * signal after joining and locks when TS packets arrive. It loses lock if
+ * no datagram arrived for a second.
+ *
+ * All functions are thread-safe. A reader is used by a single thread.
+ * Unless noted otherwise, functions return 0 on success and -1 on
+ * errors.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/queue.h>
+
+enum {
+  IPTV_RING_SLOTS = 4096 /* must be a power of 2 */
+};
+
+struct iptv_receiver;
+
+struct iptv_reader {
+  LIST_ENTRY(iptv_reader) entry;
+  uint64_t pos;
+};
+
+struct iptv_stats {
+  uint64_t datagrams;
+  uint64_t bytes; /* TS packets */
+  uint64_t lost; /* RTP sequence gaps */
+  uint64_t invalid; /* datagrams without TS packets */
+  uint64_t ring_full; /* times the thread waited for readers */
+};
+
+struct iptv_receiver*
+create_iptv_receiver(const char* ifaddr);
+
+void
+destroy_iptv_receiver(struct iptv_receiver* recv);
+
+int
+iptv_receiver_join(struct iptv_receiver* recv, uint32_t group,
+                   uint16_t port);
+
+void
+iptv_receiver_leave(struct iptv_receiver* recv);
+
+void
+iptv_receiver_get_status(struct iptv_receiver* recv, uint8_t* status,
+                         uint16_t* strength);
+
+void
+iptv_receiver_get_stats(struct iptv_receiver* recv,
+                        struct iptv_stats* stats);
+
+void
+iptv_receiver_add_reader(struct iptv_receiver* recv,
+                         struct iptv_reader* reader);
+
+void
+iptv_receiver_remove_reader(struct iptv_receiver* recv,
+                            struct iptv_reader* reader);
+
+uint32_t
+iptv_receiver_wait(struct iptv_receiver* recv, struct iptv_reader* reader,
+                   uint64_t deadline);
+
+const uint8_t*
+iptv_receiver_get(struct iptv_receiver* recv,
+                  const struct iptv_reader* reader, uint32_t i,
+                  size_t* len);
+
+void
+iptv_receiver_release(struct iptv_receiver* recv,
+                      struct iptv_reader* reader, uint32_t num);
@@ -17,19 +17,26 @@
 /* This file contains the main entry point and setup code. */
 
 #include <assert.h>
+#include <errno.h>
 #include <fdio/loop.h>
 #include <fdio/task.h>
 #include <hardware_legacy/power.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "compiler.h"
+#include "dtv_harvest.h"
 #include "io.h"
 #include "log.h"
 #include "memptr.h"
+#include "trace.h"
+#include "tv_hal.h"
 #include "wakelock.h"
+#include "watchdog.h"
 
 /*
  * Command-line options
@@ -41,8 +48,10 @@
  *
  * For each supported option, there's a |parse_opt_*| function. None
  * of these function should be called from outside of |parse_opts|. We
- * currently only support 'a' for settings the daemons network address
- * and 'h' for printing general information about the program.
+ * currently support 'a' for settings the daemons network address, 'h'
+ * for printing general information about the program, 't' and 'n' for
+ * adding virtual tuners that play transport stream files, and 'i' and
+ * 'm' for adding IPTV tuners.
  *
  * The return value of the parser functions differ slightly from the
  * usual conventions. A value of '0' means success and a value of '-1'
@@ -55,6 +64,14 @@
 
 struct options {
   const char* socket_name;
+  const char* vtuner_dir;
+  unsigned long vtuner_num;
+  const char* iptv_ifaddr;
+  unsigned long iptv_num;
+  unsigned long harvest_freshness;
+  unsigned long harvest_budget;
+  unsigned long watchdog_threshold;
+  int watchdog_backtrace;
 };
 
 static int
@@ -83,6 +100,147 @@ parse_opt_a(char* arg, struct options* opt)
   return 0;
 }
 
+static int
+parse_tuner_num(const char* arg, unsigned long* num)
+{
+  char* end;
+
+  if (!arg) {
+    fprintf(stderr, "Error: No number of tuners specified.");
+    return -1;
+  }
+
+  errno = 0;
+  *num = strtoul(arg, &end, 10);
+  if (errno || *end || !*num || *num > 16) {
+    fprintf(stderr, "Error: The number of tuners must be between 1 "
+                    "and 16.");
+    return -1;
+  }
+
+  return 0;
+}
+
+static int
+parse_opt_i(char* arg, struct options* opt)
+{
+  return parse_tuner_num(arg, &opt->iptv_num);
+}
+
+static int
+parse_opt_m(char* arg, struct options* opt)
+{
+  if (!arg) {
+    fprintf(stderr, "Error: No interface address specified.");
+    return -1;
+  }
+
+  if (!strlen(arg)) {
+    fprintf(stderr, "Error: The specified interface address is empty.");
+    return -1;
+  }
+
+  opt->iptv_ifaddr = arg;
+
+  return 0;
+}
+
+static int
+parse_opt_n(char* arg, struct options* opt)
+{
+  return parse_tuner_num(arg, &opt->vtuner_num);
+}
+
+static int
+parse_opt_t(char* arg, struct options* opt)
+{
+  if (!arg) {
+    fprintf(stderr, "Error: No directory for virtual tuners specified.");
+    return -1;
+  }
+
+  if (!strlen(arg)) {
+    fprintf(stderr, "Error: The specified directory is empty.");
+    return -1;
+  }
+
+  opt->vtuner_dir = arg;
+
+  return 0;
+}
+
+static int
+parse_opt_b(struct options* opt)
+{
+  opt->watchdog_backtrace = 1;
+
+  return 0;
+}
+
+static int
+parse_opt_e(char* arg, struct options* opt)
+{
+  char* end;
+
+  if (!arg) {
+    fprintf(stderr, "Error: No EPG freshness specified.");
+    return -1;
+  }
+
+  errno = 0;
+  opt->harvest_freshness = strtoul(arg, &end, 10);
+  if (errno || *end || !opt->harvest_freshness ||
+      opt->harvest_freshness > 7 * 24 * 60) {
+    fprintf(stderr, "Error: The EPG freshness must be between 1 and "
+                    "10080 minutes.");
+    return -1;
+  }
+
+  return 0;
+}
+
+static int
+parse_opt_p(char* arg, struct options* opt)
+{
+  char* end;
+
+  if (!arg) {
+    fprintf(stderr, "Error: No power budget specified.");
+    return -1;
+  }
+
+  errno = 0;
+  opt->harvest_budget = strtoul(arg, &end, 10);
+  if (errno || *end || opt->harvest_budget > 100) {
+    fprintf(stderr, "Error: The power budget must be between 0 and "
+                    "100 percent.");
+    return -1;
+  }
+
+  return 0;
+}
+
+static int
+parse_opt_w(char* arg, struct options* opt)
+{
+  char* end;
+
+  if (!arg) {
+    fprintf(stderr, "Error: No stall threshold specified.");
+    return -1;
+  }
+
+  errno = 0;
+  opt->watchdog_threshold = strtoul(arg, &end, 10);
+  if (errno || *end || opt->watchdog_threshold > 60 * 1000) {
+    fprintf(stderr, "Error: The stall threshold must be between 0 and "
+                    "60000 milliseconds.");
+    return -1;
+  }
+
+  return 0;
+}
+
 static int
 parse_opt_h(void)
 {
@@ -96,7 +254,34 @@ parse_opt_h(void)
          "  -a    the network address\n"
          "\n"
          "The only supported address family is AF_UNIX with abstract "
-         "names.\n");
+         "names.\n"
+         "\n"
+         "Virtual tuners:\n"
+         "  -t    directory with transport stream files, named\n"
+         "        <frequency in kHz>.ts\n"
+         "  -n    the number of virtual tuners, defaults to 1\n"
+         "\n"
+         "Virtual tuners play the file of the tuned frequency in a loop\n"
+         "at the rate of the recording.\n"
+         "\n"
+         "IPTV tuners:\n"
+         "  -i    the number of IPTV tuners\n"
+         "  -m    the IPv4 address of the network interface for\n"
+         "        multicast, defaults to the default interface\n"
+         "\n"
+         "EPG harvesting:\n"
+         "  -e    the EPG freshness target in minutes, defaults to 360\n"
+         "  -p    the power budget in percent of tuner time, defaults\n"
+         "        to 25; 0 disables harvesting\n"
+         "\n"
+         "Idle tuners read the EPG of all transponders that locked in\n"
+         "earlier scans.\n"
+         "\n"
+         "Diagnostics:\n"
+         "  -w    the threshold in milliseconds after which a blocked\n"
+         "        I/O thread is reported as stalled, defaults to 1000;\n"
+         "        0 disables the watchdog\n"
+         "  -b    logs a backtrace of the I/O thread on stalls\n");
 
   return 1;
 }
@@ -109,8 +294,24 @@ parse_opt(int c, char* arg, struct options* options)
       return parse_opt_question_mark(c);
     case 'a':
       return parse_opt_a(arg, options);
+    case 'b':
+      return parse_opt_b(options);
+    case 'e':
+      return parse_opt_e(arg, options);
     case 'h':
       return parse_opt_h();
+    case 'i':
+      return parse_opt_i(arg, options);
+    case 'm':
+      return parse_opt_m(arg, options);
+    case 'n':
+      return parse_opt_n(arg, options);
+    case 'p':
+      return parse_opt_p(arg, options);
+    case 't':
+      return parse_opt_t(arg, options);
+    case 'w':
+      return parse_opt_w(arg, options);
   }
   return -1;
 }
@@ -128,7 +329,7 @@ parse_opts(int argc, char* argv[], struct options* options)
   res = 0;
 
   do {
-    int c = getopt(argc, argv, "a:h");
+    int c = getopt(argc, argv, "a:be:hi:m:n:p:t:w:");
     if (c < 0) {
       break; /* end of options */
     }
@@ -226,6 +427,39 @@ make_daemon(void)
    */
 }
 
+/* SIGUSR1 dumps the trace, SIGUSR2 toggles tracing. Both are async-
+ * signal-safe. */
+static void
+handle_trace_signal(int signum)
+{
+  if (signum == SIGUSR1) {
+    trace_dump(TRACE_DUMP_FILE);
+  } else {
+    trace_enable(!trace_is_enabled());
+  }
+}
+
+static int
+init_trace_signals(void)
+{
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_trace_signal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+
+  if (sigaction(SIGUSR1, &sa, NULL) < 0) {
+    ALOGE_ERRNO("sigaction(SIGUSR1)");
+    return -1;
+  }
+  if (sigaction(SIGUSR2, &sa, NULL) < 0) {
+    ALOGE_ERRNO("sigaction(SIGUSR2)");
+    return -1;
+  }
+  return 0;
+}
+
 static enum ioresult
 init(void* data)
 {
@@ -235,6 +469,28 @@ init(void* data)
     return -1;
   }
 
+  if (init_trace_signals() < 0) {
+    goto err_init_trace_signals;
+  }
+
+  if (init_watchdog(options->watchdog_threshold,
+                    options->watchdog_backtrace) < 0) {
+    goto err_init_watchdog;
+  }
+
+  if (options->vtuner_dir) {
+    /* must be set before the DTV service opens the TV HAL */
+    tv_input_hal_set_virtual_tuners(options->vtuner_dir,
+                                    options->vtuner_num);
+  }
+  if (options->iptv_num) {
+    tv_input_hal_set_iptv_tuners(options->iptv_ifaddr, options->iptv_num);
+  }
+
+  /* must be set before the DTV service starts */
+  dtv_harvest_configure(options->harvest_freshness,
+                        options->harvest_budget);
+
   if (init_io(options->socket_name) < 0) {
     goto err_init_io;
   }
@@ -247,6 +503,9 @@ init(void* data)
   return IO_OK;
 
 err_init_io:
+  uninit_watchdog();
+err_init_watchdog:
+err_init_trace_signals:
   uninit_task_queue();
   return IO_ABORT;
 }
@@ -255,6 +514,7 @@ static void
 uninit(void* data ATTRIBS(UNUSED))
 {
   uninit_io();
+  uninit_watchdog();
   uninit_task_queue();
 }
 
@@ -265,7 +525,11 @@ main(int argc, char* argv[])
 
   int res;
   struct options options = {
-    .socket_name = DEFAULT_SOCKET_NAME
+    .socket_name = DEFAULT_SOCKET_NAME,
+    .vtuner_num = 1,
+    .harvest_freshness = DEFAULT_HARVEST_FRESHNESS,
+    .harvest_budget = DEFAULT_HARVEST_BUDGET,
+    .watchdog_threshold = DEFAULT_WATCHDOG_THRESHOLD
   };
 
   /* Guarantee progress until we opened a connection, or exit. */
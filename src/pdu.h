@@ -32,14 +32,15 @@ struct pdu;
  * protocol. Increment this number when you modify the protocol.
  */
 enum {
-  PROTOCOL_VERSION = 1
+  PROTOCOL_VERSION = 2
 };
 
 /* This enumerator lists the available services.
  */
 enum {
   SERVICE_REGISTRY = 0x00,
-  SERVICE_DTV = 0x01
+  SERVICE_DTV = 0x01,
+  SERVICE_STATS = 0x02
 };
 
 /* The error codes are kept in sync with Bluetooth status to make
@@ -32,15 +32,18 @@
 
 #include "pdu.h"
 #include "dtv_io.h"
+#include "stats_io.h"
 
 int (*g_service_handler[PDU_MAX_NUM_SERVICES])(const struct pdu*);
 
 register_func (* const g_register_service[PDU_MAX_NUM_SERVICES])(
   void (*)(struct pdu_wbuf*)) = {
   /* SERVICE_REGISTRY is special and not handled here */
-  [SERVICE_DTV] = register_dtv
+  [SERVICE_DTV] = register_dtv,
+  [SERVICE_STATS] = register_stats
 };
 
 int (*g_unregister_service[PDU_MAX_NUM_SERVICES])() = {
-  [SERVICE_DTV] = unregister_dtv
+  [SERVICE_DTV] = unregister_dtv,
+  [SERVICE_STATS] = unregister_stats
 };
\ No newline at end of file
@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements the runtime statistics. See the corresponding
+ * header file for documentation.
+ */
+
+#include "stats.h"
+
+#include <malloc.h>
+#include <pdu/pdu.h>
+
+#include "pdu.h"
+#include "trace.h"
+#include "tv_utils.h"
+
+/*
+ * Counters
+ *
+ * All counters are static. Driver calls come from many threads, so their
+ * counters are updated with relaxed atomic operations, and the maximum of
+ * their histogram with a compare-and-swap loop in |histogram_add_atomic|
+ * that only runs when a new maximum has been measured. The other events
+ * only occur on the I/O thread, which also reads the statistics. Their
+ * counters and maxima have a single writer and don't need
+ * read-modify-write operations, which would cost more than the event
+ * itself.
+ */
+
+struct latency {
+  uint64_t errors;
+  struct histogram hist;
+};
+
+static struct stats_opcode g_opcode[STATS_MAX_SERVICES][PDU_MAX_NUM_OPCODES];
+static struct latency g_dispatch[STATS_MAX_SERVICES];
+static struct latency g_hal[NUM_STATS_HAL_CALLS];
+static struct latency g_sendq;
+static uint64_t g_sendq_len;
+static uint64_t g_sendq_max_len;
+
+/* glibc's mallinfo() has int fields, which wrap above 2 GiB. glibc 2.33
+ * replaced it by mallinfo2(). Bionic's mallinfo() has size_t fields. */
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#define MALLINFO mallinfo2
+#define HEAP_BYTES(_field) ((uint64_t)(_field))
+#elif defined(__GLIBC__)
+#define MALLINFO mallinfo
+#define HEAP_BYTES(_field) ((uint64_t)(unsigned int)(_field))
+#else
+#define MALLINFO mallinfo
+#define HEAP_BYTES(_field) ((uint64_t)(_field))
+#endif
+
+static void
+add(uint64_t* counter, uint64_t value)
+{
+  __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static uint64_t
+load(const uint64_t* counter, int reset)
+{
+  if (reset) {
+    return __atomic_exchange_n((uint64_t*)counter, 0, __ATOMIC_RELAXED);
+  }
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void
+add_single(uint64_t* counter, uint64_t value)
+{
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) +
+                            value, __ATOMIC_RELAXED);
+}
+
+static void
+update_max_single(uint64_t* max, uint64_t value)
+{
+  if (value > __atomic_load_n(max, __ATOMIC_RELAXED)) {
+    __atomic_store_n(max, value, __ATOMIC_RELAXED);
+  }
+}
+
+/*
+ * Recording
+ */
+
+uint64_t
+stats_now(void)
+{
+  return trace_now();
+}
+
+void
+stats_dispatch(uint8_t service, uint8_t opcode, int error, uint64_t start)
+{
+  struct stats_opcode* counters;
+  uint64_t now, time;
+
+  now = stats_now();
+  if (trace_is_enabled()) {
+    trace_record(TRACE_DISPATCH, (service << 8) | opcode, start, now);
+  }
+
+  if (service >= STATS_MAX_SERVICES) {
+    return;
+  }
+
+  time = (now - start) / 1000;
+  counters = &g_opcode[service][opcode];
+
+  add_single(&counters->commands, 1);
+  add_single(&counters->time, time);
+  update_max_single(&counters->max_time, time);
+  if (error != ERROR_NONE) {
+    add_single(&counters->errors, 1);
+    add_single(&g_dispatch[service].errors, 1);
+  }
+  histogram_add(&g_dispatch[service].hist, time);
+}
+
+void
+stats_sent(uint8_t service, uint8_t opcode)
+{
+  if (service >= STATS_MAX_SERVICES) {
+    return;
+  }
+  add_single(&g_opcode[service][opcode].sent, 1);
+}
+
+void
+stats_hal_call(unsigned int call, uint8_t status, uint64_t start)
+{
+  uint64_t now = stats_now();
+
+  if (trace_is_enabled()) {
+    trace_record(TRACE_HAL, call, start, now);
+  }
+
+  if (call >= NUM_STATS_HAL_CALLS) {
+    return;
+  }
+  if (status != TV_STATUS_SUCCESS) {
+    add(&g_hal[call].errors, 1);
+  }
+  histogram_add_atomic(&g_hal[call].hist, (now - start) / 1000);
+}
+
+void
+stats_sendq(uint64_t start)
+{
+  uint64_t now = stats_now();
+
+  if (trace_is_enabled()) {
+    trace_record(TRACE_SENDQ, 0, start, now);
+  }
+
+  histogram_add(&g_sendq.hist, (now - start) / 1000);
+}
+
+void
+stats_sendq_len(unsigned long len)
+{
+  __atomic_store_n(&g_sendq_len, len, __ATOMIC_RELAXED);
+  update_max_single(&g_sendq_max_len, len);
+}
+
+/*
+ * Reading
+ */
+
+int
+stats_get_opcode(uint8_t service, uint8_t opcode, int reset,
+                 struct stats_opcode* counters)
+{
+  struct stats_opcode* cur;
+
+  if (service >= STATS_MAX_SERVICES) {
+    return -1;
+  }
+
+  cur = &g_opcode[service][opcode];
+
+  counters->commands = load(&cur->commands, reset);
+  counters->errors = load(&cur->errors, reset);
+  counters->sent = load(&cur->sent, reset);
+  counters->time = load(&cur->time, reset);
+  counters->max_time = load(&cur->max_time, reset);
+
+  return 0;
+}
+
+int
+stats_get_latency(uint8_t type, uint8_t index, int reset,
+                  uint64_t* errors, struct histogram* hist)
+{
+  struct latency* latency;
+
+  switch (type) {
+    case STATS_LATENCY_DISPATCH:
+      if (index >= STATS_MAX_SERVICES) {
+        return -1;
+      }
+      latency = g_dispatch + index;
+      break;
+    case STATS_LATENCY_HAL:
+      if (index >= NUM_STATS_HAL_CALLS) {
+        return -1;
+      }
+      latency = g_hal + index;
+      break;
+    case STATS_LATENCY_SENDQ:
+      if (index) {
+        return -1;
+      }
+      latency = &g_sendq;
+      break;
+    default:
+      return -1;
+  }
+
+  *errors = load(&latency->errors, reset);
+  histogram_load_atomic(&latency->hist, hist);
+  if (reset) {
+    histogram_clear_atomic(&latency->hist);
+  }
+
+  return 0;
+}
+
+int
+stats_get_gauge(uint8_t gauge, int reset, uint64_t* value)
+{
+  struct MALLINFO info;
+
+  switch (gauge) {
+    case STATS_GAUGE_HEAP_SIZE:
+      info = MALLINFO();
+      *value = HEAP_BYTES(info.arena) + HEAP_BYTES(info.hblkhd);
+      break;
+    case STATS_GAUGE_HEAP_USED:
+      info = MALLINFO();
+      *value = HEAP_BYTES(info.uordblks) + HEAP_BYTES(info.hblkhd);
+      break;
+    case STATS_GAUGE_SENDQ_LEN:
+      *value = __atomic_load_n(&g_sendq_len, __ATOMIC_RELAXED);
+      break;
+    case STATS_GAUGE_SENDQ_MAX_LEN:
+      *value = __atomic_load_n(&g_sendq_max_len, __ATOMIC_RELAXED);
+      if (reset) {
+        /* restart the high-water mark at the current length */
+        __atomic_store_n(&g_sendq_max_len,
+                         __atomic_load_n(&g_sendq_len, __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+      }
+      break;
+    default:
+      return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the interface for runtime statistics of the daemon.
+ *
+ * The I/O framework and the DTV service record statistics while they
+ * run; the Stats service in stats_io.h returns them to the client.
+ * Recording is lock-free and cheap enough for every PDU: each event
+ * costs a read of the monotonic clock and a few additions on static
+ * counters. Nothing is allocated.
+ *
+ * |stats_now| returns the monotonic time in nanoseconds. Record the
+ * time before an operation and pass it to the recording function after
+ * the operation completed. Dispatches, driver calls and send-queue times
+ * are also passed on to the tracer of trace.h, which uses the same
+ * clock. Histograms and handling times are in microseconds.
+ *
+ *  - |stats_dispatch| records a received command with the error code
+ *    that the service handler returned, and the time until the handler
+ *    returned.
+ *  - |stats_sent| records a PDU that has been queued for sending.
+ *  - |stats_hal_call| records a call into the driver with its TV_STATUS
+ *    code.
+ *  - |stats_sendq| records the time that a PDU spent in the send queue,
+ *    and |stats_sendq_len| the queue's length after each change.
+ *
+ * Except for |stats_hal_call|, the recording functions and the getters
+ * must only be called on the I/O thread. |stats_hal_call| is thread-safe.
+ *
+ * The counters of each opcode, and one latency histogram per service,
+ * per driver call and for the send queue accumulate until they are reset.
+ * |stats_get_opcode|, |stats_get_latency| and |stats_get_gauge| copy the
+ * current values; the |reset| flag clears them after reading. Copies of
+ * driver-call latencies aren't consistent across counters if other
+ * threads record meanwhile.
+ *
+ * The getters return 0 on success, or -1 if the arguments are out of
+ * range.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "histogram.h"
+
+enum {
+  STATS_MAX_SERVICES = 3
+};
+
+enum {
+  STATS_HAL_GET_TUNERS = 0x00,
+  STATS_HAL_SET_SOURCE = 0x01,
+  STATS_HAL_RELEASE_SOURCE = 0x02,
+  STATS_HAL_GET_STREAM_CONFIGS = 0x03,
+  STATS_HAL_OPEN_STREAM = 0x04,
+  STATS_HAL_CLOSE_STREAM = 0x05,
+  STATS_HAL_TUNE = 0x06,
+  STATS_HAL_GET_FRONTEND_STATUS = 0x07,
+  STATS_HAL_READ_SECTION = 0x08,
+  STATS_HAL_SET_CHANNEL = 0x09,
+  STATS_HAL_GET_CHANNELS = 0x0a,
+  NUM_STATS_HAL_CALLS
+};
+
+enum {
+  STATS_LATENCY_DISPATCH = 0x00, /* index is the service */
+  STATS_LATENCY_HAL = 0x01, /* index is the driver call */
+  STATS_LATENCY_SENDQ = 0x02 /* index is 0 */
+};
+
+enum {
+  STATS_GAUGE_HEAP_SIZE = 0x00, /* bytes */
+  STATS_GAUGE_HEAP_USED = 0x01, /* bytes */
+  STATS_GAUGE_SENDQ_LEN = 0x02, /* PDUs */
+  STATS_GAUGE_SENDQ_MAX_LEN = 0x03, /* PDUs */
+  NUM_STATS_GAUGES
+};
+
+struct stats_opcode {
+  uint64_t commands;
+  uint64_t errors;
+  uint64_t sent;
+  uint64_t time; /* us spent in the handler */
+  uint64_t max_time; /* us */
+};
+
+uint64_t
+stats_now(void);
+
+void
+stats_dispatch(uint8_t service, uint8_t opcode, int error, uint64_t start);
+
+void
+stats_sent(uint8_t service, uint8_t opcode);
+
+void
+stats_hal_call(unsigned int call, uint8_t status, uint64_t start);
+
+void
+stats_sendq(uint64_t start);
+
+void
+stats_sendq_len(unsigned long len);
+
+int
+stats_get_opcode(uint8_t service, uint8_t opcode, int reset,
+                 struct stats_opcode* counters);
+
+int
+stats_get_latency(uint8_t type, uint8_t index, int reset,
+                  uint64_t* errors, struct histogram* hist);
+
+int
+stats_get_gauge(uint8_t gauge, int reset, uint64_t* value);
@@ -0,0 +1,383 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements the Stats service. See the corresponding header
+ * file for documentation.
+ */
+
+#include "stats_io.h"
+
+#include <assert.h>
+#include <pdu/pdubuf.h>
+#include <stdlib.h>
+
+#include "dtv_pdu.h"
+#include "log.h"
+#include "memptr.h"
+#include "pdu.h"
+#include "stats.h"
+#include "trace.h"
+#include "watchdog.h"
+
+enum {
+  /* commands/responses */
+  OPCODE_GET_COUNTERS = 0x01,
+  OPCODE_GET_LATENCIES = 0x02,
+  OPCODE_GET_GAUGES = 0x03,
+  OPCODE_SET_TRACING = 0x04,
+  OPCODE_DUMP_TRACE = 0x05,
+  OPCODE_GET_STALLS = 0x06
+};
+
+enum {
+  IPC_FIELD_SIZE_OPCODE_COUNTERS = 2 + 5 * sizeof(uint64_t),
+  IPC_FIELD_SIZE_GAUGE = 1 + sizeof(uint64_t),
+  IPC_FIELD_SIZE_STALLS = 1 + 2 * sizeof(uint64_t)
+};
+
+static void (*g_send_pdu)(struct pdu_wbuf* wbuf);
+
+static void
+send_pdu(struct pdu_wbuf* wbuf)
+{
+  if (!g_send_pdu) {
+    ALOGE("g_send_pdu is NULL");
+  }
+
+  g_send_pdu(wbuf);
+}
+
+/*
+ * Commands/Responses
+ *
+ * Each command takes a flag for resetting the statistics after reading
+ * them. The counters are copied before building the response, so that
+ * the response's size is known in advance. Counters that other threads
+ * increment meanwhile are part of the next response.
+ */
+
+static int
+is_zero(const struct stats_opcode* counters)
+{
+  return !counters->commands && !counters->sent;
+}
+
+static int
+get_counters(const struct pdu* cmd)
+{
+  struct stats_opcode* counters;
+  struct pdu_wbuf* wbuf;
+  uint32_t num, idx;
+  uint8_t reset;
+
+  if (read_pdu_at(cmd, 0, "C", &reset) < 0) {
+    return ERROR_PARM_INVALID;
+  }
+
+  counters = calloc(STATS_MAX_SERVICES * PDU_MAX_NUM_OPCODES,
+                    sizeof(*counters));
+  if (!counters) {
+    ALOGE_ERRNO("calloc");
+    return ERROR_NOMEM;
+  }
+
+  num = 0;
+  for (idx = 0; idx < STATS_MAX_SERVICES * PDU_MAX_NUM_OPCODES; ++idx) {
+    stats_get_opcode(idx / PDU_MAX_NUM_OPCODES, idx % PDU_MAX_NUM_OPCODES,
+                     reset, counters + idx);
+    if (!is_zero(counters + idx)) {
+      ++num;
+    }
+  }
+
+  wbuf = create_pdu_wbuf(sizeof(uint32_t) +
+                         num * IPC_FIELD_SIZE_OPCODE_COUNTERS, 0, NULL);
+  if (!wbuf) {
+    goto err_create_pdu_wbuf;
+  }
+
+  init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
+
+  if (append_to_pdu(&wbuf->buf.pdu, "I", num) < 0) {
+    goto err_append_to_pdu;
+  }
+
+  for (idx = 0; idx < STATS_MAX_SERVICES * PDU_MAX_NUM_OPCODES; ++idx) {
+    if (is_zero(counters + idx)) {
+      continue;
+    }
+    if (append_to_pdu(&wbuf->buf.pdu, "CCLLLLL",
+                      (uint8_t)(idx / PDU_MAX_NUM_OPCODES),
+                      (uint8_t)(idx % PDU_MAX_NUM_OPCODES),
+                      counters[idx].commands, counters[idx].errors,
+                      counters[idx].sent, counters[idx].time,
+                      counters[idx].max_time) < 0) {
+      goto err_append_to_pdu;
+    }
+  }
+
+  send_pdu(wbuf);
+  free(counters);
+
+  return ERROR_NONE;
+
+err_append_to_pdu:
+  destroy_pdu_wbuf(wbuf);
+err_create_pdu_wbuf:
+  free(counters);
+  return ERROR_NOMEM;
+}
+
+static const struct {
+  uint8_t type;
+  uint8_t num;
+} g_latencies[] = {
+  { STATS_LATENCY_DISPATCH, STATS_MAX_SERVICES },
+  { STATS_LATENCY_HAL, NUM_STATS_HAL_CALLS },
+  { STATS_LATENCY_SENDQ, 1 }
+};
+
+static int
+get_latencies(const struct pdu* cmd)
+{
+  struct pdu_wbuf* wbuf;
+  struct histogram hist;
+  uint64_t errors;
+  uint32_t num, size;
+  uint8_t reset;
+  size_t i;
+  uint8_t j;
+
+  if (read_pdu_at(cmd, 0, "C", &reset) < 0) {
+    return ERROR_PARM_INVALID;
+  }
+
+  num = 0;
+  for (i = 0; i < ARRAY_LENGTH(g_latencies); ++i) {
+    num += g_latencies[i].num;
+  }
+
+  histogram_clear(&hist);
+  size = sizeof(uint32_t) +
+         num * (2 + sizeof(uint64_t) + calculate_histogram_size(&hist));
+
+  wbuf = create_pdu_wbuf(size, 0, NULL);
+  if (!wbuf) {
+    return ERROR_NOMEM;
+  }
+
+  init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
+
+  if (append_to_pdu(&wbuf->buf.pdu, "I", num) < 0) {
+    goto err_append_to_pdu;
+  }
+
+  for (i = 0; i < ARRAY_LENGTH(g_latencies); ++i) {
+    for (j = 0; j < g_latencies[i].num; ++j) {
+      stats_get_latency(g_latencies[i].type, j, reset, &errors, &hist);
+      if (append_to_pdu(&wbuf->buf.pdu, "CCL", g_latencies[i].type, j,
+                        errors) < 0) {
+        goto err_append_to_pdu;
+      }
+      if (append_histogram(&wbuf->buf.pdu, &hist) < 0) {
+        goto err_append_to_pdu;
+      }
+    }
+  }
+
+  send_pdu(wbuf);
+
+  return ERROR_NONE;
+
+err_append_to_pdu:
+  destroy_pdu_wbuf(wbuf);
+  return ERROR_NOMEM;
+}
+
+static int
+get_gauges(const struct pdu* cmd)
+{
+  struct pdu_wbuf* wbuf;
+  uint64_t value;
+  uint8_t reset;
+  uint8_t gauge;
+
+  if (read_pdu_at(cmd, 0, "C", &reset) < 0) {
+    return ERROR_PARM_INVALID;
+  }
+
+  wbuf = create_pdu_wbuf(sizeof(uint32_t) +
+                         NUM_STATS_GAUGES * IPC_FIELD_SIZE_GAUGE, 0, NULL);
+  if (!wbuf) {
+    return ERROR_NOMEM;
+  }
+
+  init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
+
+  if (append_to_pdu(&wbuf->buf.pdu, "I", (uint32_t)NUM_STATS_GAUGES) < 0) {
+    goto err_append_to_pdu;
+  }
+
+  for (gauge = 0; gauge < NUM_STATS_GAUGES; ++gauge) {
+    stats_get_gauge(gauge, reset, &value);
+    if (append_to_pdu(&wbuf->buf.pdu, "CL", gauge, value) < 0) {
+      goto err_append_to_pdu;
+    }
+  }
+
+  send_pdu(wbuf);
+
+  return ERROR_NONE;
+
+err_append_to_pdu:
+  destroy_pdu_wbuf(wbuf);
+  return ERROR_NOMEM;
+}
+
+static int
+set_tracing(const struct pdu* cmd)
+{
+  struct pdu_wbuf* wbuf;
+  uint8_t enable;
+
+  if (read_pdu_at(cmd, 0, "C", &enable) < 0) {
+    return ERROR_PARM_INVALID;
+  }
+
+  wbuf = create_pdu_wbuf(0, 0, NULL);
+  if (!wbuf) {
+    return ERROR_NOMEM;
+  }
+
+  trace_enable(enable);
+
+  init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
+  send_pdu(wbuf);
+
+  return ERROR_NONE;
+}
+
+static int
+dump_trace(const struct pdu* cmd)
+{
+  struct pdu_wbuf* wbuf;
+  long num;
+
+  wbuf = create_pdu_wbuf(sizeof(uint32_t), 0, NULL);
+  if (!wbuf) {
+    return ERROR_NOMEM;
+  }
+
+  num = trace_dump(TRACE_DUMP_FILE);
+  if (num < 0) {
+    ALOGE_ERRNO("trace_dump");
+    goto err_trace_dump;
+  }
+
+  init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
+
+  if (append_to_pdu(&wbuf->buf.pdu, "I", (uint32_t)num) < 0) {
+    goto err_append_to_pdu;
+  }
+
+  send_pdu(wbuf);
+
+  return ERROR_NONE;
+
+err_append_to_pdu:
+err_trace_dump:
+  destroy_pdu_wbuf(wbuf);
+  return ERROR_FAIL;
+}
+
+static int
+get_stalls(const struct pdu* cmd)
+{
+  struct pdu_wbuf* wbuf;
+  uint64_t stalls, longest;
+  uint8_t reset;
+  uint8_t cause;
+
+  if (read_pdu_at(cmd, 0, "C", &reset) < 0) {
+    return ERROR_PARM_INVALID;
+  }
+
+  wbuf = create_pdu_wbuf(sizeof(uint32_t) +
+                         NUM_WATCHDOG_CAUSES * IPC_FIELD_SIZE_STALLS,
+                         0, NULL);
+  if (!wbuf) {
+    return ERROR_NOMEM;
+  }
+
+  init_pdu(&wbuf->buf.pdu, cmd->service, cmd->opcode);
+
+  if (append_to_pdu(&wbuf->buf.pdu, "I",
+                    (uint32_t)NUM_WATCHDOG_CAUSES) < 0) {
+    goto err_append_to_pdu;
+  }
+
+  for (cause = 0; cause < NUM_WATCHDOG_CAUSES; ++cause) {
+    watchdog_get_stalls(cause, reset, &stalls, &longest);
+    if (append_to_pdu(&wbuf->buf.pdu, "CLL", cause, stalls, longest) < 0) {
+      goto err_append_to_pdu;
+    }
+  }
+
+  send_pdu(wbuf);
+
+  return ERROR_NONE;
+
+err_append_to_pdu:
+  destroy_pdu_wbuf(wbuf);
+  return ERROR_NOMEM;
+}
+
+/*
+ * Service framework
+ */
+
+static int
+stats_handler(const struct pdu* cmd)
+{
+  static int (* const handler[PDU_MAX_NUM_OPCODES])(const struct pdu*) = {
+    [OPCODE_GET_COUNTERS] = get_counters,
+    [OPCODE_GET_LATENCIES] = get_latencies,
+    [OPCODE_GET_GAUGES] = get_gauges,
+    [OPCODE_SET_TRACING] = set_tracing,
+    [OPCODE_DUMP_TRACE] = dump_trace,
+    [OPCODE_GET_STALLS] = get_stalls
+  };
+
+  return handle_pdu_by_opcode(cmd, handler);
+}
+
+int
+(*register_stats(void (*send_pdu_cb)(struct pdu_wbuf*)))(const struct pdu*)
+{
+  assert(send_pdu_cb);
+
+  g_send_pdu = send_pdu_cb;
+
+  return stats_handler;
+}
+
+int
+unregister_stats()
+{
+  g_send_pdu = NULL;
+
+  return 0;
+}
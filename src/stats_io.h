@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the interface to the Stats service.
+ *
+ * The Stats service returns the runtime statistics of stats.h to the
+ * client: counters per opcode, latency histograms, gauges and the stalls
+ * of watchdog.h. It also controls the tracer of trace.h. It has no state
+ * of its own besides the send callback.
+ *
+ * For registering, |register_stats| takes a callback for sending PDUs
+ * and returns the service-handler function on success. On errors, NULL
+ * is returned. |unregister_stats| returns 0 on success; statistics keep
+ * being recorded while the service is unregistered.
+ */
+
+#pragma once
+
+struct pdu;
+struct pdu_wbuf;
+
+int
+(*register_stats(void (*send_pdu_cb)(struct pdu_wbuf*)))(const struct pdu*);
+
+int
+unregister_stats(void);
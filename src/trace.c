@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements the event tracer. See the corresponding header
+ * file for documentation.
+ */
+
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "memptr.h"
+
+enum {
+  TRACE_VERSION = 1
+};
+
+static const char TRACE_MAGIC[8] = "TVDTRACE";
+
+static const struct {
+  uint8_t type;
+  const char* name;
+} g_events[NUM_TRACE_EVENTS] = {
+  [TRACE_DISPATCH] = { TRACE_TYPE_SPAN, "dispatch" },
+  [TRACE_HAL] = { TRACE_TYPE_SPAN, "driver" },
+  [TRACE_SEND] = { TRACE_TYPE_SPAN, "send" },
+  [TRACE_SENDQ] = { TRACE_TYPE_ASYNC_SPAN, "sendq" },
+  [TRACE_TASK_QUEUED] = { TRACE_TYPE_FLOW_START, "task" },
+  [TRACE_TASK_RUN] = { TRACE_TYPE_FLOW_END, "task" }
+};
+
+int g_trace_enabled;
+
+uint64_t
+trace_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+trace_enable(int enable)
+{
+  __atomic_store_n(&g_trace_enabled, !!enable, __ATOMIC_RELAXED);
+}
+
+/*
+ * Ring buffers
+ *
+ * Each ring has a single writer, its thread, which publishes events by
+ * incrementing |head| with release semantics. Readers load |head| with
+ * acquire semantics and can read all events before it that haven't been
+ * overwritten yet. Rings are allocated on a thread's first event and
+ * registered in |g_ring| under |g_lock|. They are never freed, so that
+ * the events of exited threads remain available. A ring of an exited
+ * thread is only reused if all slots are taken.
+ */
+
+struct trace_event {
+  uint64_t time; /* ns */
+  uint64_t duration; /* ns */
+  uint32_t arg;
+  uint16_t event;
+  uint16_t reserved;
+};
+
+struct trace_ring {
+  pid_t tid;
+  int exited;
+  uint64_t head; /* number of recorded events */
+  struct trace_event event[TRACE_RING_LEN];
+};
+
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_key;
+static int g_key_valid;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_ring* g_ring[TRACE_MAX_THREADS];
+
+static void
+thread_exited(void* data)
+{
+  struct trace_ring* ring = data;
+
+  pthread_mutex_lock(&g_lock);
+  ring->exited = 1;
+  pthread_mutex_unlock(&g_lock);
+}
+
+static void
+create_key(void)
+{
+  int err = pthread_key_create(&g_key, thread_exited);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_key_create", err);
+    return;
+  }
+  g_key_valid = 1;
+}
+
+static struct trace_ring*
+attach_ring(void)
+{
+  struct trace_ring* ring;
+  size_t i, slot;
+  int err;
+
+  pthread_once(&g_once, create_key);
+  if (!g_key_valid) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&g_lock);
+
+  slot = ARRAY_LENGTH(g_ring);
+  for (i = 0; i < ARRAY_LENGTH(g_ring); ++i) {
+    if (!g_ring[i]) {
+      slot = i;
+      break;
+    } else if (g_ring[i]->exited && slot == ARRAY_LENGTH(g_ring)) {
+      slot = i;
+    }
+  }
+  if (slot == ARRAY_LENGTH(g_ring)) {
+    ring = NULL; /* this thread isn't traced */
+    goto out;
+  }
+
+  ring = g_ring[slot];
+  if (!ring) {
+    ring = calloc(1, sizeof(*ring));
+    if (!ring) {
+      ALOGE_ERRNO("calloc");
+      goto out;
+    }
+  }
+  ring->tid = gettid();
+  ring->exited = 0;
+  __atomic_store_n(&ring->head, 0, __ATOMIC_RELEASE);
+
+  err = pthread_setspecific(g_key, ring);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_setspecific", err);
+    if (!g_ring[slot]) {
+      free(ring);
+    }
+    ring = NULL;
+    goto out;
+  }
+  __atomic_store_n(g_ring + slot, ring, __ATOMIC_RELEASE);
+
+out:
+  pthread_mutex_unlock(&g_lock);
+  return ring;
+}
+
+void
+trace_record(uint16_t event, uint32_t arg, uint64_t start, uint64_t end)
+{
+  struct trace_ring* ring;
+  struct trace_event* ev;
+  uint64_t head;
+
+  ring = g_key_valid ? pthread_getspecific(g_key) : NULL;
+  if (!ring) {
+    ring = attach_ring();
+    if (!ring) {
+      return;
+    }
+  }
+
+  head = ring->head;
+  ev = ring->event + head % TRACE_RING_LEN;
+  ev->time = start;
+  ev->duration = end - start;
+  ev->arg = arg;
+  ev->event = event;
+  ev->reserved = 0;
+
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Dumping
+ *
+ * The functions below only use async-signal-safe system calls. Each
+ * ring is written in at most two chunks straight from its buffer. The
+ * ring's header is written last with the number of events that the
+ * thread overwrote while they were written.
+ */
+
+struct ring_header {
+  uint32_t tid;
+  uint32_t num_events;
+  uint32_t num_invalid;
+};
+
+static int
+write_all(int fd, const void* buf, size_t len)
+{
+  const uint8_t* pos = buf;
+
+  while (len) {
+    ssize_t res = TEMP_FAILURE_RETRY(write(fd, pos, len));
+    if (res < 0) {
+      return -1;
+    }
+    pos += res;
+    len -= res;
+  }
+  return 0;
+}
+
+static int
+write_header(int fd)
+{
+  uint32_t version = TRACE_VERSION;
+  uint32_t num = NUM_TRACE_EVENTS;
+  uint8_t desc[2];
+  size_t i;
+
+  if (write_all(fd, TRACE_MAGIC, sizeof(TRACE_MAGIC)) < 0 ||
+      write_all(fd, &version, sizeof(version)) < 0 ||
+      write_all(fd, &num, sizeof(num)) < 0) {
+    return -1;
+  }
+  for (i = 0; i < ARRAY_LENGTH(g_events); ++i) {
+    desc[0] = g_events[i].type;
+    desc[1] = strlen(g_events[i].name);
+    if (write_all(fd, desc, sizeof(desc)) < 0 ||
+        write_all(fd, g_events[i].name, desc[1]) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Returns the number of valid events, or -1 on errors. */
+static long
+write_ring(int fd, const struct trace_ring* ring)
+{
+  struct ring_header hdr;
+  uint64_t head, first, last;
+  off_t off;
+  size_t pos, len;
+
+  off = lseek(fd, 0, SEEK_CUR);
+  if (off < 0) {
+    return -1;
+  }
+
+  head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  first = head > TRACE_RING_LEN ? head - TRACE_RING_LEN : 0;
+
+  hdr.tid = ring->tid;
+  hdr.num_events = head - first;
+  hdr.num_invalid = 0;
+
+  if (write_all(fd, &hdr, sizeof(hdr)) < 0) {
+    return -1;
+  }
+
+  /* from |first| to the end of the buffer, then from the beginning */
+  pos = first % TRACE_RING_LEN;
+  len = hdr.num_events < TRACE_RING_LEN - pos ? hdr.num_events
+                                              : TRACE_RING_LEN - pos;
+  if (write_all(fd, ring->event + pos, len * sizeof(*ring->event)) < 0 ||
+      write_all(fd, ring->event, (hdr.num_events - len) *
+                                 sizeof(*ring->event)) < 0) {
+    return -1;
+  }
+
+  /* Events up to |last| might have been overwritten meanwhile, including
+   * the slot of the event that is being recorded at |last|. */
+  last = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  if (last >= first + TRACE_RING_LEN) {
+    last -= TRACE_RING_LEN - 1;
+    hdr.num_invalid = last - first < hdr.num_events ? last - first
+                                                    : hdr.num_events;
+    if (TEMP_FAILURE_RETRY(pwrite(fd, &hdr, sizeof(hdr), off)) < 0) {
+      return -1;
+    }
+  }
+
+  return hdr.num_events - hdr.num_invalid;
+}
+
+long
+trace_dump(const char* path)
+{
+  const struct trace_ring* ring;
+  long num, res;
+  size_t i;
+  int fd, saved_errno;
+
+  saved_errno = errno;
+
+  fd = TEMP_FAILURE_RETRY(open(path, O_WRONLY | O_CREAT | O_TRUNC |
+                                     O_CLOEXEC, S_IRUSR | S_IWUSR));
+  if (fd < 0) {
+    goto err_open;
+  }
+
+  if (write_header(fd) < 0) {
+    goto err_write;
+  }
+
+  num = 0;
+  for (i = 0; i < ARRAY_LENGTH(g_ring); ++i) {
+    ring = __atomic_load_n(g_ring + i, __ATOMIC_ACQUIRE);
+    if (!ring) {
+      continue;
+    }
+    res = write_ring(fd, ring);
+    if (res < 0) {
+      goto err_write;
+    }
+    num += res;
+  }
+
+  close(fd);
+  errno = saved_errno;
+
+  return num;
+
+err_write:
+  close(fd);
+err_open:
+  errno = saved_errno;
+  return -1;
+}
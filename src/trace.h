@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the interface to the event tracer.
+ *
+ * The tracer records timestamped events of the PDU and driver path into
+ * binary ring buffers, one per thread. It's meant for finding out where
+ * the time of a slow operation went: into the command handler, a driver
+ * call, the task queue of the I/O thread, or the socket.
+ *
+ * Tracing is disabled by default and costs one branch per trace point
+ * then. |trace_enable| turns it on and off at runtime. Each thread gets
+ * its ring buffer on its first event after tracing has been enabled. The
+ * ring keeps the thread's last |TRACE_RING_LEN| events; older events are
+ * overwritten.
+ *
+ *  - |trace_span| records an event that started at |start| and ends now.
+ *    |TRACE_SENDQ| spans overlap other events of their thread; all other
+ *    spans nest properly.
+ *  - |trace_flow| records a point of a flow between threads, such as a
+ *    task that one thread queues and the I/O thread runs. Both points use
+ *    the same |arg| as flow ID.
+ *
+ * Timestamps are in nanoseconds of the monotonic clock; see |trace_now|.
+ * Each event carries a 32-bit argument, for example the service and
+ * opcode of a PDU as (service << 8) | opcode.
+ *
+ * |trace_dump| writes the contents of all ring buffers to a file. It
+ * doesn't lock or allocate memory and is safe to call from a signal
+ * handler. Events that threads overwrite during the dump are marked as
+ * invalid in the file. The function returns the number of valid events,
+ * or -1 on errors.
+ *
+ * The file starts with the magic "TVDTRACE", the format version and the
+ * event table: the number of events followed by type, name length and
+ * name of each event. Each ring follows with the thread ID, the number
+ * of events and the number of invalid leading events, and then the
+ * events: timestamp and duration in nanoseconds, argument, event and two
+ * reserved octets. All integers are in host byte order. tools/trace2json.py
+ * converts the file to the JSON format of Chrome's trace viewer.
+ *
+ * |TRACE_DUMP_FILE| is the default file for dumps.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define TRACE_DUMP_FILE "/data/misc/tvd/trace"
+
+enum {
+  TRACE_RING_LEN = 8192, /* events per thread */
+  TRACE_MAX_THREADS = 32
+};
+
+enum {
+  TRACE_TYPE_SPAN = 0x00,
+  TRACE_TYPE_ASYNC_SPAN = 0x01, /* may overlap other spans */
+  TRACE_TYPE_FLOW_START = 0x02,
+  TRACE_TYPE_FLOW_END = 0x03
+};
+
+enum {
+  TRACE_DISPATCH = 0x00, /* span; arg is service and opcode */
+  TRACE_HAL = 0x01, /* span; arg is the driver call of stats.h */
+  TRACE_SEND = 0x02, /* span; arg is service and opcode */
+  TRACE_SENDQ = 0x03, /* async span; arg is 0 */
+  TRACE_TASK_QUEUED = 0x04, /* flow start; arg is the task */
+  TRACE_TASK_RUN = 0x05, /* flow end; arg is the task */
+  NUM_TRACE_EVENTS
+};
+
+extern int g_trace_enabled;
+
+void
+trace_enable(int enable);
+
+uint64_t
+trace_now(void);
+
+void
+trace_record(uint16_t event, uint32_t arg, uint64_t start, uint64_t end);
+
+long
+trace_dump(const char* path);
+
+static inline int
+trace_is_enabled(void)
+{
+  return __builtin_expect(__atomic_load_n(&g_trace_enabled,
+                                          __ATOMIC_RELAXED), 0);
+}
+
+static inline void
+trace_span(uint16_t event, uint32_t arg, uint64_t start)
+{
+  if (trace_is_enabled()) {
+    trace_record(event, arg, start, trace_now());
+  }
+}
+
+static inline void
+trace_flow(uint16_t event, uint32_t arg)
+{
+  if (trace_is_enabled()) {
+    uint64_t now = trace_now();
+    trace_record(event, arg, now, now);
+  }
+}
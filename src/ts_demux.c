@@ -0,0 +1,419 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements the demultiplexer for MPEG-2 transport streams.
+ * See the corresponding header file for documentation.
+ */
+
+#include "ts_demux.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "memptr.h"
+
+enum {
+  FILTER_SECTION = 0x01,
+  FILTER_PACKET = 0x02,
+  NO_CC = 0xff,
+  SECTION_HEADER_LEN = 3,
+  MAX_SECTION_LEN = 4096,
+  STUFFING_BYTE = 0xff
+};
+
+struct pid_state {
+  uint8_t filter;
+  uint8_t cc; /* NO_CC before the first packet */
+  uint8_t collecting; /* set after the first payload unit start */
+  uint16_t len;
+  uint16_t total; /* length of the current section; 0 if unknown */
+  uint8_t buf[MAX_SECTION_LEN];
+};
+
+struct ts_demux {
+  struct ts_demux_callbacks callbacks;
+  void* data;
+
+  int in_sync;
+  size_t partial_len;
+  uint8_t partial[TS_PACKET_SIZE];
+
+  uint64_t filter[TS_NUM_PIDS / 64];
+  struct pid_state* pid[TS_NUM_PIDS];
+
+  struct ts_demux_stats stats;
+};
+
+/*
+ * Sections
+ */
+
+static void
+report_section(struct ts_demux* demux, uint16_t pid, const uint8_t* buf,
+               size_t len)
+{
+  ++demux->stats.sections;
+  demux->callbacks.section_cb(demux->data, pid, buf, len);
+}
+
+static uint16_t
+section_len(const uint8_t* buf)
+{
+  return SECTION_HEADER_LEN + (((buf[1] & 0x0f) << 8) | buf[2]);
+}
+
+static void
+drop_section(struct ts_demux* demux, struct pid_state* state)
+{
+  if (state->len) {
+    ++demux->stats.dropped_sections;
+  }
+  state->len = 0;
+  state->total = 0;
+}
+
+/* Collects section data from a packet's payload. */
+static void
+collect(struct ts_demux* demux, uint16_t pid, struct pid_state* state,
+        const uint8_t* p, size_t len)
+{
+  while (len) {
+    size_t n;
+
+    if (!state->len) {
+      if (p[0] == STUFFING_BYTE) {
+        state->collecting = 0; /* rest of packet is stuffing */
+        return;
+      }
+      if (len >= SECTION_HEADER_LEN && section_len(p) <= len) {
+        /* section is in this packet; report without copying */
+        n = section_len(p);
+        report_section(demux, pid, p, n);
+        p += n;
+        len -= n;
+        continue;
+      }
+    }
+
+    if (state->len < SECTION_HEADER_LEN) {
+      n = SECTION_HEADER_LEN - state->len;
+    } else {
+      n = state->total - state->len;
+    }
+    if (n > len) {
+      n = len;
+    }
+    memcpy(state->buf + state->len, p, n);
+    state->len += n;
+    p += n;
+    len -= n;
+
+    if (state->len == SECTION_HEADER_LEN) {
+      state->total = section_len(state->buf);
+      if (state->total > MAX_SECTION_LEN) {
+        drop_section(demux, state);
+        state->collecting = 0;
+        return;
+      }
+    }
+    if (state->len >= SECTION_HEADER_LEN && state->len == state->total) {
+      report_section(demux, pid, state->buf, state->total);
+      state->len = 0;
+      state->total = 0;
+    }
+  }
+}
+
+static void
+handle_section_payload(struct ts_demux* demux, uint16_t pid,
+                       struct pid_state* state, const uint8_t* p,
+                       size_t len, int unit_start)
+{
+  size_t pointer;
+
+  if (!unit_start) {
+    if (state->collecting && state->len) {
+      collect(demux, pid, state, p, len);
+    }
+    return;
+  }
+
+  if (!len) {
+    return;
+  }
+  pointer = p[0];
+  ++p;
+  --len;
+  if (pointer > len) {
+    drop_section(demux, state);
+    state->collecting = 0;
+    return;
+  }
+
+  /* finish the previous section */
+  if (state->collecting && state->len && pointer) {
+    collect(demux, pid, state, p, pointer);
+  }
+  drop_section(demux, state);
+
+  state->collecting = 1;
+  collect(demux, pid, state, p + pointer, len - pointer);
+}
+
+/*
+ * Packets
+ */
+
+static void
+handle_packet(struct ts_demux* demux, const uint8_t* packet)
+{
+  struct pid_state* state;
+  const uint8_t* payload;
+  uint16_t pid;
+  uint8_t afc, cc;
+  int discontinuity;
+
+  ++demux->stats.packets;
+
+  pid = ((packet[1] & 0x1f) << 8) | packet[2];
+  if (!(demux->filter[pid / 64] & (1ull << (pid % 64)))) {
+    return;
+  }
+
+  if (packet[1] & 0x80) {
+    ++demux->stats.transport_errors;
+    return;
+  }
+
+  state = demux->pid[pid];
+  afc = (packet[3] >> 4) & 0x03;
+  cc = packet[3] & 0x0f;
+
+  payload = packet + 4;
+  discontinuity = 0;
+  if (afc & 0x02) {
+    /* adaptation field */
+    if (packet[4] > TS_PACKET_SIZE - 5) {
+      return;
+    }
+    discontinuity = packet[4] && (packet[5] & 0x80);
+    payload += 1 + packet[4];
+  }
+
+  if (afc & 0x01) {
+    if (state->cc != NO_CC && !discontinuity) {
+      if (cc == state->cc) {
+        return; /* repeated packet */
+      } else if (cc != ((state->cc + 1) & 0x0f)) {
+        ++demux->stats.cc_errors;
+        drop_section(demux, state);
+        state->collecting = 0;
+      }
+    }
+    state->cc = cc;
+  }
+
+  if (state->filter & FILTER_PACKET) {
+    demux->callbacks.packet_cb(demux->data, pid, packet);
+  }
+  if ((state->filter & FILTER_SECTION) && (afc & 0x01)) {
+    handle_section_payload(demux, pid, state, payload,
+                           packet + TS_PACKET_SIZE - payload,
+                           packet[1] & 0x40);
+  }
+}
+
+/* Returns the offset of the first sync byte that repeats at the next one
+ * or two packet starts within |buf|, or |len| if there's none. */
+static size_t
+find_sync(const uint8_t* buf, size_t len)
+{
+  const uint8_t* p = buf;
+  const uint8_t* end = buf + len;
+
+  /* memchr(3) scans with vector instructions on common platforms */
+  while ((p = memchr(p, TS_SYNC_BYTE, end - p))) {
+    if ((end - p <= TS_PACKET_SIZE ||
+         p[TS_PACKET_SIZE] == TS_SYNC_BYTE) &&
+        (end - p <= 2 * TS_PACKET_SIZE ||
+         p[2 * TS_PACKET_SIZE] == TS_SYNC_BYTE)) {
+      return p - buf;
+    }
+    ++p;
+  }
+  return len;
+}
+
+/*
+ * Public interfaces
+ */
+
+struct ts_demux*
+create_ts_demux(const struct ts_demux_callbacks* callbacks, void* data)
+{
+  struct ts_demux* demux;
+
+  assert(callbacks);
+
+  demux = calloc(1, sizeof(*demux));
+  if (!demux) {
+    ALOGE_ERRNO("calloc");
+    return NULL;
+  }
+  demux->callbacks = *callbacks;
+  demux->data = data;
+
+  return demux;
+}
+
+void
+destroy_ts_demux(struct ts_demux* demux)
+{
+  size_t i;
+
+  if (!demux) {
+    return;
+  }
+  for (i = 0; i < ARRAY_LENGTH(demux->pid); ++i) {
+    free(demux->pid[i]);
+  }
+  free(demux);
+}
+
+static int
+add_filter(struct ts_demux* demux, uint16_t pid, uint8_t filter)
+{
+  struct pid_state* state;
+
+  assert(demux);
+
+  if (pid >= TS_NUM_PIDS) {
+    ALOGE("invalid PID 0x%x", pid);
+    return -1;
+  }
+
+  state = demux->pid[pid];
+  if (!state) {
+    state = calloc(1, sizeof(*state));
+    if (!state) {
+      ALOGE_ERRNO("calloc");
+      return -1;
+    }
+    state->cc = NO_CC;
+    demux->pid[pid] = state;
+  }
+  state->filter |= filter;
+  demux->filter[pid / 64] |= 1ull << (pid % 64);
+
+  return 0;
+}
+
+int
+ts_demux_add_section_filter(struct ts_demux* demux, uint16_t pid)
+{
+  assert(demux);
+  assert(demux->callbacks.section_cb);
+
+  return add_filter(demux, pid, FILTER_SECTION);
+}
+
+int
+ts_demux_add_packet_filter(struct ts_demux* demux, uint16_t pid)
+{
+  assert(demux);
+  assert(demux->callbacks.packet_cb);
+
+  return add_filter(demux, pid, FILTER_PACKET);
+}
+
+void
+ts_demux_remove_filter(struct ts_demux* demux, uint16_t pid)
+{
+  assert(demux);
+
+  if (pid >= TS_NUM_PIDS) {
+    return;
+  }
+  demux->filter[pid / 64] &= ~(1ull << (pid % 64));
+  free(demux->pid[pid]);
+  demux->pid[pid] = NULL;
+}
+
+void
+ts_demux_feed(struct ts_demux* demux, const uint8_t* buf, size_t len)
+{
+  size_t n;
+
+  assert(demux);
+  assert(buf || !len);
+
+  /* complete a packet from the previous call */
+  if (demux->partial_len) {
+    n = TS_PACKET_SIZE - demux->partial_len;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(demux->partial + demux->partial_len, buf, n);
+    demux->partial_len += n;
+    buf += n;
+    len -= n;
+    if (demux->partial_len < TS_PACKET_SIZE) {
+      return;
+    }
+    demux->partial_len = 0;
+    handle_packet(demux, demux->partial);
+  }
+
+  while (len) {
+    if (!demux->in_sync || buf[0] != TS_SYNC_BYTE) {
+      if (demux->in_sync) {
+        ++demux->stats.sync_losses;
+      }
+      n = find_sync(buf, len);
+      buf += n;
+      len -= n;
+      demux->in_sync = !!len;
+      if (!len) {
+        return;
+      }
+    }
+
+    /* fast path */
+    while (len >= TS_PACKET_SIZE && buf[0] == TS_SYNC_BYTE) {
+      handle_packet(demux, buf);
+      buf += TS_PACKET_SIZE;
+      len -= TS_PACKET_SIZE;
+    }
+
+    if (len && len < TS_PACKET_SIZE && buf[0] == TS_SYNC_BYTE) {
+      memcpy(demux->partial, buf, len);
+      demux->partial_len = len;
+      return;
+    }
+  }
+}
+
+void
+ts_demux_get_stats(const struct ts_demux* demux,
+                   struct ts_demux_stats* stats)
+{
+  assert(demux);
+  assert(stats);
+
+  *stats = demux->stats;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the demultiplexer for MPEG-2 transport streams.
+ *
+ * |create_ts_demux| returns a demultiplexer that reports to the given
+ * callbacks, and |destroy_ts_demux| releases it. |ts_demux_feed| accepts
+ * transport stream data in chunks of any size; packets that are split
+ * across chunks are reassembled.
+ *
+ * The demultiplexer finds the 188-byte packet boundaries by looking for
+ * sync bytes that repeat at packet distance. While in sync, it only
+ * checks the sync byte at each packet start. Each packet's PID is looked
+ * up in a bitmap of 8192 bits, so packets of unfiltered PIDs cost a few
+ * instructions.
+ *
+ * |ts_demux_add_section_filter| selects a PID for section reassembly.
+ * Complete sections are reported to |section_cb|, including their CRC,
+ * which the receiver checks with |dvb_parse_section|. This allows the
+ * receiver to skip the CRC of repeated sections. Sections that are
+ * contained in a single packet are reported without copying them.
+ * |ts_demux_add_packet_filter| selects a PID for |packet_cb|, which
+ * receives each 188-byte packet. A PID can have both filters.
+ * |ts_demux_remove_filter| removes all filters of a PID.
+ *
+ * For each filtered PID, the demultiplexer tracks the continuity
+ * counter. A single repeated packet is dropped. On other discontinuities
+ * that are not signalled in the adaptation field, the partial section of
+ * the PID is dropped and the error is counted in the statistics that
+ * |ts_demux_get_stats| returns.
+ *
+ * Demultiplexers don't lock; each one is used by a single thread. The
+ * callbacks run on the thread that calls |ts_demux_feed|. The functions
+ * that add filters return 0 on success and -1 on errors.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+  TS_PACKET_SIZE = 188,
+  TS_SYNC_BYTE = 0x47,
+  TS_NUM_PIDS = 8192
+};
+
+struct ts_demux;
+
+struct ts_demux_callbacks {
+  void
+  (*section_cb)(void* data, uint16_t pid, const uint8_t* buf, size_t len);
+  void
+  (*packet_cb)(void* data, uint16_t pid, const uint8_t* packet);
+};
+
+struct ts_demux_stats {
+  uint64_t packets;
+  uint64_t sync_losses;
+  uint64_t transport_errors; /* packets with transport_error_indicator */
+  uint64_t cc_errors;
+  uint64_t sections;
+  uint64_t dropped_sections;
+};
+
+struct ts_demux*
+create_ts_demux(const struct ts_demux_callbacks* callbacks, void* data);
+
+void
+destroy_ts_demux(struct ts_demux* demux);
+
+int
+ts_demux_add_section_filter(struct ts_demux* demux, uint16_t pid);
+
+int
+ts_demux_add_packet_filter(struct ts_demux* demux, uint16_t pid);
+
+void
+ts_demux_remove_filter(struct ts_demux* demux, uint16_t pid);
+
+void
+ts_demux_feed(struct ts_demux* demux, const uint8_t* buf, size_t len);
+
+void
+ts_demux_get_stats(const struct ts_demux* demux,
+                   struct ts_demux_stats* stats);
@@ -15,40 +15,600 @@
  */
 
 #include <hardware/tv_input.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tv_hal.h"
 #include "tv_utils.h"
+#include "vtuner.h"
 #include "log.h"
 
-#define MAX_DEVICE_NUM 100
+/* Virtual tuners use device IDs starting at these values. */
+#define VIRTUAL_DEVICE_ID_BASE 1000
+#define IPTV_DEVICE_ID_BASE 2000
+#define VIRTUAL_STREAM_ID 0
+
+#define MAX_DEVICE_STREAMS 8
+
+/*
+ * Each device caches its stream configurations. They are only fetched
+ * from the HAL module again after the module reported
+ * TV_INPUT_EVENT_STREAM_CONFIGURATIONS_CHANGED, which also closes all
+ * streams of the device.
+ *
+ * Open streams are reference counted. Opening a stream that is already
+ * open returns the open stream, so multiple users, such as live view and
+ * a recording, share it. The device can have streams of different
+ * configurations open at the same time, as far as the HAL module allows.
+ * The source of the device is the stream returned by
+ * |tv_input_hal_get_stream|, which channel changes reuse. The source's
+ * reference is tracked apart from the count of the other users' ones, so
+ * closing a stream can't drop the source's reference. A stream is closed
+ * when neither the source nor any user refers to it.
+ *
+ * The ID, type and virtual tuner of a device never change. The stream
+ * state is protected by |lock|, as it's modified by the I/O thread and
+ * by the HAL module's notifications.
+ */
+
+struct device_stream {
+  tv_stream_t stream;
+  unsigned long ref; /* users other than the source */
+};
 
 struct device_info {
   int device_id;
   int type;
-  int acting_stream_id;
+  struct vtuner* vtuner; /* NULL for hardware devices */
+  unsigned long ref;
+  pthread_mutex_t lock;
+  int num_configs; /* -1 if not fetched yet */
+  tv_stream_config_t* config;
+  int source_stream_id; /* -1 if no source */
+  uint32_t num_streams;
+  struct device_stream stream[MAX_DEVICE_STREAMS];
 };
 
 static tv_input_module_t* module = NULL;
 static tv_input_device_t* device = NULL;
 static tv_input_callback_ops_t tv_callback;
-static uint8_t device_num;
-static struct device_info device_list[MAX_DEVICE_NUM];
+static const char* vtuner_dir;
+static uint32_t vtuner_num;
+static const char* iptv_ifaddr;
+static uint32_t iptv_num;
+
+static struct device_info*
+create_device_info(int device_id, int type, struct vtuner* vt)
+{
+  struct device_info* info;
+  int err;
+
+  info = calloc(1, sizeof(*info));
+  if (!info) {
+    ALOGE_ERRNO("calloc");
+    return NULL;
+  }
+
+  err = pthread_mutex_init(&info->lock, NULL);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_mutex_init", err);
+    free(info);
+    return NULL;
+  }
+
+  info->device_id = device_id;
+  info->type = type;
+  info->vtuner = vt;
+  info->ref = 1;
+  info->num_configs = -1;
+  info->source_stream_id = -1;
+
+  return info;
+}
+
+static void
+ref_device_info(struct device_info* info)
+{
+  __atomic_add_fetch(&info->ref, 1, __ATOMIC_RELAXED);
+}
 
 static void
-remove_device_by_idx(uint8_t target)
+unref_device_info(struct device_info* info)
 {
-  uint8_t idx;
-  device_num--;
-  for (idx = target; idx < device_num; idx++) {
-    device_list[idx].device_id = device_list[idx + 1].device_id;
-    device_list[idx].type = device_list[idx + 1].type;
-    device_list[idx].acting_stream_id = device_list[idx + 1].acting_stream_id;
+  if (__atomic_sub_fetch(&info->ref, 1, __ATOMIC_ACQ_REL)) {
+    return;
   }
+  if (info->vtuner) {
+    destroy_vtuner(info->vtuner);
+  }
+  free(info->config);
+  pthread_mutex_destroy(&info->lock);
+  free(info);
+}
+
+/*
+ * Stream pool
+ *
+ * The functions in this section are called with the device's lock held.
+ */
+
+static void
+clear_stream_configs(struct device_info* info)
+{
+  free(info->config);
+  info->config = NULL;
+  info->num_configs = -1;
+}
+
+/* Returns the number of cached stream configurations, or fetches them
+ * from the HAL module. Virtual tuners have a single configuration. */
+static int
+get_stream_configs(struct device_info* info)
+{
+  int num_configs;
+  const tv_stream_config_t* configs;
+  static const tv_stream_config_t virtual_config = {
+    .stream_id = VIRTUAL_STREAM_ID,
+    .type = TV_STREAM_TYPE_INDEPENDENT_VIDEO_SOURCE
+  };
+
+  if (info->num_configs >= 0) {
+    return info->num_configs;
+  }
+
+  if (info->vtuner) {
+    num_configs = 1;
+    configs = &virtual_config;
+  } else if (device->get_stream_configurations(
+      device, info->device_id, &num_configs, &configs) != 0) {
+    ALOGE("Couldn't get stream configs");
+    return -1;
+  }
+
+  info->config = malloc(num_configs * sizeof(*info->config));
+  if (num_configs && !info->config) {
+    ALOGE_ERRNO("malloc");
+    return -1;
+  }
+  memcpy(info->config, configs, num_configs * sizeof(*info->config));
+  info->num_configs = num_configs;
+
+  return num_configs;
+}
+
+static const tv_stream_config_t*
+find_stream_config(struct device_info* info, int stream_id)
+{
+  int num_configs, idx;
+
+  num_configs = get_stream_configs(info);
+  for (idx = 0; idx < num_configs; ++idx) {
+    if (info->config[idx].stream_id == stream_id) {
+      return info->config + idx;
+    }
+  }
+  return NULL;
+}
+
+static struct device_stream*
+find_open_stream(struct device_info* info, int stream_id)
+{
+  uint32_t idx;
+
+  for (idx = 0; idx < info->num_streams; ++idx) {
+    if (info->stream[idx].stream.stream_id == stream_id) {
+      return info->stream + idx;
+    }
+  }
+  return NULL;
+}
+
+static int
+open_device_stream(struct device_info* info,
+                   const tv_stream_config_t* config, tv_stream_t* tv_stream)
+{
+  memset(tv_stream, 0, sizeof(*tv_stream));
+  tv_stream->type = config->type;
+  tv_stream->stream_id = config->stream_id;
+
+  if (info->vtuner) {
+    return vtuner_open_stream(info->vtuner,
+                              &tv_stream->sideband_stream_source_handle);
+  }
+
+  if (tv_stream->type == TV_STREAM_TYPE_BUFFER_PRODUCER) {
+    tv_stream->buffer_producer.width = config->max_video_width;
+    tv_stream->buffer_producer.height = config->max_video_height;
+  }
+  if (device->open_stream(device, info->device_id, tv_stream) != 0) {
+    ALOGE("Couldn't add stream");
+    return -1;
+  }
+  return 0;
+}
+
+static void
+close_device_stream(struct device_info* info, int stream_id)
+{
+  if (info->vtuner) {
+    vtuner_close_stream(info->vtuner);
+  } else {
+    device->close_stream(device, info->device_id, stream_id);
+  }
+}
+
+/* Returns the stream with the given ID. Unless |is_source| is set, it
+ * takes a user's reference; the source's reference is given by
+ * |source_stream_id|. */
+static uint8_t
+acquire_stream(struct device_info* info, int stream_id, int is_source,
+               tv_stream_t* tv_stream)
+{
+  const tv_stream_config_t* config;
+  struct device_stream* stream;
+
+  stream = find_open_stream(info, stream_id);
+  if (stream) {
+    if (!is_source) {
+      ++stream->ref;
+    }
+    *tv_stream = stream->stream;
+    return TV_STATUS_SUCCESS;
+  }
+
+  config = find_stream_config(info, stream_id);
+  if (!config) {
+    ALOGE("Cannot find a config with given stream ID.");
+    return TV_STATUS_INVARG;
+  }
+  if (info->num_streams == MAX_DEVICE_STREAMS) {
+    ALOGE("Too many open streams.");
+    return TV_STATUS_FAIL;
+  }
+
+  if (open_device_stream(info, config, tv_stream) < 0) {
+    return TV_STATUS_FAIL;
+  }
+
+  stream = info->stream + info->num_streams;
+  stream->stream = *tv_stream;
+  stream->ref = is_source ? 0 : 1;
+  __atomic_store_n(&info->num_streams, info->num_streams + 1,
+                   __ATOMIC_RELAXED);
+
+  return TV_STATUS_SUCCESS;
 }
 
+/* Closes the stream if neither the source nor a user refers to it. */
+static void
+close_unused_stream(struct device_info* info, struct device_stream* stream)
+{
+  int stream_id = stream->stream.stream_id;
+
+  if (stream->ref || stream_id == info->source_stream_id) {
+    return;
+  }
+
+  close_device_stream(info, stream_id);
+
+  *stream = info->stream[info->num_streams - 1];
+  __atomic_store_n(&info->num_streams, info->num_streams - 1,
+                   __ATOMIC_RELAXED);
+}
+
+/* Drops a user's reference to the stream. */
+static uint8_t
+release_stream(struct device_info* info, int stream_id)
+{
+  struct device_stream* stream;
+
+  stream = find_open_stream(info, stream_id);
+  if (!stream || !stream->ref) {
+    ALOGE("Stream %d isn't open.", stream_id);
+    return TV_STATUS_INVARG;
+  }
+  --stream->ref;
+
+  close_unused_stream(info, stream);
+
+  return TV_STATUS_SUCCESS;
+}
+
+/* Drops the source's reference to its stream. */
+static void
+release_source(struct device_info* info)
+{
+  struct device_stream* stream;
+
+  if (info->source_stream_id == -1) {
+    return;
+  }
+  stream = find_open_stream(info, info->source_stream_id);
+  info->source_stream_id = -1;
+  if (stream) {
+    close_unused_stream(info, stream);
+  }
+}
+
+/* Closes all streams, regardless of their references. */
+static void
+close_device_streams(struct device_info* info)
+{
+  uint32_t idx;
+
+  for (idx = 0; idx < info->num_streams; ++idx) {
+    close_device_stream(info, info->stream[idx].stream.stream_id);
+  }
+  __atomic_store_n(&info->num_streams, 0, __ATOMIC_RELAXED);
+  info->source_stream_id = -1;
+}
+
+/*
+ * Device table
+ *
+ * The devices are stored in immutable snapshots of the device table.
+ * Each snapshot lists the devices in the order in which they became
+ * available, and indexes them in an open-addressing hash table by device
+ * ID. Adding or removing a device publishes a new snapshot; lookups are
+ * lock-free and take constant time.
+ *
+ * Readers enter a read-side critical section before loading the current
+ * snapshot. They register in one of two counters, selected by the parity
+ * of |table_epoch|. After publishing a snapshot, the writer flips the
+ * epoch and waits until the counter of the previous epoch drops to zero.
+ * Afterwards no reader can still refer to the previous snapshot, which is
+ * then freed. Critical sections only copy data out of the table, so the
+ * writer never waits for the HAL module or a tuner. Devices are reference
+ * counted and outlive the snapshots while someone uses them.
+ *
+ * Writers are serialized by |table_lock|. Notifications from the HAL
+ * module are the only writers after initialization, so hotplugging never
+ * blocks the I/O thread.
+ */
+
+struct device_table {
+  uint32_t num;
+  uint32_t mask; /* number of hash slots - 1 */
+  struct device_info** slot; /* hash slots, NULL if empty */
+  struct device_info* device[]; /* devices in order of arrival */
+};
+
+static struct device_table empty_table = {
+  .num = 0,
+  .mask = 0,
+  .slot = (struct device_info*[1]) { NULL }
+};
+
+static struct device_table* table = &empty_table;
+static unsigned long table_epoch;
+static unsigned long table_readers[2];
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t
+hash_device_id(int device_id)
+{
+  return (uint32_t)device_id * 2654435761u; /* Knuth's multiplicative hash */
+}
+
+static unsigned long
+enter_table(void)
+{
+  unsigned long epoch;
+
+  for (;;) {
+    epoch = __atomic_load_n(&table_epoch, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(table_readers + (epoch & 1), 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&table_epoch, __ATOMIC_SEQ_CST) == epoch) {
+      return epoch;
+    }
+    /* the writer flipped the epoch; retry with the new one */
+    __atomic_sub_fetch(table_readers + (epoch & 1), 1, __ATOMIC_SEQ_CST);
+  }
+}
+
+static void
+leave_table(unsigned long epoch)
+{
+  __atomic_sub_fetch(table_readers + (epoch & 1), 1, __ATOMIC_RELEASE);
+}
+
+static const struct device_table*
+current_table(void)
+{
+  return __atomic_load_n(&table, __ATOMIC_SEQ_CST);
+}
+
+static struct device_info*
+lookup_device(const struct device_table* tab, int device_id)
+{
+  uint32_t i;
+
+  for (i = hash_device_id(device_id) & tab->mask;
+       tab->slot[i];
+       i = (i + 1) & tab->mask) {
+    if (tab->slot[i]->device_id == device_id) {
+      return tab->slot[i];
+    }
+  }
+  return NULL;
+}
+
+/* Returns a new reference to the device, or NULL if the device is
+ * unknown. */
+static struct device_info*
+get_device(int device_id)
+{
+  unsigned long epoch;
+  struct device_info* info;
+
+  epoch = enter_table();
+  info = lookup_device(current_table(), device_id);
+  if (info) {
+    ref_device_info(info);
+  }
+  leave_table(epoch);
+
+  return info;
+}
+
+/* Creates a snapshot of |num| devices. The snapshot takes over the
+ * caller's references. */
+static struct device_table*
+create_device_table(uint32_t num, struct device_info* const* dev)
+{
+  struct device_table* tab;
+  uint32_t nslots, i, j;
+
+  for (nslots = 1; nslots < 2 * num; nslots *= 2) {}
+
+  tab = calloc(1, sizeof(*tab) + num * sizeof(tab->device[0]) +
+                  nslots * sizeof(tab->slot[0]));
+  if (!tab) {
+    ALOGE_ERRNO("calloc");
+    return NULL;
+  }
+  tab->num = num;
+  tab->mask = nslots - 1;
+  tab->slot = (struct device_info**)(tab->device + num);
+
+  for (i = 0; i < num; ++i) {
+    tab->device[i] = dev[i];
+    for (j = hash_device_id(dev[i]->device_id) & tab->mask;
+         tab->slot[j];
+         j = (j + 1) & tab->mask) {}
+    tab->slot[j] = dev[i];
+  }
+
+  return tab;
+}
+
+/* Replaces the current snapshot and waits until no reader uses the old
+ * one. The caller holds |table_lock|. Returns the old snapshot. */
+static struct device_table*
+publish_table(struct device_table* tab)
+{
+  struct device_table* old;
+  unsigned long epoch;
+
+  old = __atomic_exchange_n(&table, tab, __ATOMIC_SEQ_CST);
+
+  epoch = __atomic_add_fetch(&table_epoch, 1, __ATOMIC_SEQ_CST) - 1;
+  while (__atomic_load_n(table_readers + (epoch & 1), __ATOMIC_ACQUIRE)) {
+    sched_yield();
+  }
+
+  return old;
+}
+
+static void
+destroy_device_table(struct device_table* tab)
+{
+  if (tab != &empty_table) {
+    free(tab);
+  }
+}
+
+static int
+add_device(struct device_info* info)
+{
+  struct device_table* tab;
+  struct device_info** dev;
+  const struct device_table* old;
+
+  pthread_mutex_lock(&table_lock);
+
+  old = table;
+  if (lookup_device(old, info->device_id)) {
+    ALOGE("Device %d already exists.", info->device_id);
+    goto err_lookup_device;
+  }
+
+  dev = malloc((old->num + 1) * sizeof(*dev));
+  if (!dev) {
+    ALOGE_ERRNO("malloc");
+    goto err_malloc;
+  }
+  memcpy(dev, old->device, old->num * sizeof(*dev));
+  dev[old->num] = info;
+
+  tab = create_device_table(old->num + 1, dev);
+  free(dev);
+  if (!tab) {
+    goto err_create_device_table;
+  }
+
+  destroy_device_table(publish_table(tab));
+
+  pthread_mutex_unlock(&table_lock);
+
+  return 0;
+
+err_create_device_table:
+err_malloc:
+err_lookup_device:
+  pthread_mutex_unlock(&table_lock);
+  return -1;
+}
+
+/* Removes the device from the table. Returns the table's reference to
+ * the device, or NULL if the device is unknown. */
+static struct device_info*
+remove_device(int device_id)
+{
+  struct device_table* tab;
+  struct device_info** dev;
+  struct device_info* info;
+  const struct device_table* old;
+  uint32_t i, num;
+
+  pthread_mutex_lock(&table_lock);
+
+  old = table;
+  info = lookup_device(old, device_id);
+  if (!info) {
+    goto err_lookup_device;
+  }
+
+  dev = malloc(old->num * sizeof(*dev));
+  if (!dev) {
+    ALOGE_ERRNO("malloc");
+    goto err_malloc;
+  }
+  for (num = 0, i = 0; i < old->num; ++i) {
+    if (old->device[i] != info) {
+      dev[num++] = old->device[i];
+    }
+  }
+
+  tab = create_device_table(num, dev);
+  free(dev);
+  if (!tab) {
+    goto err_create_device_table;
+  }
+
+  destroy_device_table(publish_table(tab));
+
+  pthread_mutex_unlock(&table_lock);
+
+  return info;
+
+err_create_device_table:
+err_malloc:
+err_lookup_device:
+  pthread_mutex_unlock(&table_lock);
+  return NULL;
+}
+
+/*
+ * Notifications of the HAL module
+ */
+
 static void
 device_init_notify(struct tv_input_device* dev,
         tv_input_event_t* event, void* data)
 {
-  uint8_t idx;
+  struct device_info* info;
 
   /* We only handle tuner device in current phase. */
   if (event->type == TV_INPUT_EVENT_DEVICE_AVAILABLE ||
@@ -64,50 +624,41 @@ device_init_notify(struct tv_input_device* dev,
   switch(event->type) {
     case TV_INPUT_EVENT_DEVICE_AVAILABLE :
       ALOGD("TV_INPUT_EVENT_DEVICE_AVAILABLE %d", event->device_info.device_id);
-      if (device_num >= MAX_DEVICE_NUM) {
-        ALOGE("Device list overflow.");
+      info = create_device_info(event->device_info.device_id,
+                                event->device_info.type, NULL);
+      if (!info) {
         return;
       }
-      device_list[device_num].device_id = event->device_info.device_id;
-      device_list[device_num].type = event->device_info.type;
-      device_list[device_num].acting_stream_id = -1;
-      device_num++;
+      if (add_device(info) < 0) {
+        unref_device_info(info);
+      }
       break;
     case TV_INPUT_EVENT_DEVICE_UNAVAILABLE :
       ALOGD("TV_INPUT_EVENT_DEVICE_UNAVAILABLE %d", event->device_info.device_id);
-      for (idx = 0; idx < device_num; idx++) {
-        if (device_list[idx].device_id == event->device_info.device_id) {
-          break;
-        }
-      }
-
-      if (idx >= device_num) {
+      info = remove_device(event->device_info.device_id);
+      if (!info) {
         ALOGE("Unknown device ID.");
         return;
       }
 
-      device->close_stream(device,
-                           event->device_info.device_id,
-                           device_list[idx].acting_stream_id);
-      remove_device_by_idx(idx);
+      pthread_mutex_lock(&info->lock);
+      close_device_streams(info);
+      pthread_mutex_unlock(&info->lock);
+      unref_device_info(info);
       break;
     case TV_INPUT_EVENT_STREAM_CONFIGURATIONS_CHANGED :
       ALOGD("TV_INPUT_EVENT_STREAM_CONFIGURATIONS_CHANGED %d", event->device_info.device_id);
-      for (idx = 0; idx < device_num; idx++) {
-        if (device_list[idx].device_id == event->device_info.device_id) {
-          break;
-        }
-      }
-
-      if (idx >= device_num) {
+      info = get_device(event->device_info.device_id);
+      if (!info) {
         ALOGE("Unknown device ID.");
         return;
       }
 
-      device->close_stream(device,
-                           event->device_info.device_id,
-                           device_list[idx].acting_stream_id);
-      device_list[idx].acting_stream_id = -1;
+      pthread_mutex_lock(&info->lock);
+      close_device_streams(info);
+      clear_stream_configs(info);
+      pthread_mutex_unlock(&info->lock);
+      unref_device_info(info);
       break;
     default:
       ALOGD("Capture event is not supported");
@@ -115,19 +666,114 @@ device_init_notify(struct tv_input_device* dev,
   }
 }
 
+/*
+ * Virtual tuners
+ *
+ * Virtual tuners play transport stream files instead of receiving a
+ * signal, or receive transport streams over IP multicast. They are listed
+ * as tuner devices, next to the devices of the HAL module. Without HAL
+ * module, the daemon runs with virtual tuners only. See vtuner.h for
+ * details.
+ */
+
+void
+tv_input_hal_set_virtual_tuners(const char* dir, uint32_t num)
+{
+  vtuner_dir = dir;
+  vtuner_num = num;
+}
+
+void
+tv_input_hal_set_iptv_tuners(const char* ifaddr, uint32_t num)
+{
+  iptv_ifaddr = ifaddr;
+  iptv_num = num;
+}
+
+static int
+add_virtual_tuner(int device_id, struct vtuner* vt)
+{
+  struct device_info* info;
+
+  if (!vt) {
+    return -1;
+  }
+
+  info = create_device_info(device_id, TV_INPUT_TYPE_TUNER, vt);
+  if (!info) {
+    destroy_vtuner(vt);
+    return -1;
+  }
+  if (add_device(info) < 0) {
+    unref_device_info(info);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int
+add_virtual_tuners(void)
+{
+  uint32_t idx;
+
+  for (idx = 0; idx < vtuner_num; idx++) {
+    if (add_virtual_tuner(VIRTUAL_DEVICE_ID_BASE + idx,
+                          create_vtuner(vtuner_dir)) < 0) {
+      return -1;
+    }
+  }
+  for (idx = 0; idx < iptv_num; idx++) {
+    if (add_virtual_tuner(IPTV_DEVICE_ID_BASE + idx,
+                          create_iptv_vtuner(iptv_ifaddr)) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Virtual tuners are only removed by |tv_input_hal_uninit|, so the
+ * returned tuner remains valid without holding a reference.
+ */
+struct vtuner*
+tv_input_hal_get_vtuner(int32_t device_id)
+{
+  unsigned long epoch;
+  struct device_info* info;
+  struct vtuner* vt;
+
+  epoch = enter_table();
+  info = lookup_device(current_table(), device_id);
+  vt = info ? info->vtuner : NULL;
+  leave_table(epoch);
+
+  return vt;
+}
+
+/*
+ * HAL module
+ */
+
 uint8_t
 tv_input_hal_init()
 {
   module = NULL;
   device = NULL;
-  device_num = 0;
-  device_list[MAX_DEVICE_NUM];
 
   tv_callback.notify = &device_init_notify;
 
+  if (add_virtual_tuners() < 0) {
+    return TV_STATUS_FAIL;
+  }
+
   int err = hw_get_module(TV_INPUT_HARDWARE_MODULE_ID,
                           (hw_module_t const**)&module);
-  if (err) {
+  if (err && (vtuner_num || iptv_num)) {
+    ALOGW("Couldn't load %s module (%d), using virtual tuners only",
+          TV_INPUT_HARDWARE_MODULE_ID, err);
+    return TV_STATUS_SUCCESS;
+  } else if (err) {
     ALOGE("Couldn't load %s module (%d)",
            TV_INPUT_HARDWARE_MODULE_ID, err);
     return TV_STATUS_FAIL;
@@ -153,116 +799,299 @@ tv_input_hal_init()
 uint8_t
 tv_input_hal_uninit()
 {
-  uint8_t idx;
-  for (idx = 0; idx < device_num; idx++) {
-    if (device_list[idx].acting_stream_id != -1) {
-      device->close_stream(device,
-                           device_list[idx].device_id,
-                           device_list[idx].acting_stream_id);
-    }
+  struct device_table* tab;
+  uint32_t idx;
+
+  pthread_mutex_lock(&table_lock);
+  tab = publish_table(&empty_table);
+  pthread_mutex_unlock(&table_lock);
+
+  for (idx = 0; idx < tab->num; idx++) {
+    pthread_mutex_lock(&tab->device[idx]->lock);
+    close_device_streams(tab->device[idx]);
+    pthread_mutex_unlock(&tab->device[idx]->lock);
+    unref_device_info(tab->device[idx]);
   }
+  destroy_device_table(tab);
+
   return TV_STATUS_SUCCESS;
 }
 
 uint32_t
 tv_input_hal_get_input_num_by_type(const int type)
 {
-  uint8_t idx;
+  unsigned long epoch;
+  const struct device_table* tab;
+  uint32_t idx;
   uint32_t sum;
+
   sum = 0;
-  for (idx = 0; idx < device_num; idx++) {
-    if (device_list[idx].type == type) {
+
+  epoch = enter_table();
+  tab = current_table();
+  for (idx = 0; idx < tab->num; idx++) {
+    if (tab->device[idx]->type == type) {
       sum++;
     }
   }
+  leave_table(epoch);
 
   return sum;
 }
 
+/*
+ * Stores the IDs of at most |input_num| devices of the given type. Devices
+ * can come and go between this call and |tv_input_hal_get_input_num_by_type|;
+ * unused entries of |devices| are set to -1.
+ */
 uint8_t
 tv_input_hal_get_inputs_by_type(const uint8_t input_num,
                                 const int type, int* devices)
 {
-  uint8_t idx;
+  unsigned long epoch;
+  const struct device_table* tab;
+  uint32_t idx;
   uint8_t device_cnt;
 
   device_cnt = 0;
 
-  for (idx = 0; idx < device_num; idx++) {
-    if (device_list[idx].type == type) {
-      devices[device_cnt++] = device_list[idx].device_id;
+  epoch = enter_table();
+  tab = current_table();
+  for (idx = 0; idx < tab->num && device_cnt < input_num; idx++) {
+    if (tab->device[idx]->type == type) {
+      devices[device_cnt++] = tab->device[idx]->device_id;
     }
   }
+  leave_table(epoch);
+
+  while (device_cnt < input_num) {
+    devices[device_cnt++] = -1;
+  }
 
   return TV_STATUS_SUCCESS;
 }
 
-uint8_t
-tv_input_hal_get_stream(int32_t device_id, tv_stream_t* tv_stream)
+/*
+ * Returns 1 if the device has open streams, or 0 otherwise. Devices
+ * without stream are idle and can be used for background work, such as
+ * scanning.
+ */
+int
+tv_input_hal_has_stream(int32_t device_id)
 {
-  /* Need to configure stream */
-  int numConfigs;
-  int result;
-  const tv_stream_config_t* configs;
-  int32_t idx;
-  int configIndex;
+  unsigned long epoch;
+  struct device_info* info;
+  int has_stream;
 
-  result = TV_STATUS_SUCCESS;
-  numConfigs = 0;
-  configIndex = -1;
+  epoch = enter_table();
+  info = lookup_device(current_table(), device_id);
+  has_stream = info &&
+    __atomic_load_n(&info->num_streams, __ATOMIC_RELAXED) > 0;
+  leave_table(epoch);
 
-  if (device->get_stream_configurations(
-      device, device_id, &numConfigs, &configs) != 0) {
-    ALOGE("Couldn't get stream configs");
-    return TV_STATUS_FAIL;
-  }
+  return has_stream;
+}
+
+/* Returns the ID of the first independent video source. */
+static int
+find_source_stream_id(struct device_info* info)
+{
+  int num_configs, idx;
+
+  num_configs = get_stream_configs(info);
   /*
    * FIXME
    * We only handle independent video source in current phase.
    */
-  for (idx = 0; idx < numConfigs; ++idx) {
-    if (configs[idx].type == TV_STREAM_TYPE_INDEPENDENT_VIDEO_SOURCE) {
-      configIndex = idx;
-      break;
+  for (idx = 0; idx < num_configs; ++idx) {
+    if (info->config[idx].type == TV_STREAM_TYPE_INDEPENDENT_VIDEO_SOURCE) {
+      return info->config[idx].stream_id;
     }
   }
+  return -1;
+}
 
-  if (configIndex == -1) {
-    ALOGE("Cannot find a config with given stream ID.");
+uint8_t
+tv_input_hal_get_stream(int32_t device_id, tv_stream_t* tv_stream)
+{
+  struct device_info* info;
+  struct device_stream* stream;
+  int stream_id;
+  uint8_t res;
+
+  info = get_device(device_id);
+  if (!info) {
+    ALOGE("Unknown device ID.");
     return TV_STATUS_FAIL;
   }
 
-  tv_stream->type = configs[configIndex].type;
+  pthread_mutex_lock(&info->lock);
 
-  tv_stream->stream_id = configs[configIndex].stream_id;
-  if (tv_stream->type == TV_STREAM_TYPE_BUFFER_PRODUCER) {
-    tv_stream->buffer_producer.width = configs[configIndex].max_video_width;
-    tv_stream->buffer_producer.height = configs[configIndex].max_video_height;
-  }
-
-  for (idx = 0; idx < device_num; idx++) {
-    if (device_list[idx].device_id == device_id) {
-      if (device_list[idx].acting_stream_id != -1) {
-        if ( device_list[idx].acting_stream_id != tv_stream->stream_id) {
-          result = device->close_stream(device,
-                                        device_list[idx].device_id,
-                                        device_list[idx].acting_stream_id);
-          if (result != TV_STATUS_SUCCESS) {
-            return TV_STATUS_FAIL;
-          }
-        } else {
-          return TV_STATUS_SUCCESS;
-        }
+  stream = NULL;
+  if (info->source_stream_id != -1) {
+    stream = find_open_stream(info, info->source_stream_id);
+  }
+  if (stream) {
+    *tv_stream = stream->stream; /* keep stream open across zaps */
+    res = TV_STATUS_SUCCESS;
+  } else {
+    stream_id = find_source_stream_id(info);
+    if (stream_id == -1) {
+      ALOGE("Cannot find a config with given stream ID.");
+      res = TV_STATUS_FAIL;
+    } else {
+      res = acquire_stream(info, stream_id, 1, tv_stream);
+      if (res == TV_STATUS_SUCCESS) {
+        info->source_stream_id = stream_id;
       }
-      break;
     }
   }
 
-  if (device->open_stream(device, device_id, tv_stream) != 0) {
-    ALOGE("Couldn't add stream");
-    return TV_STATUS_FAIL;
+  pthread_mutex_unlock(&info->lock);
+
+  unref_device_info(info);
+
+  return res;
+}
+
+/*
+ * Drops the reference of the device's source to its stream.
+ */
+uint8_t
+tv_input_hal_release_source(int32_t device_id)
+{
+  struct device_info* info;
+
+  info = get_device(device_id);
+  if (!info) {
+    ALOGE("Unknown device ID.");
+    return TV_STATUS_INVARG;
   }
-  device_list[idx].acting_stream_id = tv_stream->stream_id;
+
+  pthread_mutex_lock(&info->lock);
+  release_source(info);
+  pthread_mutex_unlock(&info->lock);
+
+  unref_device_info(info);
 
   return TV_STATUS_SUCCESS;
 }
+
+/*
+ * Drops the reference of the device's source to the stream with the
+ * given ID, if the source refers to it. It returns TV_STATUS_INVARG
+ * otherwise.
+ */
+uint8_t
+tv_input_hal_close_source(int32_t device_id, int32_t stream_id)
+{
+  struct device_info* info;
+  uint8_t res;
+
+  info = get_device(device_id);
+  if (!info) {
+    ALOGE("Unknown device ID.");
+    return TV_STATUS_INVARG;
+  }
+
+  pthread_mutex_lock(&info->lock);
+  if (info->source_stream_id == stream_id && stream_id != -1) {
+    release_source(info);
+    res = TV_STATUS_SUCCESS;
+  } else {
+    res = TV_STATUS_INVARG;
+  }
+  pthread_mutex_unlock(&info->lock);
+
+  unref_device_info(info);
+
+  return res;
+}
+
+/*
+ * Returns a copy of the device's stream configurations, allocated with
+ * malloc(3).
+ */
+uint8_t
+tv_input_hal_get_stream_configs(int32_t device_id, uint32_t* num_configs,
+                                tv_stream_config_t** configs)
+{
+  struct device_info* info;
+  int num;
+  uint8_t res;
+
+  info = get_device(device_id);
+  if (!info) {
+    ALOGE("Unknown device ID.");
+    return TV_STATUS_INVARG;
+  }
+
+  pthread_mutex_lock(&info->lock);
+
+  res = TV_STATUS_FAIL;
+  num = get_stream_configs(info);
+  if (num < 0) {
+    goto out;
+  }
+  *configs = malloc(num * sizeof(**configs));
+  if (num && !*configs) {
+    ALOGE_ERRNO("malloc");
+    goto out;
+  }
+  memcpy(*configs, info->config, num * sizeof(**configs));
+  *num_configs = num;
+  res = TV_STATUS_SUCCESS;
+
+out:
+  pthread_mutex_unlock(&info->lock);
+  unref_device_info(info);
+  return res;
+}
+
+/*
+ * Opens the stream with the given ID, or takes another reference to the
+ * open stream. Each successful call has to be paired with a call to
+ * |tv_input_hal_close_stream|.
+ */
+uint8_t
+tv_input_hal_open_stream(int32_t device_id, int32_t stream_id,
+                         tv_stream_t* tv_stream)
+{
+  struct device_info* info;
+  uint8_t res;
+
+  info = get_device(device_id);
+  if (!info) {
+    ALOGE("Unknown device ID.");
+    return TV_STATUS_INVARG;
+  }
+
+  pthread_mutex_lock(&info->lock);
+  res = acquire_stream(info, stream_id, 0, tv_stream);
+  pthread_mutex_unlock(&info->lock);
+
+  unref_device_info(info);
+
+  return res;
+}
+
+uint8_t
+tv_input_hal_close_stream(int32_t device_id, int32_t stream_id)
+{
+  struct device_info* info;
+  uint8_t res;
+
+  info = get_device(device_id);
+  if (!info) {
+    ALOGE("Unknown device ID.");
+    return TV_STATUS_INVARG;
+  }
+
+  pthread_mutex_lock(&info->lock);
+  res = release_stream(info, stream_id);
+  pthread_mutex_unlock(&info->lock);
+
+  unref_device_info(info);
+
+  return res;
+}
@@ -18,6 +18,8 @@
 
 #include <hardware/tv_input.h>
 
+struct vtuner;
+
 uint8_t tv_input_hal_init(void);
 
 uint8_t tv_input_hal_uninit(void);
@@ -28,4 +30,25 @@ uint8_t tv_input_hal_get_inputs_by_type(const uint8_t input_num,
                                         const int type,
                                         int* devices);
 
-uint8_t tv_input_hal_get_stream(uint32_t device_id, tv_stream_t* tv_stream);
+uint8_t tv_input_hal_get_stream(int32_t device_id, tv_stream_t* tv_stream);
+
+uint8_t tv_input_hal_release_source(int32_t device_id);
+
+uint8_t tv_input_hal_close_source(int32_t device_id, int32_t stream_id);
+
+uint8_t tv_input_hal_get_stream_configs(int32_t device_id,
+                                        uint32_t* num_configs,
+                                        tv_stream_config_t** configs);
+
+uint8_t tv_input_hal_open_stream(int32_t device_id, int32_t stream_id,
+                                 tv_stream_t* tv_stream);
+
+uint8_t tv_input_hal_close_stream(int32_t device_id, int32_t stream_id);
+
+int tv_input_hal_has_stream(int32_t device_id);
+
+void tv_input_hal_set_virtual_tuners(const char* dir, uint32_t num);
+
+void tv_input_hal_set_iptv_tuners(const char* ifaddr, uint32_t num);
+
+struct vtuner* tv_input_hal_get_vtuner(int32_t device_id);
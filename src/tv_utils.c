@@ -16,6 +16,11 @@
 
 #include "tv_utils.h"
 
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
 void
 release_tuners(const uint32_t num, struct tv_tuner* tuners)
 {
@@ -48,32 +53,164 @@ release_channels(const uint32_t num, struct tv_channel* channels)
   free(channels);
 }
 
+void
+clear_channel(struct tv_channel* ch)
+{
+  free(ch->network_id);
+  free(ch->trans_stream_id);
+  free(ch->service_id);
+  free(ch->number);
+  free(ch->name);
+}
+
+int
+copy_channel(struct tv_channel* dst, const struct tv_channel* src)
+{
+  memset(dst, 0, sizeof(*dst));
+
+  dst->network_id = strdup(src->network_id ? src->network_id : "");
+  dst->trans_stream_id =
+    strdup(src->trans_stream_id ? src->trans_stream_id : "");
+  dst->service_id = strdup(src->service_id ? src->service_id : "");
+  dst->number = strdup(src->number ? src->number : "");
+  dst->name = strdup(src->name ? src->name : "");
+  dst->type = src->type;
+  dst->is_emergency = src->is_emergency;
+  dst->is_free = src->is_free;
+
+  if (!dst->network_id || !dst->trans_stream_id || !dst->service_id ||
+      !dst->number || !dst->name) {
+    ALOGE_ERRNO("strdup");
+    clear_channel(dst);
+    return -1;
+  }
+  return 0;
+}
+
+void
+clear_program(struct tv_program* program)
+{
+  uint32_t attr_idx;
+
+  if (!program) {
+    return;
+  }
+
+  free(program->evt_id);
+  free(program->title);
+  free(program->descpt);
+  free(program->rating);
+
+  for (attr_idx=0; attr_idx<program->lang_num; attr_idx++) {
+    free(program->langs[attr_idx]);
+  }
+  free(program->langs);
+
+  for (attr_idx=0; attr_idx<program->stl_lang_num; attr_idx++) {
+    free(program->stl_langs[attr_idx]);
+  }
+  free(program->stl_langs);
+
+  memset(program, 0, sizeof(*program));
+}
+
 void
 release_programs(const uint32_t num, struct tv_program* programs)
 {
   uint32_t prog_idx;
-  uint32_t attr_idx;
 
   if (!programs) {
     return;
   }
 
   for (prog_idx = 0; prog_idx < num; prog_idx++) {
-    free(programs[prog_idx].evt_id);
-    free(programs[prog_idx].title);
-    free(programs[prog_idx].descpt);
-    free(programs[prog_idx].rating);
+    clear_program(&programs[prog_idx]);
+  }
+  free(programs);
+}
 
-    for (attr_idx=0; attr_idx<programs[prog_idx].lang_num; attr_idx++) {
-      free(programs[prog_idx].langs[attr_idx]);
-    }
-    free(programs[prog_idx].langs);
+static char*
+copy_str(const char* str)
+{
+  return strdup(str ? str : "");
+}
+
+static char**
+copy_strv(const uint32_t num, char* const* strv)
+{
+  uint32_t idx;
+  char** copy;
+
+  copy = (char**)calloc(num ? num : 1, sizeof(char*));
+  if (!copy) {
+    return NULL;
+  }
 
-    for (attr_idx=0; attr_idx<programs[prog_idx].stl_lang_num; attr_idx++) {
-      free(programs[prog_idx].stl_langs[attr_idx]);
+  for (idx = 0; idx < num; idx++) {
+    copy[idx] = copy_str(strv[idx]);
+    if (!copy[idx]) {
+      goto err;
     }
-    free(programs[prog_idx].stl_langs);
+  }
+  return copy;
+
+err:
+  while (idx) {
+    free(copy[--idx]);
+  }
+  free(copy);
+  return NULL;
+}
+
+int
+copy_program(struct tv_program* dst, const struct tv_program* src)
+{
+  memset(dst, 0, sizeof(*dst));
+
+  dst->start_time = src->start_time;
+  dst->duration = src->duration;
 
-    free(programs);
+  dst->evt_id = copy_str(src->evt_id);
+  dst->title = copy_str(src->title);
+  dst->descpt = copy_str(src->descpt);
+  dst->rating = copy_str(src->rating);
+  dst->langs = copy_strv(src->lang_num, src->langs);
+  if (dst->langs) {
+    dst->lang_num = src->lang_num;
   }
+  dst->stl_langs = copy_strv(src->stl_lang_num, src->stl_langs);
+  if (dst->stl_langs) {
+    dst->stl_lang_num = src->stl_lang_num;
+  }
+
+  if (!dst->evt_id || !dst->title || !dst->descpt || !dst->rating ||
+      !dst->langs || !dst->stl_langs) {
+    ALOGE("Couldn't copy program");
+    clear_program(dst);
+    return -1;
+  }
+
+  return 0;
+}
+
+struct tv_program*
+copy_programs(const uint32_t num, const struct tv_program* programs)
+{
+  uint32_t prog_idx;
+  struct tv_program* copy;
+
+  copy = (struct tv_program*)calloc(num ? num : 1, sizeof(struct tv_program));
+  if (!copy) {
+    ALOGE_ERRNO("calloc");
+    return NULL;
+  }
+
+  for (prog_idx = 0; prog_idx < num; prog_idx++) {
+    if (copy_program(&copy[prog_idx], &programs[prog_idx]) < 0) {
+      release_programs(prog_idx, copy);
+      return NULL;
+    }
+  }
+
+  return copy;
 }
@@ -23,6 +23,7 @@
 #define TV_STATUS_INVARG        2
 #define TV_STATUS_NO_SIGNAL     3
 #define TV_STATUS_NOT_SUPPORTED 4
+#define TV_STATUS_BUSY          5
 
 /* Channel status */
 #define DTV_CHANNEL_ADD 0
@@ -32,6 +33,30 @@
 #define DTV_SCAN_COMPLETE 1
 #define DTV_SCAN_STOPPED  2
 
+/* Modulation */
+#define TV_MODULATION_AUTO   0
+#define TV_MODULATION_QPSK   1
+#define TV_MODULATION_8PSK   2
+#define TV_MODULATION_QAM16  3
+#define TV_MODULATION_QAM32  4
+#define TV_MODULATION_QAM64  5
+#define TV_MODULATION_QAM128 6
+#define TV_MODULATION_QAM256 7
+#define TV_MODULATION_8VSB   8
+
+/* Polarization */
+#define TV_POLARIZATION_NONE       0
+#define TV_POLARIZATION_HORIZONTAL 1
+#define TV_POLARIZATION_VERTICAL   2
+#define TV_POLARIZATION_LEFT       3
+#define TV_POLARIZATION_RIGHT      4
+
+/* Frontend status */
+#define TV_FRONTEND_HAS_SIGNAL  0x01 /* energy above noise, AGC settled */
+#define TV_FRONTEND_HAS_CARRIER 0x02
+#define TV_FRONTEND_HAS_SYNC    0x04
+#define TV_FRONTEND_HAS_LOCK    0x08
+
 typedef enum {
   TVD_DVB_T    = 0x00,
   TVD_DVB_T2   = 0x01,
@@ -51,7 +76,8 @@ typedef enum {
   TVD_DTMB     = 0x0f,
   TVD_CMMB     = 0x10,
   TVD_T_DMB    = 0x11,
-  TVD_S_DMB    = 0x12
+  TVD_S_DMB    = 0x12,
+  TVD_IPTV     = 0x13
 } tvd_tuner_type;
 
 struct tv_tuner {
@@ -71,6 +97,17 @@ struct tv_channel {
   char is_free;
 };
 
+/* For TVD_IPTV, |frequency| holds the IPv4 address of a multicast group in
+ * host byte order, and |port| the group's UDP port. */
+struct tv_frequency {
+  uint32_t frequency;   /* kHz */
+  uint32_t bandwidth;   /* kHz, 0 if unknown */
+  uint32_t symbol_rate; /* symbols per second, 0 if unknown */
+  uint8_t modulation;
+  uint8_t polarization; /* satellite only */
+  uint16_t port;        /* IPTV only */
+};
+
 struct tv_program {
   char* evt_id;
   char* title;
@@ -89,3 +126,14 @@ void release_tuners(const uint32_t num, struct tv_tuner* tuners);
 void release_channels(const uint32_t num, struct tv_channel* channels);
 
 void release_programs(const uint32_t num, struct tv_program* programs);
+
+void clear_channel(struct tv_channel* channel);
+
+int copy_channel(struct tv_channel* dst, const struct tv_channel* src);
+
+void clear_program(struct tv_program* program);
+
+int copy_program(struct tv_program* dst, const struct tv_program* src);
+
+struct tv_program* copy_programs(const uint32_t num,
+                                 const struct tv_program* programs);
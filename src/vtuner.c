@@ -0,0 +1,946 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements virtual tuners. See the corresponding header file
+ * for documentation.
+ */
+
+#include "vtuner.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iptv.h"
+#include "log.h"
+#include "ts_demux.h"
+
+enum {
+  DEFAULT_BYTE_RATE = 24000000 / 8,
+  MIN_BYTE_RATE = 64000 / 8, /* keeps the stream thread responsive */
+  PCR_WINDOW = 2 * 1024 * 1024, /* bytes searched for PCRs */
+  READ_PACKETS = 64, /* packets to wait for between reads */
+  STREAM_PACKETS = PIPE_BUF / TS_PACKET_SIZE, /* atomic pipe writes */
+  MAX_STREAM_LAG = 1000, /* ms */
+  IDLE_INTERVAL = 10, /* ms */
+  IPTV_INTERVAL = 100, /* ms; interval for checking the stop flag */
+  PIPE_SIZE = 1024 * 1024 /* bytes; about 20 ms at 400 Mbit/s */
+};
+
+static const uint64_t NS_PER_SEC = 1000000000ull;
+static const uint64_t NS_PER_MS = 1000000ull;
+
+struct vtuner_channel {
+  struct tv_channel ch;
+  struct tv_frequency freq; /* including port and polarization */
+};
+
+struct vtuner {
+  pthread_mutex_t lock;
+  char* dir; /* NULL for IPTV tuners */
+  struct iptv_receiver* iptv; /* NULL for file-backed tuners */
+
+  /* tuned file */
+  uint32_t frequency;
+  const uint8_t* map;
+  size_t size; /* multiple of the packet size */
+  uint64_t byte_rate;
+  uint64_t tune_time; /* ns */
+  uint32_t generation; /* incremented on each tuning */
+
+  /* sections */
+  struct ts_demux* demux;
+  uint64_t read_pos; /* bytes since tuning */
+  uint8_t want_table_id;
+  uint8_t* section;
+  uint32_t section_cap;
+  uint32_t section_len; /* 0 until a section arrived */
+
+  /* stream */
+  int pipe_fd[2];
+  native_handle_t* handle;
+  pthread_t thread;
+  int stop;
+  uint64_t play_pos; /* bytes since tuning */
+  uint64_t dropped;
+
+  /* channels */
+  struct vtuner_channel* channel;
+  uint32_t num_channels;
+  uint32_t max_channels;
+};
+
+/*
+ * Time
+ */
+
+static uint64_t
+monotonic_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void
+sleep_until(uint64_t ns)
+{
+  struct timespec ts = {
+    .tv_sec = ns / NS_PER_SEC,
+    .tv_nsec = ns % NS_PER_SEC
+  };
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+         EINTR) { }
+}
+
+/* Returns the time in ns after tuning at which the stream reaches |pos|.
+ * Splitting the division avoids overflows. */
+static uint64_t
+pos_to_ns(uint64_t pos, uint64_t byte_rate)
+{
+  return (pos / byte_rate) * NS_PER_SEC +
+         (pos % byte_rate) * NS_PER_SEC / byte_rate;
+}
+
+static uint64_t
+ns_to_pos(uint64_t ns, uint64_t byte_rate)
+{
+  return (ns / NS_PER_SEC) * byte_rate +
+         (ns % NS_PER_SEC) * byte_rate / NS_PER_SEC;
+}
+
+/* Returns the position that playback has reached at |now|. */
+static uint64_t
+live_pos(const struct vtuner* vt, uint64_t now)
+{
+  return ns_to_pos(now - vt->tune_time, vt->byte_rate);
+}
+
+/*
+ * Files
+ */
+
+/* Returns the PCR of a packet in units of 27 MHz, or -1 if there's
+ * none. */
+static int64_t
+get_pcr(const uint8_t* packet)
+{
+  uint64_t base;
+
+  if (packet[0] != TS_SYNC_BYTE || !(packet[3] & 0x20) || packet[4] < 7 ||
+      !(packet[5] & 0x10)) {
+    return -1;
+  }
+  base = ((uint64_t)packet[6] << 25) | (packet[7] << 17) |
+         (packet[8] << 9) | (packet[9] << 1) | (packet[10] >> 7);
+
+  return base * 300 + (((packet[10] & 0x01) << 8) | packet[11]);
+}
+
+static uint16_t
+get_pid(const uint8_t* packet)
+{
+  return ((packet[1] & 0x1f) << 8) | packet[2];
+}
+
+/* Computes the byte rate of a recording from the first and the last
+ * PCR of the same PID. Only the file's beginning and end are searched,
+ * so tuning doesn't read the whole file. */
+static uint64_t
+compute_byte_rate(const uint8_t* map, size_t size)
+{
+  size_t window, off, first_off, last_off;
+  int64_t pcr, first_pcr, last_pcr;
+  uint64_t rate;
+  uint16_t pid;
+
+  window = size < PCR_WINDOW ? size : PCR_WINDOW;
+  window -= window % TS_PACKET_SIZE;
+
+  for (off = 0; off < window; off += TS_PACKET_SIZE) {
+    first_pcr = get_pcr(map + off);
+    if (first_pcr >= 0) {
+      break;
+    }
+  }
+  if (off == window) {
+    return DEFAULT_BYTE_RATE;
+  }
+  first_off = off;
+  pid = get_pid(map + off);
+
+  last_pcr = -1;
+  last_off = 0;
+  for (off = size - window; off < size; off += TS_PACKET_SIZE) {
+    pcr = get_pcr(map + off);
+    if (pcr >= 0 && get_pid(map + off) == pid) {
+      last_pcr = pcr;
+      last_off = off;
+    }
+  }
+  if (last_pcr <= first_pcr || last_off <= first_off) {
+    return DEFAULT_BYTE_RATE; /* single PCR or wrap-around */
+  }
+
+  rate = (last_off - first_off) * 27000000ull / (last_pcr - first_pcr);
+
+  return rate >= MIN_BYTE_RATE ? rate : DEFAULT_BYTE_RATE;
+}
+
+static void
+unmap_file(struct vtuner* vt)
+{
+  if (vt->map) {
+    munmap((void*)vt->map, vt->size);
+    vt->map = NULL;
+  }
+  vt->size = 0;
+}
+
+static int
+map_file(struct vtuner* vt, uint32_t frequency)
+{
+  char path[PATH_MAX];
+  struct stat st;
+  void* map;
+  int fd, res;
+
+  res = snprintf(path, sizeof(path), "%s/%u.ts", vt->dir, frequency);
+  if (res < 0 || (size_t)res >= sizeof(path)) {
+    ALOGE("Path of virtual tuner is too long");
+    return -1;
+  }
+
+  fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC));
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return 0; /* no signal */
+    }
+    ALOGE_ERRNO("open");
+    return -1;
+  }
+
+  if (fstat(fd, &st) < 0) {
+    ALOGE_ERRNO("fstat");
+    goto err_fstat;
+  }
+  if (st.st_size < TS_PACKET_SIZE) {
+    ALOGW("%s is too short", path);
+    close(fd);
+    return 0;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    ALOGE_ERRNO("mmap");
+    goto err_mmap;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  close(fd);
+
+  vt->map = map;
+  vt->size = st.st_size;
+  vt->byte_rate = compute_byte_rate(vt->map, vt->size);
+  vt->size -= vt->size % TS_PACKET_SIZE;
+
+  return 0;
+
+err_mmap:
+err_fstat:
+  close(fd);
+  return -1;
+}
+
+/*
+ * Sections
+ */
+
+static void
+section_cb(void* data, uint16_t pid, const uint8_t* buf, size_t len)
+{
+  struct vtuner* vt = data;
+
+  if (vt->section_len || buf[0] != vt->want_table_id ||
+      len > vt->section_cap) {
+    return;
+  }
+  memcpy(vt->section, buf, len);
+  vt->section_len = len;
+}
+
+/* Feeds the packets up to position |end| to the demultiplexer, until a
+ * section arrives. */
+static void
+feed_packets(struct vtuner* vt, uint64_t end)
+{
+  while (vt->read_pos + TS_PACKET_SIZE <= end && !vt->section_len) {
+    size_t off = vt->read_pos % vt->size;
+    ts_demux_feed(vt->demux, vt->map + off, TS_PACKET_SIZE);
+    vt->read_pos += TS_PACKET_SIZE;
+  }
+}
+
+/* Reads from the tuned file until a section arrives or the deadline
+ * passes. Called with the lock held. */
+static void
+read_file_section(struct vtuner* vt, uint64_t now, uint64_t deadline)
+{
+  uint32_t generation = vt->generation;
+  uint64_t due;
+
+  /* Sections that have been broadcast before the call are missed, as
+   * with a hardware demultiplexer. */
+  if (vt->read_pos < live_pos(vt, now)) {
+    vt->read_pos = live_pos(vt, now);
+  }
+
+  for (;;) {
+    feed_packets(vt, live_pos(vt, now));
+    if (vt->section_len || now >= deadline) {
+      break;
+    }
+    /* wait for a batch of packets to be broadcast */
+    due = vt->tune_time + pos_to_ns(vt->read_pos +
+                                    READ_PACKETS * TS_PACKET_SIZE,
+                                    vt->byte_rate);
+    pthread_mutex_unlock(&vt->lock);
+    sleep_until(due < deadline ? due : deadline);
+    pthread_mutex_lock(&vt->lock);
+    if (vt->generation != generation) {
+      break; /* tuned away */
+    }
+    now = monotonic_ns();
+  }
+}
+
+/* Reads datagrams from the IPTV receiver until a section arrives or the
+ * deadline passes. Called with the lock held, which is released while
+ * waiting. Only the reading thread uses the demultiplexer. */
+static void
+read_iptv_section(struct vtuner* vt, uint64_t deadline)
+{
+  struct iptv_reader reader;
+  uint32_t i, num;
+
+  pthread_mutex_unlock(&vt->lock);
+
+  iptv_receiver_add_reader(vt->iptv, &reader);
+
+  while (!vt->section_len) {
+    num = iptv_receiver_wait(vt->iptv, &reader, deadline);
+    if (!num) {
+      break;
+    }
+    for (i = 0; i < num && !vt->section_len; ++i) {
+      size_t len;
+      const uint8_t* data = iptv_receiver_get(vt->iptv, &reader, i, &len);
+      ts_demux_feed(vt->demux, data, len);
+    }
+    iptv_receiver_release(vt->iptv, &reader, num);
+  }
+
+  iptv_receiver_remove_reader(vt->iptv, &reader);
+
+  pthread_mutex_lock(&vt->lock);
+}
+
+/*
+ * Stream
+ */
+
+/* Writes the data that's due to the pipe. Returns the time at which the
+ * next data is due. */
+static uint64_t
+write_stream(struct vtuner* vt, uint64_t now)
+{
+  size_t off, len;
+  ssize_t res;
+
+  if (!vt->map) {
+    return now + IDLE_INTERVAL * NS_PER_MS;
+  }
+
+  if (live_pos(vt, now) > vt->play_pos +
+                          ns_to_pos(MAX_STREAM_LAG * NS_PER_MS,
+                                    vt->byte_rate)) {
+    vt->play_pos = live_pos(vt, now); /* skip after stalls or tuning */
+  }
+
+  while (vt->tune_time + pos_to_ns(vt->play_pos, vt->byte_rate) <= now) {
+    off = vt->play_pos % vt->size;
+    len = STREAM_PACKETS * TS_PACKET_SIZE;
+    if (len > vt->size - off) {
+      len = vt->size - off;
+    }
+    res = write(vt->pipe_fd[1], vt->map + off, len);
+    if (res < 0 && errno != EAGAIN && errno != EINTR) {
+      ALOGE_ERRNO("write");
+    } else if (res < 0) {
+      vt->dropped += len; /* reader is too slow */
+    }
+    vt->play_pos += len;
+  }
+
+  return vt->tune_time + pos_to_ns(vt->play_pos, vt->byte_rate);
+}
+
+static void
+stream_file(struct vtuner* vt)
+{
+  pthread_mutex_lock(&vt->lock);
+
+  while (!vt->stop) {
+    uint64_t next = write_stream(vt, monotonic_ns());
+    pthread_mutex_unlock(&vt->lock);
+    sleep_until(next);
+    pthread_mutex_lock(&vt->lock);
+  }
+
+  pthread_mutex_unlock(&vt->lock);
+}
+
+/* Forwards received datagrams to the pipe. Writes of up to PIPE_BUF
+ * bytes are atomic, so we combine datagrams up to this size and never
+ * split TS packets when the pipe is full. */
+static void
+stream_iptv(struct vtuner* vt)
+{
+  struct iptv_reader reader;
+  struct iovec iov[PIPE_BUF / TS_PACKET_SIZE];
+  uint64_t dropped = 0;
+
+  iptv_receiver_add_reader(vt->iptv, &reader);
+
+  while (!__atomic_load_n(&vt->stop, __ATOMIC_ACQUIRE)) {
+    uint32_t i, num;
+    size_t len;
+    int iovcnt;
+
+    num = iptv_receiver_wait(vt->iptv, &reader,
+                             monotonic_ns() + IPTV_INTERVAL * NS_PER_MS);
+
+    for (i = 0, len = 0, iovcnt = 0; i <= num; ++i) {
+      size_t data_len = 0;
+      const uint8_t* data = NULL;
+
+      if (i < num) {
+        data = iptv_receiver_get(vt->iptv, &reader, i, &data_len);
+      }
+      if (iovcnt && (i == num || len + data_len > PIPE_BUF)) {
+        if (writev(vt->pipe_fd[1], iov, iovcnt) < 0) {
+          if (errno != EAGAIN && errno != EINTR) {
+            ALOGE_ERRNO("writev");
+          }
+          dropped += len; /* reader is too slow */
+        }
+        len = 0;
+        iovcnt = 0;
+      }
+      if (data_len) {
+        iov[iovcnt].iov_base = (void*)data;
+        iov[iovcnt].iov_len = data_len;
+        ++iovcnt;
+        len += data_len;
+      }
+    }
+    iptv_receiver_release(vt->iptv, &reader, num);
+  }
+
+  iptv_receiver_remove_reader(vt->iptv, &reader);
+
+  pthread_mutex_lock(&vt->lock);
+  vt->dropped += dropped;
+  pthread_mutex_unlock(&vt->lock);
+}
+
+static void*
+stream_thread(void* arg)
+{
+  struct vtuner* vt = arg;
+
+  if (vt->iptv) {
+    stream_iptv(vt);
+  } else {
+    stream_file(vt);
+  }
+
+  return NULL;
+}
+
+/*
+ * Public interfaces
+ */
+
+static struct vtuner*
+new_vtuner(const char* dir, int iptv, const char* ifaddr)
+{
+  static const struct ts_demux_callbacks callbacks = {
+    .section_cb = section_cb
+  };
+
+  struct vtuner* vt;
+  int err;
+
+  vt = calloc(1, sizeof(*vt));
+  if (!vt) {
+    ALOGE_ERRNO("calloc");
+    return NULL;
+  }
+
+  if (dir) {
+    vt->dir = strdup(dir);
+    if (!vt->dir) {
+      ALOGE_ERRNO("strdup");
+      goto err_strdup;
+    }
+  }
+
+  if (iptv) {
+    vt->iptv = create_iptv_receiver(ifaddr);
+    if (!vt->iptv) {
+      goto err_create_iptv_receiver;
+    }
+  }
+
+  vt->demux = create_ts_demux(&callbacks, vt);
+  if (!vt->demux) {
+    goto err_create_ts_demux;
+  }
+
+  err = pthread_mutex_init(&vt->lock, NULL);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_mutex_init", err);
+    goto err_pthread_mutex_init;
+  }
+
+  vt->byte_rate = DEFAULT_BYTE_RATE;
+  vt->pipe_fd[0] = -1;
+  vt->pipe_fd[1] = -1;
+
+  return vt;
+
+err_pthread_mutex_init:
+  destroy_ts_demux(vt->demux);
+err_create_ts_demux:
+  if (vt->iptv) {
+    destroy_iptv_receiver(vt->iptv);
+  }
+err_create_iptv_receiver:
+  free(vt->dir);
+err_strdup:
+  free(vt);
+  return NULL;
+}
+
+struct vtuner*
+create_vtuner(const char* dir)
+{
+  assert(dir);
+
+  return new_vtuner(dir, 0, NULL);
+}
+
+struct vtuner*
+create_iptv_vtuner(const char* ifaddr)
+{
+  return new_vtuner(NULL, 1, ifaddr);
+}
+
+void
+destroy_vtuner(struct vtuner* vt)
+{
+  uint32_t i;
+
+  assert(vt);
+
+  vtuner_close_stream(vt);
+
+  for (i = 0; i < vt->num_channels; ++i) {
+    clear_channel(&vt->channel[i].ch);
+  }
+  free(vt->channel);
+  unmap_file(vt);
+  if (vt->iptv) {
+    destroy_iptv_receiver(vt->iptv);
+  }
+  pthread_mutex_destroy(&vt->lock);
+  destroy_ts_demux(vt->demux);
+  free(vt->dir);
+  free(vt);
+}
+
+int
+vtuner_tune(struct vtuner* vt, const struct tv_frequency* freq)
+{
+  int res;
+
+  assert(vt);
+  assert(freq);
+
+  pthread_mutex_lock(&vt->lock);
+
+  if (vt->iptv) {
+    vt->frequency = freq->frequency;
+    ++vt->generation;
+    res = iptv_receiver_join(vt->iptv, freq->frequency, freq->port);
+    pthread_mutex_unlock(&vt->lock);
+    return res;
+  }
+
+  unmap_file(vt);
+  vt->frequency = freq->frequency;
+  vt->byte_rate = DEFAULT_BYTE_RATE;
+  vt->tune_time = monotonic_ns();
+  vt->read_pos = 0;
+  vt->play_pos = 0;
+  ++vt->generation;
+
+  res = map_file(vt, freq->frequency);
+
+  pthread_mutex_unlock(&vt->lock);
+
+  return res;
+}
+
+void
+vtuner_get_status(struct vtuner* vt, uint8_t* status, uint16_t* strength)
+{
+  assert(vt);
+  assert(status);
+  assert(strength);
+
+  if (vt->iptv) {
+    iptv_receiver_get_status(vt->iptv, status, strength);
+    return;
+  }
+
+  pthread_mutex_lock(&vt->lock);
+
+  if (vt->map) {
+    *status = TV_FRONTEND_HAS_SIGNAL | TV_FRONTEND_HAS_CARRIER |
+              TV_FRONTEND_HAS_SYNC | TV_FRONTEND_HAS_LOCK;
+    *strength = UINT16_MAX;
+  } else {
+    *status = 0;
+    *strength = 0;
+  }
+
+  pthread_mutex_unlock(&vt->lock);
+}
+
+int
+vtuner_read_section(struct vtuner* vt, uint16_t pid, uint8_t table_id,
+                    uint32_t timeout, uint8_t* buf, uint32_t* len)
+{
+  uint64_t now, deadline;
+  uint32_t generation;
+  uint8_t status;
+  uint16_t strength;
+  int res;
+
+  assert(vt);
+  assert(buf);
+  assert(len);
+
+  res = -1;
+  now = monotonic_ns();
+  deadline = now + timeout * NS_PER_MS;
+
+  if (vt->iptv) {
+    iptv_receiver_get_status(vt->iptv, &status, &strength);
+  }
+
+  pthread_mutex_lock(&vt->lock);
+
+  if (vt->iptv ? !(status & TV_FRONTEND_HAS_SIGNAL) : !vt->map) {
+    goto out; /* no signal */
+  } else if (vt->section) {
+    ALOGE("Virtual tuner is already reading a section");
+    goto out;
+  }
+  generation = vt->generation;
+
+  if (ts_demux_add_section_filter(vt->demux, pid) < 0) {
+    goto out;
+  }
+  vt->want_table_id = table_id;
+  vt->section = buf;
+  vt->section_cap = *len;
+  vt->section_len = 0;
+
+  if (vt->iptv) {
+    read_iptv_section(vt, deadline);
+  } else {
+    read_file_section(vt, now, deadline);
+  }
+  if (vt->generation != generation) {
+    vt->section_len = 0; /* tuned away */
+  }
+
+  if (vt->section_len) {
+    *len = vt->section_len;
+    res = 0;
+  }
+  ts_demux_remove_filter(vt->demux, pid);
+  vt->section = NULL;
+  vt->section_len = 0;
+
+out:
+  pthread_mutex_unlock(&vt->lock);
+  return res;
+}
+
+int
+vtuner_open_stream(struct vtuner* vt, native_handle_t** handle)
+{
+  int err;
+
+  assert(vt);
+  assert(handle);
+
+  pthread_mutex_lock(&vt->lock);
+
+  if (vt->handle) {
+    goto out; /* already open */
+  }
+
+  if (pipe2(vt->pipe_fd, O_CLOEXEC) < 0) {
+    ALOGE_ERRNO("pipe2");
+    goto err_pipe2;
+  }
+  if (fcntl(vt->pipe_fd[1], F_SETFL, O_NONBLOCK) < 0) {
+    ALOGE_ERRNO("fcntl");
+    goto err_fcntl;
+  }
+  if (fcntl(vt->pipe_fd[1], F_SETPIPE_SZ, PIPE_SIZE) < 0) {
+    ALOGW_ERRNO("fcntl(F_SETPIPE_SZ)"); /* continue with default size */
+  }
+
+  vt->handle = native_handle_create(1, 0);
+  if (!vt->handle) {
+    ALOGE("native_handle_create failed");
+    goto err_native_handle_create;
+  }
+  vt->handle->data[0] = vt->pipe_fd[0];
+
+  vt->stop = 0;
+  vt->play_pos = vt->map ? live_pos(vt, monotonic_ns()) : 0;
+  vt->dropped = 0;
+
+  err = pthread_create(&vt->thread, NULL, stream_thread, vt);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_create", err);
+    goto err_pthread_create;
+  }
+
+out:
+  *handle = vt->handle;
+  pthread_mutex_unlock(&vt->lock);
+  return 0;
+
+err_pthread_create:
+  native_handle_delete(vt->handle);
+  vt->handle = NULL;
+err_native_handle_create:
+err_fcntl:
+  close(vt->pipe_fd[0]);
+  close(vt->pipe_fd[1]);
+  vt->pipe_fd[0] = -1;
+  vt->pipe_fd[1] = -1;
+err_pipe2:
+  pthread_mutex_unlock(&vt->lock);
+  return -1;
+}
+
+void
+vtuner_close_stream(struct vtuner* vt)
+{
+  assert(vt);
+
+  pthread_mutex_lock(&vt->lock);
+
+  if (!vt->handle) {
+    pthread_mutex_unlock(&vt->lock);
+    return;
+  }
+  __atomic_store_n(&vt->stop, 1, __ATOMIC_RELEASE);
+
+  pthread_mutex_unlock(&vt->lock);
+
+  pthread_join(vt->thread, NULL);
+
+  if (vt->dropped) {
+    ALOGW("Virtual tuner dropped %llu bytes",
+          (unsigned long long)vt->dropped);
+  }
+  native_handle_close(vt->handle); /* closes reading end */
+  native_handle_delete(vt->handle);
+  vt->handle = NULL;
+  close(vt->pipe_fd[1]);
+  vt->pipe_fd[0] = -1;
+  vt->pipe_fd[1] = -1;
+}
+
+/*
+ * Channels
+ */
+
+static struct vtuner_channel*
+find_channel(struct vtuner* vt, const char* number)
+{
+  uint32_t i;
+
+  for (i = 0; i < vt->num_channels; ++i) {
+    if (!strcmp(vt->channel[i].ch.number, number)) {
+      return vt->channel + i;
+    }
+  }
+  return NULL;
+}
+
+int
+vtuner_add_channel(struct vtuner* vt, const struct tv_frequency* freq,
+                   const struct tv_channel* ch)
+{
+  struct vtuner_channel* channel;
+  int res;
+
+  assert(vt);
+  assert(freq);
+  assert(ch);
+
+  res = -1;
+
+  pthread_mutex_lock(&vt->lock);
+
+  channel = find_channel(vt, ch->number ? ch->number : "");
+  if (channel) {
+    struct tv_channel copy;
+    if (copy_channel(&copy, ch) < 0) {
+      goto out;
+    }
+    clear_channel(&channel->ch); /* replace rescanned channel */
+    channel->ch = copy;
+  } else {
+    if (vt->num_channels == vt->max_channels) {
+      uint32_t max = vt->max_channels ? 2 * vt->max_channels : 16;
+      void* mem = realloc(vt->channel, max * sizeof(*vt->channel));
+      if (!mem) {
+        ALOGE_ERRNO("realloc");
+        goto out;
+      }
+      vt->channel = mem;
+      vt->max_channels = max;
+    }
+    channel = vt->channel + vt->num_channels;
+    if (copy_channel(&channel->ch, ch) < 0) {
+      goto out;
+    }
+    ++vt->num_channels;
+  }
+  channel->freq = *freq;
+  res = 0;
+
+out:
+  pthread_mutex_unlock(&vt->lock);
+  return res;
+}
+
+int
+vtuner_set_channel(struct vtuner* vt, const char* number,
+                   struct tv_channel* ch)
+{
+  struct vtuner_channel* channel;
+  struct tv_frequency freq;
+  int res;
+
+  assert(vt);
+  assert(number);
+  assert(ch);
+
+  memset(ch, 0, sizeof(*ch));
+
+  pthread_mutex_lock(&vt->lock);
+
+  channel = find_channel(vt, number);
+  if (!channel) {
+    ALOGE("Unknown channel %s", number);
+    pthread_mutex_unlock(&vt->lock);
+    return -1;
+  }
+  freq = channel->freq;
+  res = copy_channel(ch, &channel->ch);
+
+  pthread_mutex_unlock(&vt->lock);
+
+  if (res < 0) {
+    memset(ch, 0, sizeof(*ch));
+    return -1;
+  }
+
+  return vtuner_tune(vt, &freq);
+}
+
+uint32_t
+vtuner_get_channel_num(struct vtuner* vt)
+{
+  uint32_t num;
+
+  assert(vt);
+
+  pthread_mutex_lock(&vt->lock);
+  num = vt->num_channels;
+  pthread_mutex_unlock(&vt->lock);
+
+  return num;
+}
+
+uint32_t
+vtuner_get_channels(struct vtuner* vt, uint32_t num, struct tv_channel* ch)
+{
+  uint32_t i;
+
+  assert(vt);
+  assert(ch || !num);
+
+  pthread_mutex_lock(&vt->lock);
+
+  if (num > vt->num_channels) {
+    num = vt->num_channels;
+  }
+  for (i = 0; i < num; ++i) {
+    if (copy_channel(ch + i, &vt->channel[i].ch) < 0) {
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&vt->lock);
+
+  return i;
+}
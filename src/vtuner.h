@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains virtual tuners that receive transport streams from
+ * files. They allow for running the DTV service without tuner hardware,
+ * for example to test scanning, EIT and zapping on a Linux host.
+ *
+ * |create_vtuner| returns a tuner that reads from the directory |dir|.
+ * Each frequency is a file named '<frequency in kHz>.ts' that contains a
+ * recorded transport stream. |vtuner_tune| memory-maps the frequency's
+ * file. Frequencies without file have no signal. |destroy_vtuner| stops
+ * the tuner's stream and releases the tuner.
+ *
+ * The file is played back in a loop at the rate of its recording, which
+ * is computed from the PCRs at the file's beginning and end. Files
+ * without PCRs play at 24 Mbit/s. Playback is a function of time: the
+ * stream advances from the moment of tuning, whether or not anybody
+ * reads it.
+ *
+ * |create_iptv_vtuner| returns a tuner that receives transport streams
+ * over UDP/RTP multicast on the interface with the IPv4 address |ifaddr|,
+ * or on the default interface if |ifaddr| is NULL. Its frequencies are
+ * multicast groups; see |struct tv_frequency|. |vtuner_tune| joins the
+ * group, and the stream plays at the rate at which it arrives. See
+ * iptv.h for details. IPTV tuners support unicast addresses for testing,
+ * for example over loopback.
+ *
+ * |vtuner_get_status| returns the TV_FRONTEND_ flags and the signal
+ * strength. The tuner locks immediately if the file exists.
+ *
+ * |vtuner_read_section| returns the next section with the given PID and
+ * table ID. It waits for the data to arrive at the playback rate and
+ * fails after |timeout| milliseconds.
+ *
+ * |vtuner_open_stream| starts a thread that writes the transport stream
+ * to a pipe. The returned native handle contains the pipe's reading end.
+ * If the reader falls behind, data is dropped as on a real tuner. The
+ * stream follows the tuner's frequency. |vtuner_close_stream| stops the
+ * thread and releases the handle.
+ *
+ * Virtual tuners also hold a channel list. |vtuner_add_channel| stores a
+ * channel with the frequency that it has been found on, which can be
+ * another tuner's. |vtuner_set_channel| tunes to a channel's frequency
+ * and returns a copy of the channel.
+ * |vtuner_get_channels| copies up to |num| channels to |ch|. The caller
+ * releases the channels with |clear_channel|.
+ *
+ * All functions are thread-safe. Unless noted otherwise, they return 0
+ * on success and -1 on errors.
+ */
+
+#pragma once
+
+#include <cutils/native_handle.h>
+#include <stdint.h>
+#include "tv_utils.h"
+
+struct vtuner;
+
+struct vtuner*
+create_vtuner(const char* dir);
+
+struct vtuner*
+create_iptv_vtuner(const char* ifaddr);
+
+void
+destroy_vtuner(struct vtuner* vt);
+
+int
+vtuner_tune(struct vtuner* vt, const struct tv_frequency* freq);
+
+void
+vtuner_get_status(struct vtuner* vt, uint8_t* status, uint16_t* strength);
+
+int
+vtuner_read_section(struct vtuner* vt, uint16_t pid, uint8_t table_id,
+                    uint32_t timeout, uint8_t* buf, uint32_t* len);
+
+int
+vtuner_open_stream(struct vtuner* vt, native_handle_t** handle);
+
+void
+vtuner_close_stream(struct vtuner* vt);
+
+int
+vtuner_add_channel(struct vtuner* vt, const struct tv_frequency* freq,
+                   const struct tv_channel* ch);
+
+int
+vtuner_set_channel(struct vtuner* vt, const char* number,
+                   struct tv_channel* ch);
+
+uint32_t
+vtuner_get_channel_num(struct vtuner* vt);
+
+uint32_t
+vtuner_get_channels(struct vtuner* vt, uint32_t num, struct tv_channel* ch);
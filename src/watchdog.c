@@ -0,0 +1,422 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements the watchdog of the I/O thread. See the
+ * corresponding header file for documentation.
+ */
+
+#include "watchdog.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <unwind.h>
+
+#include "log.h"
+
+/* signal for taking backtraces on the I/O thread */
+#define BACKTRACE_SIGNAL (SIGRTMIN + 1)
+
+enum {
+  SAMPLES_PER_THRESHOLD = 4,
+  MIN_INTERVAL = 10, /* ms */
+  MAX_FRAMES = 32,
+  BACKTRACE_TIMEOUT = 100, /* ms */
+  NS_PER_MS = 1000000,
+  NS_PER_SEC = 1000000000
+};
+
+static const char* const g_cause_name[NUM_WATCHDOG_CAUSES] = {
+  [WATCHDOG_COMMAND] = "command",
+  [WATCHDOG_NOTIFICATION] = "notification",
+  [WATCHDOG_SEND] = "send",
+  [WATCHDOG_TASK] = "task"
+};
+
+static uint64_t
+monotonic_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / NS_PER_MS;
+}
+
+/*
+ * Heartbeat
+ *
+ * |g_beat| is odd while the I/O thread runs a handler and even while
+ * it's idle. The I/O thread is the only writer. It stores the handler's
+ * cause and argument before it publishes the new heartbeat with release
+ * semantics. The watchdog reads the heartbeat before and after the cause
+ * and argument; if it changed, the sample is discarded.
+ */
+
+static uint32_t g_beat;
+static uint8_t g_cause;
+static uint32_t g_arg;
+
+void
+watchdog_enter(uint8_t cause, uint32_t arg)
+{
+  uint32_t beat = __atomic_load_n(&g_beat, __ATOMIC_RELAXED);
+
+  __atomic_store_n(&g_cause, cause, __ATOMIC_RELAXED);
+  __atomic_store_n(&g_arg, arg, __ATOMIC_RELAXED);
+  __atomic_store_n(&g_beat, (beat | 1) + 2, __ATOMIC_RELEASE);
+}
+
+void
+watchdog_leave()
+{
+  uint32_t beat = __atomic_load_n(&g_beat, __ATOMIC_RELAXED);
+
+  __atomic_store_n(&g_beat, (beat | 1) + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Counters
+ *
+ * The watchdog thread writes the counters, the I/O thread reads and
+ * resets them.
+ */
+
+static uint64_t g_stalls[NUM_WATCHDOG_CAUSES];
+static uint64_t g_longest[NUM_WATCHDOG_CAUSES]; /* ms */
+
+static void
+update_longest(uint8_t cause, uint64_t duration)
+{
+  uint64_t cur = __atomic_load_n(g_longest + cause, __ATOMIC_RELAXED);
+
+  while (duration > cur &&
+         !__atomic_compare_exchange_n(g_longest + cause, &cur, duration, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    /* |cur| has been reloaded; try again */
+  }
+}
+
+int
+watchdog_get_stalls(uint8_t cause, int reset, uint64_t* stalls,
+                    uint64_t* longest)
+{
+  if (cause >= NUM_WATCHDOG_CAUSES) {
+    return -1;
+  }
+
+  if (reset) {
+    *stalls = __atomic_exchange_n(g_stalls + cause, 0, __ATOMIC_RELAXED);
+    *longest = __atomic_exchange_n(g_longest + cause, 0, __ATOMIC_RELAXED);
+  } else {
+    *stalls = __atomic_load_n(g_stalls + cause, __ATOMIC_RELAXED);
+    *longest = __atomic_load_n(g_longest + cause, __ATOMIC_RELAXED);
+  }
+
+  return 0;
+}
+
+/*
+ * Backtraces
+ *
+ * The watchdog sends |BACKTRACE_SIGNAL| to the I/O thread, whose signal
+ * handler unwinds its own stack into |g_frame|. The watchdog waits for
+ * the handler and logs the frames. A thread that is blocked in a system
+ * call runs the handler as well; with SA_RESTART, the call continues
+ * afterwards.
+ */
+
+static pid_t g_io_tid;
+static uintptr_t g_frame[MAX_FRAMES];
+static unsigned int g_num_frames;
+static int g_backtrace_done;
+
+struct unwind_state {
+  unsigned int num_frames;
+};
+
+static _Unwind_Reason_Code
+unwind_frame(struct _Unwind_Context* context, void* arg)
+{
+  struct unwind_state* state = arg;
+  uintptr_t pc = _Unwind_GetIP(context);
+
+  if (pc) {
+    g_frame[state->num_frames++] = pc;
+  }
+  return state->num_frames < MAX_FRAMES ? _URC_NO_REASON
+                                        : _URC_END_OF_STACK;
+}
+
+static void
+handle_backtrace_signal(int signum)
+{
+  struct unwind_state state = { 0 };
+  int saved_errno = errno;
+
+  _Unwind_Backtrace(unwind_frame, &state);
+
+  g_num_frames = state.num_frames;
+  __atomic_store_n(&g_backtrace_done, 1, __ATOMIC_RELEASE);
+
+  errno = saved_errno;
+}
+
+static int
+init_backtrace_signal(void)
+{
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_backtrace_signal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+
+  if (sigaction(BACKTRACE_SIGNAL, &sa, NULL) < 0) {
+    ALOGE_ERRNO("sigaction");
+    return -1;
+  }
+  return 0;
+}
+
+static void
+log_backtrace(void)
+{
+  struct timespec ts = {
+    .tv_sec = 0,
+    .tv_nsec = MIN_INTERVAL * NS_PER_MS
+  };
+  unsigned int i, waited;
+  Dl_info info;
+
+  __atomic_store_n(&g_backtrace_done, 0, __ATOMIC_RELAXED);
+
+  if (syscall(SYS_tgkill, getpid(), g_io_tid, BACKTRACE_SIGNAL) < 0) {
+    ALOGW_ERRNO("tgkill");
+    return;
+  }
+
+  for (waited = 0; !__atomic_load_n(&g_backtrace_done, __ATOMIC_ACQUIRE);
+       waited += MIN_INTERVAL) {
+    if (waited >= BACKTRACE_TIMEOUT) {
+      ALOGW("I/O thread didn't handle the backtrace signal");
+      return;
+    }
+    nanosleep(&ts, NULL);
+  }
+
+  for (i = 0; i < g_num_frames; ++i) {
+    if (dladdr((void*)g_frame[i], &info) && info.dli_sname) {
+      ALOGW("  #%02u pc %p %s (%s+%#lx)", i, (void*)g_frame[i],
+            info.dli_fname, info.dli_sname,
+            (unsigned long)(g_frame[i] - (uintptr_t)info.dli_saddr));
+    } else if (dladdr((void*)g_frame[i], &info)) {
+      ALOGW("  #%02u pc %p %s", i, (void*)g_frame[i], info.dli_fname);
+    } else {
+      ALOGW("  #%02u pc %p", i, (void*)g_frame[i]);
+    }
+  }
+}
+
+/*
+ * Watchdog thread
+ */
+
+static uint32_t g_threshold; /* ms */
+static int g_backtrace;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond;
+static pthread_t g_thread;
+static int g_running;
+static int g_quit;
+
+static void
+log_stall(uint8_t cause, uint32_t arg, uint64_t duration)
+{
+  switch (cause) {
+    case WATCHDOG_COMMAND:
+    case WATCHDOG_NOTIFICATION:
+      ALOGW("I/O thread stalled for %llu ms in %s 0x%02x:0x%02x",
+            (unsigned long long)duration, g_cause_name[cause],
+            arg >> 8, arg & 0xff);
+      break;
+    default:
+      ALOGW("I/O thread stalled for %llu ms in %s",
+            (unsigned long long)duration, g_cause_name[cause]);
+      break;
+  }
+}
+
+static void*
+watchdog_thread(void* arg)
+{
+  uint32_t beat, last_beat, handler_arg;
+  uint64_t interval, now, seen, duration;
+  struct timespec ts;
+  uint8_t cause, stall_cause;
+  int stalled;
+
+  interval = g_threshold / SAMPLES_PER_THRESHOLD;
+  if (interval < MIN_INTERVAL) {
+    interval = MIN_INTERVAL;
+  }
+
+  last_beat = 0;
+  seen = monotonic_ms();
+  stalled = 0;
+  stall_cause = 0;
+
+  pthread_mutex_lock(&g_lock);
+
+  while (!g_quit) {
+    now = monotonic_ms() + interval;
+    ts.tv_sec = now / 1000;
+    ts.tv_nsec = (now % 1000) * NS_PER_MS;
+
+    while (!g_quit &&
+           pthread_cond_timedwait(&g_cond, &g_lock, &ts) != ETIMEDOUT) {
+      /* wait for the next sample */
+    }
+
+    beat = __atomic_load_n(&g_beat, __ATOMIC_ACQUIRE);
+    cause = __atomic_load_n(&g_cause, __ATOMIC_RELAXED);
+    handler_arg = __atomic_load_n(&g_arg, __ATOMIC_RELAXED);
+    if (beat != __atomic_load_n(&g_beat, __ATOMIC_ACQUIRE)) {
+      continue; /* the I/O thread is making progress */
+    }
+
+    now = monotonic_ms();
+
+    if (beat != last_beat) {
+      if (stalled) {
+        ALOGW("I/O thread recovered after %llu ms",
+              (unsigned long long)(now - seen));
+        update_longest(stall_cause, now - seen);
+      }
+      last_beat = beat;
+      seen = now;
+      stalled = 0;
+      continue;
+    } else if (!(beat & 1) || cause >= NUM_WATCHDOG_CAUSES) {
+      continue; /* idle */
+    }
+
+    duration = now - seen;
+    if (duration < g_threshold) {
+      continue;
+    }
+
+    if (!stalled) {
+      stalled = 1;
+      stall_cause = cause;
+      __atomic_fetch_add(g_stalls + cause, 1, __ATOMIC_RELAXED);
+      log_stall(cause, handler_arg, duration);
+      if (g_backtrace) {
+        pthread_mutex_unlock(&g_lock);
+        log_backtrace();
+        pthread_mutex_lock(&g_lock);
+      }
+    }
+    update_longest(cause, duration);
+  }
+
+  pthread_mutex_unlock(&g_lock);
+
+  return NULL;
+}
+
+/*
+ * Public interface
+ */
+
+int
+init_watchdog(uint32_t threshold, int backtrace)
+{
+  pthread_condattr_t attr;
+  int err;
+
+  if (!threshold) {
+    return 0; /* watchdog disabled */
+  }
+
+  g_threshold = threshold;
+  g_backtrace = backtrace;
+  g_io_tid = gettid();
+
+  if (g_backtrace && init_backtrace_signal() < 0) {
+    return -1;
+  }
+
+  err = pthread_condattr_init(&attr);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_condattr_init", err);
+    return -1;
+  }
+  err = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_condattr_setclock", err);
+    goto err_pthread_condattr_setclock;
+  }
+  err = pthread_cond_init(&g_cond, &attr);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_cond_init", err);
+    goto err_pthread_cond_init;
+  }
+  pthread_condattr_destroy(&attr);
+
+  g_quit = 0;
+
+  err = pthread_create(&g_thread, NULL, watchdog_thread, NULL);
+  if (err) {
+    ALOGE_ERRNO_NUM("pthread_create", err);
+    goto err_pthread_create;
+  }
+  g_running = 1;
+
+  return 0;
+
+err_pthread_create:
+  pthread_cond_destroy(&g_cond);
+  return -1;
+err_pthread_cond_init:
+err_pthread_condattr_setclock:
+  pthread_condattr_destroy(&attr);
+  return -1;
+}
+
+void
+uninit_watchdog()
+{
+  if (!g_running) {
+    return;
+  }
+
+  pthread_mutex_lock(&g_lock);
+  g_quit = 1;
+  pthread_cond_broadcast(&g_cond);
+  pthread_mutex_unlock(&g_lock);
+
+  pthread_join(g_thread, NULL);
+  g_running = 0;
+
+  pthread_cond_destroy(&g_cond);
+}
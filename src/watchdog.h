@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * This file contains the interface to the watchdog of the I/O thread.
+ *
+ * Everything that the I/O thread does runs in callbacks of the epoll
+ * loop. If a callback blocks, for example in a driver call, the daemon
+ * stops responding to its client. The watchdog notices such stalls.
+ *
+ * The I/O thread calls |watchdog_enter| before it runs a handler and
+ * |watchdog_leave| afterwards. Both only increment a heartbeat counter
+ * and store the handler's cause and argument, without reading the clock
+ * or locking. The watchdog thread samples the heartbeat four times per
+ * threshold. If the heartbeat shows the same handler for longer than the
+ * threshold, the handler stalls the loop. The watchdog logs the stall
+ * once with its cause and argument, counts it, and keeps track of the
+ * longest stall per cause. If enabled, it also logs a backtrace of the
+ * I/O thread, taken by a signal handler on the stalled thread. The
+ * signal interrupts system calls that aren't restarted after signal
+ * handlers, such as sleeps and polls, so backtraces can change the
+ * behaviour of the blocked call.
+ *
+ * Stall durations are measured by the watchdog thread, so they are
+ * accurate to a quarter of the threshold.
+ *
+ * |init_watchdog| has to be called on the I/O thread. It starts the
+ * watchdog thread and returns 0 on success, or -1 on errors. A threshold
+ * of 0 disables the watchdog. |uninit_watchdog| stops the thread.
+ * |watchdog_get_stalls| copies the counters of a cause; with |reset| set,
+ * it clears them after reading. It returns 0 on success, or -1 if the
+ * cause is out of range.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+enum {
+  DEFAULT_WATCHDOG_THRESHOLD = 1000 /* ms */
+};
+
+enum {
+  WATCHDOG_COMMAND = 0x00, /* arg is service and opcode */
+  WATCHDOG_NOTIFICATION = 0x01, /* arg is service and opcode */
+  WATCHDOG_SEND = 0x02, /* arg is 0 */
+  WATCHDOG_TASK = 0x03, /* arg is 0 */
+  NUM_WATCHDOG_CAUSES
+};
+
+int
+init_watchdog(uint32_t threshold, int backtrace);
+
+void
+uninit_watchdog(void);
+
+void
+watchdog_enter(uint8_t cause, uint32_t arg);
+
+void
+watchdog_leave(void);
+
+int
+watchdog_get_stalls(uint8_t cause, int reset, uint64_t* stalls,
+                    uint64_t* longest);
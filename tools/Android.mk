@@ -0,0 +1,55 @@
+LOCAL_PATH:= $(call my-dir)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES:= tvload.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../src \
+                    system/libpdu/include
+LOCAL_CFLAGS := -Wall
+LOCAL_SHARED_LIBRARIES := libpdu
+LOCAL_MODULE:= tvload
+LOCAL_MODULE_PATH := $(TARGET_OUT_EXECUTABLES)
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES:= tspsi.c \
+                  ../src/crc32.c \
+                  ../src/dvb_psi.c \
+                  ../src/dvb_si.c \
+                  ../src/dvb_text.c \
+                  ../src/memptr.c \
+                  ../src/ts_demux.c \
+                  ../src/tv_utils.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../src
+LOCAL_CFLAGS := -DANDROID_VERSION=$(PLATFORM_SDK_VERSION) -Wall
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_MODULE:= tspsi
+LOCAL_MODULE_PATH := $(TARGET_OUT_EXECUTABLES)
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES:= tsbench.c \
+                  ../src/crc32.c \
+                  ../src/dvb_si.c \
+                  ../src/dvb_text.c \
+                  ../src/memptr.c \
+                  ../src/ts_demux.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../src
+LOCAL_CFLAGS := -DANDROID_VERSION=$(PLATFORM_SDK_VERSION) -Wall
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_MODULE:= tsbench
+LOCAL_MODULE_PATH := $(TARGET_OUT_EXECUTABLES)
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES:= iptvloop.c \
+                  ../src/iptv.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../src
+LOCAL_CFLAGS := -DANDROID_VERSION=$(PLATFORM_SDK_VERSION) -Wall
+LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_MODULE:= iptvloop
+LOCAL_MODULE_PATH := $(TARGET_OUT_EXECUTABLES)
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,867 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements iptvloop, a loopback test of tvd's IPTV receiver.
+ * A sender thread streams a transport stream in datagrams of seven TS
+ * packets, optionally with RTP headers, to a unicast address or a
+ * multicast group on the local host. The receiver is the one of tvd's
+ * IPTV tuners; the main thread reads from it like the stream thread of
+ * a tuner does.
+ *
+ * The sender paces the datagrams to a bit rate. It can add jitter by
+ * delaying each datagram by a random time, which causes bursts after
+ * the delay, and it can drop, duplicate or reorder datagrams on purpose.
+ * The reader can stall periodically to fill the ring, like a slow
+ * consumer.
+ *
+ * The reader compares each datagram with the one that was sent. A
+ * datagram that doesn't match is searched among the ones sent after it;
+ * the skipped datagrams count as lost. If it isn't found there, it is
+ * searched among the recent ones before it, as a duplicate or as a late
+ * datagram that was counted as lost already. The test passes if all
+ * datagrams that weren't dropped on purpose arrived intact and, with
+ * RTP, the receiver counted the same gaps. The receiver can't tell a
+ * late datagram from a lost one, so each late datagram adds a gap. With
+ * stalls, the kernel can drop datagrams when the ring and the socket
+ * buffer are full; then the test only checks that the receiver counted
+ * the loss correctly.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iptv.h"
+#include "ts_demux.h"
+
+enum {
+  PACKETS_PER_DATAGRAM = 7,
+  DATAGRAM_SIZE = PACKETS_PER_DATAGRAM * TS_PACKET_SIZE,
+  RTP_HEADER_LEN = 12,
+  RTP_PAYLOAD_MP2T = 33,
+  IDLE_TIMEOUT = 1000, /* ms without data after the sender finished */
+  LATE_WINDOW = 64 /* datagrams searched for duplicates and late ones */
+};
+
+static const uint64_t NS_PER_SEC = 1000000000ull;
+static const uint64_t NS_PER_MS = 1000000ull;
+
+static void
+print_errno(const char* func)
+{
+  fprintf(stderr, "Error: %s failed: %s\n", func, strerror(errno));
+}
+
+static uint64_t
+monotonic_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void
+sleep_until(uint64_t ns)
+{
+  struct timespec ts = {
+    .tv_sec = ns / NS_PER_SEC,
+    .tv_nsec = ns % NS_PER_SEC
+  };
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+         EINTR) {
+  }
+}
+
+/*
+ * Command-line options
+ */
+
+struct options {
+  const char* address;
+  const char* ifaddr;
+  unsigned long port;
+  int rtp;
+  unsigned long rate; /* kbit/s */
+  unsigned long jitter; /* ms */
+  unsigned long drop; /* every n-th datagram, 0 for none */
+  unsigned long duplicate; /* every n-th datagram, 0 for none */
+  unsigned long reorder; /* every n-th datagram, 0 for none */
+  unsigned long stall; /* ms per 100 ms of reading */
+  unsigned long synthetic; /* MiB */
+  unsigned long loops;
+  const char* file;
+};
+
+static int
+parse_ulong(const char* arg, const char* what, unsigned long min,
+            unsigned long max, unsigned long* value)
+{
+  char* end;
+
+  if (!arg) {
+    fprintf(stderr, "Error: No %s specified.\n", what);
+    return -1;
+  }
+
+  errno = 0;
+  *value = strtoul(arg, &end, 10);
+  if (errno || !*arg || *end || *value < min || *value > max) {
+    fprintf(stderr, "Error: The %s must be between %lu and %lu.\n",
+            what, min, max);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int
+parse_string(const char* arg, const char* what, const char** value)
+{
+  if (!arg) {
+    fprintf(stderr, "Error: No %s specified.\n", what);
+    return -1;
+  }
+
+  if (!strlen(arg)) {
+    fprintf(stderr, "Error: The specified %s is empty.\n", what);
+    return -1;
+  }
+
+  *value = arg;
+
+  return 0;
+}
+
+static int
+parse_opt_h(void)
+{
+  printf("Usage: iptvloop [OPTION] [FILE]\n"
+         "Streams a transport stream to tvd's IPTV receiver on the local\n"
+         "host and checks the received datagrams\n"
+         "\n"
+         "General options:\n"
+         "  -h    displays this help\n"
+         "\n"
+         "Network:\n"
+         "  -a    the unicast address or multicast group, defaults to\n"
+         "        127.0.0.1\n"
+         "  -m    the address of the interface for multicast, defaults\n"
+         "        to 127.0.0.1\n"
+         "  -p    the UDP port, defaults to 5004\n"
+         "  -r    sends RTP instead of plain UDP\n"
+         "\n"
+         "Stream:\n"
+         "  -g    generates a synthetic stream of the given size in MiB\n"
+         "        instead of reading a file\n"
+         "  -l    the number of times the stream is sent, defaults to 1\n"
+         "  -b    the bit rate in kbit/s, defaults to 20000; 0 sends as\n"
+         "        fast as possible\n"
+         "  -j    delays datagrams by a random time of up to the given\n"
+         "        number of ms\n"
+         "  -d    drops every n-th datagram\n"
+         "  -u    sends every n-th datagram twice\n"
+         "  -o    sends every n-th datagram after the one following it\n"
+         "  -s    the reader stalls for the given number of ms after\n"
+         "        each 100 ms of reading\n");
+
+  return 1;
+}
+
+static int
+parse_opt(int c, char* arg, struct options* opt)
+{
+  switch (c) {
+    case 'a':
+      return parse_string(arg, "address", &opt->address);
+    case 'b':
+      return parse_ulong(arg, "bit rate", 0, 10000000, &opt->rate);
+    case 'd':
+      return parse_ulong(arg, "drop interval", 2, 1000000, &opt->drop);
+    case 'g':
+      return parse_ulong(arg, "stream size", 1, 4096, &opt->synthetic);
+    case 'h':
+      return parse_opt_h();
+    case 'j':
+      return parse_ulong(arg, "jitter", 0, 10000, &opt->jitter);
+    case 'l':
+      return parse_ulong(arg, "number of loops", 1, 1000000, &opt->loops);
+    case 'm':
+      return parse_string(arg, "interface address", &opt->ifaddr);
+    case 'o':
+      return parse_ulong(arg, "reorder interval", 2, 1000000,
+                         &opt->reorder);
+    case 'p':
+      return parse_ulong(arg, "port", 1, 65535, &opt->port);
+    case 'r':
+      opt->rtp = 1;
+      return 0;
+    case 's':
+      return parse_ulong(arg, "stall", 0, 10000, &opt->stall);
+    case 'u':
+      return parse_ulong(arg, "duplicate interval", 2, 1000000,
+                         &opt->duplicate);
+  }
+
+  fprintf(stderr, "Unknown option %c\n", optopt);
+
+  return -1;
+}
+
+static int
+parse_opts(int argc, char* argv[], struct options* opt)
+{
+  int res;
+
+  opterr = 0; /* no default error messages from getopt */
+
+  res = 0;
+
+  do {
+    int c = getopt(argc, argv, "a:b:d:g:hj:l:m:o:p:rs:u:");
+    if (c < 0) {
+      break; /* end of options */
+    }
+    res = parse_opt(c, optarg, opt);
+  } while (!res);
+
+  if (res) {
+    return res;
+  }
+
+  if (optind < argc) {
+    opt->file = argv[optind++];
+  }
+  if (optind < argc) {
+    fprintf(stderr, "Error: Only one file can be sent.\n");
+    return -1;
+  }
+  if (!opt->synthetic == !opt->file) {
+    fprintf(stderr, "Error: Specify either a file or '-g'.\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Stream
+ *
+ * The stream is cut into datagrams of seven packets; a remainder of
+ * fewer packets is not sent. The synthetic stream numbers its packets,
+ * so that each datagram is unique.
+ */
+
+struct stream {
+  uint8_t* buf;
+  size_t num_datagrams;
+};
+
+static int
+read_stream(struct stream* stream, const char* path)
+{
+  struct stat st;
+  size_t off, len;
+  ssize_t res;
+  int fd;
+
+  fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY));
+  if (fd < 0) {
+    print_errno("open");
+    return -1;
+  }
+  if (fstat(fd, &st) < 0) {
+    print_errno("fstat");
+    goto err_fstat;
+  }
+
+  len = st.st_size - st.st_size % DATAGRAM_SIZE;
+  if (!len) {
+    fprintf(stderr, "Error: %s has less than %d bytes.\n", path,
+            DATAGRAM_SIZE);
+    goto err_len;
+  }
+
+  stream->buf = malloc(len);
+  if (!stream->buf) {
+    print_errno("malloc");
+    goto err_malloc;
+  }
+
+  for (off = 0; off < len; off += res) {
+    res = TEMP_FAILURE_RETRY(read(fd, stream->buf + off, len - off));
+    if (res < 0) {
+      print_errno("read");
+      goto err_read;
+    } else if (!res) {
+      fprintf(stderr, "Error: %s shrank while reading.\n", path);
+      goto err_read;
+    }
+  }
+  stream->num_datagrams = len / DATAGRAM_SIZE;
+
+  close(fd);
+
+  return 0;
+
+err_read:
+  free(stream->buf);
+err_malloc:
+err_len:
+err_fstat:
+  close(fd);
+  return -1;
+}
+
+static int
+generate_stream(struct stream* stream, unsigned long mib)
+{
+  size_t num, i;
+  uint8_t* packet;
+
+  num = mib * 1024 * 1024 / DATAGRAM_SIZE * PACKETS_PER_DATAGRAM;
+
+  stream->buf = malloc(num * TS_PACKET_SIZE);
+  if (!stream->buf) {
+    print_errno("malloc");
+    return -1;
+  }
+  stream->num_datagrams = num / PACKETS_PER_DATAGRAM;
+
+  for (i = 0; i < num; ++i) {
+    packet = stream->buf + i * TS_PACKET_SIZE;
+    packet[0] = TS_SYNC_BYTE;
+    packet[1] = 0x01; /* PID 0x100 */
+    packet[2] = 0x00;
+    packet[3] = 0x10 | (i & 0x0f);
+    memset(packet + 4, 0xff, TS_PACKET_SIZE - 4);
+    memcpy(packet + 4, &i, sizeof(i));
+  }
+
+  return 0;
+}
+
+static const uint8_t*
+datagram(const struct stream* stream, uint64_t i)
+{
+  return stream->buf + (i % stream->num_datagrams) * DATAGRAM_SIZE;
+}
+
+static int
+is_dropped(const struct options* opt, uint64_t i)
+{
+  return opt->drop && (i + 1) % opt->drop == 0;
+}
+
+static int
+is_duplicated(const struct options* opt, uint64_t i)
+{
+  return opt->duplicate && (i + 1) % opt->duplicate == 0;
+}
+
+/* Returns the datagram that is sent |i|-th. Every n-th datagram is
+ * swapped with the one after it. */
+static uint64_t
+send_order(const struct options* opt, uint64_t num, uint64_t i)
+{
+  if (opt->reorder && (i + 1) % opt->reorder == 0 && i + 1 < num) {
+    return i + 1;
+  } else if (opt->reorder && i % opt->reorder == 0 && i) {
+    return i - 1;
+  }
+  return i;
+}
+
+/*
+ * Sender
+ */
+
+struct sender {
+  pthread_t thread;
+  const struct options* opt;
+  const struct stream* stream;
+  struct sockaddr_in addr;
+  int fd;
+  uint64_t num; /* datagrams to send, including dropped ones */
+  uint64_t* sent_time; /* ns of each datagram, 0 if not sent yet */
+  uint64_t num_sent; /* datagrams up to the last one with a send time */
+  uint64_t dropped;
+  uint64_t duplicated;
+  uint64_t reordered;
+  int done;
+  int failed;
+};
+
+static int
+open_sender_socket(const struct options* opt, struct sockaddr_in* addr)
+{
+  static const int ONE = 1;
+
+  struct in_addr ifaddr;
+  int fd;
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_port = htons(opt->port);
+  if (inet_pton(AF_INET, opt->address, &addr->sin_addr) != 1) {
+    fprintf(stderr, "Error: Invalid address %s.\n", opt->address);
+    return -1;
+  }
+  if (inet_pton(AF_INET, opt->ifaddr, &ifaddr) != 1) {
+    fprintf(stderr, "Error: Invalid interface address %s.\n", opt->ifaddr);
+    return -1;
+  }
+
+  fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    print_errno("socket");
+    return -1;
+  }
+
+  if (IN_MULTICAST(ntohl(addr->sin_addr.s_addr))) {
+    if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &ifaddr,
+                   sizeof(ifaddr)) < 0) {
+      print_errno("setsockopt(IP_MULTICAST_IF)");
+      goto err_setsockopt;
+    }
+    if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &ONE,
+                   sizeof(ONE)) < 0) {
+      print_errno("setsockopt(IP_MULTICAST_LOOP)");
+      goto err_setsockopt;
+    }
+  }
+
+  return fd;
+
+err_setsockopt:
+  close(fd);
+  return -1;
+}
+
+static int
+send_datagram(struct sender* sender, uint64_t i)
+{
+  uint8_t header[RTP_HEADER_LEN];
+  struct iovec iov[2];
+  struct msghdr msg;
+  uint32_t timestamp;
+  ssize_t res;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = &sender->addr;
+  msg.msg_namelen = sizeof(sender->addr);
+  msg.msg_iov = iov;
+
+  if (sender->opt->rtp) {
+    timestamp = sender->sent_time[i] * 9 / 100000; /* 90 kHz */
+    header[0] = 0x80; /* version 2 */
+    header[1] = RTP_PAYLOAD_MP2T;
+    header[2] = i >> 8; /* sequence number */
+    header[3] = i;
+    header[4] = timestamp >> 24;
+    header[5] = timestamp >> 16;
+    header[6] = timestamp >> 8;
+    header[7] = timestamp;
+    memcpy(header + 8, "tvd\0", 4); /* SSRC */
+    iov[msg.msg_iovlen].iov_base = header;
+    iov[msg.msg_iovlen].iov_len = sizeof(header);
+    ++msg.msg_iovlen;
+  }
+  iov[msg.msg_iovlen].iov_base = (void*)datagram(sender->stream, i);
+  iov[msg.msg_iovlen].iov_len = DATAGRAM_SIZE;
+  ++msg.msg_iovlen;
+
+  res = TEMP_FAILURE_RETRY(sendmsg(sender->fd, &msg, 0));
+  if (res < 0) {
+    print_errno("sendmsg");
+    return -1;
+  }
+  return 0;
+}
+
+static void*
+send_thread(void* arg)
+{
+  struct sender* sender = arg;
+  const struct options* opt = sender->opt;
+  uint64_t start, due, interval, delay, i, j;
+
+  /* ns per datagram at the bit rate, including RTP */
+  interval = opt->rate ? (DATAGRAM_SIZE + (opt->rtp ? RTP_HEADER_LEN : 0)) *
+                         8 * NS_PER_SEC / (opt->rate * 1000) : 0;
+  start = monotonic_ns();
+  delay = 0;
+
+  for (i = 0; i < sender->num; ++i) {
+    due = start + i * interval;
+    if (opt->jitter && due >= delay) {
+      /* The delay holds back the following datagrams as well, which
+       * then go out in a burst. */
+      delay = due + lrand48() % (opt->jitter * NS_PER_MS + 1);
+    }
+    sleep_until(due > delay ? due : delay);
+
+    j = send_order(opt, sender->num, i);
+    __atomic_store_n(sender->sent_time + j, monotonic_ns(),
+                     __ATOMIC_RELAXED);
+    /* before sending, as the reader can receive the datagram before
+     * sendmsg() returns */
+    __atomic_store_n(&sender->num_sent, (i > j ? i : j) + 1,
+                     __ATOMIC_RELEASE);
+    if (is_dropped(opt, j)) {
+      ++sender->dropped;
+      continue;
+    }
+    if (j > i) {
+      ++sender->reordered;
+    }
+    if (send_datagram(sender, j) < 0) {
+      sender->failed = 1;
+      break;
+    }
+    if (is_duplicated(opt, j)) {
+      ++sender->duplicated;
+      if (send_datagram(sender, j) < 0) {
+        sender->failed = 1;
+        break;
+      }
+    }
+  }
+
+  __atomic_store_n(&sender->done, 1, __ATOMIC_RELEASE);
+
+  return NULL;
+}
+
+/*
+ * Reader
+ */
+
+struct result {
+  uint8_t* seen; /* per datagram, 1 if received */
+  uint64_t received;
+  uint64_t lost; /* not dropped on purpose, but missing */
+  uint64_t late; /* received after a later datagram */
+  uint64_t duplicates;
+  uint64_t gaps; /* missing before the last received datagram */
+  uint64_t corrupt;
+  uint64_t latency_sum; /* ns */
+  uint64_t latency_max;
+  uint64_t elapsed;
+};
+
+/* Returns the index of the first expected datagram that matches the
+ * received one, starting at |next|, or |end| if there's none. */
+static uint64_t
+find_datagram(const struct sender* sender, uint64_t next, uint64_t end,
+              const uint8_t* buf, size_t len)
+{
+  uint64_t i;
+
+  if (len != DATAGRAM_SIZE) {
+    return end;
+  }
+  for (i = next; i < end; ++i) {
+    if (is_dropped(sender->opt, i)) {
+      continue;
+    }
+    if (!memcmp(datagram(sender->stream, i), buf, DATAGRAM_SIZE)) {
+      return i;
+    }
+  }
+  return end;
+}
+
+static void
+check_datagram(const struct sender* sender, uint64_t* next,
+               const uint8_t* buf, size_t len, uint64_t now,
+               struct result* result)
+{
+  uint64_t end, first, i, sent, latency;
+
+  end = __atomic_load_n(&sender->num_sent, __ATOMIC_ACQUIRE);
+  i = find_datagram(sender, *next, end, buf, len);
+  if (i < end) {
+    for (; *next < i; ++*next) {
+      if (!is_dropped(sender->opt, *next)) {
+        ++result->lost;
+      }
+    }
+    *next = i + 1;
+  } else {
+    /* an earlier datagram, sent again or overtaken by a later one */
+    first = *next > LATE_WINDOW ? *next - LATE_WINDOW : 0;
+    i = find_datagram(sender, first, *next, buf, len);
+    if (i == *next) {
+      ++result->corrupt;
+      return;
+    } else if (result->seen[i]) {
+      ++result->duplicates;
+      return;
+    }
+    --result->lost; /* counted when the later datagram arrived */
+    ++result->late;
+  }
+
+  result->seen[i] = 1;
+  ++result->received;
+  sent = __atomic_load_n(sender->sent_time + i, __ATOMIC_RELAXED);
+  latency = now > sent ? now - sent : 0;
+  result->latency_sum += latency;
+  if (latency > result->latency_max) {
+    result->latency_max = latency;
+  }
+}
+
+static void
+read_datagrams(struct iptv_receiver* recv, const struct sender* sender,
+               struct result* result)
+{
+  struct iptv_reader reader;
+  uint64_t start, now, last_data, last_stall, next;
+  const uint8_t* buf;
+  uint32_t num, i;
+  size_t len;
+
+  iptv_receiver_add_reader(recv, &reader);
+
+  start = last_data = last_stall = monotonic_ns();
+  next = 0;
+
+  for (;;) {
+    num = iptv_receiver_wait(recv, &reader, monotonic_ns() + 100 * NS_PER_MS);
+    now = monotonic_ns();
+    for (i = 0; i < num; ++i) {
+      buf = iptv_receiver_get(recv, &reader, i, &len);
+      check_datagram(sender, &next, buf, len, now, result);
+    }
+    iptv_receiver_release(recv, &reader, num);
+
+    if (num) {
+      last_data = now;
+    } else if (__atomic_load_n(&sender->done, __ATOMIC_ACQUIRE) &&
+               now - last_data >= IDLE_TIMEOUT * NS_PER_MS) {
+      break;
+    }
+    if (sender->opt->stall && now - last_stall >= 100 * NS_PER_MS) {
+      usleep(sender->opt->stall * 1000);
+      last_stall = monotonic_ns();
+    }
+  }
+
+  /* RTP reveals gaps only up to the last received datagram. */
+  result->gaps = next - result->received;
+
+  /* datagrams after the last received one */
+  for (; next < sender->num; ++next) {
+    if (!is_dropped(sender->opt, next)) {
+      ++result->lost;
+    }
+  }
+
+  result->elapsed = last_data - start;
+
+  iptv_receiver_remove_reader(recv, &reader);
+}
+
+/*
+ * Test
+ */
+
+static int
+print_result(const struct options* opt, const struct sender* sender,
+             const struct result* result, const struct iptv_stats* stats)
+{
+  uint64_t expected;
+  int ok;
+
+  expected = sender->num - sender->dropped;
+
+  printf("Sent:     %llu datagrams, %llu dropped, %llu duplicated, "
+         "%llu reordered on purpose\n",
+         (unsigned long long)sender->num,
+         (unsigned long long)sender->dropped,
+         (unsigned long long)sender->duplicated,
+         (unsigned long long)sender->reordered);
+  printf("Received: %llu datagrams, %llu lost, %llu late, %llu duplicate, "
+         "%llu corrupt\n",
+         (unsigned long long)result->received,
+         (unsigned long long)result->lost,
+         (unsigned long long)result->late,
+         (unsigned long long)result->duplicates,
+         (unsigned long long)result->corrupt);
+  printf("Receiver: %llu datagrams, %llu bytes, %llu lost, %llu invalid, "
+         "%llu times ring full\n",
+         (unsigned long long)stats->datagrams,
+         (unsigned long long)stats->bytes,
+         (unsigned long long)stats->lost,
+         (unsigned long long)stats->invalid,
+         (unsigned long long)stats->ring_full);
+  if (result->received) {
+    printf("Latency:  %.3f ms mean, %.3f ms max\n",
+           (double)result->latency_sum / result->received / NS_PER_MS,
+           (double)result->latency_max / NS_PER_MS);
+  }
+  if (result->elapsed) {
+    printf("Rate:     %.1f Mbit/s\n",
+           result->received * DATAGRAM_SIZE * 8.0 * 1000 /
+           result->elapsed);
+  }
+
+  ok = result->received + result->lost == expected && !result->corrupt;
+  if (result->lost && !opt->stall) {
+    ok = 0; /* nothing should be lost on the loopback interface */
+  }
+  if (stats->lost != (opt->rtp ? result->gaps + result->late : 0)) {
+    ok = 0; /* the receiver miscounted the gaps */
+  }
+
+  printf("%s\n", ok ? "PASS" : "FAIL");
+
+  return ok ? 0 : -1;
+}
+
+static int
+run(const struct options* opt, const struct stream* stream)
+{
+  struct iptv_receiver* recv;
+  struct iptv_stats stats;
+  struct sender sender;
+  struct result result;
+  struct in_addr group;
+  int err, res;
+
+  memset(&sender, 0, sizeof(sender));
+  memset(&result, 0, sizeof(result));
+
+  sender.opt = opt;
+  sender.stream = stream;
+  sender.num = stream->num_datagrams * opt->loops;
+
+  sender.sent_time = calloc(sender.num, sizeof(*sender.sent_time));
+  if (!sender.sent_time) {
+    print_errno("calloc");
+    return -1;
+  }
+  result.seen = calloc(sender.num, sizeof(*result.seen));
+  if (!result.seen) {
+    print_errno("calloc");
+    goto err_calloc;
+  }
+
+  sender.fd = open_sender_socket(opt, &sender.addr);
+  if (sender.fd < 0) {
+    goto err_open_sender_socket;
+  }
+
+  recv = create_iptv_receiver(opt->ifaddr);
+  if (!recv) {
+    fprintf(stderr, "Error: Couldn't create IPTV receiver.\n");
+    goto err_create_iptv_receiver;
+  }
+
+  group = sender.addr.sin_addr;
+  if (iptv_receiver_join(recv, ntohl(group.s_addr), opt->port) < 0) {
+    fprintf(stderr, "Error: Couldn't join %s:%lu.\n", opt->address,
+            opt->port);
+    goto err_iptv_receiver_join;
+  }
+
+  err = pthread_create(&sender.thread, NULL, send_thread, &sender);
+  if (err) {
+    errno = err;
+    print_errno("pthread_create");
+    goto err_pthread_create;
+  }
+
+  read_datagrams(recv, &sender, &result);
+
+  pthread_join(sender.thread, NULL);
+
+  iptv_receiver_get_stats(recv, &stats);
+
+  res = sender.failed ? -1 : print_result(opt, &sender, &result, &stats);
+
+  destroy_iptv_receiver(recv);
+  close(sender.fd);
+  free(result.seen);
+  free(sender.sent_time);
+
+  return res;
+
+err_pthread_create:
+err_iptv_receiver_join:
+  destroy_iptv_receiver(recv);
+err_create_iptv_receiver:
+  close(sender.fd);
+err_open_sender_socket:
+  free(result.seen);
+err_calloc:
+  free(sender.sent_time);
+  return -1;
+}
+
+int
+main(int argc, char* argv[])
+{
+  struct options options = {
+    .address = "127.0.0.1",
+    .ifaddr = "127.0.0.1",
+    .port = 5004,
+    .rate = 20000,
+    .loops = 1
+  };
+  struct stream stream;
+  int res;
+
+  res = parse_opts(argc, argv, &options);
+  if (res > 0) {
+    return EXIT_SUCCESS;
+  } else if (res < 0) {
+    return EXIT_FAILURE;
+  }
+
+  srand48(1); /* reproducible jitter */
+
+  memset(&stream, 0, sizeof(stream));
+
+  if (options.synthetic) {
+    res = generate_stream(&stream, options.synthetic);
+  } else {
+    res = read_stream(&stream, options.file);
+  }
+  if (res < 0) {
+    return EXIT_FAILURE;
+  }
+
+  res = run(&options, &stream);
+
+  free(stream.buf);
+
+  return res < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
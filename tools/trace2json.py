@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2015-2016  Mozilla Foundation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Converts a trace dump of tvd to the JSON format of Chrome's trace viewer.
+
+Usage: trace2json.py <dump> [<output>]
+
+The dump is written by tvd on SIGUSR1 or on the Stats service's 'Dump
+trace' command; see src/trace.h for the format. Load the output in
+chrome://tracing or https://ui.perfetto.dev. Run the script on a host
+with the same byte order as the device.
+"""
+
+import json
+import struct
+import sys
+
+MAGIC = b"TVDTRACE"
+VERSION = 1
+
+TYPE_SPAN = 0x00
+TYPE_ASYNC_SPAN = 0x01
+TYPE_FLOW_START = 0x02
+TYPE_FLOW_END = 0x03
+
+# Events with the service and opcode of a PDU as argument.
+PDU_EVENTS = ("dispatch", "send")
+
+HEADER = struct.Struct("=8sII")
+RING = struct.Struct("=III")
+EVENT = struct.Struct("=QQIHH")
+
+
+def read_events(data):
+    magic, version, num = HEADER.unpack_from(data, 0)
+    if magic != MAGIC:
+        raise ValueError("not a tvd trace")
+    if version != VERSION:
+        raise ValueError("unsupported version %d" % version)
+    pos = HEADER.size
+
+    events = []
+    for _ in range(num):
+        type, length = data[pos], data[pos + 1]
+        events.append((type, data[pos + 2:pos + 2 + length].decode()))
+        pos += 2 + length
+
+    rings = []
+    while pos < len(data):
+        tid, num_events, num_invalid = RING.unpack_from(data, pos)
+        pos += RING.size
+        records = [EVENT.unpack_from(data, pos + i * EVENT.size)
+                   for i in range(num_invalid, num_events)]
+        pos += num_events * EVENT.size
+        rings.append((tid, records))
+
+    return events, rings
+
+
+def name_of(name, arg):
+    if name in PDU_EVENTS:
+        return "%s 0x%02x:0x%02x" % (name, arg >> 8, arg & 0xff)
+    return "%s %d" % (name, arg)
+
+
+def convert(events, rings):
+    out = []
+    async_id = 0
+
+    for tid, records in rings:
+        for time, duration, arg, event, _ in records:
+            if event >= len(events):
+                continue
+            type, name = events[event]
+            common = {"pid": 1, "tid": tid, "cat": "tvd",
+                      "ts": time / 1000.0}
+
+            if type == TYPE_SPAN:
+                out.append(dict(common, name=name_of(name, arg), ph="X",
+                                dur=duration / 1000.0))
+            elif type == TYPE_ASYNC_SPAN:
+                async_id += 1
+                out.append(dict(common, name=name, ph="b", id=async_id))
+                out.append(dict(common, name=name, ph="e", id=async_id,
+                                ts=(time + duration) / 1000.0))
+            elif type in (TYPE_FLOW_START, TYPE_FLOW_END):
+                # Flow points bind to slices, so each gets a short one.
+                start = type == TYPE_FLOW_START
+                out.append(dict(common, ph="X", dur=0.001,
+                                name="%s %s" % (name,
+                                                "queued" if start else "run")))
+                out.append(dict(common, name=name, id=arg, bp="e",
+                                ph="s" if start else "f"))
+
+    for tid, _ in rings:
+        out.append({"pid": 1, "tid": tid, "ph": "M", "name": "thread_name",
+                    "args": {"name": "tid %d" % tid}})
+
+    return {"traceEvents": out, "displayTimeUnit": "ns"}
+
+
+def main(argv):
+    if len(argv) not in (2, 3):
+        sys.stderr.write(__doc__)
+        return 1
+
+    with open(argv[1], "rb") as f:
+        events, rings = read_events(f.read())
+
+    trace = convert(events, rings)
+
+    if len(argv) == 3:
+        with open(argv[2], "w") as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
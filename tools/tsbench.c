@@ -0,0 +1,807 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements tsbench, a benchmark of tvd's transport stream
+ * code. It loads recorded transport streams into memory, or generates a
+ * synthetic stream, and measures
+ *
+ *  - the demultiplexer with section filters on the PSI/SI PIDs, as used
+ *    by scans and EPG harvesting, fed in chunks like virtual tuners do;
+ *
+ *  - crc32_mpeg2() over the stream in section-sized blocks, compared to
+ *    the bytewise table lookup that it replaced;
+ *
+ *  - dvb_text_decode() over the service names of the SDT and the event
+ *    names and descriptions of the EIT, which are collected from the
+ *    stream before the timing starts.
+ *
+ * The synthetic stream consists of video packets of unfiltered PIDs,
+ * with a PAT section in every 50th packet. It contains no text. Each
+ * measurement is repeated and the fastest run is reported, which is the
+ * least disturbed by other load on the device.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc32.h"
+#include "dvb_si.h"
+#include "dvb_text.h"
+#include "ts_demux.h"
+
+enum {
+  SYNTHETIC_PSI_INTERVAL = 50, /* packets */
+  CRC_BLOCK_SIZE = 1024, /* typical size of SDT and EIT sections */
+  MAX_SECTION_ENTRIES = DVB_MAX_SECTION_LEN / 12 /* minimal event size */
+};
+
+static void
+print_errno(const char* func)
+{
+  fprintf(stderr, "Error: %s failed: %s\n", func, strerror(errno));
+}
+
+static uint64_t
+monotonic_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Command-line options
+ */
+
+struct options {
+  unsigned long runs;
+  unsigned long chunk; /* packets */
+  unsigned long synthetic; /* MiB */
+  char** files;
+};
+
+static int
+parse_ulong(const char* arg, const char* what, unsigned long min,
+            unsigned long max, unsigned long* value)
+{
+  char* end;
+
+  if (!arg) {
+    fprintf(stderr, "Error: No %s specified.\n", what);
+    return -1;
+  }
+
+  errno = 0;
+  *value = strtoul(arg, &end, 10);
+  if (errno || !*arg || *end || *value < min || *value > max) {
+    fprintf(stderr, "Error: The %s must be between %lu and %lu.\n",
+            what, min, max);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int
+parse_opt_h(void)
+{
+  printf("Usage: tsbench [OPTION] [FILE ...]\n"
+         "Measures the throughput of tvd's transport stream\n"
+         "demultiplexer, section CRC and text decoder\n"
+         "\n"
+         "General options:\n"
+         "  -h    displays this help\n"
+         "\n"
+         "Benchmark:\n"
+         "  -n    the number of runs, defaults to 10\n"
+         "  -c    the number of packets per chunk that is fed to the\n"
+         "        demultiplexer, defaults to 64\n"
+         "  -g    generates a synthetic stream of the given size in\n"
+         "        MiB instead of reading files\n"
+         "\n"
+         "The files are concatenated in memory. The fastest run is\n"
+         "reported.\n");
+
+  return 1;
+}
+
+static int
+parse_opt(int c, char* arg, struct options* opt)
+{
+  switch (c) {
+    case 'c':
+      return parse_ulong(arg, "chunk size", 1, 1024 * 1024, &opt->chunk);
+    case 'g':
+      return parse_ulong(arg, "stream size", 1, 4096, &opt->synthetic);
+    case 'h':
+      return parse_opt_h();
+    case 'n':
+      return parse_ulong(arg, "number of runs", 1, 1000000, &opt->runs);
+  }
+
+  fprintf(stderr, "Unknown option %c\n", optopt);
+
+  return -1;
+}
+
+static int
+parse_opts(int argc, char* argv[], struct options* opt)
+{
+  int res;
+
+  opterr = 0; /* no default error messages from getopt */
+
+  res = 0;
+
+  do {
+    int c = getopt(argc, argv, "c:g:hn:");
+    if (c < 0) {
+      break; /* end of options */
+    }
+    res = parse_opt(c, optarg, opt);
+  } while (!res);
+
+  if (res) {
+    return res;
+  }
+
+  opt->files = argv + optind;
+
+  if (!opt->synthetic && !*opt->files) {
+    fprintf(stderr, "Error: No files specified.\n");
+    return -1;
+  }
+  if (opt->synthetic && *opt->files) {
+    fprintf(stderr, "Error: Files and synthetic streams are "
+                    "exclusive.\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Streams
+ */
+
+struct stream {
+  uint8_t* buf;
+  size_t len;
+};
+
+static int
+append_file(struct stream* stream, const char* path)
+{
+  struct stat st;
+  uint8_t* buf;
+  size_t off;
+  ssize_t res;
+  int fd;
+
+  fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY));
+  if (fd < 0) {
+    print_errno("open");
+    return -1;
+  }
+  if (fstat(fd, &st) < 0) {
+    print_errno("fstat");
+    goto err_fstat;
+  }
+
+  buf = realloc(stream->buf, stream->len + st.st_size);
+  if (!buf) {
+    print_errno("realloc");
+    goto err_realloc;
+  }
+  stream->buf = buf;
+
+  for (off = 0; off < (size_t)st.st_size; off += res) {
+    res = TEMP_FAILURE_RETRY(read(fd, stream->buf + stream->len + off,
+                                  st.st_size - off));
+    if (res < 0) {
+      print_errno("read");
+      goto err_read;
+    } else if (!res) {
+      break; /* file shrank */
+    }
+  }
+  stream->len += off;
+
+  close(fd);
+
+  return 0;
+
+err_read:
+err_realloc:
+err_fstat:
+  close(fd);
+  return -1;
+}
+
+/* Writes a PAT section with a single program into |packet|. */
+static void
+write_pat_packet(uint8_t* packet, uint8_t cc)
+{
+  static const uint8_t section[] = {
+    DVB_TABLE_PAT, 0xb0, 0x0d, /* section_length 13 */
+    0x00, 0x01, 0xc1, 0x00, 0x00, /* TSID 1, version 0, section 0 of 0 */
+    0x00, 0x01, 0xe1, 0x00 /* program 1 on PID 0x100 */
+  };
+  uint32_t crc;
+  uint8_t* pos;
+
+  packet[0] = TS_SYNC_BYTE;
+  packet[1] = 0x40 | (DVB_PID_PAT >> 8); /* payload_unit_start */
+  packet[2] = DVB_PID_PAT & 0xff;
+  packet[3] = 0x10 | (cc & 0x0f); /* payload only */
+  packet[4] = 0x00; /* pointer_field */
+
+  pos = packet + 5;
+  memcpy(pos, section, sizeof(section));
+  crc = crc32_mpeg2(section, sizeof(section));
+  pos += sizeof(section);
+  *pos++ = crc >> 24;
+  *pos++ = crc >> 16;
+  *pos++ = crc >> 8;
+  *pos++ = crc;
+  memset(pos, 0xff, packet + TS_PACKET_SIZE - pos);
+}
+
+static int
+generate_stream(struct stream* stream, unsigned long mib)
+{
+  size_t num, i, j;
+  uint8_t pat_cc, video_cc;
+  uint8_t* packet;
+
+  num = mib * 1024 * 1024 / TS_PACKET_SIZE;
+
+  stream->buf = malloc(num * TS_PACKET_SIZE);
+  if (!stream->buf) {
+    print_errno("malloc");
+    return -1;
+  }
+  stream->len = num * TS_PACKET_SIZE;
+
+  srand48(1);
+  pat_cc = 0;
+  video_cc = 0;
+
+  for (i = 0; i < num; ++i) {
+    packet = stream->buf + i * TS_PACKET_SIZE;
+    if (!(i % SYNTHETIC_PSI_INTERVAL)) {
+      write_pat_packet(packet, pat_cc++);
+      continue;
+    }
+    packet[0] = TS_SYNC_BYTE;
+    packet[1] = 0x01; /* PID 0x101 */
+    packet[2] = 0x01;
+    packet[3] = 0x10 | (video_cc++ & 0x0f);
+    for (j = 4; j < TS_PACKET_SIZE; ++j) {
+      packet[j] = lrand48();
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Demultiplexer
+ */
+
+static void
+section_cb(void* data, uint16_t pid, const uint8_t* buf, size_t len)
+{
+  uint64_t* bytes = data;
+
+  *bytes += len;
+}
+
+static int
+bench_demux(const struct stream* stream, const struct options* opt)
+{
+  static const struct ts_demux_callbacks callbacks = {
+    .section_cb = section_cb
+  };
+  static const uint16_t pid[] = {
+    DVB_PID_PAT, DVB_PID_NIT, DVB_PID_SDT, DVB_PID_EIT
+  };
+
+  struct ts_demux_stats stats;
+  uint64_t best, start, elapsed, bytes;
+  size_t chunk, off, i;
+  unsigned long run;
+
+  chunk = opt->chunk * TS_PACKET_SIZE;
+  best = UINT64_MAX;
+
+  for (run = 0; run < opt->runs; ++run) {
+    struct ts_demux* demux;
+
+    bytes = 0;
+
+    demux = create_ts_demux(&callbacks, &bytes);
+    if (!demux) {
+      return -1;
+    }
+    for (i = 0; i < sizeof(pid) / sizeof(pid[0]); ++i) {
+      if (ts_demux_add_section_filter(demux, pid[i]) < 0) {
+        destroy_ts_demux(demux);
+        return -1;
+      }
+    }
+
+    start = monotonic_ns();
+    for (off = 0; off < stream->len; off += chunk) {
+      ts_demux_feed(demux, stream->buf + off,
+                    stream->len - off < chunk ? stream->len - off : chunk);
+    }
+    elapsed = monotonic_ns() - start;
+
+    ts_demux_get_stats(demux, &stats);
+    destroy_ts_demux(demux);
+
+    if (elapsed < best) {
+      best = elapsed;
+    }
+  }
+
+  if (!best) {
+    best = 1;
+  }
+
+  printf("Demultiplexer: %llu packets, %llu sections (%llu bytes), "
+         "%llu sync losses, %llu CC errors\n",
+         (unsigned long long)stats.packets,
+         (unsigned long long)stats.sections, (unsigned long long)bytes,
+         (unsigned long long)stats.sync_losses,
+         (unsigned long long)stats.cc_errors);
+  printf("  %.3f ms, %.1f MiB/s, %.2f Gbit/s, %.1f Mpackets/s\n",
+         best / 1e6, stream->len * 1e9 / best / (1024 * 1024),
+         stream->len * 8.0 / best, stats.packets * 1e3 / best);
+
+  return 0;
+}
+
+/*
+ * CRC
+ */
+
+/* The bytewise table lookup that crc32_mpeg2() used before it switched
+ * to slicing-by-8. */
+static uint32_t
+crc32_bytewise(const uint32_t* table, const uint8_t* buf, size_t len)
+{
+  uint32_t crc = 0xffffffff;
+
+  while (len--) {
+    crc = (crc << 8) ^ table[(crc >> 24) ^ *buf++];
+  }
+  return crc;
+}
+
+static void
+init_crc_table(uint32_t* table)
+{
+  uint32_t i, crc;
+  int bit;
+
+  for (i = 0; i < 256; ++i) {
+    crc = i << 24;
+    for (bit = 0; bit < 8; ++bit) {
+      crc = crc & 0x80000000 ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+    }
+    table[i] = crc;
+  }
+}
+
+static uint64_t
+time_crc(const struct stream* stream, const uint32_t* table,
+         unsigned long runs, uint32_t* sum)
+{
+  uint64_t best, start, elapsed;
+  unsigned long run;
+  size_t off, len;
+
+  best = UINT64_MAX;
+
+  for (run = 0; run < runs; ++run) {
+    *sum = 0;
+    start = monotonic_ns();
+    for (off = 0; off < stream->len; off += len) {
+      len = stream->len - off < CRC_BLOCK_SIZE ? stream->len - off
+                                               : CRC_BLOCK_SIZE;
+      *sum ^= table ? crc32_bytewise(table, stream->buf + off, len)
+                    : crc32_mpeg2(stream->buf + off, len);
+    }
+    elapsed = monotonic_ns() - start;
+    if (elapsed < best) {
+      best = elapsed;
+    }
+  }
+
+  return best ? best : 1;
+}
+
+static int
+bench_crc(const struct stream* stream, const struct options* opt)
+{
+  uint32_t table[256];
+  uint64_t sliced, bytewise;
+  uint32_t sliced_sum, bytewise_sum;
+
+  init_crc_table(table);
+
+  crc32_mpeg2(stream->buf, 0); /* build the slices outside the timing */
+
+  sliced = time_crc(stream, NULL, opt->runs, &sliced_sum);
+  bytewise = time_crc(stream, table, opt->runs, &bytewise_sum);
+
+  if (sliced_sum != bytewise_sum) {
+    fprintf(stderr, "Error: crc32_mpeg2() returned wrong CRCs.\n");
+    return -1;
+  }
+
+  printf("CRC-32 in %d-byte blocks:\n", CRC_BLOCK_SIZE);
+  printf("  slicing-by-8: %.3f ms, %.1f MiB/s\n", sliced / 1e6,
+         stream->len * 1e9 / sliced / (1024 * 1024));
+  printf("  bytewise:     %.3f ms, %.1f MiB/s\n", bytewise / 1e6,
+         stream->len * 1e9 / bytewise / (1024 * 1024));
+  printf("  speedup:      %.2f\n", (double)bytewise / sliced);
+
+  return 0;
+}
+
+/*
+ * Text
+ */
+
+struct text {
+  const uint8_t* buf;
+  size_t len;
+};
+
+struct corpus {
+  uint8_t** section; /* copies that |text| points into */
+  size_t num_sections;
+  size_t max_sections;
+  struct text* text;
+  size_t num_texts;
+  size_t max_texts;
+  size_t bytes;
+  int failed;
+};
+
+static int
+add_text(struct corpus* corpus, const uint8_t* buf, size_t len)
+{
+  struct text* text;
+
+  if (!len) {
+    return 0;
+  }
+  if (corpus->num_texts == corpus->max_texts) {
+    size_t max = corpus->max_texts ? 2 * corpus->max_texts : 1024;
+    text = realloc(corpus->text, max * sizeof(*text));
+    if (!text) {
+      print_errno("realloc");
+      return -1;
+    }
+    corpus->text = text;
+    corpus->max_texts = max;
+  }
+  text = corpus->text + corpus->num_texts++;
+  text->buf = buf;
+  text->len = len;
+  corpus->bytes += len;
+
+  return 0;
+}
+
+static int
+add_sdt_texts(struct corpus* corpus, const struct dvb_section* sec)
+{
+  struct dvb_service service[MAX_SECTION_ENTRIES];
+  uint16_t original_network_id;
+  long num, i;
+
+  num = dvb_parse_sdt(sec, &original_network_id, service,
+                      MAX_SECTION_ENTRIES);
+  for (i = 0; i < num; ++i) {
+    if (add_text(corpus, service[i].provider, service[i].provider_len) < 0 ||
+        add_text(corpus, service[i].name, service[i].name_len) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Adds the strings of the short and extended event descriptors, with
+ * the same length checks as the EIT assembler. */
+static int
+add_event_texts(struct corpus* corpus, const struct dvb_event* event)
+{
+  const uint8_t* p;
+  const uint8_t* end;
+
+  p = event->desc;
+  end = p + event->desc_len;
+
+  for (; end - p >= 2 && end - p >= 2 + p[1]; p += 2 + p[1]) {
+    const uint8_t* d = p + 2;
+    uint8_t len = p[1];
+
+    if (p[0] == DVB_DESC_SHORT_EVENT && len >= 5 && 4 + d[3] < len &&
+        5 + d[3] + d[4 + d[3]] <= len) {
+      if (add_text(corpus, d + 4, d[3]) < 0 ||
+          add_text(corpus, d + 5 + d[3], d[4 + d[3]]) < 0) {
+        return -1;
+      }
+    } else if (p[0] == DVB_DESC_EXTENDED_EVENT && len >= 6 &&
+               5 + d[4] < len && 6 + d[4] + d[5 + d[4]] <= len) {
+      if (add_text(corpus, d + 6 + d[4], d[5 + d[4]]) < 0) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+static int
+add_eit_texts(struct corpus* corpus, const struct dvb_section* sec)
+{
+  struct dvb_event event[MAX_SECTION_ENTRIES];
+  struct dvb_eit_header hdr;
+  long num, i;
+
+  num = dvb_parse_eit(sec, &hdr, event, MAX_SECTION_ENTRIES);
+  for (i = 0; i < num; ++i) {
+    if (add_event_texts(corpus, event + i) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int
+add_section(struct corpus* corpus, const uint8_t* buf, size_t len)
+{
+  struct dvb_section sec;
+  uint8_t** section;
+  uint8_t* copy;
+
+  if (dvb_parse_section(buf, len, &sec) < 0) {
+    return 0; /* skip broken sections */
+  }
+  if (sec.table_id != DVB_TABLE_SDT_ACTUAL &&
+      (sec.table_id < DVB_TABLE_EIT_PF_ACTUAL ||
+       sec.table_id > DVB_TABLE_EIT_LAST)) {
+    return 0;
+  }
+
+  if (corpus->num_sections == corpus->max_sections) {
+    size_t max = corpus->max_sections ? 2 * corpus->max_sections : 256;
+    section = realloc(corpus->section, max * sizeof(*section));
+    if (!section) {
+      print_errno("realloc");
+      return -1;
+    }
+    corpus->section = section;
+    corpus->max_sections = max;
+  }
+  copy = malloc(len);
+  if (!copy) {
+    print_errno("malloc");
+    return -1;
+  }
+  memcpy(copy, buf, len);
+  corpus->section[corpus->num_sections++] = copy;
+
+  dvb_parse_section(copy, len, &sec); /* point into the copy */
+
+  if (sec.table_id == DVB_TABLE_SDT_ACTUAL) {
+    return add_sdt_texts(corpus, &sec);
+  }
+  return add_eit_texts(corpus, &sec);
+}
+
+static void
+text_section_cb(void* data, uint16_t pid, const uint8_t* buf, size_t len)
+{
+  struct corpus* corpus = data;
+
+  if (!corpus->failed && add_section(corpus, buf, len) < 0) {
+    corpus->failed = 1;
+  }
+}
+
+static void
+release_corpus(struct corpus* corpus)
+{
+  size_t i;
+
+  for (i = 0; i < corpus->num_sections; ++i) {
+    free(corpus->section[i]);
+  }
+  free(corpus->section);
+  free(corpus->text);
+}
+
+static int
+collect_texts(const struct stream* stream, struct corpus* corpus)
+{
+  static const struct ts_demux_callbacks callbacks = {
+    .section_cb = text_section_cb
+  };
+
+  struct ts_demux* demux;
+
+  memset(corpus, 0, sizeof(*corpus));
+
+  demux = create_ts_demux(&callbacks, corpus);
+  if (!demux) {
+    return -1;
+  }
+  if (ts_demux_add_section_filter(demux, DVB_PID_SDT) < 0 ||
+      ts_demux_add_section_filter(demux, DVB_PID_EIT) < 0) {
+    goto err_ts_demux_add_section_filter;
+  }
+  ts_demux_feed(demux, stream->buf, stream->len);
+  if (corpus->failed) {
+    goto err_ts_demux_feed;
+  }
+  destroy_ts_demux(demux);
+
+  return 0;
+
+err_ts_demux_feed:
+err_ts_demux_add_section_filter:
+  destroy_ts_demux(demux);
+  release_corpus(corpus);
+  return -1;
+}
+
+static int
+is_ascii(const struct text* text)
+{
+  size_t i;
+
+  for (i = 0; i < text->len; ++i) {
+    if (text->buf[i] < 0x20 || text->buf[i] > 0x7e) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int
+bench_text(const struct stream* stream, const struct options* opt)
+{
+  char dst[DVB_TEXT_MAX_LEN(255)];
+  struct corpus corpus;
+  uint64_t best, start, elapsed, out;
+  unsigned long run;
+  size_t i, ascii;
+
+  if (collect_texts(stream, &corpus) < 0) {
+    return -1;
+  }
+
+  if (!corpus.num_texts) {
+    printf("Text: no SDT or EIT strings in the stream\n");
+    release_corpus(&corpus);
+    return 0;
+  }
+
+  ascii = 0;
+  for (i = 0; i < corpus.num_texts; ++i) {
+    ascii += is_ascii(corpus.text + i);
+  }
+
+  best = UINT64_MAX;
+  out = 0;
+
+  for (run = 0; run < opt->runs; ++run) {
+    out = 0;
+    start = monotonic_ns();
+    for (i = 0; i < corpus.num_texts; ++i) {
+      out += dvb_text_decode(dst, sizeof(dst), corpus.text[i].buf,
+                             corpus.text[i].len);
+    }
+    elapsed = monotonic_ns() - start;
+    if (elapsed < best) {
+      best = elapsed;
+    }
+  }
+
+  if (!best) {
+    best = 1;
+  }
+
+  printf("Text: %zu strings from %zu sections, %zu bytes, %zu%% "
+         "printable ASCII\n", corpus.num_texts, corpus.num_sections,
+         corpus.bytes, 100 * ascii / corpus.num_texts);
+  printf("  %.3f ms, %.1f MiB/s in, %.1f MiB/s out, %.2f Mstrings/s\n",
+         best / 1e6, corpus.bytes * 1e9 / best / (1024 * 1024),
+         out * 1e9 / best / (1024 * 1024), corpus.num_texts * 1e3 / best);
+
+  release_corpus(&corpus);
+
+  return 0;
+}
+
+int
+main(int argc, char* argv[])
+{
+  struct options options = {
+    .runs = 10,
+    .chunk = 64
+  };
+  struct stream stream;
+  char** file;
+  int res;
+
+  res = parse_opts(argc, argv, &options);
+  if (res > 0) {
+    return EXIT_SUCCESS;
+  } else if (res < 0) {
+    return EXIT_FAILURE;
+  }
+
+  memset(&stream, 0, sizeof(stream));
+
+  if (options.synthetic) {
+    if (generate_stream(&stream, options.synthetic) < 0) {
+      return EXIT_FAILURE;
+    }
+  } else {
+    for (file = options.files; *file; ++file) {
+      if (append_file(&stream, *file) < 0) {
+        goto err;
+      }
+    }
+  }
+
+  if (!stream.len) {
+    fprintf(stderr, "Error: The stream is empty.\n");
+    goto err;
+  }
+
+  printf("Stream: %zu bytes, %lu runs\n", stream.len, options.runs);
+
+  if (bench_demux(&stream, &options) < 0 ||
+      bench_crc(&stream, &options) < 0 ||
+      bench_text(&stream, &options) < 0) {
+    goto err;
+  }
+
+  free(stream.buf);
+
+  return EXIT_SUCCESS;
+
+err:
+  free(stream.buf);
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements tspsi, an offline test of tvd's PSI/SI tracker.
+ * It runs recorded transport streams through the demultiplexer and the
+ * table tracker that scans use if the driver doesn't return channels,
+ * and prints the channels that a scan would report for each file.
+ *
+ * The demultiplexer filters the PAT, NIT and SDT; the PMTs are added as
+ * soon as the PAT announces them. Each file is read completely, so the
+ * NIT's logical channel numbers are included if the recording contains
+ * a NIT. Tspsi fails if a file lacks the PAT, a PMT or the SDT, like a
+ * scan would time out on them.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dvb_psi.h"
+#include "dvb_si.h"
+#include "ts_demux.h"
+#include "tv_utils.h"
+
+enum {
+  READ_SIZE = 64 * 1024,
+  MAX_PROGRAMS = 256
+};
+
+static void
+print_errno(const char* func)
+{
+  fprintf(stderr, "Error: %s failed: %s\n", func, strerror(errno));
+}
+
+struct file_state {
+  struct ts_demux* demux;
+  struct dvb_psi* psi;
+  unsigned long errors; /* sections that dvb_psi_feed() rejected */
+};
+
+/* Adds section filters for the PMTs that a PAT section announces. */
+static void
+filter_pmts(struct ts_demux* demux, const uint8_t* buf, size_t len)
+{
+  struct dvb_pat_entry entry[MAX_PROGRAMS];
+  struct dvb_section sec;
+  long num, i;
+
+  if (dvb_parse_section(buf, len, &sec) < 0 ||
+      sec.table_id != DVB_TABLE_PAT) {
+    return;
+  }
+  num = dvb_parse_pat(&sec, entry, MAX_PROGRAMS);
+  for (i = 0; i < num; ++i) {
+    if (entry[i].program_number) {
+      ts_demux_add_section_filter(demux, entry[i].pid);
+    }
+  }
+}
+
+static void
+section_cb(void* data, uint16_t pid, const uint8_t* buf, size_t len)
+{
+  struct file_state* state = data;
+
+  if (pid == DVB_PID_PAT) {
+    filter_pmts(state->demux, buf, len);
+  }
+  if (dvb_psi_feed(state->psi, buf, len) < 0) {
+    ++state->errors;
+  }
+}
+
+static int
+read_file(const char* path, struct ts_demux* demux)
+{
+  uint8_t* buf;
+  ssize_t res;
+  int fd;
+
+  buf = malloc(READ_SIZE);
+  if (!buf) {
+    print_errno("malloc");
+    return -1;
+  }
+
+  fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY));
+  if (fd < 0) {
+    print_errno("open");
+    goto err_open;
+  }
+
+  do {
+    res = TEMP_FAILURE_RETRY(read(fd, buf, READ_SIZE));
+    if (res < 0) {
+      print_errno("read");
+      goto err_read;
+    }
+    ts_demux_feed(demux, buf, res);
+  } while (res);
+
+  close(fd);
+  free(buf);
+
+  return 0;
+
+err_read:
+  close(fd);
+err_open:
+  free(buf);
+  return -1;
+}
+
+static const char*
+table_name(uint8_t table_id)
+{
+  switch (table_id) {
+    case DVB_TABLE_PAT:
+      return "PAT";
+    case DVB_TABLE_PMT:
+      return "PMT";
+    case DVB_TABLE_SDT_ACTUAL:
+      return "SDT";
+    default:
+      break;
+  }
+  return "table";
+}
+
+static void
+print_channels(uint32_t num, const struct tv_channel* ch)
+{
+  uint32_t i;
+
+  printf("  %-8s %-8s %-8s %-4s %-4s %s\n",
+         "number", "network", "service", "type", "free", "name");
+  for (i = 0; i < num; ++i) {
+    printf("  %-8s %-8s %-8s 0x%02x %-4s %s\n",
+           ch[i].number, ch[i].network_id, ch[i].service_id,
+           (unsigned char)ch[i].type, ch[i].is_free ? "yes" : "no",
+           ch[i].name);
+  }
+}
+
+/* Returns 0 if the file contains all tables that a scan waits for, or
+ * -1 otherwise. */
+static int
+test_file(const char* path)
+{
+  static const struct ts_demux_callbacks callbacks = {
+    .section_cb = section_cb
+  };
+  static const uint16_t pid[] = {
+    DVB_PID_PAT, DVB_PID_NIT, DVB_PID_SDT
+  };
+
+  struct file_state state;
+  struct ts_demux_stats stats;
+  struct tv_channel* ch;
+  uint32_t ch_num;
+  uint16_t missing_pid;
+  uint8_t missing_table_id;
+  size_t i;
+  int res;
+
+  memset(&state, 0, sizeof(state));
+
+  state.psi = create_dvb_psi();
+  if (!state.psi) {
+    return -1;
+  }
+
+  state.demux = create_ts_demux(&callbacks, &state);
+  if (!state.demux) {
+    goto err_create_ts_demux;
+  }
+
+  for (i = 0; i < sizeof(pid) / sizeof(pid[0]); ++i) {
+    if (ts_demux_add_section_filter(state.demux, pid[i]) < 0) {
+      goto err_ts_demux_add_section_filter;
+    }
+  }
+
+  if (read_file(path, state.demux) < 0) {
+    goto err_read_file;
+  }
+
+  ts_demux_get_stats(state.demux, &stats);
+
+  printf("%s: %llu packets, %llu sections, %lu invalid, %llu sync "
+         "losses, %llu CC errors\n", path,
+         (unsigned long long)stats.packets,
+         (unsigned long long)stats.sections, state.errors,
+         (unsigned long long)stats.sync_losses,
+         (unsigned long long)stats.cc_errors);
+
+  res = 0;
+
+  if (dvb_psi_next_missing(state.psi, &missing_pid, &missing_table_id)) {
+    fprintf(stderr, "Error: %s: %s on PID 0x%04x incomplete\n", path,
+            table_name(missing_table_id), missing_pid);
+    res = -1;
+    if (missing_table_id == DVB_TABLE_PAT) {
+      goto out; /* no channels without PAT */
+    }
+  }
+
+  if (dvb_psi_get_channels(state.psi, &ch_num, &ch) < 0) {
+    res = -1;
+    goto out;
+  }
+  print_channels(ch_num, ch);
+  release_channels(ch_num, ch);
+
+out:
+  destroy_ts_demux(state.demux);
+  destroy_dvb_psi(state.psi);
+
+  return res;
+
+err_read_file:
+err_ts_demux_add_section_filter:
+  destroy_ts_demux(state.demux);
+err_create_ts_demux:
+  destroy_dvb_psi(state.psi);
+  return -1;
+}
+
+int
+main(int argc, char* argv[])
+{
+  int i, failed;
+
+  if (argc < 2 || !strcmp(argv[1], "-h")) {
+    printf("Usage: tspsi FILE ...\n"
+           "Prints the channels of recorded transport streams as tvd's\n"
+           "PSI/SI tracker builds them, one transport stream per file.\n"
+           "Fails if a file lacks the PAT, a PMT or the SDT.\n");
+    return argc < 2 ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  failed = 0;
+
+  for (i = 1; i < argc; ++i) {
+    if (test_file(argv[i]) < 0) {
+      ++failed;
+    }
+  }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,2191 @@
+/*
+ * Copyright (C) 2015-2016  Mozilla Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements tvload, a client of tvd's IPC protocol for load
+ * tests. It takes the role of the client program as described in
+ * doc/ipc.txt: it listens on an abstract socket, optionally starts tvd
+ * itself, and registers the DTV and Stats services once tvd connected.
+ *
+ * Tvload runs in one of four modes:
+ *
+ *  - Mix mode, the default, sends a weighted random mix of commands. It
+ *    first queries the tuners and channels of the backend, so it works
+ *    with drivers, virtual tuners and IPTV tuners alike.
+ *
+ *  - Replay mode ('-f') sends the commands of a recorded session with
+ *    their original timing, optionally sped up and repeated.
+ *
+ *  - Record mode ('-P') sits between tvd and a real client, such as
+ *    Gecko, and forwards all PDUs. It writes the client's commands to a
+ *    session file for replay mode.
+ *
+ *  - EPG mode ('-e') tests that the guide fills up without the client
+ *    tuning to the channels. It repeats 'Get programs' for all channels
+ *    until each channel has programs for the next day, which requires
+ *    the EIT harvester if the driver doesn't return programs itself.
+ *
+ * Commands are pipelined up to a window size ('-c'). Tvd answers
+ * commands in order, so each response belongs to the oldest outstanding
+ * command of its service and opcode. Mix and replay mode report the
+ * throughput, latency percentiles per command, and the lag of
+ * notifications; that is the time from a command until the first
+ * notification that it causes, such as 'Channel scanned' after 'Start
+ * scanning channels'.
+ *
+ * Session files contain one command per line,
+ *
+ *  <time in ms> <service> <opcode> <payload>
+ *
+ * with the service, the opcode and the payload's bytes in hexadecimal,
+ * the payload without spaces. Lines starting with '#' are ignored. The
+ * time is relative to the session's first command. Commands of the
+ * Registry service are neither recorded nor replayed, as tvload
+ * registers the services itself.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pdu.h"
+
+enum {
+  /* Registry service */
+  OPCODE_ERROR = 0x00,
+  OPCODE_REGISTER_MODULE = 0x01,
+  /* DTV service */
+  OPCODE_GET_TUNERS = 0x01,
+  OPCODE_SET_SOURCE = 0x02,
+  OPCODE_START_SCAN = 0x03,
+  OPCODE_STOP_SCAN = 0x04,
+  OPCODE_CLEAR_CACHE = 0x05,
+  OPCODE_SET_CHANNEL = 0x06,
+  OPCODE_GET_CHANNEL = 0x07,
+  OPCODE_GET_PROGRAM = 0x08,
+  OPCODE_GET_CHANNEL_PAGE = 0x09,
+  OPCODE_GET_PROGRAM_PAGE = 0x0a,
+  OPCODE_SEARCH_PROGRAMS = 0x0b,
+  OPCODE_START_SCAN_WITH_MODE = 0x0c,
+  OPCODE_GET_SCAN_STATS = 0x0d,
+  OPCODE_GET_ZAP_STATS = 0x0e,
+  OPCODE_OPEN_STREAM = 0x10,
+  OPCODE_CLOSE_STREAM = 0x11,
+  OPCODE_CHANNEL_SCANNED = 0x81,
+  OPCODE_SCANNED_COMPLETE = 0x82,
+  OPCODE_SCAN_STOPPED = 0x83,
+  OPCODE_EIT_BROADCASTED = 0x84,
+  OPCODE_EIT_CHANGED = 0x85,
+  OPCODE_SOURCE_CHANGED = 0x86,
+  OPCODE_TUNER_REASSIGNED = 0x87,
+  /* Stats service */
+  OPCODE_GET_COUNTERS = 0x01,
+  OPCODE_GET_LATENCIES = 0x02,
+  OPCODE_GET_GAUGES = 0x03,
+  OPCODE_GET_STALLS = 0x06
+};
+
+enum {
+  NUM_SERVICES = SERVICE_STATS + 1,
+  NOTIFICATION_BIT = 0x80
+};
+
+enum {
+  SCAN_MODE_QUICK = 0x01,
+  SEARCH_MODE_SUBSTRING = 0x00
+};
+
+enum {
+  MAX_WINDOW = 256,
+  MAX_TUNERS = 16,
+  MAX_CHANNELS = 4096,
+  MAX_FDS = 16,
+  MAX_ID_LEN = 64
+};
+
+static const uint64_t NS_PER_MS = 1000000;
+static const uint64_t MS_PER_DAY = 24 * 60 * 60 * 1000;
+
+static volatile sig_atomic_t g_interrupted;
+
+static void
+print_errno(const char* func)
+{
+  fprintf(stderr, "Error: %s failed: %s\n", func, strerror(errno));
+}
+
+static uint64_t
+monotonic_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t
+realtime_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Command-line options
+ *
+ * The options are parsed into a structure, like tvd's own options. See
+ * |parse_opt_h| for the list of options.
+ */
+
+struct options {
+  const char* socket_name;
+  const char* tvd_path;
+  char** tvd_args;
+  unsigned long timeout; /* s */
+  const char* mix;
+  unsigned long commands;
+  unsigned long duration; /* s */
+  unsigned long window;
+  unsigned long rate; /* commands per second */
+  const char* query;
+  int scan;
+  const char* session;
+  unsigned long loops;
+  double speed;
+  const char* client_name;
+  const char* record;
+  unsigned long epg; /* s */
+};
+
+static int
+parse_ulong(const char* arg, const char* what, unsigned long min,
+            unsigned long max, unsigned long* value)
+{
+  char* end;
+
+  if (!arg) {
+    fprintf(stderr, "Error: No %s specified.\n", what);
+    return -1;
+  }
+
+  errno = 0;
+  *value = strtoul(arg, &end, 10);
+  if (errno || !*arg || *end || *value < min || *value > max) {
+    fprintf(stderr, "Error: The %s must be between %lu and %lu.\n",
+            what, min, max);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int
+parse_string(const char* arg, const char* what, const char** value)
+{
+  if (!arg) {
+    fprintf(stderr, "Error: No %s specified.\n", what);
+    return -1;
+  }
+
+  if (!strlen(arg)) {
+    fprintf(stderr, "Error: The specified %s is empty.\n", what);
+    return -1;
+  }
+
+  *value = arg;
+
+  return 0;
+}
+
+static int
+parse_opt_s(const char* arg, struct options* opt)
+{
+  char* end;
+
+  if (!arg) {
+    fprintf(stderr, "Error: No replay speed specified.\n");
+    return -1;
+  }
+
+  errno = 0;
+  opt->speed = strtod(arg, &end);
+  if (errno || !*arg || *end || opt->speed < 0 || opt->speed > 1000) {
+    fprintf(stderr, "Error: The replay speed must be between 0 and "
+                    "1000.\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+static int
+parse_opt_h(void)
+{
+  printf("Usage: tvload [OPTION] [-- TVD-OPTION ...]\n"
+         "Generates load on tvd over its IPC protocol\n"
+         "\n"
+         "General options:\n"
+         "  -h    displays this help\n"
+         "\n"
+         "Connection:\n"
+         "  -a    the network address to listen on, defaults to tvd\n"
+         "  -x    starts tvd from the given path with '-a' and all\n"
+         "        options after '--'; otherwise waits for tvd\n"
+         "  -t    the timeout in seconds for connections and\n"
+         "        responses, defaults to 30\n"
+         "\n"
+         "Command mix:\n"
+         "  -m    the command mix as comma-separated list of\n"
+         "        <command>[:<weight>], defaults to\n"
+         "        channels:4,programs:4,search:2,tuners:1\n"
+         "  -n    the number of commands, defaults to 1000\n"
+         "  -d    the maximum duration in seconds, defaults to no limit\n"
+         "  -c    the number of commands in flight, defaults to 1\n"
+         "  -r    the number of commands per second, defaults to no\n"
+         "        limit\n"
+         "  -q    the query of 'search', defaults to 'news'\n"
+         "  -k    scans the channels of the first tuner if there are\n"
+         "        none\n"
+         "\n"
+         "Commands are tuners, channels, page, programs, search, zap,\n"
+         "source, scanstats, zapstats, counters, latencies, gauges and\n"
+         "stalls.\n"
+         "\n"
+         "Replay:\n"
+         "  -f    replays the commands of a session file\n"
+         "  -l    the number of replays, defaults to 1\n"
+         "  -s    the replay speed factor, defaults to 1; 0 sends the\n"
+         "        commands without delay\n"
+         "\n"
+         "Recording:\n"
+         "  -P    forwards all PDUs between tvd and the client that\n"
+         "        listens on the given network address\n"
+         "  -o    the session file for the client's commands\n"
+         "\n"
+         "EPG:\n"
+         "  -e    waits up to the given number of seconds until all\n"
+         "        channels have programs for the next day; use '-k'\n"
+         "        to scan first\n"
+         "\n"
+         "Mix and replay mode report throughput, latencies and the lag\n"
+         "of notifications. '-c' and '-t' also apply to replays.\n");
+
+  return 1;
+}
+
+static int
+parse_opt(int c, char* arg, struct options* opt)
+{
+  switch (c) {
+    case 'a':
+      return parse_string(arg, "network address", &opt->socket_name);
+    case 'c':
+      return parse_ulong(arg, "window", 1, MAX_WINDOW, &opt->window);
+    case 'd':
+      return parse_ulong(arg, "duration", 1, 24 * 60 * 60, &opt->duration);
+    case 'e':
+      return parse_ulong(arg, "EPG timeout", 1, 24 * 60 * 60, &opt->epg);
+    case 'f':
+      return parse_string(arg, "session file", &opt->session);
+    case 'h':
+      return parse_opt_h();
+    case 'k':
+      opt->scan = 1;
+      return 0;
+    case 'l':
+      return parse_ulong(arg, "number of replays", 1, 1000000,
+                         &opt->loops);
+    case 'm':
+      return parse_string(arg, "command mix", &opt->mix);
+    case 'n':
+      return parse_ulong(arg, "number of commands", 1, 1000000000,
+                         &opt->commands);
+    case 'o':
+      return parse_string(arg, "session file", &opt->record);
+    case 'P':
+      return parse_string(arg, "client address", &opt->client_name);
+    case 'q':
+      return parse_string(arg, "query", &opt->query);
+    case 'r':
+      return parse_ulong(arg, "rate", 0, 1000000, &opt->rate);
+    case 's':
+      return parse_opt_s(arg, opt);
+    case 't':
+      return parse_ulong(arg, "timeout", 1, 3600, &opt->timeout);
+    case 'x':
+      return parse_string(arg, "path of tvd", &opt->tvd_path);
+  }
+
+  fprintf(stderr, "Unknown option %c\n", optopt);
+
+  return -1;
+}
+
+static int
+parse_opts(int argc, char* argv[], struct options* opt)
+{
+  int res;
+
+  opterr = 0; /* no default error messages from getopt */
+
+  res = 0;
+
+  do {
+    int c = getopt(argc, argv, "a:c:d:e:f:hkl:m:n:o:P:q:r:s:t:x:");
+    if (c < 0) {
+      break; /* end of options */
+    }
+    res = parse_opt(c, optarg, opt);
+  } while (!res);
+
+  if (res) {
+    return res;
+  }
+
+  opt->tvd_args = argv + optind;
+
+  if (opt->client_name && opt->session) {
+    fprintf(stderr, "Error: Recording and replaying are exclusive.\n");
+    return -1;
+  }
+  if (opt->record && !opt->client_name) {
+    fprintf(stderr, "Error: Recording requires a client address.\n");
+    return -1;
+  }
+  if (opt->epg && (opt->client_name || opt->session)) {
+    fprintf(stderr, "Error: EPG mode excludes recording and replaying.\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Statistics
+ *
+ * Latencies of commands and lags of notifications are stored as raw
+ * samples in nanoseconds and sorted for the report. For each DTV
+ * command that can cause a notification, |g_pending| stores the time
+ * of the first command that hasn't been followed by the notification
+ * yet.
+ */
+
+struct samples {
+  uint64_t* value;
+  size_t len;
+  size_t size;
+};
+
+struct cmd_stats {
+  unsigned long sent;
+  unsigned long errors;
+  struct samples latency;
+};
+
+struct ntf_stats {
+  unsigned long received;
+  uint64_t bytes;
+  uint64_t pending; /* ns, 0 if no command is waiting */
+  struct samples lag;
+};
+
+static struct cmd_stats g_cmd_stats[NUM_SERVICES][PDU_MAX_NUM_OPCODES];
+static struct ntf_stats g_ntf_stats[NUM_SERVICES][PDU_MAX_NUM_OPCODES];
+static unsigned long g_unmatched;
+
+static int
+samples_add(struct samples* samples, uint64_t value)
+{
+  if (samples->len == samples->size) {
+    size_t size = samples->size ? 2 * samples->size : 1024;
+    uint64_t* buf = realloc(samples->value, size * sizeof(*buf));
+    if (!buf) {
+      print_errno("realloc");
+      return -1;
+    }
+    samples->value = buf;
+    samples->size = size;
+  }
+  samples->value[samples->len++] = value;
+
+  return 0;
+}
+
+static int
+compare_uint64(const void* lhs, const void* rhs)
+{
+  uint64_t l = *(const uint64_t*)lhs;
+  uint64_t r = *(const uint64_t*)rhs;
+
+  return (l > r) - (l < r);
+}
+
+static void
+samples_sort(struct samples* samples)
+{
+  qsort(samples->value, samples->len, sizeof(*samples->value),
+        compare_uint64);
+}
+
+/* Returns the nearest-rank percentile of sorted samples. */
+static uint64_t
+samples_percentile(const struct samples* samples, unsigned long permille)
+{
+  size_t rank;
+
+  if (!samples->len) {
+    return 0;
+  }
+
+  rank = (samples->len * permille + 999) / 1000;
+
+  return samples->value[rank ? rank - 1 : 0];
+}
+
+static void
+reset_stats(void)
+{
+  size_t i, j;
+
+  for (i = 0; i < NUM_SERVICES; ++i) {
+    for (j = 0; j < PDU_MAX_NUM_OPCODES; ++j) {
+      struct cmd_stats* cmd = &g_cmd_stats[i][j];
+      struct ntf_stats* ntf = &g_ntf_stats[i][j];
+      cmd->sent = 0;
+      cmd->errors = 0;
+      cmd->latency.len = 0;
+      ntf->received = 0;
+      ntf->bytes = 0;
+      ntf->pending = 0;
+      ntf->lag.len = 0;
+    }
+  }
+  g_unmatched = 0;
+}
+
+/* Returns true if the DTV command |cmd| causes the notification |ntf|.
+ */
+static int
+causes_notification(uint8_t cmd, uint8_t ntf)
+{
+  switch (ntf) {
+    case OPCODE_CHANNEL_SCANNED:
+    case OPCODE_SCANNED_COMPLETE:
+      return cmd == OPCODE_START_SCAN || cmd == OPCODE_START_SCAN_WITH_MODE;
+    case OPCODE_SCAN_STOPPED:
+      return cmd == OPCODE_STOP_SCAN;
+    case OPCODE_EIT_BROADCASTED:
+    case OPCODE_EIT_CHANGED:
+    case OPCODE_SOURCE_CHANGED:
+      return cmd == OPCODE_SET_CHANNEL;
+    case OPCODE_TUNER_REASSIGNED:
+      return cmd == OPCODE_SET_SOURCE || cmd == OPCODE_SET_CHANNEL ||
+             cmd == OPCODE_OPEN_STREAM;
+  }
+  return 0;
+}
+
+static const char*
+opcode_name(uint8_t service, uint8_t opcode)
+{
+  static const char* const DTV_NAME[PDU_MAX_NUM_OPCODES] = {
+    [OPCODE_ERROR] = "error",
+    [OPCODE_GET_TUNERS] = "tuners",
+    [OPCODE_SET_SOURCE] = "source",
+    [OPCODE_START_SCAN] = "scan",
+    [OPCODE_STOP_SCAN] = "stopscan",
+    [OPCODE_CLEAR_CACHE] = "clearcache",
+    [OPCODE_SET_CHANNEL] = "zap",
+    [OPCODE_GET_CHANNEL] = "channels",
+    [OPCODE_GET_PROGRAM] = "programs",
+    [OPCODE_GET_CHANNEL_PAGE] = "page",
+    [OPCODE_GET_PROGRAM_PAGE] = "programspage",
+    [OPCODE_SEARCH_PROGRAMS] = "search",
+    [OPCODE_START_SCAN_WITH_MODE] = "scanmode",
+    [OPCODE_GET_SCAN_STATS] = "scanstats",
+    [OPCODE_GET_ZAP_STATS] = "zapstats",
+    [OPCODE_OPEN_STREAM] = "openstream",
+    [OPCODE_CLOSE_STREAM] = "closestream",
+    [OPCODE_CHANNEL_SCANNED] = "channel scanned",
+    [OPCODE_SCANNED_COMPLETE] = "scan complete",
+    [OPCODE_SCAN_STOPPED] = "scan stopped",
+    [OPCODE_EIT_BROADCASTED] = "eit broadcasted",
+    [OPCODE_EIT_CHANGED] = "eit changed",
+    [OPCODE_SOURCE_CHANGED] = "source changed",
+    [OPCODE_TUNER_REASSIGNED] = "tuner reassigned"
+  };
+  static const char* const STATS_NAME[PDU_MAX_NUM_OPCODES] = {
+    [OPCODE_ERROR] = "error",
+    [OPCODE_GET_COUNTERS] = "counters",
+    [OPCODE_GET_LATENCIES] = "latencies",
+    [OPCODE_GET_GAUGES] = "gauges",
+    [OPCODE_GET_STALLS] = "stalls"
+  };
+
+  const char* name = NULL;
+
+  if (service == SERVICE_DTV) {
+    name = DTV_NAME[opcode];
+  } else if (service == SERVICE_STATS) {
+    name = STATS_NAME[opcode];
+  }
+
+  return name ? name : "-";
+}
+
+/* Prints the percentiles of sorted samples in |unit| ns, followed by
+ * the maximum. The list of percentiles ends with 0. */
+static void
+print_percentiles(const struct samples* samples,
+                  const unsigned long* permille, int width, uint64_t unit)
+{
+  for (; *permille; ++permille) {
+    printf(" %*llu", width,
+           (unsigned long long)(samples_percentile(samples, *permille) /
+                                unit));
+  }
+  putchar('\n');
+}
+
+static void
+print_report(uint64_t elapsed)
+{
+  static const unsigned long LATENCY_PERMILLE[] = {
+    500, 900, 990, 999, 1000, 0
+  };
+  static const unsigned long LAG_PERMILLE[] = {
+    500, 900, 990, 1000, 0
+  };
+
+  unsigned long sent, errors, received;
+  size_t i, j;
+
+  sent = 0;
+  errors = 0;
+  received = 0;
+
+  for (i = 0; i < NUM_SERVICES; ++i) {
+    for (j = 0; j < PDU_MAX_NUM_OPCODES; ++j) {
+      sent += g_cmd_stats[i][j].sent;
+      errors += g_cmd_stats[i][j].errors;
+      received += g_ntf_stats[i][j].received;
+    }
+  }
+
+  printf("%lu commands in %.3f s, %.1f commands/s, %lu errors\n",
+         sent, elapsed / 1e9, elapsed ? sent * 1e9 / elapsed : 0.0,
+         errors);
+  if (g_unmatched) {
+    printf("%lu responses without command\n", g_unmatched);
+  }
+
+  printf("\nCommand latencies in us\n"
+         "%-16s %7s %7s %9s %9s %9s %9s %9s\n",
+         "command", "sent", "errors", "p50", "p90", "p99", "p99.9", "max");
+
+  for (i = 0; i < NUM_SERVICES; ++i) {
+    for (j = 0; j < PDU_MAX_NUM_OPCODES; ++j) {
+      struct cmd_stats* cmd = &g_cmd_stats[i][j];
+      if (!cmd->sent) {
+        continue;
+      }
+      samples_sort(&cmd->latency);
+      printf("%02zx:%02zx %-10s %7lu %7lu", i, j, opcode_name(i, j),
+             cmd->sent, cmd->errors);
+      print_percentiles(&cmd->latency, LATENCY_PERMILLE, 9, 1000);
+    }
+  }
+
+  if (!received) {
+    return;
+  }
+
+  printf("\nNotification lags in ms\n"
+         "%-22s %7s %9s %7s %7s %7s %7s %7s\n",
+         "notification", "recv", "bytes", "lags", "p50", "p90", "p99",
+         "max");
+
+  for (i = 0; i < NUM_SERVICES; ++i) {
+    for (j = 0; j < PDU_MAX_NUM_OPCODES; ++j) {
+      struct ntf_stats* ntf = &g_ntf_stats[i][j];
+      if (!ntf->received) {
+        continue;
+      }
+      samples_sort(&ntf->lag);
+      printf("%02zx:%02zx %-16s %7lu %9llu %7zu", i, j, opcode_name(i, j),
+             ntf->received, (unsigned long long)ntf->bytes, ntf->lag.len);
+      print_percentiles(&ntf->lag, LAG_PERMILLE, 7, NS_PER_MS);
+    }
+  }
+}
+
+/*
+ * Socket I/O
+ *
+ * Tvload uses blocking sends and polls for received PDUs. Tvd sends
+ * the file descriptors of streams as ancillary data; |recv_pdu| closes
+ * them right away. |g_inflight| holds the outstanding commands in the
+ * order they have been sent.
+ */
+
+struct inflight {
+  uint8_t service;
+  uint8_t opcode;
+  uint64_t sent; /* ns */
+};
+
+static union {
+  unsigned char raw[sizeof(struct pdu) + PDU_MAX_DATA_LENGTH];
+  struct pdu pdu;
+} g_rbuf, g_wbuf;
+
+static struct inflight g_inflight[MAX_WINDOW];
+static size_t g_inflight_len;
+static int g_timeout; /* ms */
+static int g_scan_done;
+
+static ssize_t
+create_sockaddr_un(const char* socket_name, struct sockaddr_un* addr)
+{
+  size_t len = strlen(socket_name);
+
+  /* leading '\0' of abstract socket, no trailing '\0' */
+  if (len + 1 > sizeof(addr->sun_path)) {
+    fprintf(stderr, "Error: Socket name too long.\n");
+    return -1;
+  }
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  memcpy(addr->sun_path + 1, socket_name, len);
+
+  return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+static int
+listen_socket(const char* socket_name)
+{
+  struct sockaddr_un addr;
+  ssize_t socklen;
+  int fd;
+
+  socklen = create_sockaddr_un(socket_name, &addr);
+  if (socklen < 0) {
+    return -1;
+  }
+
+  fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    print_errno("socket");
+    return -1;
+  }
+  if (bind(fd, (const struct sockaddr*)&addr, socklen) < 0) {
+    print_errno("bind");
+    goto err_bind;
+  }
+  if (listen(fd, 1) < 0) {
+    print_errno("listen");
+    goto err_listen;
+  }
+
+  return fd;
+
+err_listen:
+err_bind:
+  close(fd);
+  return -1;
+}
+
+static int
+accept_socket(int lfd, int timeout)
+{
+  struct pollfd pfd = {
+    .fd = lfd,
+    .events = POLLIN
+  };
+  int res, fd;
+
+  res = TEMP_FAILURE_RETRY(poll(&pfd, 1, timeout));
+  if (res < 0) {
+    print_errno("poll");
+    return -1;
+  } else if (!res) {
+    fprintf(stderr, "Error: Tvd didn't connect.\n");
+    return -1;
+  }
+
+  fd = TEMP_FAILURE_RETRY(accept4(lfd, NULL, NULL, SOCK_CLOEXEC));
+  if (fd < 0) {
+    print_errno("accept4");
+    return -1;
+  }
+
+  return fd;
+}
+
+static int
+connect_socket(const char* socket_name)
+{
+  struct sockaddr_un addr;
+  ssize_t socklen;
+  int fd;
+
+  socklen = create_sockaddr_un(socket_name, &addr);
+  if (socklen < 0) {
+    return -1;
+  }
+
+  fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    print_errno("socket");
+    return -1;
+  }
+  if (TEMP_FAILURE_RETRY(connect(fd, (const struct sockaddr*)&addr,
+                                 socklen)) < 0) {
+    print_errno("connect");
+    goto err_connect;
+  }
+
+  return fd;
+
+err_connect:
+  close(fd);
+  return -1;
+}
+
+static void
+close_fds(struct msghdr* msg)
+{
+  struct cmsghdr* cmsg;
+
+  for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    const int* fd;
+    size_t i, n;
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    fd = (const int*)CMSG_DATA(cmsg);
+    n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(*fd);
+    for (i = 0; i < n; ++i) {
+      close(fd[i]);
+    }
+  }
+}
+
+/* Receives one PDU into |buf| and stores the ancillary data in |msg|.
+ * Returns 1 on success, 0 on timeouts and interruptions, and -1 on
+ * errors or if the peer closed the connection. */
+static int
+recv_msg(int fd, void* buf, struct msghdr* msg, int timeout)
+{
+  struct pollfd pfd = {
+    .fd = fd,
+    .events = POLLIN
+  };
+  const struct pdu* pdu = buf;
+  ssize_t len;
+  int res;
+
+  res = poll(&pfd, 1, timeout);
+  if (res < 0) {
+    if (errno == EINTR) {
+      return 0;
+    }
+    print_errno("poll");
+    return -1;
+  } else if (!res) {
+    return 0;
+  }
+
+  len = recvmsg(fd, msg, MSG_CMSG_CLOEXEC);
+  if (len < 0) {
+    if (errno == EINTR || errno == EAGAIN) {
+      return 0;
+    }
+    print_errno("recvmsg");
+    return -1;
+  } else if (!len) {
+    fprintf(stderr, "Connection closed by peer.\n");
+    return -1;
+  }
+
+  if ((size_t)len < sizeof(*pdu) || (size_t)len != pdu_size(pdu)) {
+    fprintf(stderr, "Error: Received malformed PDU.\n");
+    close_fds(msg);
+    return -1;
+  }
+
+  return 1;
+}
+
+/* Receives a PDU from tvd into |g_rbuf| and closes its file
+ * descriptors. Returns like |recv_msg|. */
+static int
+recv_pdu(int fd, int timeout)
+{
+  unsigned char control[CMSG_SPACE(MAX_FDS * sizeof(int))];
+  struct iovec iov = {
+    .iov_base = g_rbuf.raw,
+    .iov_len = sizeof(g_rbuf.raw)
+  };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof(control)
+  };
+  int res;
+
+  res = recv_msg(fd, g_rbuf.raw, &msg, timeout);
+  if (res > 0) {
+    close_fds(&msg);
+  }
+
+  return res;
+}
+
+static int
+send_cmd(int fd, const struct pdu* cmd)
+{
+  struct inflight* inflight;
+  uint64_t now;
+  size_t i;
+
+  assert(g_inflight_len < MAX_WINDOW);
+
+  now = monotonic_ns();
+
+  if (TEMP_FAILURE_RETRY(send(fd, cmd, pdu_size(cmd), MSG_NOSIGNAL)) < 0) {
+    print_errno("send");
+    return -1;
+  }
+
+  inflight = g_inflight + g_inflight_len++;
+  inflight->service = cmd->service;
+  inflight->opcode = cmd->opcode;
+  inflight->sent = now;
+
+  if (cmd->service < NUM_SERVICES) {
+    ++g_cmd_stats[cmd->service][cmd->opcode].sent;
+  }
+
+  if (cmd->service == SERVICE_DTV) {
+    for (i = NOTIFICATION_BIT; i < PDU_MAX_NUM_OPCODES; ++i) {
+      struct ntf_stats* ntf = &g_ntf_stats[SERVICE_DTV][i];
+      if (!ntf->pending && causes_notification(cmd->opcode, i)) {
+        ntf->pending = now;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * PDU handling
+ */
+
+struct tuner {
+  char id[MAX_ID_LEN];
+  uint8_t source_type;
+};
+
+struct channel {
+  size_t tuner;
+  char number[MAX_ID_LEN];
+};
+
+static struct tuner g_tuner[MAX_TUNERS];
+static size_t g_tuners;
+static struct channel g_channel[MAX_CHANNELS];
+static size_t g_channels;
+
+/* Continuation of 'Get channels page' */
+static uint64_t g_page_token;
+static uint32_t g_page_offset;
+
+static void
+handle_page(const struct pdu* rsp)
+{
+  uint64_t token;
+  uint32_t total, count;
+
+  if (rsp->opcode == OPCODE_ERROR ||
+      read_pdu_at(rsp, 0, "LII", &token, &total, &count) < 0) {
+    g_page_token = 0; /* start over */
+    g_page_offset = 0;
+    return;
+  }
+
+  g_page_token = token;
+  g_page_offset = token ? g_page_offset + count : 0;
+}
+
+static void
+handle_rsp(const struct pdu* rsp, uint64_t now)
+{
+  struct inflight inflight;
+  size_t i;
+
+  for (i = 0; i < g_inflight_len; ++i) {
+    if (g_inflight[i].service == rsp->service &&
+        (g_inflight[i].opcode == rsp->opcode ||
+         rsp->opcode == OPCODE_ERROR)) {
+      break;
+    }
+  }
+  if (i == g_inflight_len) {
+    ++g_unmatched;
+    return;
+  }
+
+  inflight = g_inflight[i];
+  memmove(g_inflight + i, g_inflight + i + 1,
+          (g_inflight_len - i - 1) * sizeof(*g_inflight));
+  --g_inflight_len;
+
+  if (inflight.service < NUM_SERVICES) {
+    struct cmd_stats* cmd = &g_cmd_stats[inflight.service][inflight.opcode];
+    if (rsp->opcode == OPCODE_ERROR) {
+      ++cmd->errors;
+    }
+    samples_add(&cmd->latency, now - inflight.sent);
+  }
+
+  if (inflight.service == SERVICE_DTV &&
+      inflight.opcode == OPCODE_GET_CHANNEL_PAGE) {
+    handle_page(rsp);
+  }
+}
+
+static void
+handle_ntf(const struct pdu* ntf, uint64_t now)
+{
+  struct ntf_stats* stats;
+
+  if (ntf->service >= NUM_SERVICES) {
+    return;
+  }
+
+  stats = &g_ntf_stats[ntf->service][ntf->opcode];
+  ++stats->received;
+  stats->bytes += pdu_size(ntf);
+  if (stats->pending) {
+    samples_add(&stats->lag, now - stats->pending);
+    stats->pending = 0;
+  }
+
+  if (ntf->service == SERVICE_DTV &&
+      (ntf->opcode == OPCODE_SCANNED_COMPLETE ||
+       ntf->opcode == OPCODE_SCAN_STOPPED)) {
+    g_scan_done = 1;
+  }
+}
+
+static void
+handle_pdu(const struct pdu* pdu)
+{
+  uint64_t now = monotonic_ns();
+
+  if (pdu->opcode & NOTIFICATION_BIT) {
+    handle_ntf(pdu, now);
+  } else {
+    handle_rsp(pdu, now);
+  }
+}
+
+/* Waits until all outstanding commands have been answered. Tvd has to
+ * send a PDU within the timeout. */
+static int
+drain(int fd)
+{
+  uint64_t deadline;
+  int res;
+
+  deadline = monotonic_ns() + g_timeout * NS_PER_MS;
+
+  while (g_inflight_len) {
+    res = recv_pdu(fd, g_timeout);
+    if (res < 0) {
+      return -1;
+    } else if (res > 0) {
+      handle_pdu(&g_rbuf.pdu);
+      deadline = monotonic_ns() + g_timeout * NS_PER_MS;
+    } else if (monotonic_ns() >= deadline) {
+      fprintf(stderr, "Error: Tvd didn't respond.\n");
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* Sends a command and waits for its response, which is returned in
+ * |g_rbuf|. Error responses are returned as NULL. */
+static const struct pdu*
+transact(int fd, const struct pdu* cmd)
+{
+  if (drain(fd) < 0) {
+    return NULL;
+  }
+  if (send_cmd(fd, cmd) < 0) {
+    return NULL;
+  }
+  if (drain(fd) < 0) {
+    return NULL;
+  }
+  if (g_rbuf.pdu.opcode == OPCODE_ERROR) {
+    uint8_t error = ERROR_FAIL;
+    read_pdu_at(&g_rbuf.pdu, 0, "C", &error);
+    fprintf(stderr, "Error: Command 0x%02x:0x%02x failed with error "
+                    "0x%02x.\n", cmd->service, cmd->opcode, error);
+    return NULL;
+  }
+
+  return &g_rbuf.pdu;
+}
+
+/*
+ * Setup
+ *
+ * After tvd connected, tvload registers the services and reads the
+ * tuners and channels that the command mix refers to.
+ */
+
+static int
+register_service(int fd, uint8_t service)
+{
+  const struct pdu* rsp;
+  uint32_t version;
+
+  init_pdu(&g_wbuf.pdu, SERVICE_REGISTRY, OPCODE_REGISTER_MODULE);
+  if (append_to_pdu(&g_wbuf.pdu, "C", service) < 0) {
+    return -1;
+  }
+
+  rsp = transact(fd, &g_wbuf.pdu);
+  if (!rsp) {
+    return -1;
+  }
+  if (read_pdu_at(rsp, 0, "I", &version) < 0) {
+    return -1;
+  }
+  if (version != PROTOCOL_VERSION) {
+    fprintf(stderr, "Warning: Tvd implements protocol version %u, "
+                    "tvload implements %u.\n",
+            version, (unsigned int)PROTOCOL_VERSION);
+  }
+
+  return 0;
+}
+
+static int
+read_tuners(int fd)
+{
+  const struct pdu* rsp;
+  uint32_t num, i;
+  long off;
+
+  init_pdu(&g_wbuf.pdu, SERVICE_DTV, OPCODE_GET_TUNERS);
+
+  rsp = transact(fd, &g_wbuf.pdu);
+  if (!rsp) {
+    return -1;
+  }
+
+  off = read_pdu_at(rsp, 0, "I", &num);
+  if (off < 0) {
+    return -1;
+  }
+
+  g_tuners = 0;
+
+  for (i = 0; i < num; ++i) {
+    const char* id;
+    uint32_t types;
+    uint8_t type = 0;
+
+    off = read_pdu_at(rsp, off, "0I", &id, &types);
+    if (off < 0) {
+      return -1;
+    }
+    if (types) {
+      off = read_pdu_at(rsp, off, "C", &type);
+      if (off < 0) {
+        return -1;
+      }
+      off += types - 1; /* use the first source type */
+    }
+    if (!types || g_tuners == MAX_TUNERS || strlen(id) >= MAX_ID_LEN) {
+      continue;
+    }
+    strcpy(g_tuner[g_tuners].id, id);
+    g_tuner[g_tuners].source_type = type;
+    ++g_tuners;
+  }
+
+  return 0;
+}
+
+static int
+read_channels(int fd, size_t tuner)
+{
+  const struct pdu* rsp;
+  uint32_t num, i;
+  long off;
+
+  init_pdu(&g_wbuf.pdu, SERVICE_DTV, OPCODE_GET_CHANNEL);
+  if (append_to_pdu(&g_wbuf.pdu, "0C", g_tuner[tuner].id,
+                    g_tuner[tuner].source_type) < 0) {
+    return -1;
+  }
+
+  rsp = transact(fd, &g_wbuf.pdu);
+  if (!rsp) {
+    return -1;
+  }
+
+  off = read_pdu_at(rsp, 0, "I", &num);
+  if (off < 0) {
+    return -1;
+  }
+
+  for (i = 0; i < num; ++i) {
+    const char *network_id, *ts_id, *service_id, *number, *name;
+    uint8_t type, is_emergency, is_free;
+
+    off = read_pdu_at(rsp, off, "000C00CC", &network_id, &ts_id,
+                      &service_id, &type, &number, &name, &is_emergency,
+                      &is_free);
+    if (off < 0) {
+      return -1;
+    }
+    if (g_channels == MAX_CHANNELS || strlen(number) >= MAX_ID_LEN) {
+      continue;
+    }
+    g_channel[g_channels].tuner = tuner;
+    strcpy(g_channel[g_channels].number, number);
+    ++g_channels;
+  }
+
+  return 0;
+}
+
+static int
+scan_channels(int fd)
+{
+  int res;
+
+  printf("Scanning channels of tuner %s...\n", g_tuner[0].id);
+
+  init_pdu(&g_wbuf.pdu, SERVICE_DTV, OPCODE_START_SCAN_WITH_MODE);
+  if (append_to_pdu(&g_wbuf.pdu, "0CC", g_tuner[0].id,
+                    g_tuner[0].source_type, (uint8_t)SCAN_MODE_QUICK) < 0) {
+    return -1;
+  }
+
+  g_scan_done = 0;
+
+  if (!transact(fd, &g_wbuf.pdu)) {
+    return -1;
+  }
+
+  /* Scans have no upper bound on their duration. */
+  while (!g_scan_done) {
+    res = recv_pdu(fd, -1);
+    if (res < 0) {
+      return -1;
+    } else if (!res) {
+      if (g_interrupted) {
+        return -1;
+      }
+      continue;
+    }
+    handle_pdu(&g_rbuf.pdu);
+  }
+
+  return 0;
+}
+
+static int
+read_lineup(int fd, int scan)
+{
+  size_t i;
+
+  if (read_tuners(fd) < 0) {
+    return -1;
+  }
+  if (!g_tuners) {
+    fprintf(stderr, "Error: Tvd has no tuners.\n");
+    return -1;
+  }
+
+  g_channels = 0;
+
+  for (i = 0; i < g_tuners; ++i) {
+    if (read_channels(fd, i) < 0) {
+      return -1;
+    }
+  }
+
+  if (!g_channels && scan) {
+    if (scan_channels(fd) < 0) {
+      return -1;
+    }
+    for (i = 0; i < g_tuners; ++i) {
+      if (read_channels(fd, i) < 0) {
+        return -1;
+      }
+    }
+  }
+
+  printf("%zu tuners, %zu channels\n", g_tuners, g_channels);
+
+  return 0;
+}
+
+/*
+ * Command mix
+ *
+ * Each command of the mix has a function that builds a command PDU from
+ * random tuners and channels of the lineup. Commands are drawn with a
+ * probability proportional to their weight.
+ */
+
+struct mix_cmd {
+  const char* name;
+  int needs_channels;
+  int (*build)(struct pdu* cmd, const struct options* opt);
+  unsigned long weight;
+};
+
+static const struct tuner*
+random_tuner(void)
+{
+  return g_tuner + lrand48() % g_tuners;
+}
+
+static const struct channel*
+random_channel(void)
+{
+  return g_channel + lrand48() % g_channels;
+}
+
+static int
+build_tuners(struct pdu* cmd, const struct options* opt)
+{
+  init_pdu(cmd, SERVICE_DTV, OPCODE_GET_TUNERS);
+  return 0;
+}
+
+static int
+build_channels(struct pdu* cmd, const struct options* opt)
+{
+  const struct tuner* tuner = random_tuner();
+
+  init_pdu(cmd, SERVICE_DTV, OPCODE_GET_CHANNEL);
+  return append_to_pdu(cmd, "0C", tuner->id, tuner->source_type) < 0 ?
+    -1 : 0;
+}
+
+static int
+build_page(struct pdu* cmd, const struct options* opt)
+{
+  const struct tuner* tuner = random_tuner();
+
+  init_pdu(cmd, SERVICE_DTV, OPCODE_GET_CHANNEL_PAGE);
+  return append_to_pdu(cmd, "0CLII", tuner->id, tuner->source_type,
+                       g_page_token, g_page_offset, (uint32_t)0) < 0 ?
+    -1 : 0;
+}
+
+static int
+build_programs(struct pdu* cmd, const struct options* opt)
+{
+  const struct channel* ch = random_channel();
+  const struct tuner* tuner = g_tuner + ch->tuner;
+  uint64_t now = realtime_ms();
+
+  init_pdu(cmd, SERVICE_DTV, OPCODE_GET_PROGRAM);
+  return append_to_pdu(cmd, "0C0LL", tuner->id, tuner->source_type,
+                       ch->number, now, now + MS_PER_DAY) < 0 ? -1 : 0;
+}
+
+static int
+build_search(struct pdu* cmd, const struct options* opt)
+{
+  const struct tuner* tuner = random_tuner();
+  uint64_t now = realtime_ms();
+
+  init_pdu(cmd, SERVICE_DTV, OPCODE_SEARCH_PROGRAMS);
+  return append_to_pdu(cmd, "0C0LLC0I", tuner->id, tuner->source_type,
+                       "", now, now + 7 * MS_PER_DAY,
+                       (uint8_t)SEARCH_MODE_SUBSTRING, opt->query,
+                       (uint32_t)0) < 0 ? -1 : 0;
+}
+
+static int
+build_zap(struct pdu* cmd, const struct options* opt)
+{
+  const struct channel* ch = random_channel();
+  const struct tuner* tuner = g_tuner + ch->tuner;
+
+  init_pdu(cmd, SERVICE_DTV, OPCODE_SET_CHANNEL);
+  return append_to_pdu(cmd, "0C0", tuner->id, tuner->source_type,
+                       ch->number) < 0 ? -1 : 0;
+}
+
+static int
+build_source(struct pdu* cmd, const struct options* opt)
+{
+  const struct tuner* tuner = random_tuner();
+
+  init_pdu(cmd, SERVICE_DTV, OPCODE_SET_SOURCE);
+  return append_to_pdu(cmd, "0C", tuner->id, tuner->source_type) < 0 ?
+    -1 : 0;
+}
+
+static int
+build_scanstats(struct pdu* cmd, const struct options* opt)
+{
+  init_pdu(cmd, SERVICE_DTV, OPCODE_GET_SCAN_STATS);
+  return append_to_pdu(cmd, "CC", random_tuner()->source_type,
+                       (uint8_t)0) < 0 ? -1 : 0;
+}
+
+static int
+build_zapstats(struct pdu* cmd, const struct options* opt)
+{
+  init_pdu(cmd, SERVICE_DTV, OPCODE_GET_ZAP_STATS);
+  return append_to_pdu(cmd, "C", (uint8_t)0) < 0 ? -1 : 0;
+}
+
+static int
+build_stats(struct pdu* cmd, uint8_t opcode)
+{
+  init_pdu(cmd, SERVICE_STATS, opcode);
+  return append_to_pdu(cmd, "C", (uint8_t)0) < 0 ? -1 : 0;
+}
+
+static int
+build_counters(struct pdu* cmd, const struct options* opt)
+{
+  return build_stats(cmd, OPCODE_GET_COUNTERS);
+}
+
+static int
+build_latencies(struct pdu* cmd, const struct options* opt)
+{
+  return build_stats(cmd, OPCODE_GET_LATENCIES);
+}
+
+static int
+build_gauges(struct pdu* cmd, const struct options* opt)
+{
+  return build_stats(cmd, OPCODE_GET_GAUGES);
+}
+
+static int
+build_stalls(struct pdu* cmd, const struct options* opt)
+{
+  return build_stats(cmd, OPCODE_GET_STALLS);
+}
+
+static struct mix_cmd g_mix[] = {
+  { "tuners", 0, build_tuners, 0 },
+  { "channels", 0, build_channels, 0 },
+  { "page", 0, build_page, 0 },
+  { "programs", 1, build_programs, 0 },
+  { "search", 0, build_search, 0 },
+  { "zap", 1, build_zap, 0 },
+  { "source", 0, build_source, 0 },
+  { "scanstats", 0, build_scanstats, 0 },
+  { "zapstats", 0, build_zapstats, 0 },
+  { "counters", 0, build_counters, 0 },
+  { "latencies", 0, build_latencies, 0 },
+  { "gauges", 0, build_gauges, 0 },
+  { "stalls", 0, build_stalls, 0 }
+};
+
+static unsigned long g_mix_weight;
+
+static int
+parse_mix(const char* str)
+{
+  char *buf, *entry, *saveptr;
+  size_t i;
+
+  buf = strdup(str);
+  if (!buf) {
+    print_errno("strdup");
+    return -1;
+  }
+
+  for (entry = strtok_r(buf, ",", &saveptr); entry;
+       entry = strtok_r(NULL, ",", &saveptr)) {
+    char* weight = strchr(entry, ':');
+    unsigned long value = 1;
+    if (weight) {
+      *weight++ = '\0';
+      if (parse_ulong(weight, "weight", 1, 1000, &value) < 0) {
+        goto err;
+      }
+    }
+    for (i = 0; i < sizeof(g_mix) / sizeof(*g_mix); ++i) {
+      if (!strcmp(entry, g_mix[i].name)) {
+        break;
+      }
+    }
+    if (i == sizeof(g_mix) / sizeof(*g_mix)) {
+      fprintf(stderr, "Error: Unknown command '%s'.\n", entry);
+      goto err;
+    }
+    g_mix[i].weight += value;
+    g_mix_weight += value;
+  }
+
+  free(buf);
+
+  if (!g_mix_weight) {
+    fprintf(stderr, "Error: The command mix is empty.\n");
+    return -1;
+  }
+
+  return 0;
+
+err:
+  free(buf);
+  return -1;
+}
+
+static int
+check_mix(void)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof(g_mix) / sizeof(*g_mix); ++i) {
+    if (g_mix[i].weight && g_mix[i].needs_channels && !g_channels) {
+      fprintf(stderr, "Error: Command '%s' requires channels; scan "
+                      "with '-k' first.\n", g_mix[i].name);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static const struct mix_cmd*
+random_mix_cmd(void)
+{
+  unsigned long r = lrand48() % g_mix_weight;
+  size_t i;
+
+  for (i = 0; r >= g_mix[i].weight; ++i) {
+    r -= g_mix[i].weight;
+  }
+
+  return g_mix + i;
+}
+
+/*
+ * Load generation
+ *
+ * |run_load| sends commands from a source function while keeping at
+ * most |window| commands in flight. Without a rate limit, the next
+ * command goes out as soon as the window has room. Otherwise the
+ * source function returns the time at which its next command is due.
+ * Tvload never sends ahead of time, but sends late commands right
+ * away; the report shows the largest delay.
+ */
+
+struct source {
+  /* Builds the next command in |cmd| and stores its due time relative
+   * to the start in |due|. Returns 0 on success, 1 at the end of the
+   * commands, and -1 on errors. */
+  int (*next)(struct source* source, struct pdu* cmd, uint64_t* due);
+  const struct options* opt;
+  int paced; /* commands have due times */
+  unsigned long count;
+  /* replay state */
+  FILE* file;
+  unsigned long loop;
+  uint64_t loop_start; /* ns */
+  uint64_t last; /* ns */
+};
+
+static int
+run_load(int fd, struct source* source, unsigned long window,
+         uint64_t duration)
+{
+  uint64_t start, due, now, slip, deadline;
+  int res, have_cmd;
+
+  start = monotonic_ns();
+  deadline = start + g_timeout * NS_PER_MS;
+  slip = 0;
+  have_cmd = 0;
+  due = 0;
+
+  while (!g_interrupted) {
+    int timeout;
+
+    now = monotonic_ns();
+    if (duration && now - start >= duration) {
+      break;
+    }
+
+    if (!have_cmd) {
+      res = source->next(source, &g_wbuf.pdu, &due);
+      if (res < 0) {
+        return -1;
+      } else if (res > 0) {
+        break;
+      }
+      have_cmd = 1;
+    }
+
+    if (g_inflight_len < window && now >= start + due) {
+      if (send_cmd(fd, &g_wbuf.pdu) < 0) {
+        return -1;
+      }
+      if (source->paced && now - (start + due) > slip) {
+        slip = now - (start + due);
+      }
+      if (g_inflight_len == 1) {
+        deadline = now + g_timeout * NS_PER_MS;
+      }
+      have_cmd = 0;
+      timeout = 0; /* check for responses without waiting */
+    } else if (g_inflight_len < window) {
+      timeout = (start + due - now + NS_PER_MS - 1) / NS_PER_MS;
+    } else {
+      timeout = g_timeout;
+    }
+
+    res = recv_pdu(fd, timeout);
+    if (res < 0) {
+      return -1;
+    } else if (res > 0) {
+      handle_pdu(&g_rbuf.pdu);
+      deadline = monotonic_ns() + g_timeout * NS_PER_MS;
+    } else if (g_inflight_len == window && monotonic_ns() >= deadline) {
+      fprintf(stderr, "Error: Tvd didn't respond.\n");
+      return -1;
+    }
+  }
+
+  if (drain(fd) < 0) {
+    return -1;
+  }
+
+  print_report(monotonic_ns() - start);
+  if (slip >= NS_PER_MS) {
+    printf("\nCommands were sent up to %llu ms late\n",
+           (unsigned long long)(slip / NS_PER_MS));
+  }
+
+  return 0;
+}
+
+static int
+next_mix_cmd(struct source* source, struct pdu* cmd, uint64_t* due)
+{
+  const struct options* opt = source->opt;
+
+  if (source->count == opt->commands) {
+    return 1;
+  }
+  if (random_mix_cmd()->build(cmd, opt) < 0) {
+    return -1;
+  }
+  *due = opt->rate ? source->count * 1000000000ull / opt->rate : 0;
+  ++source->count;
+
+  return 0;
+}
+
+static int
+parse_hex(const char* str, unsigned char* buf, size_t size)
+{
+  size_t i, len;
+
+  len = strlen(str);
+  if (len % 2 || len / 2 > size) {
+    return -1;
+  }
+
+  for (i = 0; i < len / 2; ++i) {
+    unsigned int byte;
+    if (sscanf(str + 2 * i, "%2x", &byte) != 1) {
+      return -1;
+    }
+    buf[i] = byte;
+  }
+
+  return len / 2;
+}
+
+/* Reads the next command of a session file. At the end of the file,
+ * the next loop starts after the session's last command. */
+static int
+next_session_cmd(struct source* source, struct pdu* cmd, uint64_t* due)
+{
+  static unsigned char payload[PDU_MAX_DATA_LENGTH];
+  static char line[2 * PDU_MAX_DATA_LENGTH + 64];
+  static char hex[sizeof(line)];
+
+  const struct options* opt = source->opt;
+
+  for (;;) {
+    unsigned long long ms;
+    unsigned int service, opcode;
+    int n, len;
+
+    if (!fgets(line, sizeof(line), source->file)) {
+      if (ferror(source->file)) {
+        print_errno("fgets");
+        return -1;
+      }
+      if (++source->loop == opt->loops) {
+        return 1;
+      }
+      if (!source->count) {
+        fprintf(stderr, "Error: The session contains no commands.\n");
+        return -1;
+      }
+      rewind(source->file);
+      source->loop_start = source->last;
+      continue;
+    }
+    if (line[0] == '#' || line[0] == '\n') {
+      continue;
+    }
+
+    hex[0] = '\0';
+    n = sscanf(line, "%llu %x %x %s", &ms, &service, &opcode, hex);
+    if (n < 3 || service >= PDU_MAX_NUM_SERVICES ||
+        opcode >= PDU_MAX_NUM_OPCODES) {
+      fprintf(stderr, "Error: Malformed line in session file: %s", line);
+      return -1;
+    }
+    len = parse_hex(hex, payload, sizeof(payload));
+    if (len < 0) {
+      fprintf(stderr, "Error: Malformed payload in session file: %s",
+              line);
+      return -1;
+    }
+    if (service == SERVICE_REGISTRY) {
+      continue;
+    }
+
+    init_pdu(cmd, service, opcode);
+    if (len && append_to_pdu(cmd, "m", payload, (size_t)len) < 0) {
+      return -1;
+    }
+
+    source->last = source->loop_start + ms * NS_PER_MS;
+    *due = opt->speed > 0 ? source->last / opt->speed : 0;
+    ++source->count;
+
+    return 0;
+  }
+}
+
+/*
+ * EPG check
+ *
+ * |check_epg| queries the programs of the next day for every channel,
+ * and repeats the queries every few seconds until each channel has at
+ * least one program. Notifications that arrive in between are counted
+ * like in the other modes.
+ */
+
+enum {
+  EPG_POLL_INTERVAL = 5000 /* ms */
+};
+
+/* Returns the number of programs of the channel for the next day, or -1
+ * on errors. */
+static long
+count_programs(int fd, const struct channel* ch)
+{
+  const struct tuner* tuner = g_tuner + ch->tuner;
+  const struct pdu* rsp;
+  uint64_t now = realtime_ms();
+  uint32_t num;
+
+  init_pdu(&g_wbuf.pdu, SERVICE_DTV, OPCODE_GET_PROGRAM);
+  if (append_to_pdu(&g_wbuf.pdu, "0C0LL", tuner->id, tuner->source_type,
+                    ch->number, now, now + MS_PER_DAY) < 0) {
+    return -1;
+  }
+
+  rsp = transact(fd, &g_wbuf.pdu);
+  if (!rsp) {
+    return -1;
+  }
+  if (read_pdu_at(rsp, 0, "I", &num) < 0) {
+    return -1;
+  }
+
+  return num;
+}
+
+/* Handles PDUs from tvd for |timeout| milliseconds. */
+static int
+idle(int fd, int timeout)
+{
+  uint64_t deadline, now;
+  int res;
+
+  deadline = monotonic_ns() + timeout * NS_PER_MS;
+
+  for (now = monotonic_ns(); now < deadline; now = monotonic_ns()) {
+    res = recv_pdu(fd, (deadline - now) / NS_PER_MS + 1);
+    if (res < 0) {
+      return -1;
+    } else if (res > 0) {
+      handle_pdu(&g_rbuf.pdu);
+    } else if (g_interrupted) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int
+check_epg(int fd, unsigned long timeout)
+{
+  uint64_t start, deadline;
+  unsigned long programs;
+  size_t i, missing;
+  long num;
+
+  if (!g_channels) {
+    fprintf(stderr, "Error: Tvd has no channels.\n");
+    return -1;
+  }
+
+  start = monotonic_ns();
+  deadline = start + timeout * 1000 * NS_PER_MS;
+
+  for (;;) {
+    missing = 0;
+    programs = 0;
+
+    for (i = 0; i < g_channels; ++i) {
+      num = count_programs(fd, g_channel + i);
+      if (num < 0) {
+        return -1;
+      }
+      if (!num) {
+        ++missing;
+      }
+      programs += num;
+    }
+
+    printf("%6.1f s: %zu of %zu channels have programs, %lu programs\n",
+           (double)(monotonic_ns() - start) / (1000 * NS_PER_MS),
+           g_channels - missing, g_channels, programs);
+
+    if (!missing) {
+      return 0;
+    }
+    if (monotonic_ns() >= deadline) {
+      fprintf(stderr, "Error: %zu channels have no programs.\n", missing);
+      return -1;
+    }
+    if (idle(fd, EPG_POLL_INTERVAL) < 0) {
+      return -1;
+    }
+  }
+}
+
+/*
+ * Recording
+ *
+ * |run_proxy| forwards PDUs between tvd and the client in both
+ * directions, including the file descriptors of streams, and writes
+ * the client's commands to the session file.
+ */
+
+static int
+forward_pdu(int from, int to, FILE* record, uint64_t* start)
+{
+  unsigned char control[CMSG_SPACE(MAX_FDS * sizeof(int))];
+  struct iovec iov = {
+    .iov_base = g_rbuf.raw,
+    .iov_len = sizeof(g_rbuf.raw)
+  };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof(control)
+  };
+  const struct pdu* pdu = &g_rbuf.pdu;
+  int res;
+
+  res = recv_msg(from, g_rbuf.raw, &msg, 0);
+  if (res <= 0) {
+    return res;
+  }
+
+  iov.iov_len = pdu_size(pdu);
+  if (!msg.msg_controllen) {
+    msg.msg_control = NULL;
+  }
+
+  res = TEMP_FAILURE_RETRY(sendmsg(to, &msg, MSG_NOSIGNAL));
+  close_fds(&msg);
+  if (res < 0) {
+    print_errno("sendmsg");
+    return -1;
+  }
+
+  if (record && pdu->service != SERVICE_REGISTRY) {
+    uint64_t now = monotonic_ns();
+    size_t i;
+    if (!*start) {
+      *start = now;
+    }
+    fprintf(record, "%llu %02x %02x ",
+            (unsigned long long)((now - *start) / NS_PER_MS),
+            pdu->service, pdu->opcode);
+    for (i = 0; i < pdu->len; ++i) {
+      fprintf(record, "%02x", pdu->data[i]);
+    }
+    fputc('\n', record);
+  }
+
+  return 1;
+}
+
+static int
+run_proxy(int tvd_fd, const struct options* opt)
+{
+  struct pollfd pfd[2];
+  FILE* record;
+  uint64_t start;
+  unsigned long commands;
+  int client_fd, res;
+
+  record = NULL;
+
+  if (opt->record) {
+    record = fopen(opt->record, "w");
+    if (!record) {
+      print_errno("fopen");
+      return -1;
+    }
+  }
+
+  client_fd = connect_socket(opt->client_name);
+  if (client_fd < 0) {
+    goto err_connect_socket;
+  }
+
+  pfd[0].fd = client_fd;
+  pfd[0].events = POLLIN;
+  pfd[1].fd = tvd_fd;
+  pfd[1].events = POLLIN;
+
+  start = 0;
+  commands = 0;
+
+  while (!g_interrupted) {
+    res = poll(pfd, 2, -1);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      print_errno("poll");
+      break;
+    }
+    if (pfd[0].revents) {
+      res = forward_pdu(client_fd, tvd_fd, record, &start);
+      if (res < 0) {
+        break;
+      }
+      commands += res;
+    }
+    if (pfd[1].revents && forward_pdu(tvd_fd, client_fd, NULL, NULL) < 0) {
+      break;
+    }
+  }
+
+  printf("Forwarded %lu commands\n", commands);
+
+  close(client_fd);
+  if (record && fclose(record)) {
+    print_errno("fclose");
+    return -1;
+  }
+
+  return 0;
+
+err_connect_socket:
+  if (record) {
+    fclose(record);
+  }
+  return -1;
+}
+
+/*
+ * Program start up
+ *
+ * Tvload listens on its socket before it starts tvd, so tvd's
+ * connection request can't fail. When tvload closes the connection,
+ * tvd exits.
+ */
+
+static pid_t
+start_tvd(const struct options* opt)
+{
+  char** argv;
+  size_t argc, i;
+  pid_t pid;
+
+  for (argc = 0; opt->tvd_args[argc]; ++argc) {
+  }
+
+  argv = calloc(argc + 4, sizeof(*argv));
+  if (!argv) {
+    print_errno("calloc");
+    return -1;
+  }
+  argv[0] = (char*)opt->tvd_path;
+  argv[1] = "-a";
+  argv[2] = (char*)opt->socket_name;
+  for (i = 0; i < argc; ++i) {
+    argv[i + 3] = opt->tvd_args[i];
+  }
+
+  pid = fork();
+  if (pid < 0) {
+    print_errno("fork");
+  } else if (!pid) {
+    execv(opt->tvd_path, argv);
+    print_errno("execv");
+    _exit(EXIT_FAILURE);
+  }
+
+  free(argv);
+
+  return pid;
+}
+
+static void
+stop_tvd(pid_t pid)
+{
+  int i;
+
+  /* tvd exits after the connection has been closed */
+  for (i = 0; i < 50; ++i) {
+    if (waitpid(pid, NULL, WNOHANG)) {
+      return;
+    }
+    usleep(100000);
+  }
+
+  fprintf(stderr, "Warning: Tvd didn't exit; terminating it.\n");
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+}
+
+static void
+handle_interrupt(int signum)
+{
+  g_interrupted = 1;
+}
+
+static int
+init_signals(void)
+{
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_interrupt; /* no SA_RESTART; interrupts poll */
+  sigemptyset(&sa.sa_mask);
+
+  if (sigaction(SIGINT, &sa, NULL) < 0) {
+    print_errno("sigaction(SIGINT)");
+    return -1;
+  }
+  if (sigaction(SIGTERM, &sa, NULL) < 0) {
+    print_errno("sigaction(SIGTERM)");
+    return -1;
+  }
+  return 0;
+}
+
+static int
+run(int fd, const struct options* opt)
+{
+  struct source source;
+
+  if (opt->client_name) {
+    return run_proxy(fd, opt);
+  }
+
+  if (register_service(fd, SERVICE_DTV) < 0) {
+    return -1;
+  }
+  if (register_service(fd, SERVICE_STATS) < 0) {
+    return -1;
+  }
+
+  if (opt->epg) {
+    if (read_lineup(fd, opt->scan) < 0) {
+      return -1;
+    }
+    return check_epg(fd, opt->epg);
+  }
+
+  memset(&source, 0, sizeof(source));
+  source.opt = opt;
+
+  if (opt->session) {
+    source.next = next_session_cmd;
+    source.paced = opt->speed > 0;
+    source.file = fopen(opt->session, "r");
+    if (!source.file) {
+      print_errno("fopen");
+      return -1;
+    }
+  } else {
+    if (parse_mix(opt->mix) < 0) {
+      return -1;
+    }
+    if (read_lineup(fd, opt->scan) < 0) {
+      return -1;
+    }
+    if (check_mix() < 0) {
+      return -1;
+    }
+    source.next = next_mix_cmd;
+    source.paced = opt->rate > 0;
+  }
+
+  reset_stats();
+
+  if (run_load(fd, &source, opt->window, opt->duration * 1000 * NS_PER_MS)
+        < 0) {
+    goto err_run_load;
+  }
+
+  if (source.file) {
+    fclose(source.file);
+  }
+
+  return 0;
+
+err_run_load:
+  if (source.file) {
+    fclose(source.file);
+  }
+  return -1;
+}
+
+int
+main(int argc, char* argv[])
+{
+  static const char DEFAULT_SOCKET_NAME[] = "tvd";
+  static const char DEFAULT_MIX[] = "channels:4,programs:4,search:2,tuners:1";
+
+  struct options options = {
+    .socket_name = DEFAULT_SOCKET_NAME,
+    .timeout = 30,
+    .mix = DEFAULT_MIX,
+    .commands = 1000,
+    .window = 1,
+    .query = "news",
+    .loops = 1,
+    .speed = 1
+  };
+  int res, lfd, fd;
+  pid_t pid;
+
+  res = parse_opts(argc, argv, &options);
+  if (res > 0) {
+    return EXIT_SUCCESS;
+  } else if (res < 0) {
+    return EXIT_FAILURE;
+  }
+
+  g_timeout = options.timeout * 1000;
+  srand48(1); /* reproducible command sequences */
+
+  if (init_signals() < 0) {
+    return EXIT_FAILURE;
+  }
+
+  lfd = listen_socket(options.socket_name);
+  if (lfd < 0) {
+    return EXIT_FAILURE;
+  }
+
+  pid = 0;
+
+  if (options.tvd_path) {
+    pid = start_tvd(&options);
+    if (pid < 0) {
+      goto err_start_tvd;
+    }
+  } else {
+    printf("Waiting for tvd to connect to '%s'...\n", options.socket_name);
+  }
+
+  fd = accept_socket(lfd, options.tvd_path ? g_timeout : -1);
+  if (fd < 0) {
+    goto err_accept_socket;
+  }
+
+  res = run(fd, &options);
+
+  close(fd);
+  if (pid > 0) {
+    stop_tvd(pid);
+  }
+  close(lfd);
+
+  return res < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+err_accept_socket:
+  if (pid > 0) {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+  }
+err_start_tvd:
+  close(lfd);
+  return EXIT_FAILURE;
+}